@@ -0,0 +1,454 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <aws/auth/auth.h>
+#include <aws/auth/credentials.h>
+#include <aws/common/allocator.h>
+#include <aws/common/clock.h>
+#include <aws/common/command_line_parser.h>
+#include <aws/common/common.h>
+#include <aws/common/error.h>
+#include <aws/common/string.h>
+#include <aws/common/thread.h>
+#include <aws/dsql-auth/auth_token.h>
+#include <aws/dsql-auth/token_cache.h>
+#include <aws/io/io.h>
+
+#include "counting_allocator.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* August 27, 2024 at 00:00:00 UTC, in nanoseconds; a fixed clock keeps every run on the same signing date */
+static const uint64_t s_bench_time_ns = 1724716800ULL * 1000000000ULL;
+
+AWS_STATIC_STRING_FROM_LITERAL(s_hostname, "peccy.dsql.us-east-1.on.aws");
+AWS_STATIC_STRING_FROM_LITERAL(s_region, "us-east-1");
+
+enum { WARMUP_ITERATIONS = 100 };
+
+/* --scale runs every mode at 1, 2, 4, ... up to this many threads */
+enum { MAX_SCALE_THREADS = 64 };
+
+enum bench_mode {
+    BENCH_MODE_SYNC,
+    BENCH_MODE_CACHE,
+    BENCH_MODE_BATCH,
+    BENCH_MODE_COUNT,
+};
+
+static const char *s_mode_names[BENCH_MODE_COUNT] = {"sync", "cache", "batch"};
+
+static int s_bench_get_system_time(uint64_t *current_time) {
+    *current_time = s_bench_time_ns;
+    return AWS_OP_SUCCESS;
+}
+
+struct bench_ctx {
+    struct aws_allocator *allocator;
+    struct counting_allocator counting;
+    struct aws_credentials_provider *credentials_provider;
+    struct aws_dsql_auth_config config;
+    struct aws_dsql_auth_token_cache *cache;
+
+    size_t iterations;
+    size_t threads;
+    size_t batch_size;
+    bool scale;
+    int modes[BENCH_MODE_COUNT];
+};
+
+struct bench_worker {
+    struct bench_ctx *ctx;
+    enum bench_mode mode;
+    size_t iterations;
+    struct aws_thread thread;
+
+    /* Latency of every operation, in nanoseconds */
+    uint64_t *latencies_ns;
+
+    /* Batch mode only, batch_size of each */
+    struct aws_dsql_auth_token_batch_entry *entries;
+    struct aws_dsql_auth_token *tokens;
+
+    int error_code;
+};
+
+static void s_usage(int exit_code) {
+    fprintf(stderr, "Usage:\n");
+    fprintf(stderr, "  dsql-auth-bench [--mode MODE] [--iterations N] [--threads N] [--batch-size N] [--scale]\n\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --mode MODE                Optional. sync, cache, batch or all. Default is all\n");
+    fprintf(stderr, "  --iterations N             Optional. Operations per thread. Default is 100000\n");
+    fprintf(stderr, "  --threads N                Optional. Threads for the multi-threaded run. Default is 4\n");
+    fprintf(stderr, "  --batch-size N             Optional. Tokens per batch call. Default is 16\n");
+    fprintf(stderr, "  --scale                    Optional. Run at 1, 2, 4, ... 64 threads instead of --threads\n");
+    fprintf(stderr, "\n");
+    exit(exit_code);
+}
+
+static struct aws_cli_option s_long_options[] = {
+    {"mode", AWS_CLI_OPTIONS_REQUIRED_ARGUMENT, NULL, 'm'},
+    {"iterations", AWS_CLI_OPTIONS_REQUIRED_ARGUMENT, NULL, 'n'},
+    {"threads", AWS_CLI_OPTIONS_REQUIRED_ARGUMENT, NULL, 't'},
+    {"batch-size", AWS_CLI_OPTIONS_REQUIRED_ARGUMENT, NULL, 'b'},
+    {"scale", AWS_CLI_OPTIONS_NO_ARGUMENT, NULL, 's'},
+    {"help", AWS_CLI_OPTIONS_NO_ARGUMENT, NULL, '?'},
+    {NULL, 0, NULL, 0},
+};
+
+static bool s_parse_count(const char *arg, const char *name, size_t *out_count) {
+    long long count = strtoll(arg, NULL, 10);
+    if (count <= 0) {
+        fprintf(stderr, "Error: %s must be a positive number\n", name);
+        return false;
+    }
+    *out_count = (size_t)count;
+    return true;
+}
+
+static bool s_parse_args(int argc, char **argv, struct bench_ctx *ctx) {
+    ctx->iterations = 100000;
+    ctx->threads = 4;
+    ctx->batch_size = 16;
+    for (int i = 0; i < BENCH_MODE_COUNT; ++i) {
+        ctx->modes[i] = 1;
+    }
+
+    int opt;
+    int option_index = 0;
+
+    while ((opt = aws_cli_getopt_long(argc, argv, "m:n:t:b:s?", s_long_options, &option_index)) != -1) {
+        switch (opt) {
+            case 0:
+                /* getopt_long() set a variable, just keep going */
+                break;
+
+            case 'm': {
+                if (strcmp(aws_cli_optarg, "all") == 0) {
+                    break;
+                }
+                bool found = false;
+                for (int i = 0; i < BENCH_MODE_COUNT; ++i) {
+                    ctx->modes[i] = strcmp(aws_cli_optarg, s_mode_names[i]) == 0;
+                    found = found || ctx->modes[i];
+                }
+                if (!found) {
+                    fprintf(stderr, "Error: unknown mode '%s'\n", aws_cli_optarg);
+                    return false;
+                }
+                break;
+            }
+
+            case 'n':
+                if (!s_parse_count(aws_cli_optarg, "iterations", &ctx->iterations)) {
+                    return false;
+                }
+                break;
+
+            case 't':
+                if (!s_parse_count(aws_cli_optarg, "threads", &ctx->threads)) {
+                    return false;
+                }
+                break;
+
+            case 'b':
+                if (!s_parse_count(aws_cli_optarg, "batch-size", &ctx->batch_size)) {
+                    return false;
+                }
+                break;
+
+            case 's':
+                ctx->scale = true;
+                break;
+
+            case '?':
+                s_usage(0);
+                break;
+
+            default:
+                s_usage(1);
+                break;
+        }
+    }
+
+    return true;
+}
+
+/* Tokens produced by one operation of the mode */
+static size_t s_tokens_per_op(const struct bench_ctx *ctx, enum bench_mode mode) {
+    return mode == BENCH_MODE_BATCH ? ctx->batch_size : 1;
+}
+
+static int s_run_op(struct bench_worker *worker) {
+    struct bench_ctx *ctx = worker->ctx;
+    struct aws_dsql_auth_token token = {0};
+    int result = AWS_OP_ERR;
+
+    switch (worker->mode) {
+        case BENCH_MODE_SYNC:
+            result = aws_dsql_auth_token_generate(&ctx->config, false, ctx->allocator, &token);
+            aws_dsql_auth_token_clean_up(&token);
+            break;
+
+        case BENCH_MODE_CACHE:
+            result = aws_dsql_auth_token_cache_get(ctx->cache, &ctx->config, false, ctx->allocator, &token);
+            aws_dsql_auth_token_clean_up(&token);
+            break;
+
+        case BENCH_MODE_BATCH:
+            result = aws_dsql_auth_token_generate_batch(
+                &ctx->config, worker->entries, worker->tokens, ctx->batch_size, ctx->allocator);
+            for (size_t i = 0; i < ctx->batch_size; ++i) {
+                aws_dsql_auth_token_clean_up(&worker->tokens[i]);
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    return result;
+}
+
+static void s_worker_main(void *arg) {
+    struct bench_worker *worker = arg;
+
+    for (size_t i = 0; i < worker->iterations; ++i) {
+        uint64_t start_ns = 0;
+        uint64_t end_ns = 0;
+        aws_high_res_clock_get_ticks(&start_ns);
+
+        if (s_run_op(worker)) {
+            worker->error_code = aws_last_error();
+            return;
+        }
+
+        aws_high_res_clock_get_ticks(&end_ns);
+        worker->latencies_ns[i] = end_ns - start_ns;
+    }
+}
+
+static int s_compare_u64(const void *a, const void *b) {
+    uint64_t lhs = *(const uint64_t *)a;
+    uint64_t rhs = *(const uint64_t *)b;
+    return lhs < rhs ? -1 : (lhs > rhs ? 1 : 0);
+}
+
+/* Percentile in parts per thousand of sorted samples, in microseconds */
+static double s_percentile_us(const uint64_t *sorted_ns, size_t count, size_t per_mille) {
+    size_t index = (count - 1) * per_mille / 1000;
+    return (double)sorted_ns[index] / 1000.0;
+}
+
+static void s_print_header(void) {
+    printf(
+        "%-6s %7s %12s %10s %10s %10s %12s %12s\n",
+        "mode",
+        "threads",
+        "tokens/sec",
+        "p50 us",
+        "p99 us",
+        "p999 us",
+        "allocs/tok",
+        "bytes/tok");
+}
+
+/**
+ * Run one mode with the given number of threads and print a result row. Latencies are per operation, so a batch
+ * mode row reports the latency of a whole batch call.
+ */
+static int s_run_mode(struct bench_ctx *ctx, enum bench_mode mode, size_t threads) {
+    struct aws_allocator *system_allocator = ctx->counting.parent;
+    int result = AWS_OP_ERR;
+
+    size_t samples = ctx->iterations * threads;
+    uint64_t *latencies_ns = aws_mem_calloc(system_allocator, samples, sizeof(uint64_t));
+    struct bench_worker *workers = aws_mem_calloc(system_allocator, threads, sizeof(struct bench_worker));
+    if (!latencies_ns || !workers) {
+        goto done;
+    }
+
+    for (size_t i = 0; i < threads; ++i) {
+        struct bench_worker *worker = &workers[i];
+        worker->ctx = ctx;
+        worker->mode = mode;
+        worker->latencies_ns = latencies_ns + i * ctx->iterations;
+
+        if (mode == BENCH_MODE_BATCH) {
+            worker->entries =
+                aws_mem_calloc(system_allocator, ctx->batch_size, sizeof(struct aws_dsql_auth_token_batch_entry));
+            worker->tokens = aws_mem_calloc(system_allocator, ctx->batch_size, sizeof(struct aws_dsql_auth_token));
+            if (!worker->entries || !worker->tokens) {
+                goto done;
+            }
+            for (size_t j = 0; j < ctx->batch_size; ++j) {
+                worker->entries[j].hostname = aws_string_c_str(s_hostname);
+                worker->entries[j].region = (struct aws_string *)s_region; /* Cast away const */
+            }
+        }
+    }
+
+    /* Warm up on one thread: fills the token cache and the signing key cache, and settles the allocator */
+    workers[0].iterations = WARMUP_ITERATIONS < ctx->iterations ? WARMUP_ITERATIONS : ctx->iterations;
+    s_worker_main(&workers[0]);
+    if (workers[0].error_code) {
+        fprintf(stderr, "Error: %s warmup failed: %s\n", s_mode_names[mode], aws_error_str(workers[0].error_code));
+        goto done;
+    }
+
+    s_counting_allocator_reset(&ctx->counting);
+
+    uint64_t start_ns = 0;
+    uint64_t end_ns = 0;
+    aws_high_res_clock_get_ticks(&start_ns);
+
+    size_t launched = 0;
+    for (; launched < threads; ++launched) {
+        struct bench_worker *worker = &workers[launched];
+        worker->iterations = ctx->iterations;
+        if (aws_thread_init(&worker->thread, system_allocator) ||
+            aws_thread_launch(&worker->thread, s_worker_main, worker, aws_default_thread_options())) {
+            fprintf(stderr, "Error: failed to launch thread: %s\n", aws_error_str(aws_last_error()));
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < launched; ++i) {
+        aws_thread_join(&workers[i].thread);
+        aws_thread_clean_up(&workers[i].thread);
+    }
+
+    aws_high_res_clock_get_ticks(&end_ns);
+
+    if (launched < threads) {
+        goto done;
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        if (workers[i].error_code) {
+            fprintf(stderr, "Error: %s failed: %s\n", s_mode_names[mode], aws_error_str(workers[i].error_code));
+            goto done;
+        }
+    }
+
+    size_t tokens = samples * s_tokens_per_op(ctx, mode);
+    double elapsed_secs = (double)(end_ns - start_ns) / 1e9;
+    size_t alloc_count = s_counting_allocator_count(&ctx->counting);
+    size_t alloc_bytes = s_counting_allocator_bytes(&ctx->counting);
+
+    qsort(latencies_ns, samples, sizeof(uint64_t), s_compare_u64);
+
+    printf(
+        "%-6s %7zu %12.0f %10.2f %10.2f %10.2f %12.2f %12.1f\n",
+        s_mode_names[mode],
+        threads,
+        (double)tokens / elapsed_secs,
+        s_percentile_us(latencies_ns, samples, 500),
+        s_percentile_us(latencies_ns, samples, 990),
+        s_percentile_us(latencies_ns, samples, 999),
+        (double)alloc_count / (double)tokens,
+        (double)alloc_bytes / (double)tokens);
+
+    result = AWS_OP_SUCCESS;
+
+done:
+    if (workers) {
+        for (size_t i = 0; i < threads; ++i) {
+            if (workers[i].entries) {
+                aws_mem_release(system_allocator, workers[i].entries);
+            }
+            if (workers[i].tokens) {
+                aws_mem_release(system_allocator, workers[i].tokens);
+            }
+        }
+        aws_mem_release(system_allocator, workers);
+    }
+    if (latencies_ns) {
+        aws_mem_release(system_allocator, latencies_ns);
+    }
+
+    return result;
+}
+
+int main(int argc, char **argv) {
+    struct aws_allocator *system_allocator = aws_default_allocator();
+    struct bench_ctx ctx;
+    AWS_ZERO_STRUCT(ctx);
+    int result = AWS_OP_ERR;
+
+    aws_common_library_init(system_allocator);
+    aws_io_library_init(system_allocator);
+    aws_auth_library_init(system_allocator);
+
+    if (!s_parse_args(argc, argv, &ctx)) {
+        s_usage(1);
+    }
+
+    /* Everything the library allocates, including the provider and the cache, goes through the counter */
+    ctx.allocator = s_counting_allocator_init(&ctx.counting, system_allocator);
+
+    struct aws_credentials_provider_static_options credentials_options = {
+        .access_key_id = aws_byte_cursor_from_c_str("AKIDEXAMPLE"),
+        .secret_access_key = aws_byte_cursor_from_c_str("wJalrXUtnFEMI/K7MDENG+bPxRfiCYEXAMPLEKEY"),
+        .session_token = aws_byte_cursor_from_c_str("token"),
+    };
+    ctx.credentials_provider = aws_credentials_provider_new_static(ctx.allocator, &credentials_options);
+    if (!ctx.credentials_provider) {
+        fprintf(stderr, "Error: Failed to create credentials provider\n");
+        goto cleanup;
+    }
+
+    aws_dsql_auth_config_init(&ctx.config);
+    aws_dsql_auth_config_set_hostname(&ctx.config, aws_string_c_str(s_hostname));
+    aws_dsql_auth_config_set_region(&ctx.config, (struct aws_string *)s_region); /* Cast away const */
+    aws_dsql_auth_config_set_credentials_provider(&ctx.config, ctx.credentials_provider);
+    ctx.config.system_clock_fn = s_bench_get_system_time;
+
+    if (ctx.modes[BENCH_MODE_CACHE]) {
+        /* The cache reads the config's clock, so cached tokens never age during the run */
+        ctx.cache = aws_dsql_auth_token_cache_new(ctx.allocator, NULL);
+        if (!ctx.cache) {
+            fprintf(stderr, "Error: Failed to create token cache\n");
+            goto cleanup;
+        }
+    }
+
+    s_print_header();
+
+    result = AWS_OP_SUCCESS;
+    for (int mode = 0; mode < BENCH_MODE_COUNT && result == AWS_OP_SUCCESS; ++mode) {
+        if (!ctx.modes[mode]) {
+            continue;
+        }
+
+        if (ctx.scale) {
+            for (size_t threads = 1; threads <= MAX_SCALE_THREADS && result == AWS_OP_SUCCESS; threads *= 2) {
+                result = s_run_mode(&ctx, (enum bench_mode)mode, threads);
+            }
+            continue;
+        }
+
+        result = s_run_mode(&ctx, (enum bench_mode)mode, 1);
+        if (result == AWS_OP_SUCCESS && ctx.threads > 1) {
+            result = s_run_mode(&ctx, (enum bench_mode)mode, ctx.threads);
+        }
+    }
+
+cleanup:
+    if (ctx.cache) {
+        aws_dsql_auth_token_cache_release(ctx.cache);
+    }
+    if (ctx.credentials_provider) {
+        aws_credentials_provider_release(ctx.credentials_provider);
+    }
+
+    aws_auth_library_clean_up();
+    aws_io_library_clean_up();
+    aws_common_library_clean_up();
+
+    return (result == AWS_OP_SUCCESS) ? 0 : 1;
+}
@@ -20,6 +20,56 @@ AWS_EXTERN_C_BEGIN
  * @{
  */
 
+/**
+ * Where the time of one token generation went, reported to a config's on_generation_stats observer. Durations are
+ * monotonic nanoseconds; a stage that did not run reports 0.
+ */
+struct aws_dsql_auth_generation_stats {
+    /**
+     * Waiting for the credentials provider. In a batch the credentials are retrieved once and reported with the first
+     * entry.
+     */
+    uint64_t credentials_ns;
+
+    /**
+     * Building the presign request for the hostname, region and action.
+     */
+    uint64_t request_ns;
+
+    /**
+     * Hashing the canonical request, looking up the signing key and signing.
+     */
+    uint64_t signing_ns;
+
+    /**
+     * Copying the signed token into its string.
+     */
+    uint64_t token_string_ns;
+
+    /**
+     * From the start of the call until the token was ready.
+     */
+    uint64_t total_ns;
+
+    /**
+     * Whether the token was served by an aws_dsql_auth_token_cache without generating one.
+     */
+    bool token_cache_hit;
+
+    /**
+     * AWS_ERROR_SUCCESS, or the error the generation failed with.
+     */
+    int error_code;
+};
+
+/**
+ * Invoked with the stats of one token generation, on the thread that finished it.
+ *
+ * @param[in] stats The stats, only valid for the duration of the callback
+ * @param[in] user_data The on_generation_stats_user_data of the config
+ */
+typedef void(aws_dsql_auth_on_generation_stats_fn)(const struct aws_dsql_auth_generation_stats *stats, void *user_data);
+
 /**
  * Configuration for the DSQL auth token generator.
  */
@@ -52,6 +102,26 @@ struct aws_dsql_auth_config {
      * For mocking, leave NULL otherwise
      */
     aws_io_clock_fn *system_clock_fn;
+
+    /**
+     * Optional. Invoked once for every token generated with this config, or served from a token cache with it, and for
+     * every generation that fails after its arguments were validated. When NULL only the credentials fetch is timed,
+     * for the library metrics.
+     */
+    aws_dsql_auth_on_generation_stats_fn *on_generation_stats;
+
+    /**
+     * Passed to on_generation_stats.
+     */
+    void *on_generation_stats_user_data;
+
+    /**
+     * Optional. When set, aws_dsql_auth_token_generate_async runs on this group instead of the caller's thread: each
+     * generation is scheduled as a task on a loop picked by its hostname and action, so the tokens of one cluster are
+     * always signed on the same loop, and credentials that arrive on another thread are handed back to that loop
+     * before signing. Set with aws_dsql_auth_config_set_event_loop_group, which holds a reference.
+     */
+    struct aws_event_loop_group *event_loop_group;
 };
 
 /**
@@ -62,8 +132,78 @@ struct aws_dsql_auth_token {
      * The token string.
      */
     struct aws_string *token;
+
+    /**
+     * When the token was signed, its X-Amz-Date, in seconds since the Unix epoch.
+     */
+    uint64_t issued_at_secs;
+
+    /**
+     * When the token stops being accepted, issued_at_secs plus its X-Amz-Expires, in seconds since the Unix epoch.
+     */
+    uint64_t expires_at_secs;
+};
+
+/**
+ * An immutable, reference-counted token, for handing one token to many connection attempts, on any threads, without
+ * copying its string. Read it through aws_dsql_auth_shared_token_get_token. The token is freed when the last
+ * reference is released.
+ */
+struct aws_dsql_auth_shared_token;
+
+/**
+ * A prepared token generator for one cluster.
+ *
+ * The config is validated once, and everything about the token that does not depend on the credentials or the
+ * signing date (the encoded action and credential scope, the canonical request tail, expiration) is precomputed, so
+ * each generation only fetches credentials, stamps in the date and signs. The percent-encoded access key ID and
+ * session token are kept for as long as the provider returns the same credentials, so they are not encoded again
+ * for every token. Generators may be used from any number of threads.
+ */
+struct aws_dsql_auth_generator;
+
+/**
+ * One cluster to generate a token for in a batch.
+ */
+struct aws_dsql_auth_token_batch_entry {
+    /**
+     * The hostname of the database to connect to.
+     * Required.
+     */
+    const char *hostname;
+
+    /**
+     * The region the database is located in.
+     * Required.
+     */
+    struct aws_string *region;
+
+    /**
+     * Whether to generate an admin token (true) or regular token (false).
+     */
+    bool is_admin;
+
+    /**
+     * Output: AWS_ERROR_SUCCESS if the token for this entry was generated, otherwise the error that prevented it.
+     */
+    int error_code;
 };
 
+/**
+ * Invoked when an asynchronous token generation completes.
+ *
+ * The token is only valid for the duration of the callback and is cleaned up once it returns. To keep it, move it
+ * out by copying the struct and zeroing the original:
+ *
+ *     *my_token = *token;
+ *     AWS_ZERO_STRUCT(*token);
+ *
+ * @param[in] token The generated token, or NULL if generation failed
+ * @param[in] error_code AWS_ERROR_SUCCESS, or the error that caused generation to fail
+ * @param[in] user_data The user data passed to aws_dsql_auth_token_generate_async
+ */
+typedef void(aws_dsql_auth_on_token_generated_fn)(struct aws_dsql_auth_token *token, int error_code, void *user_data);
+
 /**
  * Initialize a new auth token config with default values.
  *
@@ -113,6 +253,19 @@ AWS_DSQL_AUTH_API int aws_dsql_auth_config_infer_region(
     struct aws_dsql_auth_config *config,
     struct aws_string **out_region);
 
+/**
+ * Parse the region out of a DSQL hostname without allocating. Accepts the same hostnames as
+ * aws_dsql_auth_config_infer_region, '<cluster-id>.dsql*.<region>.on.aws', in a single pass.
+ *
+ * @param[in] hostname The hostname, which does not need to be NUL-terminated
+ * @param[out] out_region Receives a cursor into hostname covering the region
+ *
+ * @return AWS_OP_SUCCESS if the region was found, AWS_OP_ERR with AWS_ERROR_INVALID_ARGUMENT otherwise
+ */
+AWS_DSQL_AUTH_API int aws_dsql_auth_hostname_parse_region(
+    struct aws_byte_cursor hostname,
+    struct aws_byte_cursor *out_region);
+
 /**
  * Set the expiration time for the auth token config.
  *
@@ -131,6 +284,29 @@ AWS_DSQL_AUTH_API void aws_dsql_auth_config_set_credentials_provider(
     struct aws_dsql_auth_config *config,
     struct aws_credentials_provider *credentials_provider);
 
+/**
+ * Set the observer that receives per-stage timings of every generation made with the config.
+ *
+ * @param[in,out] config The config to modify
+ * @param[in] on_generation_stats The observer, or NULL to stop taking timings
+ * @param[in] user_data Passed to the observer
+ */
+AWS_DSQL_AUTH_API void aws_dsql_auth_config_set_on_generation_stats(
+    struct aws_dsql_auth_config *config,
+    aws_dsql_auth_on_generation_stats_fn *on_generation_stats,
+    void *user_data);
+
+/**
+ * Set the event loop group asynchronous generations are scheduled on. The config holds a reference to the group
+ * until it is replaced or the config is cleaned up.
+ *
+ * @param[in,out] config The config to set
+ * @param[in] event_loop_group The event loop group, or NULL to run generations on the caller's thread
+ */
+AWS_DSQL_AUTH_API void aws_dsql_auth_config_set_event_loop_group(
+    struct aws_dsql_auth_config *config,
+    struct aws_event_loop_group *event_loop_group);
+
 /**
  * Generate an authentication token for Aurora DSQL.
  *
@@ -147,6 +323,218 @@ AWS_DSQL_AUTH_API int aws_dsql_auth_token_generate(
     struct aws_allocator *allocator,
     struct aws_dsql_auth_token *token);
 
+/**
+ * Generate an authentication token for Aurora DSQL directly into a caller-provided buffer.
+ *
+ * The token is appended to output without any intermediate copy, and output is never grown. If the remaining
+ * capacity is too small, AWS_ERROR_SHORT_BUFFER is raised, output is left unchanged and out_required_len still
+ * receives the token length, so the call can be retried with a large enough buffer. A char array can be used with
+ * aws_byte_buf_from_empty_array, or see aws_dsql_auth_token_generate_into_c_str.
+ *
+ * @param[in] config The configuration for the token generator
+ * @param[in] is_admin Whether to generate an admin token (true) or regular token (false)
+ * @param[in] allocator The allocator to use for memory allocation
+ * @param[in,out] output The buffer the token is appended to; no NUL terminator is written
+ * @param[out] out_required_len Receives the token length in bytes
+ *
+ * @return AWS_OP_SUCCESS if successful, AWS_OP_ERR otherwise
+ */
+AWS_DSQL_AUTH_API int aws_dsql_auth_token_generate_into_buf(
+    const struct aws_dsql_auth_config *config,
+    bool is_admin,
+    struct aws_allocator *allocator,
+    struct aws_byte_buf *output,
+    size_t *out_required_len);
+
+/**
+ * Generate an authentication token for Aurora DSQL as a NUL-terminated string in a caller-provided char buffer.
+ *
+ * Behaves like aws_dsql_auth_token_generate_into_buf: if the token and its terminator do not fit in buffer_size
+ * bytes, AWS_ERROR_SHORT_BUFFER is raised and the buffer is left untouched.
+ *
+ * @param[in] config The configuration for the token generator
+ * @param[in] is_admin Whether to generate an admin token (true) or regular token (false)
+ * @param[in] allocator The allocator to use for memory allocation
+ * @param[out] buffer The buffer to write the token to, may be NULL if buffer_size is 0
+ * @param[in] buffer_size The size of buffer in bytes, which must be at least the token length plus one
+ * @param[out] out_token_len Receives the token length in bytes, not counting the NUL terminator
+ *
+ * @return AWS_OP_SUCCESS if successful, AWS_OP_ERR otherwise
+ */
+AWS_DSQL_AUTH_API int aws_dsql_auth_token_generate_into_c_str(
+    const struct aws_dsql_auth_config *config,
+    bool is_admin,
+    struct aws_allocator *allocator,
+    char *buffer,
+    size_t buffer_size,
+    size_t *out_token_len);
+
+/**
+ * Generate authentication tokens for many Aurora DSQL clusters at once.
+ *
+ * Credentials are retrieved from the config's provider once, and every token is signed with the same date. The
+ * config's expires_in and system_clock_fn apply to every entry; its hostname and region are ignored in favor of
+ * each entry's own.
+ *
+ * Entries are signed in groups of up to 16. On CPUs with a multi-buffer SHA-256 kernel (AVX2, AVX-512 or NEON) a group
+ * is hashed and signed side by side, so listing clusters together is cheaper than generating their tokens one at a
+ * time. The generation stats observer is called once for each token generated, with the timings of its group.
+ *
+ * @param[in] config The configuration shared by every entry
+ * @param[in,out] entries The clusters to generate tokens for; error_code is set on each
+ * @param[out] tokens Array of count tokens, tokens[i] receives the token for entries[i] when it succeeds
+ * @param[in] count The number of entries and tokens; 0 succeeds without retrieving credentials
+ * @param[in] allocator The allocator to use for memory allocation
+ *
+ * @return AWS_OP_SUCCESS if every token was generated. AWS_OP_ERR otherwise, with the first failing entry's
+ *         error raised; entries whose error_code is AWS_ERROR_SUCCESS still received their token.
+ */
+AWS_DSQL_AUTH_API int aws_dsql_auth_token_generate_batch(
+    const struct aws_dsql_auth_config *config,
+    struct aws_dsql_auth_token_batch_entry *entries,
+    struct aws_dsql_auth_token *tokens,
+    size_t count,
+    struct aws_allocator *allocator);
+
+/**
+ * Generate both a regular and an admin authentication token for the same Aurora DSQL cluster in one pass.
+ *
+ * Credentials are retrieved once and both tokens are signed with the same date; the credential, date, expiration
+ * and security token parameters are encoded once and shared, so the pair costs little more than a single token.
+ * The generation stats observer, if any, is called once for each token with the stage timings of the pass.
+ *
+ * @param[in] config The configuration for the token generator
+ * @param[in] allocator The allocator to use for memory allocation
+ * @param[out] token Receives the DbConnect token
+ * @param[out] admin_token Receives the DbConnectAdmin token
+ *
+ * @return AWS_OP_SUCCESS if both tokens were generated. AWS_OP_ERR otherwise, in which case neither token is changed.
+ */
+AWS_DSQL_AUTH_API int aws_dsql_auth_token_generate_pair(
+    const struct aws_dsql_auth_config *config,
+    struct aws_allocator *allocator,
+    struct aws_dsql_auth_token *token,
+    struct aws_dsql_auth_token *admin_token);
+
+/**
+ * Generate an authentication token for Aurora DSQL without blocking the calling thread.
+ *
+ * Credentials retrieval chains directly into signing, and on_complete is invoked from whichever thread finishes
+ * the work: the caller's thread if the credentials provider completes immediately, otherwise the provider's thread.
+ * With an event loop group in the config, the whole generation runs on one of its loops instead and on_complete is
+ * always invoked there; if the loop shuts down first, on_complete receives AWS_IO_EVENT_LOOP_SHUTDOWN.
+ * The config is copied, so it does not need to outlive this call.
+ *
+ * @param[in] config The configuration for the token generator
+ * @param[in] is_admin Whether to generate an admin token (true) or regular token (false)
+ * @param[in] allocator The allocator to use for memory allocation
+ * @param[in] on_complete The callback to invoke with the generated token
+ * @param[in] user_data User data passed to on_complete
+ *
+ * @return AWS_OP_SUCCESS if generation was started, in which case on_complete is invoked exactly once.
+ *         AWS_OP_ERR otherwise, in which case on_complete is not invoked.
+ */
+AWS_DSQL_AUTH_API int aws_dsql_auth_token_generate_async(
+    const struct aws_dsql_auth_config *config,
+    bool is_admin,
+    struct aws_allocator *allocator,
+    aws_dsql_auth_on_token_generated_fn *on_complete,
+    void *user_data);
+
+/**
+ * Create a prepared token generator from a config. The config is copied, so it does not need to outlive this call.
+ *
+ * @param[in] allocator The allocator to use for the generator and its tokens
+ * @param[in] config The configuration; hostname, region and credentials_provider are required
+ *
+ * @return A new generator with a reference count of 1, or NULL with the error raised on failure
+ */
+AWS_DSQL_AUTH_API struct aws_dsql_auth_generator *aws_dsql_auth_generator_new(
+    struct aws_allocator *allocator,
+    const struct aws_dsql_auth_config *config);
+
+/**
+ * Acquire a reference to the generator.
+ *
+ * @param[in] generator The generator to acquire
+ *
+ * @return The generator
+ */
+AWS_DSQL_AUTH_API struct aws_dsql_auth_generator *aws_dsql_auth_generator_acquire(
+    struct aws_dsql_auth_generator *generator);
+
+/**
+ * Release a reference to the generator, destroying it when the last reference is released.
+ *
+ * @param[in] generator The generator to release, may be NULL
+ *
+ * @return NULL
+ */
+AWS_DSQL_AUTH_API struct aws_dsql_auth_generator *aws_dsql_auth_generator_release(
+    struct aws_dsql_auth_generator *generator);
+
+/**
+ * Generate an authentication token with a prepared generator. Produces the same token as aws_dsql_auth_token_generate
+ * with the config the generator was created from.
+ *
+ * @param[in] generator The generator
+ * @param[in] is_admin Whether to generate an admin token (true) or regular token (false)
+ * @param[out] token The generated token
+ *
+ * @return AWS_OP_SUCCESS if successful, AWS_OP_ERR otherwise
+ */
+AWS_DSQL_AUTH_API int aws_dsql_auth_generator_generate(
+    const struct aws_dsql_auth_generator *generator,
+    bool is_admin,
+    struct aws_dsql_auth_token *token);
+
+/**
+ * Generate an authentication token with a prepared generator as a shared token. Produces the same token as
+ * aws_dsql_auth_generator_generate.
+ *
+ * @param[in] generator The generator
+ * @param[in] is_admin Whether to generate an admin token (true) or regular token (false)
+ * @param[out] out_token Receives the token, released with aws_dsql_auth_shared_token_release
+ *
+ * @return AWS_OP_SUCCESS if successful, AWS_OP_ERR otherwise
+ */
+AWS_DSQL_AUTH_API int aws_dsql_auth_generator_generate_shared(
+    const struct aws_dsql_auth_generator *generator,
+    bool is_admin,
+    struct aws_dsql_auth_shared_token **out_token);
+
+/**
+ * Generate an authentication token with a prepared generator directly into a caller-provided buffer, with the same
+ * buffer handling as aws_dsql_auth_token_generate_into_buf.
+ *
+ * @param[in] generator The generator
+ * @param[in] is_admin Whether to generate an admin token (true) or regular token (false)
+ * @param[in,out] output The buffer the token is appended to; no NUL terminator is written
+ * @param[out] out_required_len Receives the token length in bytes
+ *
+ * @return AWS_OP_SUCCESS if successful, AWS_OP_ERR otherwise
+ */
+AWS_DSQL_AUTH_API int aws_dsql_auth_generator_generate_into_buf(
+    const struct aws_dsql_auth_generator *generator,
+    bool is_admin,
+    struct aws_byte_buf *output,
+    size_t *out_required_len);
+
+/**
+ * Generate both a regular and an admin authentication token with a prepared generator. Produces the same tokens as
+ * aws_dsql_auth_token_generate_pair with the config the generator was created from.
+ *
+ * @param[in] generator The generator
+ * @param[out] token Receives the DbConnect token
+ * @param[out] admin_token Receives the DbConnectAdmin token
+ *
+ * @return AWS_OP_SUCCESS if both tokens were generated. AWS_OP_ERR otherwise, in which case neither token is changed.
+ */
+AWS_DSQL_AUTH_API int aws_dsql_auth_generator_generate_pair(
+    const struct aws_dsql_auth_generator *generator,
+    struct aws_dsql_auth_token *token,
+    struct aws_dsql_auth_token *admin_token);
+
 /**
  * Clean up resources associated with the auth token.
  *
@@ -163,6 +551,71 @@ AWS_DSQL_AUTH_API void aws_dsql_auth_token_clean_up(struct aws_dsql_auth_token *
  */
 AWS_DSQL_AUTH_API const char *aws_dsql_auth_token_get_str(const struct aws_dsql_auth_token *token);
 
+/**
+ * Get when the token was signed, without parsing the token string.
+ *
+ * @param[in] token The token
+ *
+ * @return The signing time in seconds since the Unix epoch, or 0 if the token holds no token string
+ */
+AWS_DSQL_AUTH_API uint64_t aws_dsql_auth_token_get_issued_timepoint_seconds(const struct aws_dsql_auth_token *token);
+
+/**
+ * Get when the token expires, without parsing the token string. A pool can compare it against the current time on
+ * each health check to decide when to rotate a connection's password.
+ *
+ * @param[in] token The token
+ *
+ * @return The expiration in seconds since the Unix epoch, or 0 if the token holds no token string
+ */
+AWS_DSQL_AUTH_API uint64_t aws_dsql_auth_token_get_expiration_timepoint_seconds(
+    const struct aws_dsql_auth_token *token);
+
+/**
+ * Turn a token into a shared token. The shared token takes over the token's string without copying it, and the token
+ * is left empty.
+ *
+ * @param[in] allocator The allocator to use for the shared token
+ * @param[in,out] token The token to share; must hold a token string
+ *
+ * @return A new shared token with a reference count of 1, or NULL with the error raised on failure, in which case
+ * the token is unchanged
+ */
+AWS_DSQL_AUTH_API struct aws_dsql_auth_shared_token *aws_dsql_auth_shared_token_new(
+    struct aws_allocator *allocator,
+    struct aws_dsql_auth_token *token);
+
+/**
+ * Acquire a reference to the shared token.
+ *
+ * @param[in] token The shared token to acquire, may be NULL
+ *
+ * @return The shared token
+ */
+AWS_DSQL_AUTH_API struct aws_dsql_auth_shared_token *aws_dsql_auth_shared_token_acquire(
+    struct aws_dsql_auth_shared_token *token);
+
+/**
+ * Release a reference to the shared token, freeing it when the last reference is released.
+ *
+ * @param[in] token The shared token to release, may be NULL
+ *
+ * @return NULL
+ */
+AWS_DSQL_AUTH_API struct aws_dsql_auth_shared_token *aws_dsql_auth_shared_token_release(
+    struct aws_dsql_auth_shared_token *token);
+
+/**
+ * Get the token a shared token holds, to read with aws_dsql_auth_token_get_str and the other token getters. It must
+ * not be modified or cleaned up, and is valid while the caller holds a reference.
+ *
+ * @param[in] token The shared token
+ *
+ * @return The token
+ */
+AWS_DSQL_AUTH_API const struct aws_dsql_auth_token *aws_dsql_auth_shared_token_get_token(
+    const struct aws_dsql_auth_shared_token *token);
+
 /**
  * @}
  */
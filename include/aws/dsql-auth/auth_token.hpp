@@ -0,0 +1,363 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef AWS_DSQL_AUTH_AUTH_TOKEN_HPP
+#define AWS_DSQL_AUTH_AUTH_TOKEN_HPP
+
+#include <aws/common/error.h>
+#include <aws/dsql-auth/auth_token.h>
+
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <string_view>
+#include <utility>
+
+/**
+ * Header-only C++17 wrappers over the token generator. Every type is move-only and owns what it wraps, and tokens are
+ * read through std::string_view without copying their string.
+ *
+ * Like the C API, nothing here throws: failures leave an empty object whose LastError() or aws_last_error() holds the
+ * error. The one exception is GenerateAsync, whose std::promise may throw std::bad_alloc.
+ */
+namespace Aws {
+namespace DsqlAuth {
+
+/**
+ * An auth token usable as a password for a DSQL database. An empty token is the result of a failed generation and
+ * carries its error.
+ */
+class Token final {
+  public:
+    Token() noexcept : m_token(), m_lastError(AWS_ERROR_SUCCESS) {}
+
+    ~Token() { aws_dsql_auth_token_clean_up(&m_token); }
+
+    Token(const Token &) = delete;
+    Token &operator=(const Token &) = delete;
+
+    Token(Token &&other) noexcept : m_token(other.m_token), m_lastError(other.m_lastError) {
+        AWS_ZERO_STRUCT(other.m_token);
+    }
+
+    Token &operator=(Token &&other) noexcept {
+        if (this != &other) {
+            aws_dsql_auth_token_clean_up(&m_token);
+            m_token = other.m_token;
+            m_lastError = other.m_lastError;
+            AWS_ZERO_STRUCT(other.m_token);
+        }
+        return *this;
+    }
+
+    /**
+     * Whether the token holds a token string.
+     */
+    explicit operator bool() const noexcept { return m_token.token != nullptr; }
+
+    /**
+     * The error the generation of an empty token failed with, AWS_ERROR_SUCCESS otherwise.
+     */
+    int LastError() const noexcept { return m_lastError; }
+
+    /**
+     * The token string, valid for as long as the token is neither destroyed nor assigned to. Empty for an empty token.
+     */
+    std::string_view View() const noexcept {
+        if (!m_token.token) {
+            return std::string_view();
+        }
+        return std::string_view(reinterpret_cast<const char *>(aws_string_bytes(m_token.token)), m_token.token->len);
+    }
+
+    /**
+     * The token string, NUL-terminated for APIs such as libpq that take one. nullptr for an empty token.
+     */
+    const char *CStr() const noexcept { return aws_dsql_auth_token_get_str(&m_token); }
+
+    /**
+     * When the token was signed, in seconds since the Unix epoch, or 0 for an empty token.
+     */
+    uint64_t IssuedAtSeconds() const noexcept { return aws_dsql_auth_token_get_issued_timepoint_seconds(&m_token); }
+
+    /**
+     * When the token expires, in seconds since the Unix epoch, or 0 for an empty token.
+     */
+    uint64_t ExpiresAtSeconds() const noexcept {
+        return aws_dsql_auth_token_get_expiration_timepoint_seconds(&m_token);
+    }
+
+    const struct aws_dsql_auth_token *GetUnderlyingHandle() const noexcept { return &m_token; }
+
+  private:
+    friend class Config;
+    friend class Generator;
+
+    /* Takes over a token from the C API, leaving it empty */
+    explicit Token(struct aws_dsql_auth_token &token) noexcept : m_token(token), m_lastError(AWS_ERROR_SUCCESS) {
+        AWS_ZERO_STRUCT(token);
+    }
+
+    explicit Token(int lastError) noexcept : m_token(), m_lastError(lastError) {}
+
+    /* The result of a C call that filled m_token on success */
+    static Token s_fromResult(int result, struct aws_dsql_auth_token &token) noexcept {
+        return result == AWS_OP_SUCCESS ? Token(token) : Token(aws_last_error());
+    }
+
+    struct aws_dsql_auth_token m_token;
+    int m_lastError;
+};
+
+/**
+ * Configuration for generating tokens for one cluster. Unlike aws_dsql_auth_config, it owns its hostname and region.
+ * A moved-from config may only be destroyed or assigned to.
+ */
+class Config final {
+  public:
+    /**
+     * @param[in] allocator The allocator for the config's strings and for the tokens it generates
+     */
+    explicit Config(struct aws_allocator *allocator = aws_default_allocator()) noexcept
+        : m_allocator(allocator), m_config(), m_hostname(nullptr), m_region(nullptr) {
+        aws_dsql_auth_config_init(&m_config);
+    }
+
+    ~Config() { s_cleanUp(*this); }
+
+    Config(const Config &) = delete;
+    Config &operator=(const Config &) = delete;
+
+    Config(Config &&other) noexcept
+        : m_allocator(other.m_allocator), m_config(other.m_config), m_hostname(other.m_hostname),
+          m_region(other.m_region) {
+        s_disown(other);
+    }
+
+    Config &operator=(Config &&other) noexcept {
+        if (this != &other) {
+            s_cleanUp(*this);
+            m_allocator = other.m_allocator;
+            m_config = other.m_config;
+            m_hostname = other.m_hostname;
+            m_region = other.m_region;
+            s_disown(other);
+        }
+        return *this;
+    }
+
+    /**
+     * Set the hostname of the database, which is copied.
+     *
+     * @return true if successful, false with the error raised otherwise
+     */
+    bool SetHostname(std::string_view hostname) noexcept {
+        if (!s_setString(m_allocator, hostname, m_hostname)) {
+            return false;
+        }
+        aws_dsql_auth_config_set_hostname(&m_config, aws_string_c_str(m_hostname));
+        return true;
+    }
+
+    /**
+     * Set the region the database is located in, which is copied.
+     *
+     * @return true if successful, false with the error raised otherwise
+     */
+    bool SetRegion(std::string_view region) noexcept {
+        if (!s_setString(m_allocator, region, m_region)) {
+            return false;
+        }
+        aws_dsql_auth_config_set_region(&m_config, m_region);
+        return true;
+    }
+
+    /**
+     * Set the region from the hostname, as aws_dsql_auth_config_infer_region would infer it.
+     *
+     * @return true if successful, false with the error raised otherwise, in which case the region is unchanged
+     */
+    bool InferRegion() noexcept {
+        if (!m_hostname) {
+            aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+            return false;
+        }
+        struct aws_byte_cursor region;
+        if (aws_dsql_auth_hostname_parse_region(aws_byte_cursor_from_string(m_hostname), &region)) {
+            return false;
+        }
+        return SetRegion(std::string_view(reinterpret_cast<const char *>(region.ptr), region.len));
+    }
+
+    void SetExpiresIn(uint64_t expiresInSeconds) noexcept {
+        aws_dsql_auth_config_set_expires_in(&m_config, expiresInSeconds);
+    }
+
+    /**
+     * Set the credentials provider, which the config holds a reference to.
+     */
+    void SetCredentialsProvider(struct aws_credentials_provider *credentialsProvider) noexcept {
+        aws_dsql_auth_config_set_credentials_provider(&m_config, credentialsProvider);
+    }
+
+    /**
+     * Set the event loop group GenerateAsync runs on, which the config holds a reference to.
+     */
+    void SetEventLoopGroup(struct aws_event_loop_group *eventLoopGroup) noexcept {
+        aws_dsql_auth_config_set_event_loop_group(&m_config, eventLoopGroup);
+    }
+
+    /**
+     * Generate a token, as aws_dsql_auth_token_generate.
+     *
+     * @return The token, or an empty token carrying the error
+     */
+    Token Generate(bool isAdmin) const noexcept {
+        struct aws_dsql_auth_token token;
+        AWS_ZERO_STRUCT(token);
+        return Token::s_fromResult(aws_dsql_auth_token_generate(&m_config, isAdmin, m_allocator, &token), token);
+    }
+
+    /**
+     * Generate a token into a buffer the caller owns, allocating nothing, as aws_dsql_auth_token_generate_into_c_str.
+     *
+     * @return A view of the token in buffer, which is NUL-terminated, or an empty view with the error raised. An error
+     * of AWS_ERROR_SHORT_BUFFER means the token and its terminator did not fit.
+     */
+    std::string_view GenerateInto(bool isAdmin, char *buffer, size_t bufferSize) const noexcept {
+        size_t tokenLen = 0;
+        if (aws_dsql_auth_token_generate_into_c_str(&m_config, isAdmin, m_allocator, buffer, bufferSize, &tokenLen)) {
+            return std::string_view();
+        }
+        return std::string_view(buffer, tokenLen);
+    }
+
+    /**
+     * Generate a token without blocking the calling thread, as aws_dsql_auth_token_generate_async. The config is
+     * copied, so it does not need to outlive the generation.
+     *
+     * @return A future that becomes ready with the token, or an empty token carrying the error
+     */
+    std::future<Token> GenerateAsync(bool isAdmin) const {
+        auto promise = std::make_unique<std::promise<Token>>();
+        std::future<Token> future = promise->get_future();
+
+        /* On success the promise belongs to the callback, which may already have run */
+        if (aws_dsql_auth_token_generate_async(&m_config, isAdmin, m_allocator, s_onTokenGenerated, promise.get())) {
+            promise->set_value(Token(aws_last_error()));
+        } else {
+            promise.release();
+        }
+
+        return future;
+    }
+
+    struct aws_allocator *GetAllocator() const noexcept { return m_allocator; }
+
+    const struct aws_dsql_auth_config *GetUnderlyingHandle() const noexcept { return &m_config; }
+
+  private:
+    static bool s_setString(struct aws_allocator *allocator, std::string_view value, struct aws_string *&str) noexcept {
+        struct aws_string *copy =
+            aws_string_new_from_array(allocator, reinterpret_cast<const uint8_t *>(value.data()), value.size());
+        if (!copy) {
+            return false;
+        }
+        aws_string_destroy(str);
+        str = copy;
+        return true;
+    }
+
+    static void s_onTokenGenerated(struct aws_dsql_auth_token *token, int errorCode, void *userData) {
+        std::unique_ptr<std::promise<Token>> promise(static_cast<std::promise<Token> *>(userData));
+        promise->set_value(token ? Token(*token) : Token(errorCode));
+    }
+
+    static void s_cleanUp(Config &config) noexcept {
+        aws_dsql_auth_config_clean_up(&config.m_config);
+        aws_string_destroy(config.m_hostname);
+        aws_string_destroy(config.m_region);
+    }
+
+    /* The references and strings now belong to the config other was moved into */
+    static void s_disown(Config &other) noexcept {
+        AWS_ZERO_STRUCT(other.m_config);
+        other.m_hostname = nullptr;
+        other.m_region = nullptr;
+    }
+
+    struct aws_allocator *m_allocator;
+    struct aws_dsql_auth_config m_config;
+    struct aws_string *m_hostname;
+    struct aws_string *m_region;
+};
+
+/**
+ * A prepared generator for one cluster, as aws_dsql_auth_generator. It may be used from any number of threads.
+ */
+class Generator final {
+  public:
+    /**
+     * Prepare a generator from a config, which does not need to outlive it. Check the result with operator bool.
+     */
+    explicit Generator(const Config &config) noexcept
+        : m_generator(aws_dsql_auth_generator_new(config.GetAllocator(), config.GetUnderlyingHandle())) {}
+
+    ~Generator() { aws_dsql_auth_generator_release(m_generator); }
+
+    Generator(const Generator &) = delete;
+    Generator &operator=(const Generator &) = delete;
+
+    Generator(Generator &&other) noexcept : m_generator(std::exchange(other.m_generator, nullptr)) {}
+
+    Generator &operator=(Generator &&other) noexcept {
+        if (this != &other) {
+            aws_dsql_auth_generator_release(m_generator);
+            m_generator = std::exchange(other.m_generator, nullptr);
+        }
+        return *this;
+    }
+
+    /**
+     * Whether the generator was created, otherwise aws_last_error() holds why not.
+     */
+    explicit operator bool() const noexcept { return m_generator != nullptr; }
+
+    /**
+     * Generate a token, as aws_dsql_auth_generator_generate.
+     *
+     * @return The token, or an empty token carrying the error
+     */
+    Token Generate(bool isAdmin) const noexcept {
+        struct aws_dsql_auth_token token;
+        AWS_ZERO_STRUCT(token);
+        return Token::s_fromResult(aws_dsql_auth_generator_generate(m_generator, isAdmin, &token), token);
+    }
+
+    /**
+     * Generate a token into a buffer the caller owns, allocating nothing, as aws_dsql_auth_generator_generate_into_buf.
+     *
+     * @return A view of the token in buffer, which is not NUL-terminated, or an empty view with the error raised. An
+     * error of AWS_ERROR_SHORT_BUFFER means the token did not fit.
+     */
+    std::string_view GenerateInto(bool isAdmin, char *buffer, size_t bufferSize) const noexcept {
+        struct aws_byte_buf output = aws_byte_buf_from_empty_array(buffer, bufferSize);
+        size_t requiredLen = 0;
+        if (aws_dsql_auth_generator_generate_into_buf(m_generator, isAdmin, &output, &requiredLen)) {
+            return std::string_view();
+        }
+        return std::string_view(buffer, output.len);
+    }
+
+    const struct aws_dsql_auth_generator *GetUnderlyingHandle() const noexcept { return m_generator; }
+
+  private:
+    struct aws_dsql_auth_generator *m_generator;
+};
+
+} // namespace DsqlAuth
+} // namespace Aws
+
+#endif /* AWS_DSQL_AUTH_AUTH_TOKEN_HPP */
@@ -0,0 +1,90 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef AWS_DSQL_AUTH_CREDENTIALS_SNAPSHOT_H
+#define AWS_DSQL_AUTH_CREDENTIALS_SNAPSHOT_H
+
+#include <aws/auth/credentials.h>
+#include <aws/dsql-auth/exports.h>
+#include <aws/io/io.h>
+
+AWS_EXTERN_C_BEGIN
+
+/**
+ * @addtogroup aws-dsql-auth
+ * @{
+ */
+
+/**
+ * Options for creating a credentials snapshot provider.
+ */
+struct aws_dsql_auth_credentials_snapshot_options {
+    struct aws_credentials_provider_shutdown_options shutdown_options;
+
+    /**
+     * The provider credentials are sourced from, such as the default chain.
+     * Required.
+     */
+    struct aws_credentials_provider *source;
+
+    /**
+     * Start refreshing the snapshot once it has fewer than this many seconds left before its expiration.
+     * Default is 300 seconds (5 minutes) if 0 is specified.
+     */
+    uint64_t refresh_ahead_seconds;
+
+    /**
+     * Start each refresh at a random point up to this many seconds earlier than refresh_ahead_seconds, so that
+     * processes that fetched their credentials at the same moment do not all go back to the source together.
+     * Default is no jitter if 0 is specified.
+     */
+    uint64_t refresh_jitter_seconds;
+
+    /**
+     * For mocking, leave NULL otherwise
+     */
+    aws_io_clock_fn *system_clock_fn;
+
+    /**
+     * Optional. When set, background refreshes are started from a task on one loop of this group rather than on the
+     * thread of the request that triggered them, so a source that does blocking work never holds up a caller. The
+     * provider holds a reference to the group.
+     */
+    struct aws_event_loop_group *event_loop_group;
+};
+
+/**
+ * Create a credentials provider that serves a snapshot of the source's credentials.
+ *
+ * The first request waits on the source; after that every request completes immediately, on the caller's thread,
+ * with the current snapshot, without taking a lock. Once the snapshot is within refresh_ahead_seconds of its
+ * expiration, the next request starts a single refresh from the source in the background and is still served the
+ * current snapshot, which is replaced when the refresh lands. A failed refresh is retried after a jittered backoff
+ * that doubles with each failure in a row, up to a minute. Only a snapshot that has actually expired makes requests
+ * wait on the source again.
+ *
+ * Use the returned provider as the credentials_provider of an aws_dsql_auth_config so that token generation does not
+ * wait on the source in steady state.
+ *
+ * A forked child keeps the snapshot and is served from it without going to the source. A refresh the parent had in
+ * flight is dropped, the child's refreshes start from the thread of the request rather than an event loop, and each
+ * child picks its own jittered refresh point.
+ *
+ * @param[in] allocator The allocator to use for memory allocation
+ * @param[in] options The provider options
+ *
+ * @return A new credentials provider with a reference count of 1, or NULL on failure
+ */
+AWS_DSQL_AUTH_API struct aws_credentials_provider *aws_dsql_auth_credentials_provider_new_snapshot(
+    struct aws_allocator *allocator,
+    const struct aws_dsql_auth_credentials_snapshot_options *options);
+
+/**
+ * @}
+ */
+
+AWS_EXTERN_C_END
+
+#endif /* AWS_DSQL_AUTH_CREDENTIALS_SNAPSHOT_H */
@@ -0,0 +1,114 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef AWS_DSQL_AUTH_METRICS_H
+#define AWS_DSQL_AUTH_METRICS_H
+
+#include <aws/common/macros.h>
+#include <aws/dsql-auth/exports.h>
+#include <stdint.h>
+
+AWS_EXTERN_C_BEGIN
+
+/**
+ * @addtogroup aws-dsql-auth
+ * @{
+ */
+
+/**
+ * Number of buckets in the credentials latency histogram. Bucket 0 counts fetches that took under 1 microsecond,
+ * bucket i fetches that took at least 2^(i-1) and under 2^i microseconds, and the last bucket everything slower.
+ */
+#define AWS_DSQL_AUTH_METRICS_LATENCY_BUCKET_COUNT 24
+
+/**
+ * Process-wide counters, summed over every config, generator and token cache since the process started.
+ *
+ * Counters only grow, so an exporter derives rates from the difference between two snapshots. The token cache
+ * entry and byte counts are gauges of what every live cache holds right now.
+ *
+ * Every metric is accumulated in a size_t, so snapshots are only exact on 64-bit builds. On 32-bit builds counters
+ * wrap modulo 2^32, and an exporter should take the difference between two snapshots modulo 2^32 as well.
+ */
+struct aws_dsql_auth_metrics {
+    /**
+     * Tokens generated, including the ones generated to fill or refresh a token cache.
+     */
+    uint64_t tokens_generated;
+
+    /**
+     * Generations that failed, whatever the stage.
+     */
+    uint64_t generation_failures;
+
+    /**
+     * aws_dsql_auth_token_cache_get calls served from the cache, and calls that found no usable token.
+     */
+    uint64_t token_cache_hits;
+    uint64_t token_cache_misses;
+
+    /**
+     * Misses that waited for a generation of the same token already in progress instead of starting their own.
+     */
+    uint64_t token_cache_coalesced;
+
+    /**
+     * Background refreshes of cached tokens, and refreshes that failed and left the current token in place.
+     */
+    uint64_t token_cache_refreshes;
+    uint64_t token_cache_refresh_failures;
+
+    /**
+     * Tokens dropped by token caches to stay within their entry or byte budget.
+     */
+    uint64_t token_cache_evictions;
+
+    /**
+     * Tokens held by every live token cache, and the bytes they hold, counting each shared security token once.
+     */
+    uint64_t token_cache_entries;
+    uint64_t token_cache_bytes;
+
+    /**
+     * Credentials requested from a credentials provider for a generation, the ones that failed, and how long the
+     * provider took to answer, in total in microseconds, each fetch rounded to the nearest, and as a histogram.
+     */
+    uint64_t credentials_fetches;
+    uint64_t credentials_fetch_failures;
+    uint64_t credentials_fetch_us;
+    uint64_t credentials_fetch_latency_buckets[AWS_DSQL_AUTH_METRICS_LATENCY_BUCKET_COUNT];
+
+    /**
+     * Background refreshes started by credentials snapshot providers, and the ones that failed.
+     */
+    uint64_t credentials_snapshot_refreshes;
+    uint64_t credentials_snapshot_refresh_failures;
+
+    /**
+     * References given up in forked children because what would have released them did not come across the fork:
+     * the event loop group of each token cache and credentials snapshot provider, and each refresh that was in flight
+     * on one. Whatever they referenced stays allocated in the child.
+     */
+    uint64_t fork_abandoned_references;
+};
+
+/**
+ * Take a snapshot of the library's metrics.
+ *
+ * Recording a metric only writes to a counter shard of the calling thread, so the hot path never shares a cache line
+ * with other threads; the snapshot sums the shards. It takes no lock and is cheap enough to poll every few seconds.
+ * Counters recorded while the snapshot runs may or may not be included.
+ *
+ * @param[out] out_metrics Receives the metrics
+ */
+AWS_DSQL_AUTH_API void aws_dsql_auth_metrics_snapshot(struct aws_dsql_auth_metrics *out_metrics);
+
+/**
+ * @}
+ */
+
+AWS_EXTERN_C_END
+
+#endif /* AWS_DSQL_AUTH_METRICS_H */
@@ -0,0 +1,62 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef AWS_DSQL_AUTH_PRIVATE_FORK_H
+#define AWS_DSQL_AUTH_PRIVATE_FORK_H
+
+#include <aws/common/linked_list.h>
+#include <aws/dsql-auth/exports.h>
+
+/**
+ * Lets an object with locks and background work survive fork(). A forked child only has the thread that called fork,
+ * so anything another thread held or was in the middle of has to be given up in the child, and the locks must be
+ * taken before the fork so that the child gets the object in a consistent state.
+ *
+ * Every registered handler is run from pthread_atfork handlers, which the first registration installs. Handlers are
+ * not run on platforms without fork.
+ */
+struct aws_dsql_auth_fork_handler {
+    /*
+     * Take the object's locks ahead of a fork without blocking. Returns false, having taken nothing, if one is held:
+     * its holder may be waiting on the registry, for example to destroy another object, so the fork backs off and
+     * retries rather than wait with the registry held.
+     */
+    bool (*try_prepare)(void *user_data);
+
+    /* Release what try_prepare took, in the parent after the fork or when a prepare backs off */
+    void (*parent)(void *user_data);
+
+    /*
+     * In the child, with what try_prepare took still held: drop whatever threads that did not come across owned or
+     * were doing, release what try_prepare took, and re-initialize only the condition variables, which threads that
+     * did not come across may have been waiting on.
+     */
+    void (*child)(void *user_data);
+
+    void *user_data;
+
+    /* Owned by the registry */
+    struct aws_linked_list_node node;
+};
+
+AWS_EXTERN_C_BEGIN
+
+/**
+ * Register a fork handler. It is run for every fork from now until it is unregistered.
+ *
+ * @param[in] handler The handler, which must live until it is unregistered
+ */
+AWS_DSQL_AUTH_API void aws_dsql_auth_fork_handler_register(struct aws_dsql_auth_fork_handler *handler);
+
+/**
+ * Unregister a fork handler before its object is destroyed. Waits for a fork in progress to finish.
+ *
+ * @param[in] handler A registered handler
+ */
+AWS_DSQL_AUTH_API void aws_dsql_auth_fork_handler_unregister(struct aws_dsql_auth_fork_handler *handler);
+
+AWS_EXTERN_C_END
+
+#endif /* AWS_DSQL_AUTH_PRIVATE_FORK_H */
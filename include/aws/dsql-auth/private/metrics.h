@@ -0,0 +1,52 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef AWS_DSQL_AUTH_PRIVATE_METRICS_H
+#define AWS_DSQL_AUTH_PRIVATE_METRICS_H
+
+#include <aws/dsql-auth/metrics.h>
+
+/* The counters behind struct aws_dsql_auth_metrics, other than the latency histogram */
+enum aws_dsql_auth_metric {
+    AWS_DSQL_AUTH_METRIC_TOKENS_GENERATED,
+    AWS_DSQL_AUTH_METRIC_GENERATION_FAILURES,
+    AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_HITS,
+    AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_MISSES,
+    AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_COALESCED,
+    AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_REFRESHES,
+    AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_REFRESH_FAILURES,
+    AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_EVICTIONS,
+    AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_ENTRIES,
+    AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_BYTES,
+    AWS_DSQL_AUTH_METRIC_CREDENTIALS_FETCHES,
+    AWS_DSQL_AUTH_METRIC_CREDENTIALS_FETCH_FAILURES,
+    AWS_DSQL_AUTH_METRIC_CREDENTIALS_FETCH_US,
+    AWS_DSQL_AUTH_METRIC_CREDENTIALS_SNAPSHOT_REFRESHES,
+    AWS_DSQL_AUTH_METRIC_CREDENTIALS_SNAPSHOT_REFRESH_FAILURES,
+    AWS_DSQL_AUTH_METRIC_FORK_ABANDONED_REFERENCES,
+    AWS_DSQL_AUTH_METRIC_COUNT,
+};
+
+AWS_EXTERN_C_BEGIN
+
+/**
+ * Add amount to a metric in the calling thread's shard.
+ */
+AWS_DSQL_AUTH_API void aws_dsql_auth_metrics_add(enum aws_dsql_auth_metric metric, uint64_t amount);
+
+/**
+ * Subtract amount from a gauge in the calling thread's shard. A shard may go below zero when a gauge is raised on one
+ * thread and lowered on another; only the sum over every shard is meaningful.
+ */
+AWS_DSQL_AUTH_API void aws_dsql_auth_metrics_sub(enum aws_dsql_auth_metric metric, uint64_t amount);
+
+/**
+ * Record one credentials fetch: its outcome, its latency and its histogram bucket.
+ */
+AWS_DSQL_AUTH_API void aws_dsql_auth_metrics_record_credentials_fetch(uint64_t duration_ns, bool succeeded);
+
+AWS_EXTERN_C_END
+
+#endif /* AWS_DSQL_AUTH_PRIVATE_METRICS_H */
@@ -0,0 +1,142 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef AWS_DSQL_AUTH_PRIVATE_READER_SHARDS_H
+#define AWS_DSQL_AUTH_PRIVATE_READER_SHARDS_H
+
+#include <aws/common/atomics.h>
+#include <aws/common/linked_list.h>
+#include <aws/dsql-auth/exports.h>
+
+/* Threads are spread over this many shards, so that concurrent threads rarely share one */
+enum { AWS_DSQL_AUTH_THREAD_SHARD_COUNT = 64 };
+
+enum { AWS_DSQL_AUTH_CACHE_LINE_SIZE = 64 };
+
+/**
+ * Lets readers load objects that writers replace without taking a lock, and writers free what they replaced once no
+ * reader can still see it, without ever waiting for one. Readers only write to their thread's shard. Writers must
+ * serialize among themselves, typically with the owner's lock, for everything but aws_dsql_auth_read_lock and
+ * aws_dsql_auth_read_unlock.
+ *
+ * The read phase only moves from p to p + 1 once the slot of phase p - 1 has drained. Something retired at phase r was
+ * unpublished before the moves to r + 1 and r + 2, which between them check both slots, so once the phase reaches
+ * r + 2 every reader counted in either slot when it was unpublished has left. A reader that counts itself after its
+ * slot was checked is fine: all the operations are sequentially consistent, so it loads pointers after they were
+ * unpublished.
+ */
+struct aws_dsql_auth_reader_shard {
+    /* Readers inside, counted in the slot of the read phase they entered in */
+    struct aws_atomic_var active[2];
+    uint8_t padding[AWS_DSQL_AUTH_CACHE_LINE_SIZE - 2 * sizeof(struct aws_atomic_var)];
+};
+AWS_ALIGNED_TYPEDEF(
+    struct aws_dsql_auth_reader_shard,
+    aws_dsql_auth_aligned_reader_shard,
+    AWS_DSQL_AUTH_CACHE_LINE_SIZE);
+
+/* Something a writer unpublished, embedded in it and queued until no reader can still see it */
+struct aws_dsql_auth_retired {
+    struct aws_linked_list_node node;
+
+    /* The read phase just after it was unpublished */
+    size_t phase;
+};
+
+typedef void(aws_dsql_auth_free_retired_fn)(struct aws_dsql_auth_retired *retired, void *user_data);
+
+/* Aligned on a cache line, inside a larger allocation that starts at allocation */
+struct aws_dsql_auth_reader_shards {
+    struct aws_allocator *allocator;
+    void *allocation;
+
+    /* Moved on by writers to tell when readers have left */
+    struct aws_atomic_var read_phase;
+
+    /* Guarded by the writers' lock: struct aws_dsql_auth_retired, in the order they were retired */
+    struct aws_linked_list retired;
+
+    /* Their alignment keeps the shards off the line holding read_phase, which every reader loads */
+    aws_dsql_auth_aligned_reader_shard shards[AWS_DSQL_AUTH_THREAD_SHARD_COUNT];
+};
+
+AWS_EXTERN_C_BEGIN
+
+/**
+ * Shard of the calling thread, in [0, AWS_DSQL_AUTH_THREAD_SHARD_COUNT), assigned round-robin on its first call.
+ */
+AWS_DSQL_AUTH_API size_t aws_dsql_auth_thread_shard(void);
+
+/**
+ * Create reader shards with no reader inside and nothing retired.
+ *
+ * @param[in] allocator Memory allocator
+ * @return The reader shards, or NULL with the error raised
+ */
+AWS_DSQL_AUTH_API struct aws_dsql_auth_reader_shards *aws_dsql_auth_reader_shards_new(struct aws_allocator *allocator);
+
+/**
+ * Destroy reader shards once no reader or writer can use them, freeing whatever is still retired.
+ *
+ * @param[in] reader_shards The reader shards
+ * @param[in] free_retired Frees one retired object
+ * @param[in] user_data Passed to free_retired
+ */
+AWS_DSQL_AUTH_API void aws_dsql_auth_reader_shards_destroy(
+    struct aws_dsql_auth_reader_shards *reader_shards,
+    aws_dsql_auth_free_retired_fn *free_retired,
+    void *user_data);
+
+/**
+ * Enter the read side. Until the matching aws_dsql_auth_read_unlock, nothing the reader loads is freed. The only
+ * write is to the calling thread's shard.
+ *
+ * @param[in] reader_shards The reader shards
+ * @return The counter to pass to aws_dsql_auth_read_unlock
+ */
+AWS_DSQL_AUTH_API struct aws_atomic_var *aws_dsql_auth_read_lock(struct aws_dsql_auth_reader_shards *reader_shards);
+
+/**
+ * Leave the read side.
+ *
+ * @param[in] active What aws_dsql_auth_read_lock returned
+ */
+AWS_DSQL_AUTH_API void aws_dsql_auth_read_unlock(struct aws_atomic_var *active);
+
+/**
+ * Queue what a writer just unpublished to be freed once no reader can still see it. Must be called by a writer, after
+ * the replacement is published or the object taken out of what readers load.
+ *
+ * @param[in] reader_shards The reader shards
+ * @param[in] retired Embedded in what was unpublished
+ */
+AWS_DSQL_AUTH_API void aws_dsql_auth_reader_shards_retire(
+    struct aws_dsql_auth_reader_shards *reader_shards,
+    struct aws_dsql_auth_retired *retired);
+
+/**
+ * Free whatever was retired long enough ago that no reader can still see it, oldest first, moving the read phase on
+ * as far as readers allow without waiting for one. Must be called by a writer; what readers hold up now is freed by
+ * a later call.
+ *
+ * @param[in] reader_shards The reader shards
+ * @param[in] free_retired Frees one retired object
+ * @param[in] user_data Passed to free_retired
+ */
+AWS_DSQL_AUTH_API void aws_dsql_auth_reader_shards_reclaim(
+    struct aws_dsql_auth_reader_shards *reader_shards,
+    aws_dsql_auth_free_retired_fn *free_retired,
+    void *user_data);
+
+/**
+ * Count no reader inside, in a forked child, where the readers that were inside did not come across.
+ *
+ * @param[in] reader_shards The reader shards
+ */
+AWS_DSQL_AUTH_API void aws_dsql_auth_reader_shards_reset(struct aws_dsql_auth_reader_shards *reader_shards);
+
+AWS_EXTERN_C_END
+
+#endif /* AWS_DSQL_AUTH_PRIVATE_READER_SHARDS_H */
@@ -0,0 +1,50 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef AWS_DSQL_AUTH_PRIVATE_SCRATCH_ALLOCATOR_H
+#define AWS_DSQL_AUTH_PRIVATE_SCRATCH_ALLOCATOR_H
+
+#include <aws/common/allocator.h>
+#include <aws/dsql-auth/exports.h>
+
+/* Scratch space for the temporaries of one generation: its state, hash and HMAC objects, and key derivation */
+#define AWS_DSQL_AUTH_SCRATCH_SIZE 1024
+
+/**
+ * A bump allocator over caller-provided storage, usually on the stack, for the temporaries of a single generation.
+ *
+ * Releasing a block from the storage is a no-op; the space comes back when the storage goes out of scope. Requests
+ * that do not fit are passed to the parent allocator, and released to it. The allocator is not thread-safe, which is
+ * fine for a generation since its steps run one after another even when they hop threads.
+ */
+struct aws_dsql_auth_scratch_allocator {
+    struct aws_allocator base;
+    struct aws_allocator *parent;
+    uint8_t *storage;
+    size_t capacity;
+    size_t used;
+};
+
+AWS_EXTERN_C_BEGIN
+
+/**
+ * Initialize a scratch allocator. The storage must outlive every block acquired from it.
+ *
+ * @param[in] scratch The scratch allocator to initialize
+ * @param[in] parent The allocator for requests that do not fit in the storage
+ * @param[in] storage The storage to allocate from
+ * @param[in] capacity The size of the storage in bytes
+ *
+ * @return The allocator to pass around, &scratch->base
+ */
+AWS_DSQL_AUTH_API struct aws_allocator *aws_dsql_auth_scratch_allocator_init(
+    struct aws_dsql_auth_scratch_allocator *scratch,
+    struct aws_allocator *parent,
+    void *storage,
+    size_t capacity);
+
+AWS_EXTERN_C_END
+
+#endif /* AWS_DSQL_AUTH_PRIVATE_SCRATCH_ALLOCATOR_H */
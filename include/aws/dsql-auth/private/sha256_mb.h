@@ -0,0 +1,62 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef AWS_DSQL_AUTH_PRIVATE_SHA256_MB_H
+#define AWS_DSQL_AUTH_PRIVATE_SHA256_MB_H
+
+#include <aws/common/byte_buf.h>
+#include <aws/dsql-auth/exports.h>
+
+/* Lanes of the widest multi-buffer kernel, AVX-512; AVX2 has 8 and NEON 4 */
+#define AWS_DSQL_AUTH_SHA256_MB_MAX_LANES 16
+
+/**
+ * One message for the multi-buffer SHA-256 kernels: the concatenation of its pieces. Cursors are borrowed for the
+ * duration of the call.
+ */
+struct aws_dsql_auth_sha256_mb_job {
+    const struct aws_byte_cursor *pieces;
+    size_t piece_count;
+
+    /* Receives the 32 byte digest */
+    uint8_t *out_digest;
+};
+
+AWS_EXTERN_C_BEGIN
+
+/**
+ * Pick the multi-buffer kernel to hash job_count messages with: the widest one this CPU runs that the messages fill.
+ * A kernel costs the same whether its lanes are busy or idle, so with fewer messages than the narrowest kernel has
+ * lanes, hashing them one at a time is faster.
+ *
+ * @param[in] job_count The number of messages to hash
+ *
+ * @return The kernel's lane count, or 0 if no kernel is worth using for that many messages
+ */
+AWS_DSQL_AUTH_API size_t aws_dsql_auth_sha256_mb_lanes(size_t job_count);
+
+/**
+ * @param[in] lanes A lane count: 4, 8 or 16
+ *
+ * @return Whether this CPU runs the multi-buffer kernel with that many lanes
+ */
+AWS_DSQL_AUTH_API bool aws_dsql_auth_sha256_mb_supports(size_t lanes);
+
+/**
+ * Hash every job's message with SHA-256, running one message on each lane of a multi-buffer kernel. A lane that
+ * finishes its message takes the next job, so messages of different lengths keep every lane busy.
+ *
+ * @param[in] jobs The messages to hash, each receiving its digest
+ * @param[in] job_count The number of jobs
+ * @param[in] lanes The kernel to use, which aws_dsql_auth_sha256_mb_supports must accept
+ */
+AWS_DSQL_AUTH_API void aws_dsql_auth_sha256_mb_hash(
+    const struct aws_dsql_auth_sha256_mb_job *jobs,
+    size_t job_count,
+    size_t lanes);
+
+AWS_EXTERN_C_END
+
+#endif /* AWS_DSQL_AUTH_PRIVATE_SHA256_MB_H */
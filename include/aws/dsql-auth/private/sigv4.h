@@ -0,0 +1,308 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef AWS_DSQL_AUTH_PRIVATE_SIGV4_H
+#define AWS_DSQL_AUTH_PRIVATE_SIGV4_H
+
+#include <aws/common/atomics.h>
+#include <aws/common/byte_buf.h>
+#include <aws/dsql-auth/exports.h>
+
+struct aws_credentials;
+
+/* Length of a derived SigV4 signing key (HMAC-SHA256 output) */
+#define AWS_DSQL_AUTH_SIGNING_KEY_LEN 32
+
+/* Input limits of a presign template; the hostname limit is the DNS name limit */
+#define AWS_DSQL_AUTH_MAX_HOSTNAME_LEN 253
+#define AWS_DSQL_AUTH_MAX_REGION_LEN 64
+#define AWS_DSQL_AUTH_MAX_ACTION_LEN 32
+
+/* Most tokens aws_dsql_auth_presign_template_sign_batch signs at once, one per lane of the widest SHA-256 kernel */
+#define AWS_DSQL_AUTH_PRESIGN_BATCH_MAX 16
+
+/* Inline storage of a presign template, enough for every piece at the input limits */
+#define AWS_DSQL_AUTH_PRESIGN_TEMPLATE_STORAGE_SIZE 1280
+
+/* Inline storage of presign credentials, enough for the encoded access key ID and session token of common providers */
+#define AWS_DSQL_AUTH_PRESIGN_CREDENTIALS_STORAGE_SIZE 4096
+
+/* Most fragments a credentials fragment cache keeps, one per generation signing with them at the same time */
+#define AWS_DSQL_AUTH_CREDENTIALS_FRAGMENT_CACHE_SLOTS 16
+
+struct aws_dsql_auth_credentials_fragment;
+
+/**
+ * Inputs to a DSQL presigned token. All cursors are borrowed for the duration of the call.
+ */
+struct aws_dsql_auth_presign_params {
+    struct aws_byte_cursor hostname;
+    struct aws_byte_cursor region;
+    struct aws_byte_cursor action;
+    const struct aws_credentials *credentials;
+
+    /* Seconds the token is valid for, 0 selects the 900 second default */
+    uint64_t expires_in;
+
+    /* Signing time, in seconds since the Unix epoch */
+    uint64_t signing_time_secs;
+};
+
+/**
+ * The parts of a presigned token that depend only on the hostname, region, action and expiration, precomputed so
+ * that signing a token only has to stamp in the credentials and date. Every cursor points into the inline storage,
+ * so a template must not be copied or moved once initialized.
+ */
+struct aws_dsql_auth_presign_template {
+    /* The hostname and region, unencoded */
+    struct aws_byte_cursor hostname;
+    struct aws_byte_cursor region;
+
+    /* '<hostname>/?' */
+    struct aws_byte_cursor token_head;
+
+    /* 'Action=<action>&X-Amz-Algorithm=AWS4-HMAC-SHA256&X-Amz-Credential=' */
+    struct aws_byte_cursor query_head;
+
+    /* '%2F<region>%2Fdsql%2Faws4_request&X-Amz-Date=' */
+    struct aws_byte_cursor scope_param;
+
+    /* '&X-Amz-Expires=<seconds>' */
+    struct aws_byte_cursor expires_param;
+
+    /* '&X-Amz-SignedHeaders=host\nhost:<hostname>\n\nhost\n<empty payload hash>', ends the canonical request */
+    struct aws_byte_cursor canonical_tail;
+
+    /* '/<region>/dsql/aws4_request\n', the credential scope after the date in the string to sign */
+    struct aws_byte_cursor scope_tail;
+
+    uint8_t storage[AWS_DSQL_AUTH_PRESIGN_TEMPLATE_STORAGE_SIZE];
+};
+
+/**
+ * Percent-encoded access key IDs and session tokens kept across generations by an object that signs with the same
+ * credentials again and again, such as a generator. Each fragment holds a reference to the credentials it encodes,
+ * so no other credentials can be allocated at their address while it is cached, and finding it is a pointer
+ * comparison. A generation takes its fragment out of a slot while it signs and puts it back after, so a lookup takes
+ * no lock and never waits: with every slot taken, it encodes the credentials itself.
+ */
+struct aws_dsql_auth_credentials_fragment_cache {
+    /* For the fragments */
+    struct aws_allocator *allocator;
+
+    /* struct aws_dsql_auth_credentials_fragment *, or NULL for a free or taken slot */
+    struct aws_atomic_var slots[AWS_DSQL_AUTH_CREDENTIALS_FRAGMENT_CACHE_SLOTS];
+};
+
+/**
+ * The signing credentials of one generation, with the access key ID and session token the way a token carries them:
+ * percent-encoded into the inline storage or by a fragment taken from a cache, or left raw for credentials too long
+ * for the storage, which are then encoded as they are written. Initialized once per generation and passed to each
+ * presign call of it. Every cursor may point into the inline storage, so it must not be copied or moved once
+ * initialized.
+ */
+struct aws_dsql_auth_presign_credentials {
+    const struct aws_credentials *credentials;
+    struct aws_byte_cursor access_key_id;
+    struct aws_byte_cursor session_token;
+    bool is_encoded;
+
+    /* The fragment taken for this generation and the cache it goes back to, or NULL */
+    struct aws_dsql_auth_credentials_fragment_cache *fragment_cache;
+    struct aws_dsql_auth_credentials_fragment *fragment;
+
+    uint8_t storage[AWS_DSQL_AUTH_PRESIGN_CREDENTIALS_STORAGE_SIZE];
+};
+
+AWS_EXTERN_C_BEGIN
+
+/**
+ * Initialize an empty credentials fragment cache.
+ *
+ * @param[out] fragment_cache The cache to initialize
+ * @param[in] allocator The allocator fragments are allocated from
+ */
+AWS_DSQL_AUTH_API void aws_dsql_auth_credentials_fragment_cache_init(
+    struct aws_dsql_auth_credentials_fragment_cache *fragment_cache,
+    struct aws_allocator *allocator);
+
+/**
+ * Free every cached fragment and release its credentials. No generation may still hold one.
+ */
+AWS_DSQL_AUTH_API void aws_dsql_auth_credentials_fragment_cache_clean_up(
+    struct aws_dsql_auth_credentials_fragment_cache *fragment_cache);
+
+/**
+ * Prepare credentials for the presign calls of one generation. With a fragment cache, the fragment of the credentials
+ * is taken from it, or created if none is free; otherwise, or if a fragment cannot be allocated, the credentials are
+ * encoded into the inline storage. Never fails.
+ *
+ * @param[out] presign_credentials The presign credentials to initialize
+ * @param[in] credentials The signing credentials, which must outlive presign_credentials
+ * @param[in] fragment_cache The cache to take a fragment from, or NULL
+ */
+AWS_DSQL_AUTH_API void aws_dsql_auth_presign_credentials_init(
+    struct aws_dsql_auth_presign_credentials *presign_credentials,
+    const struct aws_credentials *credentials,
+    struct aws_dsql_auth_credentials_fragment_cache *fragment_cache);
+
+/**
+ * Put the fragment back in its cache, or free it if the cache has no free slot left, and zero the inline storage.
+ */
+AWS_DSQL_AUTH_API void aws_dsql_auth_presign_credentials_clean_up(
+    struct aws_dsql_auth_presign_credentials *presign_credentials);
+
+/**
+ * Initialize a presign template. The inputs are copied into the template.
+ *
+ * @param[out] presign_template The template to initialize
+ * @param[in] hostname The hostname, at most AWS_DSQL_AUTH_MAX_HOSTNAME_LEN bytes
+ * @param[in] region The signing region, at most AWS_DSQL_AUTH_MAX_REGION_LEN bytes
+ * @param[in] action The Action query parameter, at most AWS_DSQL_AUTH_MAX_ACTION_LEN bytes
+ * @param[in] expires_in Seconds the token is valid for, 0 selects the 900 second default
+ *
+ * @return AWS_OP_SUCCESS if successful, AWS_OP_ERR with AWS_ERROR_INVALID_ARGUMENT for empty or over-long inputs
+ */
+AWS_DSQL_AUTH_API int aws_dsql_auth_presign_template_init(
+    struct aws_dsql_auth_presign_template *presign_template,
+    struct aws_byte_cursor hostname,
+    struct aws_byte_cursor region,
+    struct aws_byte_cursor action,
+    uint64_t expires_in);
+
+/**
+ * Presign a token from a template and append it to out_token, with the same buffer handling as aws_dsql_auth_presign.
+ *
+ * @param[in] allocator The allocator to use for hashing state
+ * @param[in] presign_template The template
+ * @param[in] presign_credentials The signing credentials
+ * @param[in] signing_time_secs Signing time, in seconds since the Unix epoch
+ * @param[in,out] out_token The buffer the token is appended to
+ *
+ * @return AWS_OP_SUCCESS if successful, AWS_OP_ERR otherwise
+ */
+AWS_DSQL_AUTH_API int aws_dsql_auth_presign_template_sign(
+    struct aws_allocator *allocator,
+    const struct aws_dsql_auth_presign_template *presign_template,
+    const struct aws_dsql_auth_presign_credentials *presign_credentials,
+    uint64_t signing_time_secs,
+    struct aws_byte_buf *out_token);
+
+/**
+ * Presign two tokens that differ only in their Action, such as a DbConnect and a DbConnectAdmin token for the same
+ * cluster, with the same buffer handling as aws_dsql_auth_presign_template_sign. The date is formatted and the
+ * signing key is looked up once, and the credentials are written once; only the canonical request hash and the
+ * signature are computed for each token. Nothing is written to either buffer unless both tokens are signed.
+ *
+ * @param[in] allocator The allocator to use for hashing state
+ * @param[in] first_template The template of the first token
+ * @param[in] second_template The template of the second token, with the same hostname, region and expiration
+ * @param[in] presign_credentials The signing credentials
+ * @param[in] signing_time_secs Signing time, in seconds since the Unix epoch
+ * @param[in,out] out_first_token The buffer the first token is appended to
+ * @param[in,out] out_second_token The buffer the second token is appended to, distinct from out_first_token
+ *
+ * @return AWS_OP_SUCCESS if successful, AWS_OP_ERR otherwise; templates that differ in more than their action fail
+ *         with AWS_ERROR_INVALID_ARGUMENT
+ */
+AWS_DSQL_AUTH_API int aws_dsql_auth_presign_template_sign_pair(
+    struct aws_allocator *allocator,
+    const struct aws_dsql_auth_presign_template *first_template,
+    const struct aws_dsql_auth_presign_template *second_template,
+    const struct aws_dsql_auth_presign_credentials *presign_credentials,
+    uint64_t signing_time_secs,
+    struct aws_byte_buf *out_first_token,
+    struct aws_byte_buf *out_second_token);
+
+/**
+ * Presign a token from each of several templates with the same credentials and signing time, appending the token of
+ * templates[i] to out_tokens[i] with the same buffer handling as aws_dsql_auth_presign_template_sign. The date is
+ * formatted once, and consecutive templates for the same region share a signing key lookup.
+ *
+ * When the CPU runs a multi-buffer SHA-256 kernel (AVX-512, AVX2 or NEON) that the templates fill, the canonical
+ * request hashes and HMACs of every token are computed side by side, one token per lane; otherwise each token is
+ * signed as aws_dsql_auth_presign_template_sign would. Either way the tokens are the same. Nothing is written
+ * to any buffer unless every token is signed.
+ *
+ * @param[in] allocator The allocator to use for hashing state
+ * @param[in] templates The templates, at most AWS_DSQL_AUTH_PRESIGN_BATCH_MAX of them
+ * @param[in] count The number of templates and buffers
+ * @param[in] presign_credentials The signing credentials
+ * @param[in] signing_time_secs Signing time, in seconds since the Unix epoch
+ * @param[in,out] out_tokens Distinct buffers the tokens are appended to, one per template
+ *
+ * @return AWS_OP_SUCCESS if successful, AWS_OP_ERR otherwise
+ */
+AWS_DSQL_AUTH_API int aws_dsql_auth_presign_template_sign_batch(
+    struct aws_allocator *allocator,
+    const struct aws_dsql_auth_presign_template *const *templates,
+    size_t count,
+    const struct aws_dsql_auth_presign_credentials *presign_credentials,
+    uint64_t signing_time_secs,
+    struct aws_byte_buf *out_tokens);
+
+/**
+ * Compute the exact length of the token aws_dsql_auth_presign_template_sign would produce, without signing.
+ *
+ * @param[in] presign_template The template
+ * @param[in] presign_credentials The signing credentials
+ * @param[out] out_len Receives the token length in bytes, with no NUL terminator
+ *
+ * @return AWS_OP_SUCCESS if successful, AWS_OP_ERR otherwise
+ */
+AWS_DSQL_AUTH_API int aws_dsql_auth_presign_template_length(
+    const struct aws_dsql_auth_presign_template *presign_template,
+    const struct aws_dsql_auth_presign_credentials *presign_credentials,
+    size_t *out_len);
+
+/**
+ * Presign a DSQL connect request with SigV4 query parameters and append the resulting token,
+ * '<hostname>/?Action=...&X-Amz-Signature=...', to out_token.
+ *
+ * Room for the whole token is made before anything is written. A buffer with an allocator is grown at most once; a
+ * fixed buffer (no allocator) that is too small fails with AWS_ERROR_SHORT_BUFFER and is left unchanged.
+ *
+ * This produces the same token as signing an HTTP request with aws_sign_request_aws using
+ * AWS_ST_HTTP_REQUEST_QUERY_PARAMS. The canonical request is hashed as it is produced, and the signing key comes from
+ * aws_dsql_auth_signing_key_get, so a warm token costs one SHA-256 over the canonical request and one HMAC over the
+ * string to sign. The access key ID and session token are encoded for this token alone; callers that sign many
+ * tokens with the same credentials keep them encoded in a credentials fragment cache instead.
+ *
+ * @param[in] allocator The allocator to use for hashing state
+ * @param[in] params The presign inputs
+ * @param[in,out] out_token The buffer the token is appended to
+ *
+ * @return AWS_OP_SUCCESS if successful, AWS_OP_ERR otherwise
+ */
+AWS_DSQL_AUTH_API int aws_dsql_auth_presign(
+    struct aws_allocator *allocator,
+    const struct aws_dsql_auth_presign_params *params,
+    struct aws_byte_buf *out_token);
+
+/**
+ * Get the SigV4 signing key for the dsql service, deriving it only if it is not already cached.
+ *
+ * Keys are cached process-wide per (secret access key, region, date). A rotated secret or a new UTC day simply misses
+ * and replaces the stale key, so the four chained HMACs run at most once per credentials, region and day. The cache
+ * identifies a secret by its SHA-256, compared in constant time, and never holds the secret itself.
+ *
+ * @param[in] allocator The allocator to use for hashing state
+ * @param[in] secret_access_key The secret access key of the signing credentials
+ * @param[in] region The signing region
+ * @param[in] short_date The signing date, formatted as YYYYMMDD
+ * @param[out] out_key Receives AWS_DSQL_AUTH_SIGNING_KEY_LEN bytes of signing key
+ *
+ * @return AWS_OP_SUCCESS if successful, AWS_OP_ERR otherwise
+ */
+AWS_DSQL_AUTH_API int aws_dsql_auth_signing_key_get(
+    struct aws_allocator *allocator,
+    struct aws_byte_cursor secret_access_key,
+    struct aws_byte_cursor region,
+    struct aws_byte_cursor short_date,
+    uint8_t out_key[AWS_DSQL_AUTH_SIGNING_KEY_LEN]);
+
+AWS_EXTERN_C_END
+
+#endif /* AWS_DSQL_AUTH_PRIVATE_SIGV4_H */
@@ -0,0 +1,228 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef AWS_DSQL_AUTH_TOKEN_CACHE_H
+#define AWS_DSQL_AUTH_TOKEN_CACHE_H
+
+#include <aws/dsql-auth/auth_token.h>
+
+AWS_EXTERN_C_BEGIN
+
+/**
+ * @addtogroup aws-dsql-auth
+ * @{
+ */
+
+/**
+ * An in-process cache of auth tokens.
+ *
+ * Tokens are keyed by hostname, region, admin flag, expiration and credentials provider. A cached token is returned
+ * for as long as it has enough validity left; once it enters the refresh-ahead window a replacement is generated on a
+ * background thread, so callers on the connect path do not wait on credential retrieval or signing. A failed refresh
+ * is retried after a jittered backoff that doubles with each failure in a row, up to a minute.
+ *
+ * Cached tokens are kept compact: the percent-encoded security token, most of a token's bytes, is held once for every
+ * token signed with the same credentials, and the full token is only put back together when a get hands it out.
+ *
+ * By default the cache grows with every token it is asked for. With an entry or byte budget it evicts the tokens
+ * that have gone longest without a get once it goes over, so tokens in use stay cached while idle ones are dropped
+ * along with their reference to the credentials provider.
+ *
+ * A cache survives fork(): a forked child keeps every cached token, and drops the refreshes, generations and waits
+ * of the parent's threads, which did not come across. Its refreshes run on threads the child launches for its first
+ * one, even when the cache was given an event loop group, whose loops do not survive the fork either.
+ */
+struct aws_dsql_auth_token_cache;
+
+/**
+ * The token a cache dropped to stay within its budget. Valid only for the duration of the callback.
+ */
+struct aws_dsql_auth_token_cache_eviction {
+    const char *hostname;
+    const struct aws_string *region;
+    struct aws_credentials_provider *credentials_provider;
+    bool is_admin;
+};
+
+/**
+ * Invoked with the cache lock held each time the cache evicts a token, for example to release per-tenant resources.
+ * It must not call back into the cache.
+ */
+typedef void(aws_dsql_auth_token_cache_on_eviction_fn)(
+    const struct aws_dsql_auth_token_cache_eviction *eviction,
+    void *user_data);
+
+/**
+ * Options for creating a token cache.
+ */
+struct aws_dsql_auth_token_cache_options {
+    /**
+     * Start a background refresh once a cached token has fewer than this many seconds of validity left.
+     * Default is a quarter of the token's expires_in if 0 is specified.
+     */
+    uint64_t refresh_ahead_seconds;
+
+    /**
+     * Never hand out a cached token with fewer than this many seconds of validity left; generate a new one
+     * synchronously instead.
+     * Default is 10 seconds if 0 is specified.
+     */
+    uint64_t min_remaining_seconds;
+
+    /**
+     * Start each token's refresh at a random point up to this many seconds before its refresh-ahead window, so that
+     * processes that cached their tokens at the same moment do not all refresh them at the same moment. The jitter
+     * is capped at half the time a token spends outside the refresh-ahead window.
+     * Default is no jitter if 0 is specified.
+     */
+    uint64_t refresh_jitter_seconds;
+
+    /**
+     * The number of background refreshes the cache runs at once, each on its own thread.
+     * Default is 1 if 0 is specified. Ignored with an event_loop_group.
+     */
+    size_t max_concurrent_refreshes;
+
+    /**
+     * Optional. When set, the cache starts no threads of its own: each refresh runs as an asynchronous generation on
+     * this group, always on the same loop for the same token, and neither the refresh nor its credentials retrieval
+     * ever runs on the thread of the get that triggered it. The cache holds a reference to the group.
+     */
+    struct aws_event_loop_group *event_loop_group;
+
+    /**
+     * The most tokens the cache holds at once. Past it, the cache evicts tokens with CLOCK: a get marks its token
+     * as recently used, and an eviction sweep passes over marked tokens once, clearing the mark, before evicting them.
+     * Tokens being generated or refreshed, or waited on, are never evicted.
+     * Default is no limit if 0 is specified.
+     */
+    size_t max_entries;
+
+    /**
+     * The most bytes of tokens the cache holds at once, counting each shared security token once, evicted the same
+     * way as for max_entries.
+     * Default is no limit if 0 is specified.
+     */
+    size_t max_bytes;
+
+    /**
+     * Optional. Invoked for each evicted token.
+     */
+    aws_dsql_auth_token_cache_on_eviction_fn *on_eviction;
+    void *on_eviction_user_data;
+};
+
+/**
+ * Create a new token cache. Unless the options name an event loop group, the cache starts max_concurrent_refreshes
+ * background threads used to refresh tokens ahead of expiry.
+ *
+ * @param[in] allocator The allocator to use for memory allocation
+ * @param[in] options The cache options, may be NULL to use defaults
+ *
+ * @return A new token cache with a reference count of 1, or NULL on failure
+ */
+AWS_DSQL_AUTH_API struct aws_dsql_auth_token_cache *aws_dsql_auth_token_cache_new(
+    struct aws_allocator *allocator,
+    const struct aws_dsql_auth_token_cache_options *options);
+
+/**
+ * Acquire a reference to the token cache.
+ *
+ * @param[in] cache The cache to acquire
+ *
+ * @return The cache
+ */
+AWS_DSQL_AUTH_API struct aws_dsql_auth_token_cache *aws_dsql_auth_token_cache_acquire(
+    struct aws_dsql_auth_token_cache *cache);
+
+/**
+ * Release a reference to the token cache. When the last reference is released the background thread is stopped and
+ * all cached tokens are destroyed.
+ *
+ * @param[in] cache The cache to release, may be NULL
+ *
+ * @return NULL
+ */
+AWS_DSQL_AUTH_API struct aws_dsql_auth_token_cache *aws_dsql_auth_token_cache_release(
+    struct aws_dsql_auth_token_cache *cache);
+
+/**
+ * Get an authentication token for Aurora DSQL, using a cached token if one with enough validity left is available.
+ * On a miss the token is generated synchronously with aws_dsql_auth_token_generate and stored in the cache.
+ *
+ * A hit takes no lock and is safe to call from any number of threads at once; only misses and refreshes
+ * synchronize with each other. Concurrent misses for the same token are coalesced: one of them generates it, and the
+ * others wait for that generation and share its result, including its error if it fails.
+ *
+ * If the config has a generation stats observer, hits, and misses served by another caller's generation, are reported
+ * to it with token_cache_hit set. Other misses are reported by the generation itself; background refreshes report to
+ * the observer of the config that first cached the token.
+ *
+ * @param[in] cache The token cache
+ * @param[in] config The configuration for the token generator
+ * @param[in] is_admin Whether to get an admin token (true) or regular token (false)
+ * @param[in] allocator The allocator to use for the returned token
+ * @param[out] token The token, owned by the caller and cleaned up with aws_dsql_auth_token_clean_up
+ *
+ * @return AWS_OP_SUCCESS if successful, AWS_OP_ERR otherwise
+ */
+AWS_DSQL_AUTH_API int aws_dsql_auth_token_cache_get(
+    struct aws_dsql_auth_token_cache *cache,
+    const struct aws_dsql_auth_config *config,
+    bool is_admin,
+    struct aws_allocator *allocator,
+    struct aws_dsql_auth_token *token);
+
+/**
+ * Get a cached authentication token as a shared token, with the same caching as aws_dsql_auth_token_cache_get. A hit
+ * hands out a reference to the token the cache holds instead of a copy of it, so every caller shares one allocation.
+ * A token the cache has since replaced stays valid until its last reference is released.
+ *
+ * The first shared get of each cached token takes the cache lock to materialize the token the others then share,
+ * which the cache counts against its byte budget for as long as it holds the token.
+ *
+ * @param[in] cache The token cache
+ * @param[in] config The configuration for the token generator
+ * @param[in] is_admin Whether to get an admin token (true) or regular token (false)
+ * @param[out] out_token Receives a reference to the token, released with aws_dsql_auth_shared_token_release
+ *
+ * @return AWS_OP_SUCCESS if successful, AWS_OP_ERR otherwise
+ */
+AWS_DSQL_AUTH_API int aws_dsql_auth_token_cache_get_shared(
+    struct aws_dsql_auth_token_cache *cache,
+    const struct aws_dsql_auth_config *config,
+    bool is_admin,
+    struct aws_dsql_auth_shared_token **out_token);
+
+/**
+ * Get a cached authentication token directly into a caller-provided buffer, with the same caching as
+ * aws_dsql_auth_token_cache_get. A hit puts the token together straight into output and allocates nothing.
+ *
+ * Output is never grown, with the same buffer handling as aws_dsql_auth_token_generate_into_buf: if the remaining
+ * capacity is too small, AWS_ERROR_SHORT_BUFFER is raised, output is left unchanged and out_required_len still
+ * receives the token length.
+ *
+ * @param[in] cache The token cache
+ * @param[in] config The configuration for the token generator
+ * @param[in] is_admin Whether to get an admin token (true) or regular token (false)
+ * @param[in,out] output The buffer the token is appended to; no NUL terminator is written
+ * @param[out] out_required_len Receives the token length in bytes
+ *
+ * @return AWS_OP_SUCCESS if successful, AWS_OP_ERR otherwise
+ */
+AWS_DSQL_AUTH_API int aws_dsql_auth_token_cache_get_into_buf(
+    struct aws_dsql_auth_token_cache *cache,
+    const struct aws_dsql_auth_config *config,
+    bool is_admin,
+    struct aws_byte_buf *output,
+    size_t *out_required_len);
+
+/**
+ * @}
+ */
+
+AWS_EXTERN_C_END
+
+#endif /* AWS_DSQL_AUTH_TOKEN_CACHE_H */
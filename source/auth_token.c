@@ -4,25 +4,24 @@
  */
 
 #include <aws/auth/credentials.h>
-#include <aws/auth/signable.h>
-#include <aws/auth/signing.h>
-#include <aws/auth/signing_config.h>
-#include <aws/auth/signing_result.h>
 #include <aws/common/allocator.h> /* for aws_allocator, aws_mem_calloc/release */
 #include <aws/common/byte_buf.h>  /* for aws_byte_cursor_from_c_str */
 #include <aws/common/clock.h>     /* for aws_sys_clock_get_ticks function */
 #include <aws/common/condition_variable.h>
-#include <aws/common/date_time.h>
 #include <aws/common/error.h>
+#include <aws/common/hash_table.h>
 #include <aws/common/mutex.h>
+#include <aws/common/ref_count.h>
 #include <aws/common/string.h>
 #include <aws/common/zero.h> /* for AWS_ZERO_STRUCT */
 #include <aws/dsql-auth/auth_token.h>
-#include <aws/http/request_response.h>
+#include <aws/dsql-auth/private/metrics.h>
+#include <aws/dsql-auth/private/scratch_allocator.h>
+#include <aws/dsql-auth/private/sigv4.h>
+#include <aws/io/event_loop.h>
 
 #include <stdint.h>
-#include <stdio.h>
-#include <string.h> /* for strlen, strcmp, memcpy */
+#include <string.h> /* for strlen, memcmp, memcpy */
 
 /* Hostname format: <cluster-id>.dsql*.<region>.on.aws, where cluster-id is 26
  * chars and dsql* can be dsql, dsql-xxx, etc. */
@@ -32,10 +31,18 @@ enum { CLUSTER_ID_LENGTH = 26 };
 
 #define ACTION_DB_CONNECT "DbConnect"
 #define ACTION_DB_CONNECT_ADMIN "DbConnectAdmin"
-#define SERVICE_NAME "dsql"
 
 enum { DEFAULT_EXPIRES_IN = 900 };
 
+/* Stack space for presigning; tokens carrying a session token run to 1-2 KB, anything longer goes to the heap */
+enum { TOKEN_SCRATCH_SIZE = 4096 };
+
+/*
+ * Stack space for one batch group: its templates, its tokens and the signing temporaries. A group of a few entries
+ * fits; a larger one takes its templates and its tokens from the heap in one block each.
+ */
+enum { BATCH_SCRATCH_SIZE = 16384 };
+
 int aws_dsql_auth_config_init(struct aws_dsql_auth_config *config) {
     AWS_ZERO_STRUCT(*config);
     config->expires_in = DEFAULT_EXPIRES_IN;
@@ -52,6 +59,10 @@ void aws_dsql_auth_config_clean_up(struct aws_dsql_auth_config *config) {
         aws_credentials_provider_release(config->credentials_provider);
     }
 
+    if (config->event_loop_group) {
+        aws_event_loop_group_release(config->event_loop_group);
+    }
+
     AWS_ZERO_STRUCT(*config);
 }
 
@@ -67,6 +78,15 @@ void aws_dsql_auth_config_set_expires_in(struct aws_dsql_auth_config *config, ui
     config->expires_in = expires_in;
 }
 
+void aws_dsql_auth_config_set_on_generation_stats(
+    struct aws_dsql_auth_config *config,
+    aws_dsql_auth_on_generation_stats_fn *on_generation_stats,
+    void *user_data) {
+
+    config->on_generation_stats = on_generation_stats;
+    config->on_generation_stats_user_data = user_data;
+}
+
 void aws_dsql_auth_config_set_credentials_provider(
     struct aws_dsql_auth_config *config,
     struct aws_credentials_provider *credentials_provider) {
@@ -81,122 +101,62 @@ void aws_dsql_auth_config_set_credentials_provider(
     }
 }
 
-/* Structure to hold signing state */
-struct aws_signing_userdata {
-    struct aws_allocator *allocator;
-
-    struct aws_mutex mutex;
-    struct aws_condition_variable condition_var;
-
-    struct aws_http_message *request;
-
-    int signing_result_code;
-    bool is_signing_complete;
-};
-
-/* Callback for when signing is complete */
-static void s_on_signing_complete(struct aws_signing_result *result, int error_code, void *userdata) {
-    struct aws_signing_userdata *context = userdata;
-
-    aws_mutex_lock(&context->mutex);
-
-    /* Store the result in the userdata */
-    aws_apply_signing_result_to_http_request(context->request, context->allocator, result);
-    context->signing_result_code = error_code;
-    context->is_signing_complete = true;
-
-    aws_condition_variable_notify_one(&context->condition_var);
-    aws_mutex_unlock(&context->mutex);
-}
-
-/* Helper function for condition variable predicate */
-static bool s_is_signing_complete(void *userdata) {
-    struct aws_signing_userdata *context = userdata;
-    return context->is_signing_complete;
-}
-
-/* Structure to hold credentials callback state */
-struct aws_credentials_callback_state {
-    struct aws_mutex mutex;
-    struct aws_condition_variable condition_var;
-    struct aws_credentials *credentials;
-    int error_code;
-    bool is_complete;
-};
-
-/**
- * Initialize a credentials callback state.
- *
- * @param[out] state The state to initialize
- *
- * @return AWS_OP_SUCCESS if successful, AWS_OP_ERR otherwise
- */
-static int s_aws_credentials_callback_state_init(struct aws_credentials_callback_state *state) {
-    AWS_ZERO_STRUCT(*state);
+void aws_dsql_auth_config_set_event_loop_group(
+    struct aws_dsql_auth_config *config,
+    struct aws_event_loop_group *event_loop_group) {
 
-    if (aws_mutex_init(&state->mutex)) {
-        return AWS_OP_ERR;
+    if (config->event_loop_group) {
+        aws_event_loop_group_release(config->event_loop_group);
     }
 
-    if (aws_condition_variable_init(&state->condition_var)) {
-        aws_mutex_clean_up(&state->mutex);
-        return AWS_OP_ERR;
+    config->event_loop_group = event_loop_group;
+    if (event_loop_group) {
+        aws_event_loop_group_acquire(event_loop_group);
     }
-
-    state->credentials = NULL;
-    state->error_code = 0;
-    state->is_complete = false;
-
-    return AWS_OP_SUCCESS;
 }
 
-/**
- * Clean up resources associated with a credentials callback state.
- *
- * @param[in] state The state to clean up
- */
-static void s_aws_credentials_callback_state_clean_up(struct aws_credentials_callback_state *state) {
-    if (!state) {
-        return;
+int aws_dsql_auth_hostname_parse_region(struct aws_byte_cursor hostname, struct aws_byte_cursor *out_region) {
+    if (!out_region) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
     }
+    AWS_ZERO_STRUCT(*out_region);
 
-    if (state->credentials) {
-        aws_credentials_release(state->credentials);
+    /* Strip the '.on.aws' suffix; everything left is '<cluster-id>.<labels>' */
+    struct aws_byte_cursor suffix = aws_byte_cursor_from_c_str(DSQL_HOSTNAME_END);
+    if (hostname.len <= suffix.len || memcmp(hostname.ptr + hostname.len - suffix.len, suffix.ptr, suffix.len) != 0) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
     }
-
-    aws_condition_variable_clean_up(&state->condition_var);
-    aws_mutex_clean_up(&state->mutex);
-
-    AWS_ZERO_STRUCT(*state);
-}
-
-/* Callback for when credentials are retrieved */
-static void s_on_get_credentials_complete(struct aws_credentials *credentials, int error_code, void *userdata) {
-    struct aws_credentials_callback_state *state = (struct aws_credentials_callback_state *)userdata;
-    aws_mutex_lock(&state->mutex);
-
-    /* Store the result in the userdata */
-    state->credentials = credentials;
-    if (credentials) {
-        aws_credentials_acquire(credentials);
+    hostname.len -= suffix.len;
+
+    /* The region is the label right after the first label starting with 'dsql' that follows the cluster id */
+    struct aws_byte_cursor dsql_prefix = aws_byte_cursor_from_c_str("dsql");
+    struct aws_byte_cursor label;
+    AWS_ZERO_STRUCT(label);
+    bool is_cluster_id = true;
+    bool after_dsql = false;
+
+    while (aws_byte_cursor_next_split(&hostname, '.', &label)) {
+        if (is_cluster_id) {
+            if (label.len != CLUSTER_ID_LENGTH) {
+                break;
+            }
+            is_cluster_id = false;
+        } else if (after_dsql) {
+            if (label.len == 0) {
+                break;
+            }
+            *out_region = label;
+            return AWS_OP_SUCCESS;
+        } else if (aws_byte_cursor_starts_with(&label, &dsql_prefix)) {
+            after_dsql = true;
+        }
     }
-    state->error_code = error_code;
-    state->is_complete = true;
-
-    aws_condition_variable_notify_one(&state->condition_var);
-    aws_mutex_unlock(&state->mutex);
-}
 
-/* Helper function for condition variable predicate */
-static bool s_is_credentials_complete(void *userdata) {
-    struct aws_credentials_callback_state *state = (struct aws_credentials_callback_state *)userdata;
-    return state->is_complete;
+    return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
 }
 
 /**
- * Extract the AWS region from a DSQL hostname. Expected format:
- * '<cluster-id>.dsql*.<region>.on.aws' Where cluster-id is always 26 characters
- * and dsql* can be 'dsql', 'dsql-xxx', etc.
+ * Extract the AWS region from a DSQL hostname into a new string.
  *
  * @param[in] allocator The allocator to use for memory allocation
  * @param[in] hostname The hostname to extract the region from
@@ -215,126 +175,16 @@ static int s_extract_region_from_hostname(
         return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
     }
 
-    size_t hostname_len = strlen(hostname);
-    if (hostname_len == 0) {
-        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
-    }
-
-    /* Create a working copy of the hostname for tokenization */
-    char *hostname_copy = aws_mem_calloc(allocator, 1, hostname_len + 1);
-    if (!hostname_copy) {
-        return aws_raise_error(AWS_ERROR_OOM);
-    }
-    strcpy(hostname_copy, hostname);
-
-    /* Split hostname by periods and collect parts */
-    char *parts[16]; /* Should be enough for any reasonable hostname */
-    int part_count = 0;
-
-    /* Use strtok_r for thread safety if available, otherwise strtok */
-    char *saveptr = NULL;
-    char *token = strtok_r(hostname_copy, ".", &saveptr);
-
-    while (token != NULL && part_count < 16) {
-        parts[part_count++] = token;
-        token = strtok_r(NULL, ".", &saveptr);
-    }
-
-    /* Validate minimum structure: cluster-id, dsql*, region, on, aws */
-    if (part_count < 5) {
-        aws_mem_release(allocator, hostname_copy);
-        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
-    }
-
-    /* Check that it ends with "on.aws" */
-    if (strcmp(parts[part_count - 1], "aws") != 0 || strcmp(parts[part_count - 2], "on") != 0) {
-        aws_mem_release(allocator, hostname_copy);
-        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
-    }
-
-    /* Find the dsql part (starts with "dsql") */
-    int dsql_index = -1;
-    for (int i = 1; i < part_count - 2; i++) { /* Skip first part (cluster-id) and last two parts (on.aws) */
-        if (strncmp(parts[i], "dsql", 4) == 0) {
-            dsql_index = i;
-            break;
-        }
-    }
-
-    if (dsql_index == -1) {
-        aws_mem_release(allocator, hostname_copy);
-        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT); /* No dsql part found */
-    }
-
-    /* Validate cluster ID length (should be exactly 26 characters) */
-    if (strlen(parts[0]) != CLUSTER_ID_LENGTH) {
-        aws_mem_release(allocator, hostname_copy);
-        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
-    }
-
-    /* The region should be the part immediately after the dsql part */
-    int region_index = dsql_index + 1;
-    if (region_index >= part_count - 2) { /* Must have region before "on.aws" */
-        aws_mem_release(allocator, hostname_copy);
-        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
-    }
-
-    /* Extract the region */
-    const char *region = parts[region_index];
-    if (strlen(region) == 0) {
-        aws_mem_release(allocator, hostname_copy);
-        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
-    }
-
-    /* Create the aws_string for the region */
-    *region_str = aws_string_new_from_c_str(allocator, region);
-
-    /* Clean up the working copy */
-    aws_mem_release(allocator, hostname_copy);
-
-    if (!*region_str) {
-        return aws_raise_error(AWS_ERROR_OOM);
-    }
-
-    return AWS_OP_SUCCESS;
-}
-
-/* Helper function to load credentials from a credentials provider */
-static int s_load_credentials(
-    struct aws_credentials_provider *credentials_provider,
-    struct aws_credentials **out_credentials) {
-
-    struct aws_credentials_callback_state creds_state;
-    if (s_aws_credentials_callback_state_init(&creds_state) != AWS_OP_SUCCESS) {
+    struct aws_byte_cursor region;
+    if (aws_dsql_auth_hostname_parse_region(aws_byte_cursor_from_c_str(hostname), &region)) {
         return AWS_OP_ERR;
     }
 
-    if (aws_credentials_provider_get_credentials(credentials_provider, s_on_get_credentials_complete, &creds_state)) {
-        s_aws_credentials_callback_state_clean_up(&creds_state);
+    *region_str = aws_string_new_from_cursor(allocator, &region);
+    if (!*region_str) {
         return AWS_OP_ERR;
     }
 
-    /* Wait for credentials to be retrieved */
-    aws_mutex_lock(&creds_state.mutex);
-    if (!creds_state.is_complete) {
-        aws_condition_variable_wait_pred(
-            &creds_state.condition_var, &creds_state.mutex, s_is_credentials_complete, &creds_state);
-    }
-    aws_mutex_unlock(&creds_state.mutex);
-
-    /* Check if credentials were successfully retrieved */
-    if (creds_state.error_code != AWS_ERROR_SUCCESS || !creds_state.credentials) {
-        int error_code = creds_state.error_code ? creds_state.error_code : AWS_ERROR_INVALID_STATE;
-        s_aws_credentials_callback_state_clean_up(&creds_state);
-        return aws_raise_error(error_code);
-    }
-
-    *out_credentials = creds_state.credentials;
-    creds_state.credentials = NULL; /* Transfer ownership to out_credentials */
-
-    /* Clean up resources, but don't release the credentials as they're now owned by the caller */
-    s_aws_credentials_callback_state_clean_up(&creds_state);
-
     return AWS_OP_SUCCESS;
 }
 
@@ -363,11 +213,11 @@ static int s_validate_token_config(const struct aws_dsql_auth_config *config) {
 /**
  * Helper to get the current time from the system or configuration.
  */
-static int s_get_current_time(const struct aws_dsql_auth_config *config, uint64_t *out_time_ms) {
+static int s_get_current_time(aws_io_clock_fn *system_clock_fn, uint64_t *out_time_ms) {
     uint64_t current_time_ns = 0;
 
-    if (config->system_clock_fn) {
-        if (config->system_clock_fn(&current_time_ns)) {
+    if (system_clock_fn) {
+        if (system_clock_fn(&current_time_ns)) {
             return AWS_OP_ERR;
         }
     } else {
@@ -381,326 +231,1435 @@ static int s_get_current_time(const struct aws_dsql_auth_config *config, uint64_
     return AWS_OP_SUCCESS;
 }
 
-/* Type definitions to avoid similar parameter types */
-typedef const char *action_name_t;
-typedef const char *hostname_t;
+static struct aws_byte_cursor s_action_for(bool is_admin) {
+    return aws_byte_cursor_from_c_str(is_admin ? ACTION_DB_CONNECT_ADMIN : ACTION_DB_CONNECT);
+}
+
+/* Record when a token signed at signing_time_secs was issued and when it expires */
+static void s_set_token_times(struct aws_dsql_auth_token *token, uint64_t signing_time_secs, uint64_t expires_in) {
+    token->issued_at_secs = signing_time_secs;
+    token->expires_at_secs = signing_time_secs + (expires_in ? expires_in : DEFAULT_EXPIRES_IN);
+}
 
 /**
- * Helper to create and configure an HTTP request for signing.
- *
- * @param allocator The allocator to use
- * @param api_action The action to include in the URL query parameter
- * @param host_name The hostname to set in the Host header
- * @param out_request Output parameter to receive the created HTTP request
+ * Stage timings of one generation, taken only for an observer, which is called when the generation finishes. The
+ * credentials stage also feeds the library metrics, so it is timed either way.
  */
-static int s_create_http_request(
-    struct aws_allocator *allocator,
-    action_name_t api_action, /* Using type definition to avoid similar parameter types */
-    hostname_t host_name,     /* Using type definition to avoid similar parameter types */
-    struct aws_http_message **out_request) {
+struct aws_dsql_auth_stats_timer {
+    aws_dsql_auth_on_generation_stats_fn *on_stats;
+    void *user_data;
+    struct aws_dsql_auth_generation_stats stats;
 
-    /* Create an HTTP request for signing */
-    struct aws_http_message *request = aws_http_message_new_request(allocator);
-    if (!request) {
-        return AWS_OP_ERR;
+    /* Tokens the timed generation produces; a pair reports the same stats for both of its tokens */
+    size_t token_count;
+
+    uint64_t started_at_ns;
+    uint64_t stage_started_at_ns;
+};
+
+static void s_stats_timer_init(
+    struct aws_dsql_auth_stats_timer *timer,
+    aws_dsql_auth_on_generation_stats_fn *on_stats,
+    void *user_data) {
+
+    AWS_ZERO_STRUCT(*timer);
+    timer->on_stats = on_stats;
+    timer->user_data = user_data;
+    timer->token_count = 1;
+    if (on_stats) {
+        aws_high_res_clock_get_ticks(&timer->started_at_ns);
+        timer->stage_started_at_ns = timer->started_at_ns;
     }
+}
 
-    /* Set the request method to GET */
-    if (aws_http_message_set_request_method(request, aws_byte_cursor_from_c_str("GET"))) {
-        aws_http_message_release(request);
-        return AWS_OP_ERR;
+/* End the current stage, charging its time to stage_ns, and start the next one */
+static void s_stats_timer_end_stage(struct aws_dsql_auth_stats_timer *timer, uint64_t *stage_ns) {
+    if (!timer->on_stats) {
+        return;
     }
 
-    /* Set the request path to the URL path and query string */
-    char path_buffer[1024];
-    snprintf(path_buffer, sizeof(path_buffer), "/?Action=%s", api_action);
-    if (aws_http_message_set_request_path(request, aws_byte_cursor_from_c_str(path_buffer))) {
-        aws_http_message_release(request);
-        return AWS_OP_ERR;
+    uint64_t now_ns = 0;
+    aws_high_res_clock_get_ticks(&now_ns);
+    *stage_ns += now_ns - timer->stage_started_at_ns;
+    timer->stage_started_at_ns = now_ns;
+}
+
+/* Start the credentials stage; with an observer the stage that ended last already did */
+static void s_stats_timer_start_credentials(struct aws_dsql_auth_stats_timer *timer) {
+    if (!timer->on_stats) {
+        aws_high_res_clock_get_ticks(&timer->stage_started_at_ns);
     }
+}
 
-    /* Add Host header which is required for signing */
-    struct aws_http_header host_header = {
-        .name = aws_byte_cursor_from_c_str("Host"), .value = aws_byte_cursor_from_c_str(host_name)};
+/* End the credentials stage, recording the fetch in the library metrics */
+static void s_stats_timer_end_credentials(struct aws_dsql_auth_stats_timer *timer, bool succeeded) {
+    uint64_t now_ns = 0;
+    aws_high_res_clock_get_ticks(&now_ns);
+    uint64_t credentials_ns = now_ns - timer->stage_started_at_ns;
+    timer->stage_started_at_ns = now_ns;
+    timer->stats.credentials_ns += credentials_ns;
+    aws_dsql_auth_metrics_record_credentials_fetch(credentials_ns, succeeded);
+}
 
-    if (aws_http_message_add_header(request, host_header)) {
-        aws_http_message_release(request);
-        return AWS_OP_ERR;
+static void s_stats_timer_report(struct aws_dsql_auth_stats_timer *timer, int error_code) {
+    aws_dsql_auth_metrics_add(
+        error_code == AWS_ERROR_SUCCESS ? AWS_DSQL_AUTH_METRIC_TOKENS_GENERATED
+                                        : AWS_DSQL_AUTH_METRIC_GENERATION_FAILURES,
+        timer->token_count);
+
+    if (!timer->on_stats) {
+        return;
     }
 
-    *out_request = request;
-    return AWS_OP_SUCCESS;
+    uint64_t now_ns = 0;
+    aws_high_res_clock_get_ticks(&now_ns);
+    timer->stats.total_ns = now_ns - timer->started_at_ns;
+    timer->stats.error_code = error_code;
+    for (size_t i = 0; i < timer->token_count; ++i) {
+        timer->on_stats(&timer->stats, timer->user_data);
+    }
 }
 
 /**
- * Initialize a signing userdata context.
- *
- * @param[in] allocator The allocator to use
- * @param[out] context The context to initialize
- * @param[in] request The HTTP request to associate with this context
- *
- * @return AWS_OP_SUCCESS if successful, AWS_OP_ERR otherwise
+ * Presign a token into a new aws_string. The token is presigned into scratch space, so the aws_string, from
+ * allocator, is the only allocation that outlives the call and the token is copied once. Every temporary comes from
+ * scratch_allocator.
  */
-static int s_aws_signing_userdata_init(
+static int s_presign_to_string(
     struct aws_allocator *allocator,
-    struct aws_signing_userdata *context,
-    struct aws_http_message *request) {
+    struct aws_allocator *scratch_allocator,
+    const struct aws_dsql_auth_presign_template *presign_template,
+    const struct aws_dsql_auth_presign_credentials *presign_credentials,
+    uint64_t signing_time_secs,
+    struct aws_dsql_auth_stats_timer *timer,
+    struct aws_string **out_token_string) {
 
-    AWS_ZERO_STRUCT(*context);
+    uint8_t scratch[TOKEN_SCRATCH_SIZE];
+    struct aws_byte_buf token_buf = aws_byte_buf_from_empty_array(scratch, sizeof(scratch));
 
-    if (aws_mutex_init(&context->mutex)) {
+    size_t token_len = 0;
+    if (aws_dsql_auth_presign_template_length(presign_template, presign_credentials, &token_len)) {
         return AWS_OP_ERR;
     }
-
-    if (aws_condition_variable_init(&context->condition_var)) {
-        aws_mutex_clean_up(&context->mutex);
+    if (token_len > sizeof(scratch) && aws_byte_buf_init(&token_buf, scratch_allocator, token_len)) {
         return AWS_OP_ERR;
     }
 
-    context->allocator = allocator;
-    context->request = request;
-    context->signing_result_code = 0;
-    context->is_signing_complete = false;
+    *out_token_string = NULL;
+    int result = aws_dsql_auth_presign_template_sign(
+        scratch_allocator, presign_template, presign_credentials, signing_time_secs, &token_buf);
+    if (result == AWS_OP_SUCCESS) {
+        s_stats_timer_end_stage(timer, &timer->stats.signing_ns);
+        *out_token_string = aws_string_new_from_buf(allocator, &token_buf);
+        s_stats_timer_end_stage(timer, &timer->stats.token_string_ns);
+    }
+    aws_byte_buf_clean_up(&token_buf);
 
-    return AWS_OP_SUCCESS;
+    return *out_token_string ? AWS_OP_SUCCESS : AWS_OP_ERR;
 }
 
 /**
- * Clean up resources associated with a signing userdata context.
- *
- * @param[in] context The context to clean up
+ * Presign a token into the remaining capacity of output without ever growing it.
  */
-static void s_aws_signing_userdata_clean_up(struct aws_signing_userdata *context) {
-    if (!context) {
-        return;
+static int s_presign_into_buf(
+    struct aws_allocator *allocator,
+    const struct aws_dsql_auth_presign_template *presign_template,
+    const struct aws_dsql_auth_presign_credentials *presign_credentials,
+    uint64_t signing_time_secs,
+    struct aws_dsql_auth_stats_timer *timer,
+    struct aws_byte_buf *output,
+    size_t *out_required_len) {
+
+    if (aws_dsql_auth_presign_template_length(presign_template, presign_credentials, out_required_len)) {
+        return AWS_OP_ERR;
     }
 
-    aws_condition_variable_clean_up(&context->condition_var);
-    aws_mutex_clean_up(&context->mutex);
+    /* A view over the remaining capacity with no allocator, so the presigner can never grow output */
+    size_t available = output->capacity - output->len;
+    struct aws_byte_buf view =
+        aws_byte_buf_from_empty_array(available ? output->buffer + output->len : NULL, available);
 
-    /* Note: We don't release the request here as that's managed by the caller */
+    if (aws_dsql_auth_presign_template_sign(
+            allocator, presign_template, presign_credentials, signing_time_secs, &view)) {
+        return AWS_OP_ERR;
+    }
+    s_stats_timer_end_stage(timer, &timer->stats.signing_ns);
 
-    AWS_ZERO_STRUCT(*context);
+    output->len += view.len;
+    return AWS_OP_SUCCESS;
 }
 
 /**
- * Helper to create a token string from a signed request.
+ * Presign a regular and an admin token in one pass from templates indexed by is_admin, and hand them to the caller's
+ * tokens, which are only changed if both succeed. As in s_presign_to_string, each token is presigned into scratch
+ * space and copied once into its aws_string from allocator.
  */
-static int s_create_token_string(
+static int s_presign_pair(
     struct aws_allocator *allocator,
-    const char *hostname,
-    struct aws_http_message *request,
-    struct aws_string **out_token_string) {
+    const struct aws_dsql_auth_presign_template templates[2],
+    const struct aws_dsql_auth_presign_credentials *presign_credentials,
+    uint64_t signing_time_secs,
+    uint64_t expires_in,
+    struct aws_dsql_auth_stats_timer *timer,
+    struct aws_dsql_auth_token *token,
+    struct aws_dsql_auth_token *admin_token) {
+
+    uint8_t scratch_storage[AWS_DSQL_AUTH_SCRATCH_SIZE];
+    struct aws_dsql_auth_scratch_allocator scratch;
+    struct aws_allocator *scratch_allocator =
+        aws_dsql_auth_scratch_allocator_init(&scratch, allocator, scratch_storage, sizeof(scratch_storage));
+
+    uint8_t token_scratch[2][TOKEN_SCRATCH_SIZE];
+    struct aws_byte_buf token_bufs[2];
+    struct aws_string *token_strings[2] = {NULL, NULL};
+    for (size_t i = 0; i < AWS_ARRAY_SIZE(token_bufs); ++i) {
+        token_bufs[i] = aws_byte_buf_from_empty_array(token_scratch[i], sizeof(token_scratch[i]));
+    }
 
-    /* Get the signed request path */
-    struct aws_byte_cursor path_cursor;
-    if (aws_http_message_get_request_path(request, &path_cursor) != AWS_OP_SUCCESS) {
-        return AWS_OP_ERR;
+    int result = AWS_OP_ERR;
+    for (size_t i = 0; i < AWS_ARRAY_SIZE(token_bufs); ++i) {
+        size_t token_len = 0;
+        if (aws_dsql_auth_presign_template_length(&templates[i], presign_credentials, &token_len)) {
+            goto done;
+        }
+        if (token_len > sizeof(token_scratch[i]) && aws_byte_buf_init(&token_bufs[i], scratch_allocator, token_len)) {
+            goto done;
+        }
     }
 
-    /* Create the complete token string: hostname + signed path */
-    size_t hostname_len = strlen(hostname);
-    size_t path_len = path_cursor.len;
-    size_t total_len = hostname_len + path_len;
+    if (aws_dsql_auth_presign_template_sign_pair(
+            scratch_allocator,
+            &templates[0],
+            &templates[1],
+            presign_credentials,
+            signing_time_secs,
+            &token_bufs[0],
+            &token_bufs[1])) {
+        goto done;
+    }
+    s_stats_timer_end_stage(timer, &timer->stats.signing_ns);
 
-    /* Create a buffer for the token string */
-    char *token_buffer = aws_mem_calloc(allocator, 1, total_len + 1); /* +1 for null terminator */
-    if (!token_buffer) {
-        return aws_raise_error(AWS_ERROR_OOM);
+    for (size_t i = 0; i < AWS_ARRAY_SIZE(token_strings); ++i) {
+        token_strings[i] = aws_string_new_from_buf(allocator, &token_bufs[i]);
+        if (!token_strings[i]) {
+            goto done;
+        }
     }
+    s_stats_timer_end_stage(timer, &timer->stats.token_string_ns);
 
-    /* Copy hostname and path to form the complete token */
-    memcpy(token_buffer, hostname, hostname_len);
-    memcpy(token_buffer + hostname_len, path_cursor.ptr, path_len);
+    aws_dsql_auth_token_clean_up(token);
+    token->token = token_strings[0];
+    s_set_token_times(token, signing_time_secs, expires_in);
 
-    /* Create the aws_string from our buffer */
-    *out_token_string = aws_string_new_from_c_str(allocator, token_buffer);
+    aws_dsql_auth_token_clean_up(admin_token);
+    admin_token->token = token_strings[1];
+    s_set_token_times(admin_token, signing_time_secs, expires_in);
 
-    /* Free the temporary buffer as it was copied into the aws_string */
-    aws_mem_release(allocator, token_buffer);
+    AWS_ZERO_ARRAY(token_strings);
+    result = AWS_OP_SUCCESS;
 
-    if (!*out_token_string) {
-        return aws_raise_error(AWS_ERROR_OOM);
+done:
+    for (size_t i = 0; i < AWS_ARRAY_SIZE(token_bufs); ++i) {
+        aws_string_destroy(token_strings[i]);
+        aws_byte_buf_clean_up(&token_bufs[i]);
     }
 
-    return AWS_OP_SUCCESS;
+    return result;
 }
 
 /**
- * Helper to create a signable from the request and sign it with AWS SigV4.
- *
- * @param allocator The allocator to use
- * @param request The HTTP request to sign
- * @param credentials The credentials to use for signing
- * @param region The AWS region for signing
- * @param expiration_in_seconds The expiration time for the signed request
- * @param date_time The current date time for signing
- *
- * @return AWS_OP_SUCCESS if successful, AWS_OP_ERR otherwise
+ * State for one asynchronous token generation. The hostname and region are copied into storage allocated with the
+ * state, so the caller's config does not need to outlive the call.
  */
-static int s_sign_request(
-    struct aws_allocator *allocator,
-    struct aws_http_message *request,
-    struct aws_credentials *credentials,
-    struct aws_string *region,
-    uint64_t expiration_in_seconds,
-    struct aws_date_time date_time) {
-
-    /* Create a signable from the request */
-    struct aws_signable *signable = aws_signable_new_http_request(allocator, request);
-    if (!signable) {
-        return AWS_OP_ERR;
-    }
+struct aws_dsql_auth_generate_state {
+    /* For the state and every temporary of the generation; a scratch allocator when the caller waits */
+    struct aws_allocator *allocator;
 
-    /* Set up the signing configuration */
-    struct aws_signing_config_aws signing_config;
-    AWS_ZERO_STRUCT(signing_config);
-    signing_config.config_type = AWS_SIGNING_CONFIG_AWS;
-    signing_config.algorithm = AWS_SIGNING_ALGORITHM_V4;
-    signing_config.signature_type = AWS_ST_HTTP_REQUEST_QUERY_PARAMS;
-    /* Ensure the region is correctly converted to a byte cursor */
-    signing_config.region = aws_byte_cursor_from_string(region);
-    signing_config.service = aws_byte_cursor_from_c_str(SERVICE_NAME);
-    signing_config.flags.use_double_uri_encode = false;
-    signing_config.flags.should_normalize_uri_path = true;
-    signing_config.credentials = credentials;
-    signing_config.expiration_in_seconds = expiration_in_seconds;
-    signing_config.date = date_time;
-
-    /* Set up the signing state */
-    struct aws_signing_userdata context;
-    int result = s_aws_signing_userdata_init(allocator, &context, request);
-    if (result != AWS_OP_SUCCESS) {
-        aws_signable_destroy(signable);
-        return result;
-    }
+    /* For the token handed to on_complete */
+    struct aws_allocator *token_allocator;
 
-    /* Sign the request */
-    if (aws_sign_request_aws(
-            allocator, signable, (struct aws_signing_config_base *)&signing_config, s_on_signing_complete, &context)) {
-        s_aws_signing_userdata_clean_up(&context);
-        aws_signable_destroy(signable);
-        return AWS_OP_ERR;
-    }
+    struct aws_byte_cursor hostname;
+    struct aws_byte_cursor region;
+    struct aws_credentials_provider *credentials_provider;
+    uint64_t expires_in;
+    uint64_t signing_time_secs;
+    bool is_admin;
 
-    /* Wait for signing to complete */
-    aws_mutex_lock(&context.mutex);
-    if (!context.is_signing_complete) {
-        aws_condition_variable_wait_pred(&context.condition_var, &context.mutex, s_is_signing_complete, &context);
-    }
-    aws_mutex_unlock(&context.mutex);
+    struct aws_credentials *credentials;
 
-    /* Check if signing was successful */
-    if (context.signing_result_code != AWS_ERROR_SUCCESS) {
-        s_aws_signing_userdata_clean_up(&context);
-        aws_signable_destroy(signable);
-        return aws_raise_error(context.signing_result_code);
-    }
+    struct aws_dsql_auth_stats_timer timer;
 
-    /* Clean up signing resources */
-    s_aws_signing_userdata_clean_up(&context);
-    aws_signable_destroy(signable);
+    /* The loop the generation runs on, or NULL to run on whichever thread drives it */
+    struct aws_event_loop *event_loop;
+    struct aws_task task;
 
-    return AWS_OP_SUCCESS;
-}
+    aws_dsql_auth_on_token_generated_fn *on_complete;
+    void *user_data;
+};
 
-int aws_dsql_auth_token_generate(
-    const struct aws_dsql_auth_config *config,
-    bool is_admin,
+static struct aws_dsql_auth_generate_state *s_aws_dsql_auth_generate_state_new(
     struct aws_allocator *allocator,
-    struct aws_dsql_auth_token *token) {
+    struct aws_allocator *token_allocator,
+    const char *hostname,
+    const struct aws_string *region,
+    uint64_t expires_in,
+    bool is_admin,
+    uint64_t signing_time_secs) {
 
-    int result;
+    size_t hostname_len = strlen(hostname);
+    size_t region_len = region->len;
 
-    /* Validate input parameters and initialize token if needed */
-    result = s_validate_token_config(config);
-    if (result != AWS_OP_SUCCESS) {
-        return result;
+    /* Trailing storage holds the NUL-terminated hostname followed by the region */
+    struct aws_dsql_auth_generate_state *state =
+        aws_mem_calloc(allocator, 1, sizeof(struct aws_dsql_auth_generate_state) + hostname_len + 1 + region_len);
+    if (!state) {
+        return NULL;
     }
 
-    const char *action = is_admin ? ACTION_DB_CONNECT_ADMIN : ACTION_DB_CONNECT;
+    uint8_t *storage = (uint8_t *)(state + 1);
+    memcpy(storage, hostname, hostname_len);
+    memcpy(storage + hostname_len + 1, aws_string_bytes(region), region_len);
 
-    /* Get the current time */
-    uint64_t current_time_ms;
-    if (s_get_current_time(config, &current_time_ms) != AWS_OP_SUCCESS) {
-        return AWS_OP_ERR;
-    }
+    state->allocator = allocator;
+    state->token_allocator = token_allocator;
+    state->hostname = aws_byte_cursor_from_array(storage, hostname_len);
+    state->region = aws_byte_cursor_from_array(storage + hostname_len + 1, region_len);
+    state->expires_in = expires_in;
+    state->signing_time_secs = signing_time_secs;
+    state->is_admin = is_admin;
 
-    /* Initialize the date with the current time */
-    struct aws_date_time date_time;
-    aws_date_time_init_epoch_millis(&date_time, current_time_ms);
+    return state;
+}
 
-    /* Get credentials from the provider */
-    struct aws_credentials *credentials = NULL;
-    result = s_load_credentials(config->credentials_provider, &credentials);
-    if (result != AWS_OP_SUCCESS) {
-        return result;
+static void s_aws_dsql_auth_generate_state_destroy(struct aws_dsql_auth_generate_state *state) {
+    if (state->credentials) {
+        aws_credentials_release(state->credentials);
     }
-
-    /* Create an HTTP request for signing */
-    struct aws_http_message *request = NULL;
-    result = s_create_http_request(allocator, action, config->hostname, &request);
-    if (result != AWS_OP_SUCCESS) {
-        aws_credentials_release(credentials);
-        return result;
+    if (state->credentials_provider) {
+        aws_credentials_provider_release(state->credentials_provider);
     }
 
-    /* Create a signable and sign the request */
-    result = s_sign_request(allocator, request, credentials, config->region, config->expires_in, date_time);
+    aws_mem_release(state->allocator, state);
+}
 
-    if (result != AWS_OP_SUCCESS) {
-        aws_http_message_release(request);
-        aws_credentials_release(credentials);
-        return result;
+/**
+ * Finish a generation: invoke the user callback and release everything the generation held.
+ *
+ * @param[in] state The generation state, destroyed by this call before the callback runs
+ * @param[in] token_string The generated token string or NULL on failure, cleaned up after the callback returns
+ * @param[in] error_code AWS_ERROR_SUCCESS or the error that caused the generation to fail
+ */
+static void s_complete_generation(
+    struct aws_dsql_auth_generate_state *state,
+    struct aws_string *token_string,
+    int error_code) {
+
+    struct aws_dsql_auth_token token = {.token = token_string};
+    s_set_token_times(&token, state->signing_time_secs, state->expires_in);
+    aws_dsql_auth_on_token_generated_fn *on_complete = state->on_complete;
+    void *user_data = state->user_data;
+    struct aws_dsql_auth_stats_timer timer = state->timer;
+
+    /* The state may live in scratch space of a waiting caller, so it is gone before the caller is woken */
+    s_aws_dsql_auth_generate_state_destroy(state);
+
+    /* Before the callback, since a waiting caller may return as soon as it runs */
+    s_stats_timer_report(&timer, error_code);
+
+    on_complete(token_string ? &token : NULL, error_code, user_data);
+
+    aws_dsql_auth_token_clean_up(&token);
+}
+
+/**
+ * Presign the token once the generation holds credentials.
+ * Always finishes through s_complete_generation, on failure as well as on success.
+ */
+static void s_start_signing(struct aws_dsql_auth_generate_state *state) {
+    struct aws_dsql_auth_presign_template presign_template;
+    if (aws_dsql_auth_presign_template_init(
+            &presign_template, state->hostname, state->region, s_action_for(state->is_admin), state->expires_in)) {
+        s_complete_generation(state, NULL, aws_last_error());
+        return;
     }
+    s_stats_timer_end_stage(&state->timer, &state->timer.stats.request_ns);
+
+    struct aws_dsql_auth_presign_credentials presign_credentials;
+    aws_dsql_auth_presign_credentials_init(&presign_credentials, state->credentials, NULL);
 
-    /* Create the token string */
     struct aws_string *token_string = NULL;
-    result = s_create_token_string(allocator, config->hostname, request, &token_string);
+    int result = s_presign_to_string(
+        state->token_allocator,
+        state->allocator,
+        &presign_template,
+        &presign_credentials,
+        state->signing_time_secs,
+        &state->timer,
+        &token_string);
+    aws_dsql_auth_presign_credentials_clean_up(&presign_credentials);
+
+    s_complete_generation(state, token_string, result == AWS_OP_SUCCESS ? AWS_ERROR_SUCCESS : aws_last_error());
+}
 
-    /* Clean up resources we no longer need */
-    aws_http_message_release(request);
-    aws_credentials_release(credentials);
+static void s_signing_task(struct aws_task *task, void *arg, enum aws_task_status status) {
+    (void)task;
+    struct aws_dsql_auth_generate_state *state = arg;
 
-    if (result != AWS_OP_SUCCESS) {
-        return result;
+    if (status == AWS_TASK_STATUS_CANCELED) {
+        s_complete_generation(state, NULL, AWS_IO_EVENT_LOOP_SHUTDOWN);
+        return;
     }
 
-    /* Clean up existing token if there is one */
-    if (token->token != NULL) {
-        aws_string_destroy(token->token);
+    s_start_signing(state);
+}
+
+/* Callback for when credentials are retrieved */
+static void s_on_get_credentials_complete(struct aws_credentials *credentials, int error_code, void *userdata) {
+    struct aws_dsql_auth_generate_state *state = userdata;
+
+    s_stats_timer_end_credentials(&state->timer, error_code == AWS_ERROR_SUCCESS && credentials);
+
+    /* Check if credentials were successfully retrieved */
+    if (error_code != AWS_ERROR_SUCCESS || !credentials) {
+        s_complete_generation(state, NULL, error_code ? error_code : AWS_ERROR_INVALID_STATE);
+        return;
     }
 
-    token->token = token_string;
+    state->credentials = credentials;
+    aws_credentials_acquire(credentials);
 
-    return AWS_OP_SUCCESS;
+    /* Credentials that arrive on the provider's own thread are handed back to the generation's loop to be signed */
+    if (state->event_loop && !aws_event_loop_thread_is_callers_thread(state->event_loop)) {
+        aws_task_init(&state->task, s_signing_task, state, "dsql_auth_sign_token");
+        aws_event_loop_schedule_task_now(state->event_loop, &state->task);
+        return;
+    }
+
+    s_start_signing(state);
 }
 
-void aws_dsql_auth_token_clean_up(struct aws_dsql_auth_token *token) {
-    if (!token) {
+static void s_get_credentials_task(struct aws_task *task, void *arg, enum aws_task_status status) {
+    (void)task;
+    struct aws_dsql_auth_generate_state *state = arg;
+
+    if (status == AWS_TASK_STATUS_CANCELED) {
+        s_complete_generation(state, NULL, AWS_IO_EVENT_LOOP_SHUTDOWN);
         return;
     }
 
-    if (token->token) {
-        /* Destroy the aws_string which frees both the structure and its string data */
-        aws_string_destroy(token->token);
-        token->token = NULL;
+    if (aws_credentials_provider_get_credentials(state->credentials_provider, s_on_get_credentials_complete, state)) {
+        s_complete_generation(state, NULL, aws_last_error());
     }
-
-    AWS_ZERO_STRUCT(*token);
 }
 
-void aws_dsql_auth_module_clean_up(struct aws_allocator *allocator) {
-    /* Nothing to clean up */
-    (void)allocator;
+/* Pick the loop of the group a generation runs on, so that every token of a cluster and action shares one loop */
+static struct aws_event_loop *s_event_loop_for(
+    struct aws_event_loop_group *event_loop_group,
+    const char *hostname,
+    bool is_admin) {
+
+    uint64_t hash = aws_hash_combine(aws_hash_c_string(hostname), is_admin ? 1 : 0);
+    return aws_event_loop_group_get_loop_at(
+        event_loop_group, (size_t)(hash % aws_event_loop_group_get_loop_count(event_loop_group)));
 }
 
-const char *aws_dsql_auth_token_get_str(const struct aws_dsql_auth_token *token) {
-    if (!token || !token->token) {
-        return NULL;
+/**
+ * Start a generation whose state and temporaries come from scratch_allocator and whose token comes from allocator.
+ * With an event loop group the generation is scheduled on one of its loops, otherwise it starts on this thread.
+ */
+static int s_token_generate_async(
+    const struct aws_dsql_auth_config *config,
+    bool is_admin,
+    struct aws_allocator *allocator,
+    struct aws_allocator *scratch_allocator,
+    struct aws_event_loop_group *event_loop_group,
+    aws_dsql_auth_on_token_generated_fn *on_complete,
+    void *user_data) {
+
+    if (!on_complete) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
     }
 
-    return aws_string_c_str(token->token);
+    /* Validate input parameters */
+    if (s_validate_token_config(config) != AWS_OP_SUCCESS) {
+        return AWS_OP_ERR;
+    }
+
+    struct aws_dsql_auth_stats_timer timer;
+    s_stats_timer_init(&timer, config->on_generation_stats, config->on_generation_stats_user_data);
+
+    /* Get the current time */
+    uint64_t current_time_ms;
+    if (s_get_current_time(config->system_clock_fn, &current_time_ms) != AWS_OP_SUCCESS) {
+        goto on_error;
+    }
+
+    struct aws_dsql_auth_generate_state *state = s_aws_dsql_auth_generate_state_new(
+        scratch_allocator,
+        allocator,
+        config->hostname,
+        config->region,
+        config->expires_in,
+        is_admin,
+        current_time_ms / 1000);
+    if (!state) {
+        goto on_error;
+    }
+
+    state->credentials_provider = aws_credentials_provider_acquire(config->credentials_provider);
+    state->on_complete = on_complete;
+    state->user_data = user_data;
+    state->timer = timer;
+    s_stats_timer_start_credentials(&state->timer);
+
+    if (event_loop_group && aws_event_loop_group_get_loop_count(event_loop_group) > 0) {
+        state->event_loop = s_event_loop_for(event_loop_group, config->hostname, is_admin);
+        aws_task_init(&state->task, s_get_credentials_task, state, "dsql_auth_get_credentials");
+        aws_event_loop_schedule_task_now(state->event_loop, &state->task);
+        return AWS_OP_SUCCESS;
+    }
+
+    /* Get credentials from the provider; the rest of the generation continues from the callback */
+    if (aws_credentials_provider_get_credentials(config->credentials_provider, s_on_get_credentials_complete, state)) {
+        s_aws_dsql_auth_generate_state_destroy(state);
+        goto on_error;
+    }
+
+    return AWS_OP_SUCCESS;
+
+on_error:
+    s_stats_timer_report(&timer, aws_last_error());
+    return AWS_OP_ERR;
+}
+
+int aws_dsql_auth_token_generate_async(
+    const struct aws_dsql_auth_config *config,
+    bool is_admin,
+    struct aws_allocator *allocator,
+    aws_dsql_auth_on_token_generated_fn *on_complete,
+    void *user_data) {
+
+    if (!config) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    /* The generation outlives this call, so its state cannot live in scratch space */
+    return s_token_generate_async(
+        config, is_admin, allocator, allocator, config->event_loop_group, on_complete, user_data);
+}
+
+/* Structure to wait on asynchronous credentials retrieval or generation from the synchronous APIs */
+struct aws_dsql_auth_wait_state {
+    struct aws_mutex mutex;
+    struct aws_condition_variable condition_var;
+    struct aws_credentials *credentials;
+    struct aws_dsql_auth_token token;
+    int error_code;
+    bool is_complete;
+};
+
+static int s_aws_dsql_auth_wait_state_init(struct aws_dsql_auth_wait_state *wait_state) {
+    AWS_ZERO_STRUCT(*wait_state);
+
+    if (aws_mutex_init(&wait_state->mutex)) {
+        return AWS_OP_ERR;
+    }
+
+    if (aws_condition_variable_init(&wait_state->condition_var)) {
+        aws_mutex_clean_up(&wait_state->mutex);
+        return AWS_OP_ERR;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+static void s_aws_dsql_auth_wait_state_clean_up(struct aws_dsql_auth_wait_state *wait_state) {
+    if (wait_state->credentials) {
+        aws_credentials_release(wait_state->credentials);
+    }
+    aws_dsql_auth_token_clean_up(&wait_state->token);
+
+    aws_condition_variable_clean_up(&wait_state->condition_var);
+    aws_mutex_clean_up(&wait_state->mutex);
+
+    AWS_ZERO_STRUCT(*wait_state);
+}
+
+/* Helper function for condition variable predicate */
+static bool s_is_wait_complete(void *userdata) {
+    struct aws_dsql_auth_wait_state *wait_state = userdata;
+    return wait_state->is_complete;
+}
+
+/**
+ * Block until the pending operation completes, then re-arm the wait state for the next one.
+ *
+ * @return AWS_OP_SUCCESS if the operation succeeded, AWS_OP_ERR with its error raised otherwise
+ */
+static int s_wait_for_completion(struct aws_dsql_auth_wait_state *wait_state) {
+    aws_mutex_lock(&wait_state->mutex);
+    aws_condition_variable_wait_pred(&wait_state->condition_var, &wait_state->mutex, s_is_wait_complete, wait_state);
+    wait_state->is_complete = false;
+    aws_mutex_unlock(&wait_state->mutex);
+
+    if (wait_state->error_code != AWS_ERROR_SUCCESS) {
+        return aws_raise_error(wait_state->error_code);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Callback for when a generation started by a synchronous API is complete */
+static void s_on_sync_generate_complete(struct aws_dsql_auth_token *token, int error_code, void *user_data) {
+    struct aws_dsql_auth_wait_state *wait_state = user_data;
+
+    aws_mutex_lock(&wait_state->mutex);
+
+    /* Move the token out so it survives the callback */
+    if (token) {
+        wait_state->token = *token;
+        AWS_ZERO_STRUCT(*token);
+    }
+    wait_state->error_code = error_code;
+    wait_state->is_complete = true;
+
+    aws_condition_variable_notify_one(&wait_state->condition_var);
+    aws_mutex_unlock(&wait_state->mutex);
+}
+
+/* Callback for when credentials requested by a synchronous API are retrieved */
+static void s_on_sync_get_credentials_complete(struct aws_credentials *credentials, int error_code, void *userdata) {
+    struct aws_dsql_auth_wait_state *wait_state = userdata;
+
+    aws_mutex_lock(&wait_state->mutex);
+
+    wait_state->credentials = credentials;
+    if (credentials) {
+        aws_credentials_acquire(credentials);
+    }
+    wait_state->error_code = error_code;
+    if (error_code == AWS_ERROR_SUCCESS && !credentials) {
+        wait_state->error_code = AWS_ERROR_INVALID_STATE;
+    }
+    wait_state->is_complete = true;
+
+    aws_condition_variable_notify_one(&wait_state->condition_var);
+    aws_mutex_unlock(&wait_state->mutex);
+}
+
+/* Move the token held by the wait state into the caller's token, replacing any token it already holds */
+static void s_move_token_out(struct aws_dsql_auth_wait_state *wait_state, struct aws_dsql_auth_token *token) {
+    /* Clean up existing token if there is one */
+    if (token->token != NULL) {
+        aws_string_destroy(token->token);
+    }
+
+    *token = wait_state->token;
+    AWS_ZERO_STRUCT(wait_state->token);
+}
+
+/* Retrieve credentials from the provider and wait for them; on success they are held by the wait state */
+static int s_get_credentials_sync(
+    struct aws_credentials_provider *credentials_provider,
+    struct aws_dsql_auth_wait_state *wait_state) {
+
+    if (aws_credentials_provider_get_credentials(
+            credentials_provider, s_on_sync_get_credentials_complete, wait_state)) {
+        return AWS_OP_ERR;
+    }
+
+    return s_wait_for_completion(wait_state);
+}
+
+int aws_dsql_auth_token_generate(
+    const struct aws_dsql_auth_config *config,
+    bool is_admin,
+    struct aws_allocator *allocator,
+    struct aws_dsql_auth_token *token) {
+
+    struct aws_dsql_auth_wait_state wait_state;
+    if (s_aws_dsql_auth_wait_state_init(&wait_state)) {
+        return AWS_OP_ERR;
+    }
+
+    /* This call waits for the generation, so its temporaries can live on this stack; only the token is allocated */
+    uint8_t scratch_storage[AWS_DSQL_AUTH_SCRATCH_SIZE];
+    struct aws_dsql_auth_scratch_allocator scratch;
+    struct aws_allocator *scratch_allocator =
+        aws_dsql_auth_scratch_allocator_init(&scratch, allocator, scratch_storage, sizeof(scratch_storage));
+
+    /* The caller waits anyway, so the generation runs on its thread rather than being handed to the event loop group */
+    int result = s_token_generate_async(
+        config, is_admin, allocator, scratch_allocator, NULL, s_on_sync_generate_complete, &wait_state);
+
+    if (result == AWS_OP_SUCCESS) {
+        result = s_wait_for_completion(&wait_state);
+    }
+
+    if (result == AWS_OP_SUCCESS) {
+        s_move_token_out(&wait_state, token);
+    }
+
+    s_aws_dsql_auth_wait_state_clean_up(&wait_state);
+
+    return result;
+}
+
+int aws_dsql_auth_token_generate_into_buf(
+    const struct aws_dsql_auth_config *config,
+    bool is_admin,
+    struct aws_allocator *allocator,
+    struct aws_byte_buf *output,
+    size_t *out_required_len) {
+
+    if (!output || !out_required_len) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    if (s_validate_token_config(config) != AWS_OP_SUCCESS) {
+        return AWS_OP_ERR;
+    }
+
+    struct aws_dsql_auth_stats_timer timer;
+    s_stats_timer_init(&timer, config->on_generation_stats, config->on_generation_stats_user_data);
+
+    uint64_t current_time_ms;
+    struct aws_dsql_auth_presign_template presign_template;
+    struct aws_dsql_auth_wait_state wait_state;
+
+    int result = s_get_current_time(config->system_clock_fn, &current_time_ms);
+    if (result == AWS_OP_SUCCESS) {
+        result = aws_dsql_auth_presign_template_init(
+            &presign_template,
+            aws_byte_cursor_from_c_str(config->hostname),
+            aws_byte_cursor_from_string(config->region),
+            s_action_for(is_admin),
+            config->expires_in);
+    }
+    if (result == AWS_OP_SUCCESS) {
+        s_stats_timer_end_stage(&timer, &timer.stats.request_ns);
+        result = s_aws_dsql_auth_wait_state_init(&wait_state);
+    }
+    if (result != AWS_OP_SUCCESS) {
+        s_stats_timer_report(&timer, aws_last_error());
+        return AWS_OP_ERR;
+    }
+
+    s_stats_timer_start_credentials(&timer);
+    result = s_get_credentials_sync(config->credentials_provider, &wait_state);
+    s_stats_timer_end_credentials(&timer, result == AWS_OP_SUCCESS);
+
+    if (result == AWS_OP_SUCCESS) {
+        uint8_t scratch_storage[AWS_DSQL_AUTH_SCRATCH_SIZE];
+        struct aws_dsql_auth_scratch_allocator scratch;
+        struct aws_dsql_auth_presign_credentials presign_credentials;
+        aws_dsql_auth_presign_credentials_init(&presign_credentials, wait_state.credentials, NULL);
+        result = s_presign_into_buf(
+            aws_dsql_auth_scratch_allocator_init(&scratch, allocator, scratch_storage, sizeof(scratch_storage)),
+            &presign_template,
+            &presign_credentials,
+            current_time_ms / 1000,
+            &timer,
+            output,
+            out_required_len);
+        aws_dsql_auth_presign_credentials_clean_up(&presign_credentials);
+    }
+
+    s_stats_timer_report(&timer, result == AWS_OP_SUCCESS ? AWS_ERROR_SUCCESS : aws_last_error());
+    s_aws_dsql_auth_wait_state_clean_up(&wait_state);
+
+    return result;
+}
+
+int aws_dsql_auth_token_generate_into_c_str(
+    const struct aws_dsql_auth_config *config,
+    bool is_admin,
+    struct aws_allocator *allocator,
+    char *buffer,
+    size_t buffer_size,
+    size_t *out_token_len) {
+
+    if ((!buffer && buffer_size > 0) || !out_token_len) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    /* Keep the last byte back for the terminator */
+    struct aws_byte_buf output = aws_byte_buf_from_empty_array(buffer, buffer_size > 0 ? buffer_size - 1 : 0);
+    if (aws_dsql_auth_token_generate_into_buf(config, is_admin, allocator, &output, out_token_len)) {
+        return AWS_OP_ERR;
+    }
+
+    buffer[output.len] = '\0';
+    return AWS_OP_SUCCESS;
+}
+
+/* Report a batch entry that failed on its own, with no stage timings of its own */
+static void s_report_batch_entry_failure(const struct aws_dsql_auth_config *config, int error_code) {
+    struct aws_dsql_auth_stats_timer timer;
+    s_stats_timer_init(&timer, config->on_generation_stats, config->on_generation_stats_user_data);
+    s_stats_timer_report(&timer, error_code);
+}
+
+/* Set the error of every entry of a group that failed as a whole and report it */
+static void s_fail_batch_group(
+    struct aws_dsql_auth_token_batch_entry *entries,
+    const size_t *indices,
+    size_t count,
+    struct aws_dsql_auth_stats_timer *timer,
+    int error_code) {
+
+    for (size_t i = 0; i < count; ++i) {
+        entries[indices ? indices[i] : i].error_code = error_code;
+    }
+    s_stats_timer_report(timer, error_code);
+}
+
+/**
+ * Generate the tokens of up to AWS_DSQL_AUTH_PRESIGN_BATCH_MAX batch entries in one pass of the batch presigner,
+ * setting each entry's error_code. The templates and the signing temporaries live in scratch space, and the tokens
+ * are presigned side by side into one scratch buffer for the group, each copied once into its aws_string as in
+ * s_presign_to_string.
+ *
+ * @return Whether the timer was reported, for every token the group signed; a group with nothing to sign leaves it
+ */
+static bool s_generate_batch_group(
+    const struct aws_dsql_auth_config *config,
+    struct aws_dsql_auth_token_batch_entry *entries,
+    struct aws_dsql_auth_token *tokens,
+    size_t count,
+    const struct aws_dsql_auth_presign_credentials *presign_credentials,
+    uint64_t signing_time_secs,
+    struct aws_dsql_auth_stats_timer *timer,
+    struct aws_allocator *allocator) {
+
+    uint8_t scratch_storage[BATCH_SCRATCH_SIZE];
+    struct aws_dsql_auth_scratch_allocator scratch;
+    struct aws_allocator *scratch_allocator =
+        aws_dsql_auth_scratch_allocator_init(&scratch, allocator, scratch_storage, sizeof(scratch_storage));
+
+    struct aws_dsql_auth_presign_template *templates =
+        aws_mem_calloc(scratch_allocator, count, sizeof(struct aws_dsql_auth_presign_template));
+    if (!templates) {
+        s_fail_batch_group(entries, NULL, count, timer, aws_last_error());
+        return true;
+    }
+
+    /* The entries with a template, which are signed together */
+    const struct aws_dsql_auth_presign_template *group_templates[AWS_DSQL_AUTH_PRESIGN_BATCH_MAX];
+    size_t group_indices[AWS_DSQL_AUTH_PRESIGN_BATCH_MAX];
+    size_t group_count = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        struct aws_dsql_auth_token_batch_entry *entry = &entries[i];
+        if (!entry->hostname || !entry->region) {
+            entry->error_code = AWS_ERROR_INVALID_ARGUMENT;
+            continue;
+        }
+
+        struct aws_dsql_auth_presign_template *presign_template = &templates[group_count];
+        if (aws_dsql_auth_presign_template_init(
+                presign_template,
+                aws_byte_cursor_from_c_str(entry->hostname),
+                aws_byte_cursor_from_string(entry->region),
+                s_action_for(entry->is_admin),
+                config->expires_in)) {
+            entry->error_code = aws_last_error();
+            s_report_batch_entry_failure(config, entry->error_code);
+            continue;
+        }
+
+        group_templates[group_count] = presign_template;
+        group_indices[group_count] = i;
+        ++group_count;
+    }
+
+    if (group_count == 0) {
+        aws_mem_release(scratch_allocator, templates);
+        return false;
+    }
+    s_stats_timer_end_stage(timer, &timer->stats.request_ns);
+    timer->token_count = group_count;
+
+    struct aws_byte_buf group_buf;
+    AWS_ZERO_STRUCT(group_buf);
+    struct aws_byte_buf token_bufs[AWS_DSQL_AUTH_PRESIGN_BATCH_MAX];
+    size_t token_lens[AWS_DSQL_AUTH_PRESIGN_BATCH_MAX];
+    size_t total_len = 0;
+
+    int result = AWS_OP_SUCCESS;
+    for (size_t i = 0; i < group_count && result == AWS_OP_SUCCESS; ++i) {
+        result = aws_dsql_auth_presign_template_length(group_templates[i], presign_credentials, &token_lens[i]);
+        total_len += token_lens[i];
+    }
+    if (result == AWS_OP_SUCCESS) {
+        result = aws_byte_buf_init(&group_buf, scratch_allocator, total_len);
+    }
+    if (result == AWS_OP_SUCCESS) {
+        /* Fixed views into the group buffer, one exactly the size of each token */
+        size_t offset = 0;
+        for (size_t i = 0; i < group_count; ++i) {
+            token_bufs[i] = aws_byte_buf_from_empty_array(group_buf.buffer + offset, token_lens[i]);
+            offset += token_lens[i];
+        }
+        result = aws_dsql_auth_presign_template_sign_batch(
+            scratch_allocator, group_templates, group_count, presign_credentials, signing_time_secs, token_bufs);
+    }
+
+    if (result != AWS_OP_SUCCESS) {
+        s_fail_batch_group(entries, group_indices, group_count, timer, aws_last_error());
+        aws_byte_buf_clean_up(&group_buf);
+        aws_mem_release(scratch_allocator, templates);
+        return true;
+    }
+    s_stats_timer_end_stage(timer, &timer->stats.signing_ns);
+
+    size_t generated_count = 0;
+    for (size_t i = 0; i < group_count; ++i) {
+        struct aws_dsql_auth_token_batch_entry *entry = &entries[group_indices[i]];
+        struct aws_string *token_string = aws_string_new_from_buf(allocator, &token_bufs[i]);
+        if (!token_string) {
+            entry->error_code = aws_last_error();
+            s_report_batch_entry_failure(config, entry->error_code);
+            continue;
+        }
+
+        struct aws_dsql_auth_token *token = &tokens[group_indices[i]];
+        aws_dsql_auth_token_clean_up(token);
+        token->token = token_string;
+        s_set_token_times(token, signing_time_secs, config->expires_in);
+        entry->error_code = AWS_ERROR_SUCCESS;
+        ++generated_count;
+    }
+    s_stats_timer_end_stage(timer, &timer->stats.token_string_ns);
+
+    timer->token_count = generated_count;
+    s_stats_timer_report(timer, AWS_ERROR_SUCCESS);
+    aws_byte_buf_clean_up(&group_buf);
+    aws_mem_release(scratch_allocator, templates);
+    return true;
+}
+
+int aws_dsql_auth_token_generate_batch(
+    const struct aws_dsql_auth_config *config,
+    struct aws_dsql_auth_token_batch_entry *entries,
+    struct aws_dsql_auth_token *tokens,
+    size_t count,
+    struct aws_allocator *allocator) {
+
+    if (!config || (count > 0 && (!entries || !tokens))) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    /* Fail fast if credentials provider is not set */
+    if (!config->credentials_provider) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    /* Nothing to sign, so no reason to go to the credentials provider */
+    if (count == 0) {
+        return AWS_OP_SUCCESS;
+    }
+
+    struct aws_dsql_auth_wait_state wait_state;
+    if (s_aws_dsql_auth_wait_state_init(&wait_state)) {
+        return AWS_OP_ERR;
+    }
+
+    struct aws_dsql_auth_stats_timer timer;
+    s_stats_timer_init(&timer, config->on_generation_stats, config->on_generation_stats_user_data);
+
+    /* Every entry is signed with the same date and the same credentials */
+    uint64_t current_time_ms;
+    int result = s_get_current_time(config->system_clock_fn, &current_time_ms);
+
+    if (result == AWS_OP_SUCCESS) {
+        s_stats_timer_start_credentials(&timer);
+        result = s_get_credentials_sync(config->credentials_provider, &wait_state);
+        s_stats_timer_end_credentials(&timer, result == AWS_OP_SUCCESS);
+    }
+
+    if (result != AWS_OP_SUCCESS) {
+        int error_code = aws_last_error();
+        s_stats_timer_report(&timer, error_code);
+        for (size_t i = 0; i < count; ++i) {
+            entries[i].error_code = error_code;
+        }
+        s_aws_dsql_auth_wait_state_clean_up(&wait_state);
+        return AWS_OP_ERR;
+    }
+
+    /* Encoded once for every group */
+    struct aws_dsql_auth_presign_credentials presign_credentials;
+    aws_dsql_auth_presign_credentials_init(&presign_credentials, wait_state.credentials, NULL);
+
+    int first_error_code = AWS_ERROR_SUCCESS;
+    for (size_t group_start = 0; group_start < count; group_start += AWS_DSQL_AUTH_PRESIGN_BATCH_MAX) {
+        size_t group_count = count - group_start;
+        if (group_count > AWS_DSQL_AUTH_PRESIGN_BATCH_MAX) {
+            group_count = AWS_DSQL_AUTH_PRESIGN_BATCH_MAX;
+        }
+
+        /* The first group to sign anything reports the credentials stage; every later one starts timing afresh */
+        if (s_generate_batch_group(
+                config,
+                &entries[group_start],
+                &tokens[group_start],
+                group_count,
+                &presign_credentials,
+                current_time_ms / 1000,
+                &timer,
+                allocator)) {
+            s_stats_timer_init(&timer, config->on_generation_stats, config->on_generation_stats_user_data);
+        }
+
+        for (size_t i = group_start; i < group_start + group_count; ++i) {
+            if (entries[i].error_code != AWS_ERROR_SUCCESS && first_error_code == AWS_ERROR_SUCCESS) {
+                first_error_code = entries[i].error_code;
+            }
+        }
+    }
+
+    aws_dsql_auth_presign_credentials_clean_up(&presign_credentials);
+    s_aws_dsql_auth_wait_state_clean_up(&wait_state);
+
+    if (first_error_code != AWS_ERROR_SUCCESS) {
+        return aws_raise_error(first_error_code);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_dsql_auth_token_generate_pair(
+    const struct aws_dsql_auth_config *config,
+    struct aws_allocator *allocator,
+    struct aws_dsql_auth_token *token,
+    struct aws_dsql_auth_token *admin_token) {
+
+    if (!config || !token || !admin_token || token == admin_token) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    if (s_validate_token_config(config) != AWS_OP_SUCCESS) {
+        return AWS_OP_ERR;
+    }
+
+    struct aws_dsql_auth_stats_timer timer;
+    s_stats_timer_init(&timer, config->on_generation_stats, config->on_generation_stats_user_data);
+    timer.token_count = 2;
+
+    /* Both tokens are signed with the same date and the same credentials; indexed by is_admin */
+    uint64_t current_time_ms;
+    struct aws_dsql_auth_presign_template templates[2];
+    struct aws_dsql_auth_wait_state wait_state;
+
+    int result = s_get_current_time(config->system_clock_fn, &current_time_ms);
+    for (size_t i = 0; i < AWS_ARRAY_SIZE(templates) && result == AWS_OP_SUCCESS; ++i) {
+        result = aws_dsql_auth_presign_template_init(
+            &templates[i],
+            aws_byte_cursor_from_c_str(config->hostname),
+            aws_byte_cursor_from_string(config->region),
+            s_action_for(i != 0),
+            config->expires_in);
+    }
+    if (result == AWS_OP_SUCCESS) {
+        s_stats_timer_end_stage(&timer, &timer.stats.request_ns);
+        result = s_aws_dsql_auth_wait_state_init(&wait_state);
+    }
+    if (result != AWS_OP_SUCCESS) {
+        s_stats_timer_report(&timer, aws_last_error());
+        return AWS_OP_ERR;
+    }
+
+    s_stats_timer_start_credentials(&timer);
+    result = s_get_credentials_sync(config->credentials_provider, &wait_state);
+    s_stats_timer_end_credentials(&timer, result == AWS_OP_SUCCESS);
+
+    if (result == AWS_OP_SUCCESS) {
+        struct aws_dsql_auth_presign_credentials presign_credentials;
+        aws_dsql_auth_presign_credentials_init(&presign_credentials, wait_state.credentials, NULL);
+        result = s_presign_pair(
+            allocator,
+            templates,
+            &presign_credentials,
+            current_time_ms / 1000,
+            config->expires_in,
+            &timer,
+            token,
+            admin_token);
+        aws_dsql_auth_presign_credentials_clean_up(&presign_credentials);
+    }
+
+    s_stats_timer_report(&timer, result == AWS_OP_SUCCESS ? AWS_ERROR_SUCCESS : aws_last_error());
+    s_aws_dsql_auth_wait_state_clean_up(&wait_state);
+
+    return result;
+}
+
+struct aws_dsql_auth_generator {
+    struct aws_allocator *allocator;
+    struct aws_ref_count ref_count;
+
+    struct aws_credentials_provider *credentials_provider;
+    aws_io_clock_fn *system_clock_fn;
+    uint64_t expires_in;
+    aws_dsql_auth_on_generation_stats_fn *on_generation_stats;
+    void *on_generation_stats_user_data;
+
+    /* Indexed by is_admin */
+    struct aws_dsql_auth_presign_template templates[2];
+
+    /* The provider's credentials, encoded for every generation; allocated with the generator */
+    struct aws_dsql_auth_credentials_fragment_cache *fragments;
+};
+
+static void s_aws_dsql_auth_generator_destroy(void *user_data) {
+    struct aws_dsql_auth_generator *generator = user_data;
+
+    aws_dsql_auth_credentials_fragment_cache_clean_up(generator->fragments);
+    aws_credentials_provider_release(generator->credentials_provider);
+    aws_mem_release(generator->allocator, generator);
+}
+
+struct aws_dsql_auth_generator *aws_dsql_auth_generator_new(
+    struct aws_allocator *allocator,
+    const struct aws_dsql_auth_config *config) {
+
+    if (!config) {
+        aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        return NULL;
+    }
+
+    if (s_validate_token_config(config) != AWS_OP_SUCCESS) {
+        return NULL;
+    }
+
+    struct aws_dsql_auth_generator *generator = NULL;
+    struct aws_dsql_auth_credentials_fragment_cache *fragments = NULL;
+    if (!aws_mem_acquire_many(
+            allocator,
+            2,
+            &generator,
+            sizeof(struct aws_dsql_auth_generator),
+            &fragments,
+            sizeof(struct aws_dsql_auth_credentials_fragment_cache))) {
+        return NULL;
+    }
+    AWS_ZERO_STRUCT(*generator);
+
+    generator->allocator = allocator;
+    generator->system_clock_fn = config->system_clock_fn;
+    generator->expires_in = config->expires_in;
+    generator->on_generation_stats = config->on_generation_stats;
+    generator->on_generation_stats_user_data = config->on_generation_stats_user_data;
+
+    for (size_t i = 0; i < AWS_ARRAY_SIZE(generator->templates); ++i) {
+        if (aws_dsql_auth_presign_template_init(
+                &generator->templates[i],
+                aws_byte_cursor_from_c_str(config->hostname),
+                aws_byte_cursor_from_string(config->region),
+                s_action_for(i != 0),
+                config->expires_in)) {
+            aws_mem_release(allocator, generator);
+            return NULL;
+        }
+    }
+
+    aws_dsql_auth_credentials_fragment_cache_init(fragments, allocator);
+    generator->fragments = fragments;
+    generator->credentials_provider = aws_credentials_provider_acquire(config->credentials_provider);
+    aws_ref_count_init(&generator->ref_count, generator, s_aws_dsql_auth_generator_destroy);
+
+    return generator;
+}
+
+struct aws_dsql_auth_generator *aws_dsql_auth_generator_acquire(struct aws_dsql_auth_generator *generator) {
+    if (generator) {
+        aws_ref_count_acquire(&generator->ref_count);
+    }
+    return generator;
+}
+
+struct aws_dsql_auth_generator *aws_dsql_auth_generator_release(struct aws_dsql_auth_generator *generator) {
+    if (generator) {
+        aws_ref_count_release(&generator->ref_count);
+    }
+    return NULL;
+}
+
+/**
+ * Read the clock and retrieve credentials for one generation of token_count tokens; on success the wait state holds
+ * the credentials. The timer is started either way, and a failure is reported to it.
+ */
+static int s_generator_begin(
+    const struct aws_dsql_auth_generator *generator,
+    size_t token_count,
+    struct aws_dsql_auth_wait_state *wait_state,
+    struct aws_dsql_auth_stats_timer *timer,
+    uint64_t *out_signing_time_secs) {
+
+    s_stats_timer_init(timer, generator->on_generation_stats, generator->on_generation_stats_user_data);
+    timer->token_count = token_count;
+
+    uint64_t current_time_ms;
+    if (s_get_current_time(generator->system_clock_fn, &current_time_ms)) {
+        goto on_error;
+    }
+    *out_signing_time_secs = current_time_ms / 1000;
+
+    if (s_aws_dsql_auth_wait_state_init(wait_state)) {
+        goto on_error;
+    }
+
+    s_stats_timer_start_credentials(timer);
+    if (s_get_credentials_sync(generator->credentials_provider, wait_state)) {
+        s_stats_timer_end_credentials(timer, false);
+        s_aws_dsql_auth_wait_state_clean_up(wait_state);
+        goto on_error;
+    }
+    s_stats_timer_end_credentials(timer, true);
+
+    return AWS_OP_SUCCESS;
+
+on_error:
+    s_stats_timer_report(timer, aws_last_error());
+    return AWS_OP_ERR;
+}
+
+int aws_dsql_auth_generator_generate(
+    const struct aws_dsql_auth_generator *generator,
+    bool is_admin,
+    struct aws_dsql_auth_token *token) {
+
+    if (!generator || !token) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    struct aws_dsql_auth_wait_state wait_state;
+    struct aws_dsql_auth_stats_timer timer;
+    uint64_t signing_time_secs = 0;
+    if (s_generator_begin(generator, 1, &wait_state, &timer, &signing_time_secs)) {
+        return AWS_OP_ERR;
+    }
+
+    uint8_t scratch_storage[AWS_DSQL_AUTH_SCRATCH_SIZE];
+    struct aws_dsql_auth_scratch_allocator scratch;
+
+    struct aws_dsql_auth_presign_credentials presign_credentials;
+    aws_dsql_auth_presign_credentials_init(&presign_credentials, wait_state.credentials, generator->fragments);
+
+    struct aws_string *token_string = NULL;
+    int result = s_presign_to_string(
+        generator->allocator,
+        aws_dsql_auth_scratch_allocator_init(&scratch, generator->allocator, scratch_storage, sizeof(scratch_storage)),
+        &generator->templates[is_admin ? 1 : 0],
+        &presign_credentials,
+        signing_time_secs,
+        &timer,
+        &token_string);
+    aws_dsql_auth_presign_credentials_clean_up(&presign_credentials);
+
+    if (result == AWS_OP_SUCCESS) {
+        aws_dsql_auth_token_clean_up(token);
+        token->token = token_string;
+        s_set_token_times(token, signing_time_secs, generator->expires_in);
+    }
+
+    s_stats_timer_report(&timer, result == AWS_OP_SUCCESS ? AWS_ERROR_SUCCESS : aws_last_error());
+    s_aws_dsql_auth_wait_state_clean_up(&wait_state);
+
+    return result;
+}
+
+int aws_dsql_auth_generator_generate_shared(
+    const struct aws_dsql_auth_generator *generator,
+    bool is_admin,
+    struct aws_dsql_auth_shared_token **out_token) {
+
+    if (!generator || !out_token) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    struct aws_dsql_auth_token token = {0};
+    if (aws_dsql_auth_generator_generate(generator, is_admin, &token)) {
+        return AWS_OP_ERR;
+    }
+
+    *out_token = aws_dsql_auth_shared_token_new(generator->allocator, &token);
+    aws_dsql_auth_token_clean_up(&token);
+
+    return *out_token ? AWS_OP_SUCCESS : AWS_OP_ERR;
+}
+
+int aws_dsql_auth_generator_generate_into_buf(
+    const struct aws_dsql_auth_generator *generator,
+    bool is_admin,
+    struct aws_byte_buf *output,
+    size_t *out_required_len) {
+
+    if (!generator || !output || !out_required_len) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    struct aws_dsql_auth_wait_state wait_state;
+    struct aws_dsql_auth_stats_timer timer;
+    uint64_t signing_time_secs = 0;
+    if (s_generator_begin(generator, 1, &wait_state, &timer, &signing_time_secs)) {
+        return AWS_OP_ERR;
+    }
+
+    uint8_t scratch_storage[AWS_DSQL_AUTH_SCRATCH_SIZE];
+    struct aws_dsql_auth_scratch_allocator scratch;
+
+    struct aws_dsql_auth_presign_credentials presign_credentials;
+    aws_dsql_auth_presign_credentials_init(&presign_credentials, wait_state.credentials, generator->fragments);
+
+    int result = s_presign_into_buf(
+        aws_dsql_auth_scratch_allocator_init(&scratch, generator->allocator, scratch_storage, sizeof(scratch_storage)),
+        &generator->templates[is_admin ? 1 : 0],
+        &presign_credentials,
+        signing_time_secs,
+        &timer,
+        output,
+        out_required_len);
+    aws_dsql_auth_presign_credentials_clean_up(&presign_credentials);
+
+    s_stats_timer_report(&timer, result == AWS_OP_SUCCESS ? AWS_ERROR_SUCCESS : aws_last_error());
+    s_aws_dsql_auth_wait_state_clean_up(&wait_state);
+
+    return result;
+}
+
+int aws_dsql_auth_generator_generate_pair(
+    const struct aws_dsql_auth_generator *generator,
+    struct aws_dsql_auth_token *token,
+    struct aws_dsql_auth_token *admin_token) {
+
+    if (!generator || !token || !admin_token || token == admin_token) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    struct aws_dsql_auth_wait_state wait_state;
+    struct aws_dsql_auth_stats_timer timer;
+    uint64_t signing_time_secs = 0;
+    if (s_generator_begin(generator, 2, &wait_state, &timer, &signing_time_secs)) {
+        return AWS_OP_ERR;
+    }
+
+    struct aws_dsql_auth_presign_credentials presign_credentials;
+    aws_dsql_auth_presign_credentials_init(&presign_credentials, wait_state.credentials, generator->fragments);
+
+    int result = s_presign_pair(
+        generator->allocator,
+        generator->templates,
+        &presign_credentials,
+        signing_time_secs,
+        generator->expires_in,
+        &timer,
+        token,
+        admin_token);
+    aws_dsql_auth_presign_credentials_clean_up(&presign_credentials);
+
+    s_stats_timer_report(&timer, result == AWS_OP_SUCCESS ? AWS_ERROR_SUCCESS : aws_last_error());
+    s_aws_dsql_auth_wait_state_clean_up(&wait_state);
+
+    return result;
+}
+
+void aws_dsql_auth_token_clean_up(struct aws_dsql_auth_token *token) {
+    if (!token) {
+        return;
+    }
+
+    if (token->token) {
+        /* Destroy the aws_string which frees both the structure and its string data */
+        aws_string_destroy(token->token);
+        token->token = NULL;
+    }
+
+    AWS_ZERO_STRUCT(*token);
+}
+
+struct aws_dsql_auth_shared_token {
+    struct aws_allocator *allocator;
+    struct aws_ref_count ref_count;
+    struct aws_dsql_auth_token token;
+};
+
+static void s_aws_dsql_auth_shared_token_destroy(void *user_data) {
+    struct aws_dsql_auth_shared_token *shared = user_data;
+
+    aws_dsql_auth_token_clean_up(&shared->token);
+    aws_mem_release(shared->allocator, shared);
+}
+
+struct aws_dsql_auth_shared_token *aws_dsql_auth_shared_token_new(
+    struct aws_allocator *allocator,
+    struct aws_dsql_auth_token *token) {
+
+    if (!token || !token->token) {
+        aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        return NULL;
+    }
+
+    struct aws_dsql_auth_shared_token *shared =
+        aws_mem_calloc(allocator, 1, sizeof(struct aws_dsql_auth_shared_token));
+    if (!shared) {
+        return NULL;
+    }
+
+    shared->allocator = allocator;
+    shared->token = *token;
+    AWS_ZERO_STRUCT(*token);
+    aws_ref_count_init(&shared->ref_count, shared, s_aws_dsql_auth_shared_token_destroy);
+
+    return shared;
+}
+
+struct aws_dsql_auth_shared_token *aws_dsql_auth_shared_token_acquire(struct aws_dsql_auth_shared_token *token) {
+    if (token) {
+        aws_ref_count_acquire(&token->ref_count);
+    }
+    return token;
+}
+
+struct aws_dsql_auth_shared_token *aws_dsql_auth_shared_token_release(struct aws_dsql_auth_shared_token *token) {
+    if (token) {
+        aws_ref_count_release(&token->ref_count);
+    }
+    return NULL;
+}
+
+const struct aws_dsql_auth_token *aws_dsql_auth_shared_token_get_token(const struct aws_dsql_auth_shared_token *token) {
+    return token ? &token->token : NULL;
+}
+
+void aws_dsql_auth_module_clean_up(struct aws_allocator *allocator) {
+    /* Nothing to clean up */
+    (void)allocator;
+}
+
+const char *aws_dsql_auth_token_get_str(const struct aws_dsql_auth_token *token) {
+    if (!token || !token->token) {
+        return NULL;
+    }
+
+    return aws_string_c_str(token->token);
+}
+
+uint64_t aws_dsql_auth_token_get_issued_timepoint_seconds(const struct aws_dsql_auth_token *token) {
+    if (!token || !token->token) {
+        return 0;
+    }
+
+    return token->issued_at_secs;
+}
+
+uint64_t aws_dsql_auth_token_get_expiration_timepoint_seconds(const struct aws_dsql_auth_token *token) {
+    if (!token || !token->token) {
+        return 0;
+    }
+
+    return token->expires_at_secs;
 }
 
 /**
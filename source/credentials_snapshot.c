@@ -0,0 +1,456 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <aws/common/atomics.h>
+#include <aws/common/clock.h>
+#include <aws/common/device_random.h>
+#include <aws/common/math.h>
+#include <aws/common/mutex.h>
+#include <aws/dsql-auth/credentials_snapshot.h>
+#include <aws/dsql-auth/private/fork.h>
+#include <aws/dsql-auth/private/metrics.h>
+#include <aws/dsql-auth/private/reader_shards.h>
+
+#include <aws/auth/credentials.h>
+#include <aws/io/event_loop.h>
+
+enum { DEFAULT_REFRESH_AHEAD_SECONDS = 300 };
+
+/* After a failed refresh the next one waits this long, doubling with each further failure up to the maximum */
+enum { REFRESH_RETRY_BASE_MS = 1000 };
+enum { REFRESH_RETRY_MAX_MS = 60000 };
+
+/* Published credentials with when to refresh them, never modified once readers can see them */
+struct snapshot_state {
+    /* Retired once replaced, until no reader can still see it */
+    struct aws_dsql_auth_retired retired;
+
+    struct aws_credentials *credentials;
+    uint64_t expiration_secs;
+    uint64_t refresh_at_secs;
+};
+
+struct aws_dsql_auth_credentials_snapshot_impl {
+    struct aws_allocator *allocator;
+    struct aws_credentials_provider *source;
+    uint64_t refresh_ahead_seconds;
+    uint64_t refresh_jitter_seconds;
+    aws_io_clock_fn *system_clock_fn;
+
+    /* When set, background refreshes are started from a task on this loop, of event_loop_group */
+    struct aws_event_loop_group *event_loop_group;
+    struct aws_event_loop *event_loop;
+
+    /* struct snapshot_state *, loaded by readers without the lock and only replaced with the lock held */
+    struct aws_atomic_var state;
+
+    /* Readers of state; writers retire the states they replace here, with the lock held */
+    struct aws_dsql_auth_reader_shards *reader_shards;
+
+    /* Serializes writers replacing the snapshot, never held across a call into the source. Readers never take it. */
+    struct aws_mutex lock;
+
+    /* Set by the request that claims the background refresh, and cleared when the refresh ends */
+    struct aws_atomic_var is_refreshing;
+
+    /* No refresh starts before this after a failed one, in seconds */
+    struct aws_atomic_var refresh_retry_at_secs;
+
+    /* Only touched by the holder of the refresh claim: the failed refreshes in a row */
+    size_t refresh_failure_count;
+
+    struct aws_dsql_auth_fork_handler fork_handler;
+};
+
+/* A request forwarded to the source: either a caller waiting for credentials, or a background refresh */
+struct snapshot_source_request {
+    struct aws_allocator *allocator;
+    struct aws_credentials_provider *provider;
+    aws_on_get_credentials_callback_fn *callback;
+    void *user_data;
+    bool is_refresh;
+
+    /* Starts a background refresh on the snapshot's event loop */
+    struct aws_task task;
+};
+
+static int s_get_current_time_secs(aws_io_clock_fn *system_clock_fn, uint64_t *out_time_secs) {
+    uint64_t current_time_ns = 0;
+
+    if (system_clock_fn) {
+        if (system_clock_fn(&current_time_ns)) {
+            return AWS_OP_ERR;
+        }
+    } else {
+        if (aws_sys_clock_get_ticks(&current_time_ns)) {
+            return AWS_OP_ERR;
+        }
+    }
+
+    *out_time_secs = aws_timestamp_convert(current_time_ns, AWS_TIMESTAMP_NANOS, AWS_TIMESTAMP_SECS, NULL);
+    return AWS_OP_SUCCESS;
+}
+
+static void s_state_destroy(struct aws_dsql_auth_credentials_snapshot_impl *impl, struct snapshot_state *state) {
+    aws_credentials_release(state->credentials);
+    aws_mem_release(impl->allocator, state);
+}
+
+static void s_free_retired(struct aws_dsql_auth_retired *retired, void *user_data) {
+    s_state_destroy(user_data, AWS_CONTAINER_OF(retired, struct snapshot_state, retired));
+}
+
+/**
+ * Free the states replaced long enough ago that no reader can still see them, without ever waiting for one. Must be
+ * called with the lock held; what readers hold up now is freed when a later refresh ends.
+ */
+static void s_reclaim_retired(struct aws_dsql_auth_credentials_snapshot_impl *impl) {
+    aws_dsql_auth_reader_shards_reclaim(impl->reader_shards, s_free_retired, impl);
+}
+
+/* When credentials expiring at expiration_secs start refreshing: refresh_ahead_seconds before, plus a random jitter */
+static uint64_t s_refresh_at_secs(
+    const struct aws_dsql_auth_credentials_snapshot_impl *impl,
+    uint64_t expiration_secs) {
+    uint64_t jitter_secs = 0;
+    uint64_t random = 0;
+    if (impl->refresh_jitter_seconds > 0 && aws_device_random_u64(&random) == AWS_OP_SUCCESS) {
+        jitter_secs = random % (impl->refresh_jitter_seconds + 1);
+    }
+
+    uint64_t lead_secs = impl->refresh_ahead_seconds + jitter_secs;
+    return expiration_secs > lead_secs ? expiration_secs - lead_secs : 0;
+}
+
+/* Replace the snapshot unless the current one outlives the new credentials, or memory runs out */
+static void s_store_snapshot(
+    struct aws_dsql_auth_credentials_snapshot_impl *impl,
+    struct aws_credentials *credentials) {
+
+    struct snapshot_state *state = aws_mem_calloc(impl->allocator, 1, sizeof(struct snapshot_state));
+    if (!state) {
+        return;
+    }
+    state->credentials = credentials;
+    state->expiration_secs = aws_credentials_get_expiration_timepoint_seconds(credentials);
+    state->refresh_at_secs = s_refresh_at_secs(impl, state->expiration_secs);
+
+    aws_mutex_lock(&impl->lock);
+    struct snapshot_state *current = aws_atomic_load_ptr(&impl->state);
+    if (!current || state->expiration_secs >= current->expiration_secs) {
+        aws_credentials_acquire(credentials);
+        aws_atomic_store_ptr(&impl->state, state);
+        state = NULL;
+
+        if (current) {
+            aws_dsql_auth_reader_shards_retire(impl->reader_shards, &current->retired);
+        }
+    }
+    s_reclaim_retired(impl);
+    aws_mutex_unlock(&impl->lock);
+
+    if (state) {
+        aws_mem_release(impl->allocator, state);
+    }
+}
+
+/* Claim the background refresh, so that only one request starts it, unless a failed one is still backing off */
+static bool s_claim_refresh(struct aws_dsql_auth_credentials_snapshot_impl *impl, uint64_t now_secs) {
+    if (now_secs < aws_atomic_load_int(&impl->refresh_retry_at_secs)) {
+        return false;
+    }
+
+    size_t expected = 0;
+    return aws_atomic_load_int(&impl->is_refreshing) == 0 &&
+           aws_atomic_compare_exchange_int(&impl->is_refreshing, &expected, 1);
+}
+
+/**
+ * End the background refresh, which the caller claimed. A failed one is counted and holds the next one off, for an
+ * exponential backoff with a random half of it as jitter, so that a failing source is not asked again by every
+ * request in the refresh window. Snapshots that readers held up when they were replaced are freed here.
+ */
+static void s_end_refresh(struct aws_dsql_auth_credentials_snapshot_impl *impl, bool failed) {
+    uint64_t retry_at_secs = 0;
+    if (failed) {
+        aws_dsql_auth_metrics_add(AWS_DSQL_AUTH_METRIC_CREDENTIALS_SNAPSHOT_REFRESH_FAILURES, 1);
+
+        uint64_t random = 0;
+        bool has_random = aws_device_random_u64(&random) == AWS_OP_SUCCESS;
+        uint64_t now_secs = 0;
+        s_get_current_time_secs(impl->system_clock_fn, &now_secs);
+
+        size_t shift = aws_min_size(impl->refresh_failure_count, 16);
+        ++impl->refresh_failure_count;
+        uint64_t backoff_ms = aws_min_u64((uint64_t)REFRESH_RETRY_BASE_MS << shift, REFRESH_RETRY_MAX_MS);
+        if (has_random) {
+            backoff_ms -= random % (backoff_ms / 2 + 1);
+        }
+        retry_at_secs = now_secs + (backoff_ms + 999) / 1000;
+    } else {
+        impl->refresh_failure_count = 0;
+    }
+    aws_atomic_store_int(&impl->refresh_retry_at_secs, (size_t)retry_at_secs);
+    aws_atomic_store_int(&impl->is_refreshing, 0);
+
+    aws_mutex_lock(&impl->lock);
+    s_reclaim_retired(impl);
+    aws_mutex_unlock(&impl->lock);
+}
+
+static void s_destroy_source_request(struct snapshot_source_request *request) {
+    aws_credentials_provider_release(request->provider);
+    aws_mem_release(request->allocator, request);
+}
+
+static void s_on_source_credentials(struct aws_credentials *credentials, int error_code, void *user_data) {
+    struct snapshot_source_request *request = user_data;
+    struct aws_dsql_auth_credentials_snapshot_impl *impl = request->provider->impl;
+
+    if (error_code == AWS_ERROR_SUCCESS && credentials) {
+        s_store_snapshot(impl, credentials);
+    }
+
+    if (request->is_refresh) {
+        s_end_refresh(impl, error_code != AWS_ERROR_SUCCESS || !credentials);
+    } else {
+        request->callback(credentials, error_code, request->user_data);
+    }
+
+    s_destroy_source_request(request);
+}
+
+static void s_refresh_task(struct aws_task *task, void *arg, enum aws_task_status status) {
+    (void)task;
+    struct snapshot_source_request *request = arg;
+    struct aws_dsql_auth_credentials_snapshot_impl *impl = request->provider->impl;
+
+    if (status == AWS_TASK_STATUS_RUN_READY &&
+        aws_credentials_provider_get_credentials(impl->source, s_on_source_credentials, request) == AWS_OP_SUCCESS) {
+        return;
+    }
+
+    /* The refresh never reached the source; the current snapshot stays in place */
+    s_end_refresh(impl, true);
+    s_destroy_source_request(request);
+}
+
+/**
+ * Forward a request to the source. A NULL callback makes it a background refresh, whose result only updates the
+ * snapshot, and which is started from the snapshot's event loop if it has one.
+ */
+static int s_request_from_source(
+    struct aws_credentials_provider *provider,
+    aws_on_get_credentials_callback_fn *callback,
+    void *user_data) {
+
+    struct aws_dsql_auth_credentials_snapshot_impl *impl = provider->impl;
+
+    struct snapshot_source_request *request =
+        aws_mem_calloc(provider->allocator, 1, sizeof(struct snapshot_source_request));
+    if (!request) {
+        return AWS_OP_ERR;
+    }
+
+    request->allocator = provider->allocator;
+    request->provider = aws_credentials_provider_acquire(provider);
+    request->callback = callback;
+    request->user_data = user_data;
+    request->is_refresh = callback == NULL;
+
+    if (request->is_refresh && impl->event_loop) {
+        aws_task_init(&request->task, s_refresh_task, request, "dsql_auth_credentials_refresh");
+        aws_event_loop_schedule_task_now(impl->event_loop, &request->task);
+        return AWS_OP_SUCCESS;
+    }
+
+    if (aws_credentials_provider_get_credentials(impl->source, s_on_source_credentials, request)) {
+        s_destroy_source_request(request);
+        return AWS_OP_ERR;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+static int s_snapshot_get_credentials(
+    struct aws_credentials_provider *provider,
+    aws_on_get_credentials_callback_fn callback,
+    void *user_data) {
+
+    struct aws_dsql_auth_credentials_snapshot_impl *impl = provider->impl;
+
+    uint64_t now_secs = 0;
+    if (s_get_current_time_secs(impl->system_clock_fn, &now_secs)) {
+        return AWS_OP_ERR;
+    }
+
+    struct aws_credentials *credentials = NULL;
+    bool is_refresh_due = false;
+
+    struct aws_atomic_var *active = aws_dsql_auth_read_lock(impl->reader_shards);
+    struct snapshot_state *state = aws_atomic_load_ptr(&impl->state);
+    if (state && state->expiration_secs > now_secs) {
+        credentials = state->credentials;
+        aws_credentials_acquire(credentials);
+        is_refresh_due = now_secs >= state->refresh_at_secs;
+    }
+    aws_dsql_auth_read_unlock(active);
+
+    if (!credentials) {
+        /* Cold or expired: wait on the source, exactly as if there were no snapshot */
+        return s_request_from_source(provider, callback, user_data);
+    }
+
+    /* A failed refresh leaves the current snapshot in place, a request in the window retries after a backoff */
+    if (is_refresh_due && s_claim_refresh(impl, now_secs)) {
+        aws_dsql_auth_metrics_add(AWS_DSQL_AUTH_METRIC_CREDENTIALS_SNAPSHOT_REFRESHES, 1);
+        if (s_request_from_source(provider, NULL, NULL)) {
+            s_end_refresh(impl, true);
+        }
+    }
+
+    callback(credentials, AWS_ERROR_SUCCESS, user_data);
+    aws_credentials_release(credentials);
+
+    return AWS_OP_SUCCESS;
+}
+
+static bool s_snapshot_try_prepare_fork(void *user_data) {
+    struct aws_dsql_auth_credentials_snapshot_impl *impl = user_data;
+    return aws_mutex_try_lock(&impl->lock) == AWS_OP_SUCCESS;
+}
+
+static void s_snapshot_parent_fork(void *user_data) {
+    struct aws_dsql_auth_credentials_snapshot_impl *impl = user_data;
+    aws_mutex_unlock(&impl->lock);
+}
+
+/**
+ * Keep the snapshot in a forked child, so that the child's requests are served from it without going to the source.
+ * A refresh that was in flight will never land here and the event loop no longer runs, so the next request in the
+ * refresh window starts its own refresh, from its own thread, at a point jittered again for this child so that
+ * workers forked from one parent do not all go back to the source at once. Requests in flight in the parent are
+ * never completed here, nor their references released; the refresh's and the group's are counted as abandoned.
+ */
+static void s_snapshot_child_fork(void *user_data) {
+    struct aws_dsql_auth_credentials_snapshot_impl *impl = user_data;
+
+    /* The forking thread is the only one left, so no reader is inside and the state can be changed in place */
+    aws_dsql_auth_reader_shards_reset(impl->reader_shards);
+
+    size_t abandoned = aws_atomic_exchange_int(&impl->is_refreshing, 0);
+    struct snapshot_state *state = aws_atomic_load_ptr(&impl->state);
+    if (state) {
+        state->refresh_at_secs = s_refresh_at_secs(impl, state->expiration_secs);
+    }
+
+    /* The group's reference is given up rather than released, its loops did not come across */
+    if (impl->event_loop_group) {
+        impl->event_loop_group = NULL;
+        impl->event_loop = NULL;
+        ++abandoned;
+    }
+    aws_dsql_auth_metrics_add(AWS_DSQL_AUTH_METRIC_FORK_ABANDONED_REFERENCES, abandoned);
+
+    aws_mutex_unlock(&impl->lock);
+}
+
+static void s_snapshot_destroy(struct aws_credentials_provider *provider) {
+    struct aws_dsql_auth_credentials_snapshot_impl *impl = provider->impl;
+
+    aws_dsql_auth_fork_handler_unregister(&impl->fork_handler);
+
+    /* Requests in flight hold a reference to the provider, so nothing can still be using impl */
+    struct snapshot_state *state = aws_atomic_load_ptr(&impl->state);
+    if (state) {
+        s_state_destroy(impl, state);
+    }
+    aws_dsql_auth_reader_shards_destroy(impl->reader_shards, s_free_retired, impl);
+    aws_credentials_provider_release(impl->source);
+    if (impl->event_loop_group) {
+        aws_event_loop_group_release(impl->event_loop_group);
+    }
+    aws_mutex_clean_up(&impl->lock);
+
+    struct aws_credentials_provider_shutdown_options shutdown_options = provider->shutdown_options;
+    aws_mem_release(provider->allocator, provider);
+
+    if (shutdown_options.shutdown_callback) {
+        shutdown_options.shutdown_callback(shutdown_options.shutdown_user_data);
+    }
+}
+
+static struct aws_credentials_provider_vtable s_snapshot_vtable = {
+    .get_credentials = s_snapshot_get_credentials,
+    .destroy = s_snapshot_destroy,
+};
+
+struct aws_credentials_provider *aws_dsql_auth_credentials_provider_new_snapshot(
+    struct aws_allocator *allocator,
+    const struct aws_dsql_auth_credentials_snapshot_options *options) {
+
+    if (!options || !options->source) {
+        aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        return NULL;
+    }
+
+    struct aws_credentials_provider *provider = NULL;
+    struct aws_dsql_auth_credentials_snapshot_impl *impl = NULL;
+
+    if (!aws_mem_acquire_many(
+            allocator,
+            2,
+            &provider,
+            sizeof(struct aws_credentials_provider),
+            &impl,
+            sizeof(struct aws_dsql_auth_credentials_snapshot_impl))) {
+        return NULL;
+    }
+
+    AWS_ZERO_STRUCT(*provider);
+    AWS_ZERO_STRUCT(*impl);
+
+    impl->reader_shards = aws_dsql_auth_reader_shards_new(allocator);
+    if (!impl->reader_shards) {
+        aws_mem_release(allocator, provider);
+        return NULL;
+    }
+
+    if (aws_mutex_init(&impl->lock)) {
+        aws_dsql_auth_reader_shards_destroy(impl->reader_shards, s_free_retired, impl);
+        aws_mem_release(allocator, provider);
+        return NULL;
+    }
+
+    aws_atomic_init_ptr(&impl->state, NULL);
+    aws_atomic_init_int(&impl->is_refreshing, 0);
+    aws_atomic_init_int(&impl->refresh_retry_at_secs, 0);
+
+    impl->allocator = allocator;
+    impl->source = aws_credentials_provider_acquire(options->source);
+    impl->refresh_ahead_seconds =
+        options->refresh_ahead_seconds ? options->refresh_ahead_seconds : DEFAULT_REFRESH_AHEAD_SECONDS;
+    impl->refresh_jitter_seconds = options->refresh_jitter_seconds;
+    impl->system_clock_fn = options->system_clock_fn;
+    if (options->event_loop_group) {
+        /* A snapshot has a single key, so one loop serves all of its refreshes */
+        impl->event_loop_group = aws_event_loop_group_acquire(options->event_loop_group);
+        impl->event_loop = aws_event_loop_group_get_next_loop(impl->event_loop_group);
+    }
+
+    provider->vtable = &s_snapshot_vtable;
+    provider->allocator = allocator;
+    provider->shutdown_options = options->shutdown_options;
+    provider->impl = impl;
+    aws_atomic_init_int(&provider->ref_count, 1);
+
+    impl->fork_handler.try_prepare = s_snapshot_try_prepare_fork;
+    impl->fork_handler.parent = s_snapshot_parent_fork;
+    impl->fork_handler.child = s_snapshot_child_fork;
+    impl->fork_handler.user_data = impl;
+    aws_dsql_auth_fork_handler_register(&impl->fork_handler);
+
+    return provider;
+}
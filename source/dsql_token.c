@@ -6,18 +6,69 @@
 #include <aws/auth/auth.h>
 #include <aws/auth/credentials.h>
 #include <aws/common/allocator.h>
+#include <aws/common/clock.h>
 #include <aws/common/command_line_parser.h>
 #include <aws/common/common.h>
 #include <aws/common/error.h>
 #include <aws/common/string.h>
+#include <aws/common/thread.h>
 #include <aws/dsql-auth/auth_token.h>
+#include <aws/dsql-auth/credentials_snapshot.h>
+#include <aws/io/channel_bootstrap.h>
+#include <aws/io/event_loop.h>
+#include <aws/io/host_resolver.h>
 #include <aws/io/io.h>
 #include <aws/io/tls_channel_handler.h>
 #include <aws/sdkutils/sdkutils.h>
 
+#include "dsql_token_agent.h"
+#include "dsql_token_file_cache.h"
+
+#include <ctype.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+/* Input lines are read and generated this many at a time; each chunk's tokens are written before the next is read */
+enum { STREAM_CHUNK_SIZE = 64 };
+
+/* Longest input line, enough for a maximum length hostname, a region and the admin flag */
+enum { STREAM_MAX_LINE_LENGTH = 512 };
+
+enum { MAX_WORKERS = 64 };
+
+/* Connections an agent serves at once unless --workers says otherwise */
+enum { DEFAULT_AGENT_WORKERS = 4 };
+
+/* A token from the cache file is only used if it stays valid at least this long, enough to connect with it */
+enum { FILE_CACHE_MIN_REMAINING_SECONDS = 60 };
+
+/* Room for the credentials source, AWS_PROFILE and AWS_ACCESS_KEY_ID */
+enum { CREDENTIALS_SELECTOR_SIZE = 512 };
+
+/* Consulted for the agent socket when --agent is not given */
+static const char *s_agent_env_var = "DSQL_TOKEN_AGENT";
+
+/* Where credentials come from; everything but the default chain builds a single provider */
+enum dsql_token_credentials_source {
+    DSQL_TOKEN_CREDENTIALS_DEFAULT,
+    DSQL_TOKEN_CREDENTIALS_ENV,
+    DSQL_TOKEN_CREDENTIALS_PROFILE,
+    DSQL_TOKEN_CREDENTIALS_IMDS,
+    DSQL_TOKEN_CREDENTIALS_ECS,
+    DSQL_TOKEN_CREDENTIALS_PROCESS,
+    DSQL_TOKEN_CREDENTIALS_SOURCE_COUNT,
+};
+
+static const char *s_credentials_source_names[DSQL_TOKEN_CREDENTIALS_SOURCE_COUNT] = {
+    [DSQL_TOKEN_CREDENTIALS_DEFAULT] = "default",
+    [DSQL_TOKEN_CREDENTIALS_ENV] = "env",
+    [DSQL_TOKEN_CREDENTIALS_PROFILE] = "profile",
+    [DSQL_TOKEN_CREDENTIALS_IMDS] = "imds",
+    [DSQL_TOKEN_CREDENTIALS_ECS] = "ecs",
+    [DSQL_TOKEN_CREDENTIALS_PROCESS] = "process",
+};
 
 struct dsql_token_ctx {
     struct aws_allocator *allocator;
@@ -25,16 +76,73 @@ struct dsql_token_ctx {
     struct aws_string *region;
     uint64_t expires_in;
     bool admin;
+    const char *input_path;
+    const char *serve_path;
+    const char *agent_path;
+    bool use_file_cache;
+    const char *file_cache_path;
+    size_t workers;
+    enum dsql_token_credentials_source credentials_source;
+
+    /* See s_build_credentials_selector */
+    char credentials_selector[CREDENTIALS_SELECTOR_SIZE];
+
+    /* Initialized once the token cannot come from an agent, the networking only if the credentials source needs it */
+    bool auth_initialized;
+    struct aws_event_loop_group *event_loop_group;
+    struct aws_host_resolver *host_resolver;
+    struct aws_client_bootstrap *bootstrap;
+    struct aws_tls_ctx *tls_ctx;
+};
+
+/* One line of streaming input */
+struct dsql_token_stream_line {
+    struct aws_string *hostname;
+    struct aws_string *region;
+    size_t line_number;
+};
+
+/* A slice of a chunk, generated with one batch call */
+struct dsql_token_stream_worker {
+    struct aws_allocator *allocator;
+    const struct aws_dsql_auth_config *config;
+    struct aws_dsql_auth_token_batch_entry *entries;
+    struct aws_dsql_auth_token *tokens;
+    size_t count;
+    struct aws_thread thread;
 };
 
 static void s_usage(int exit_code) {
     fprintf(stderr, "Usage:\n");
-    fprintf(stderr, "  dsql-token --hostname HOSTNAME [--region REGION] [--expires-in SECONDS] [--admin]\n\n");
+    fprintf(stderr, "  dsql-token --hostname HOSTNAME [--region REGION] [--expires-in SECONDS] [--admin]\n");
+    fprintf(stderr, "  dsql-token --input FILE [--workers N] [--expires-in SECONDS] [--admin]\n");
+    fprintf(stderr, "  dsql-token --serve SOCKET [--workers N]\n\n");
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "  --hostname HOSTNAME        Required. The hostname of the Aurora DSQL database\n");
     fprintf(stderr, "  --region REGION            Optional. The AWS region. If not provided, will be auto-detected\n");
+    fprintf(stderr, "                             With --input, the region of lines that do not name one\n");
     fprintf(stderr, "  --expires-in SECONDS       Optional. The expiration time in seconds. Default is 900 (15 min)\n");
     fprintf(stderr, "  --admin                    Optional. Generate an admin token. Default is false\n");
+    fprintf(stderr, "  --input FILE               Optional. Read 'HOSTNAME [REGION] [admin]' lines from FILE, or\n");
+    fprintf(stderr, "                             from stdin if FILE is -, and write one token per line in order\n");
+    fprintf(stderr, "  --workers N                Optional. Threads generating tokens for --input. Default is 1\n");
+    fprintf(
+        stderr,
+        "                             With --serve, connections served at once. Default is %d\n",
+        DEFAULT_AGENT_WORKERS);
+    fprintf(stderr, "  --serve SOCKET             Optional. Run as an agent answering token requests on the Unix\n");
+    fprintf(stderr, "                             socket SOCKET, keeping credentials and tokens cached\n");
+    fprintf(stderr, "  --cache                    Optional. Share tokens with other runs through a cache file in\n");
+    fprintf(stderr, "                             $XDG_RUNTIME_DIR, reusing one that is still valid\n");
+    fprintf(stderr, "  --cache-file FILE          Optional. Like --cache, with the cache file at FILE\n");
+    fprintf(stderr, "  --credentials-source SRC   Optional. Use only env, profile, imds, ecs or process credentials\n");
+    fprintf(stderr, "                             Default is the default provider chain, trying each in turn\n");
+    fprintf(stderr, "  --agent SOCKET             Optional. Get the token from the agent on SOCKET, generating it\n");
+    fprintf(stderr, "                             here if the agent is unreachable or its credentials source,\n");
+    fprintf(
+        stderr,
+        "                             AWS_PROFILE or AWS_ACCESS_KEY_ID differ. Defaults to $%s\n",
+        s_agent_env_var);
     fprintf(stderr, "\n");
     exit(exit_code);
 }
@@ -44,6 +152,13 @@ static struct aws_cli_option s_long_options[] = {
     {"region", AWS_CLI_OPTIONS_REQUIRED_ARGUMENT, NULL, 'r'},
     {"expires-in", AWS_CLI_OPTIONS_REQUIRED_ARGUMENT, NULL, 'e'},
     {"admin", AWS_CLI_OPTIONS_NO_ARGUMENT, NULL, 'a'},
+    {"input", AWS_CLI_OPTIONS_REQUIRED_ARGUMENT, NULL, 'i'},
+    {"workers", AWS_CLI_OPTIONS_REQUIRED_ARGUMENT, NULL, 'w'},
+    {"serve", AWS_CLI_OPTIONS_REQUIRED_ARGUMENT, NULL, 's'},
+    {"agent", AWS_CLI_OPTIONS_REQUIRED_ARGUMENT, NULL, 'g'},
+    {"credentials-source", AWS_CLI_OPTIONS_REQUIRED_ARGUMENT, NULL, 'c'},
+    {"cache", AWS_CLI_OPTIONS_NO_ARGUMENT, NULL, 'k'},
+    {"cache-file", AWS_CLI_OPTIONS_REQUIRED_ARGUMENT, NULL, 'f'},
     {"help", AWS_CLI_OPTIONS_NO_ARGUMENT, NULL, '?'},
     {NULL, 0, NULL, 0},
 };
@@ -51,11 +166,12 @@ static struct aws_cli_option s_long_options[] = {
 static bool s_parse_args(int argc, char **argv, struct dsql_token_ctx *ctx) {
     ctx->admin = false;
     ctx->expires_in = 0; // Use default value
+    ctx->workers = 0; // Use the mode's default
 
     int opt;
     int option_index = 0;
 
-    while ((opt = aws_cli_getopt_long(argc, argv, "h:r:e:a?", s_long_options, &option_index)) != -1) {
+    while ((opt = aws_cli_getopt_long(argc, argv, "h:r:e:ai:w:s:g:c:kf:?", s_long_options, &option_index)) != -1) {
         switch (opt) {
             case 0:
                 /* getopt_long() set a variable, just keep going */
@@ -89,6 +205,51 @@ static bool s_parse_args(int argc, char **argv, struct dsql_token_ctx *ctx) {
                 ctx->admin = true;
                 break;
 
+            case 'i':
+                ctx->input_path = aws_cli_optarg;
+                break;
+
+            case 'w': {
+                long long workers = strtoll(aws_cli_optarg, NULL, 10);
+                if (workers <= 0 || workers > MAX_WORKERS) {
+                    fprintf(stderr, "Error: workers must be between 1 and %d\n", MAX_WORKERS);
+                    return false;
+                }
+                ctx->workers = (size_t)workers;
+                break;
+            }
+
+            case 's':
+                ctx->serve_path = aws_cli_optarg;
+                break;
+
+            case 'g':
+                ctx->agent_path = aws_cli_optarg;
+                break;
+
+            case 'k':
+                ctx->use_file_cache = true;
+                break;
+
+            case 'f':
+                ctx->use_file_cache = true;
+                ctx->file_cache_path = aws_cli_optarg;
+                break;
+
+            case 'c': {
+                size_t source = 0;
+                while (source < DSQL_TOKEN_CREDENTIALS_SOURCE_COUNT &&
+                       strcmp(aws_cli_optarg, s_credentials_source_names[source]) != 0) {
+                    ++source;
+                }
+                if (source == DSQL_TOKEN_CREDENTIALS_SOURCE_COUNT) {
+                    fprintf(stderr, "Error: unknown credentials source '%s'\n", aws_cli_optarg);
+                    return false;
+                }
+                ctx->credentials_source = (enum dsql_token_credentials_source)source;
+                break;
+            }
+
             case '?':
                 s_usage(0);
                 break;
@@ -99,25 +260,507 @@ static bool s_parse_args(int argc, char **argv, struct dsql_token_ctx *ctx) {
         }
     }
 
-    if (!ctx->hostname) {
-        fprintf(stderr, "Error: --hostname is required\n");
+    int modes = (ctx->hostname != NULL) + (ctx->input_path != NULL) + (ctx->serve_path != NULL);
+    if (modes == 0) {
+        fprintf(stderr, "Error: --hostname, --input or --serve is required\n");
         return false;
     }
 
+    if (modes > 1) {
+        fprintf(stderr, "Error: only one of --hostname, --input and --serve can be used\n");
+        return false;
+    }
+
+    if (ctx->workers == 0) {
+        ctx->workers = ctx->serve_path ? DEFAULT_AGENT_WORKERS : 1;
+    }
+
+    if (!ctx->agent_path && ctx->hostname) {
+        const char *agent_path = getenv(s_agent_env_var);
+        if (agent_path && agent_path[0] != '\0') {
+            ctx->agent_path = agent_path;
+        }
+    }
+
     return true;
 }
 
+/**
+ * Initialize the libraries, and the networking of a credentials source that talks to an endpoint. aws-c-auth is
+ * initialized for every source, since it registers the error strings its providers report failures with. The event
+ * loop group, host resolver, bootstrap and TLS context are the slow part of a cold start, so only the sources that
+ * need them pay for them.
+ *
+ * @return AWS_OP_SUCCESS if successful, AWS_OP_ERR otherwise
+ */
+static int s_init_libraries(struct dsql_token_ctx *ctx) {
+    aws_io_library_init(ctx->allocator);
+    aws_auth_library_init(ctx->allocator);
+    aws_sdkutils_library_init(ctx->allocator);
+    ctx->auth_initialized = true;
+
+    switch (ctx->credentials_source) {
+        case DSQL_TOKEN_CREDENTIALS_ENV:
+        case DSQL_TOKEN_CREDENTIALS_PROFILE:
+        case DSQL_TOKEN_CREDENTIALS_PROCESS:
+            /* Read from the environment, the shared config and credentials files or a child process */
+            return AWS_OP_SUCCESS;
+
+        case DSQL_TOKEN_CREDENTIALS_DEFAULT:
+            /* The default chain sets up its own networking */
+            return AWS_OP_SUCCESS;
+
+        default:
+            break;
+    }
+
+    ctx->event_loop_group = aws_event_loop_group_new_default(ctx->allocator, 1, NULL);
+    if (!ctx->event_loop_group) {
+        return AWS_OP_ERR;
+    }
+
+    struct aws_host_resolver_default_options resolver_options = {
+        .max_entries = 8,
+        .el_group = ctx->event_loop_group,
+    };
+    ctx->host_resolver = aws_host_resolver_new_default(ctx->allocator, &resolver_options);
+    if (!ctx->host_resolver) {
+        return AWS_OP_ERR;
+    }
+
+    struct aws_client_bootstrap_options bootstrap_options = {
+        .event_loop_group = ctx->event_loop_group,
+        .host_resolver = ctx->host_resolver,
+    };
+    ctx->bootstrap = aws_client_bootstrap_new(ctx->allocator, &bootstrap_options);
+    if (!ctx->bootstrap) {
+        return AWS_OP_ERR;
+    }
+
+    /* A container credentials endpoint may be HTTPS; IMDS is always plain HTTP */
+    if (ctx->credentials_source == DSQL_TOKEN_CREDENTIALS_ECS) {
+        struct aws_tls_ctx_options tls_options;
+        aws_tls_ctx_options_init_default_client(&tls_options, ctx->allocator);
+        ctx->tls_ctx = aws_tls_client_ctx_new(ctx->allocator, &tls_options);
+        aws_tls_ctx_options_clean_up(&tls_options);
+        if (!ctx->tls_ctx) {
+            return AWS_OP_ERR;
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+static void s_clean_up_libraries(struct dsql_token_ctx *ctx) {
+    if (ctx->tls_ctx) {
+        aws_tls_ctx_release(ctx->tls_ctx);
+    }
+    if (ctx->bootstrap) {
+        aws_client_bootstrap_release(ctx->bootstrap);
+    }
+    if (ctx->host_resolver) {
+        aws_host_resolver_release(ctx->host_resolver);
+    }
+    if (ctx->event_loop_group) {
+        aws_event_loop_group_release(ctx->event_loop_group);
+        aws_thread_join_all_managed();
+    }
+
+    if (ctx->auth_initialized) {
+        aws_sdkutils_library_clean_up();
+        aws_auth_library_clean_up();
+        aws_io_library_clean_up();
+    }
+}
+
+static struct aws_credentials_provider *s_new_credentials_provider(struct dsql_token_ctx *ctx) {
+    switch (ctx->credentials_source) {
+        case DSQL_TOKEN_CREDENTIALS_ENV: {
+            struct aws_credentials_provider_environment_options options = {0};
+            return aws_credentials_provider_new_environment(ctx->allocator, &options);
+        }
+
+        case DSQL_TOKEN_CREDENTIALS_PROFILE: {
+            /* Without a bootstrap, profiles that assume a role fail; the default chain handles those */
+            struct aws_credentials_provider_profile_options options = {0};
+            return aws_credentials_provider_new_profile(ctx->allocator, &options);
+        }
+
+        case DSQL_TOKEN_CREDENTIALS_IMDS: {
+            struct aws_credentials_provider_imds_options options = {.bootstrap = ctx->bootstrap};
+            return aws_credentials_provider_new_imds(ctx->allocator, &options);
+        }
+
+        case DSQL_TOKEN_CREDENTIALS_ECS: {
+            struct aws_credentials_provider_ecs_environment_options options = {
+                .bootstrap = ctx->bootstrap,
+                .tls_ctx = ctx->tls_ctx,
+            };
+            return aws_credentials_provider_new_ecs_from_environment(ctx->allocator, &options);
+        }
+
+        case DSQL_TOKEN_CREDENTIALS_PROCESS: {
+            struct aws_credentials_provider_process_options options = {0};
+            return aws_credentials_provider_new_process(ctx->allocator, &options);
+        }
+
+        default: {
+            struct aws_credentials_provider_chain_default_options options = {0};
+            return aws_credentials_provider_new_chain_default(ctx->allocator, &options);
+        }
+    }
+}
+
+static uint64_t s_now_secs(void) {
+    uint64_t now_ns = 0;
+    aws_sys_clock_get_ticks(&now_ns);
+    return aws_timestamp_convert(now_ns, AWS_TIMESTAMP_NANOS, AWS_TIMESTAMP_SECS, NULL);
+}
+
+/* Open the cache file for a single-token run. A cache that cannot be used only costs the reuse, so this never fails */
+static struct dsql_token_file_cache *s_open_file_cache(struct dsql_token_ctx *ctx) {
+    if (ctx->file_cache_path) {
+        return dsql_token_file_cache_open(ctx->allocator, ctx->file_cache_path);
+    }
+
+    struct aws_byte_buf path;
+    if (dsql_token_file_cache_default_path(ctx->allocator, &path)) {
+        fprintf(stderr, "Warning: XDG_RUNTIME_DIR is not set, use --cache-file to choose the token cache\n");
+        return NULL;
+    }
+
+    struct dsql_token_file_cache *cache = dsql_token_file_cache_open(ctx->allocator, (const char *)path.buffer);
+    aws_byte_buf_clean_up(&path);
+    return cache;
+}
+
+/**
+ * Build what selects the credentials without looking them up: the credentials source, AWS_PROFILE and
+ * AWS_ACCESS_KEY_ID, separated by commas. Runs whose selectors differ may sign with different identities, so they never
+ * share tokens through the cache file or an agent.
+ *
+ * @return AWS_OP_SUCCESS if the selector fits in buffer, AWS_OP_ERR otherwise
+ */
+static int s_build_credentials_selector(const struct dsql_token_ctx *ctx, char *buffer, size_t buffer_size) {
+    const char *profile = getenv("AWS_PROFILE");
+    const char *access_key_id = getenv("AWS_ACCESS_KEY_ID");
+
+    int length = snprintf(
+        buffer,
+        buffer_size,
+        "%s,%s,%s",
+        s_credentials_source_names[ctx->credentials_source],
+        profile ? profile : "",
+        access_key_id ? access_key_id : "");
+    if (length < 0 || (size_t)length >= buffer_size) {
+        return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Build the cache file key for a token: what is signed, and the credentials selector.
+ *
+ * @return AWS_OP_SUCCESS if the key fits in buffer, AWS_OP_ERR otherwise
+ */
+static int s_build_file_cache_key(
+    const struct dsql_token_ctx *ctx,
+    const struct aws_dsql_auth_config *config,
+    char *buffer,
+    size_t buffer_size,
+    struct aws_byte_cursor *out_key) {
+
+    int length = snprintf(
+        buffer,
+        buffer_size,
+        "%s %s %s %llu %s",
+        config->hostname,
+        aws_string_c_str(config->region),
+        ctx->admin ? "admin" : "user",
+        (unsigned long long)config->expires_in,
+        ctx->credentials_selector);
+    if (length < 0 || (size_t)length >= buffer_size) {
+        return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+    }
+
+    *out_key = aws_byte_cursor_from_array(buffer, (size_t)length);
+    return AWS_OP_SUCCESS;
+}
+
+/* Split off the next whitespace separated field of the line, or return an empty cursor at the end */
+static struct aws_byte_cursor s_next_field(struct aws_byte_cursor *line) {
+    while (line->len > 0 && isspace(*line->ptr)) {
+        aws_byte_cursor_advance(line, 1);
+    }
+
+    size_t length = 0;
+    while (length < line->len && !isspace(line->ptr[length])) {
+        ++length;
+    }
+
+    return aws_byte_cursor_advance(line, length);
+}
+
+/**
+ * Parse a 'HOSTNAME [REGION] [admin]' line into a batch entry. The region is inferred from the hostname when absent.
+ *
+ * @return AWS_OP_SUCCESS if the line was parsed, AWS_OP_ERR otherwise with the reason printed
+ */
+static int s_parse_stream_line(
+    struct dsql_token_ctx *ctx,
+    struct aws_byte_cursor line,
+    struct dsql_token_stream_line *parsed,
+    struct aws_dsql_auth_token_batch_entry *entry) {
+
+    struct aws_byte_cursor hostname = s_next_field(&line);
+    struct aws_byte_cursor region = {0};
+
+    entry->is_admin = ctx->admin;
+
+    struct aws_byte_cursor field = s_next_field(&line);
+    for (; field.len > 0; field = s_next_field(&line)) {
+        if (aws_byte_cursor_eq_c_str(&field, "admin")) {
+            entry->is_admin = true;
+        } else if (region.len == 0) {
+            region = field;
+        } else {
+            fprintf(
+                stderr,
+                "Error: line %zu: unexpected field '" PRInSTR "'\n",
+                parsed->line_number,
+                AWS_BYTE_CURSOR_PRI(field));
+            return AWS_OP_ERR;
+        }
+    }
+
+    if (region.len == 0 && ctx->region) {
+        region = aws_byte_cursor_from_string(ctx->region);
+    }
+
+    if (region.len == 0 && aws_dsql_auth_hostname_parse_region(hostname, &region)) {
+        fprintf(
+            stderr,
+            "Error: line %zu: failed to infer AWS region from '" PRInSTR "', add it after the hostname\n",
+            parsed->line_number,
+            AWS_BYTE_CURSOR_PRI(hostname));
+        return AWS_OP_ERR;
+    }
+
+    parsed->hostname = aws_string_new_from_cursor(ctx->allocator, &hostname);
+    parsed->region = aws_string_new_from_cursor(ctx->allocator, &region);
+    if (!parsed->hostname || !parsed->region) {
+        fprintf(stderr, "Error: line %zu: %s\n", parsed->line_number, aws_error_str(aws_last_error()));
+        return AWS_OP_ERR;
+    }
+
+    entry->hostname = aws_string_c_str(parsed->hostname);
+    entry->region = parsed->region;
+    return AWS_OP_SUCCESS;
+}
+
+static void s_stream_worker_fn(void *arg) {
+    struct dsql_token_stream_worker *worker = arg;
+
+    /* Failures are reported per entry */
+    aws_dsql_auth_token_generate_batch(
+        worker->config, worker->entries, worker->tokens, worker->count, worker->allocator);
+}
+
+/* Generate every parsed entry of a chunk, split across the workers */
+static void s_generate_stream_chunk(
+    struct dsql_token_ctx *ctx,
+    const struct aws_dsql_auth_config *config,
+    struct aws_dsql_auth_token_batch_entry *entries,
+    struct aws_dsql_auth_token *tokens,
+    size_t count) {
+
+    struct dsql_token_stream_worker workers[MAX_WORKERS];
+    size_t per_worker = (count + ctx->workers - 1) / ctx->workers;
+    size_t worker_count = 0;
+
+    for (size_t start = 0; start < count; start += per_worker) {
+        struct dsql_token_stream_worker *worker = &workers[worker_count++];
+        worker->allocator = ctx->allocator;
+        worker->config = config;
+        worker->entries = entries + start;
+        worker->tokens = tokens + start;
+        worker->count = count - start < per_worker ? count - start : per_worker;
+    }
+
+    /* The first slice runs on this thread; if a thread cannot be launched its slice runs here too */
+    bool launched[MAX_WORKERS] = {false};
+    for (size_t i = 1; i < worker_count; ++i) {
+        aws_thread_init(&workers[i].thread, ctx->allocator);
+        launched[i] =
+            aws_thread_launch(&workers[i].thread, s_stream_worker_fn, &workers[i], aws_default_thread_options()) ==
+            AWS_OP_SUCCESS;
+        if (!launched[i]) {
+            aws_thread_clean_up(&workers[i].thread);
+            s_stream_worker_fn(&workers[i]);
+        }
+    }
+
+    s_stream_worker_fn(&workers[0]);
+
+    for (size_t i = 1; i < worker_count; ++i) {
+        if (launched[i]) {
+            aws_thread_join(&workers[i].thread);
+            aws_thread_clean_up(&workers[i].thread);
+        }
+    }
+}
+
+static void s_clean_up_stream_chunk(
+    struct dsql_token_stream_line *lines,
+    struct aws_dsql_auth_token *tokens,
+    size_t count) {
+
+    for (size_t i = 0; i < count; ++i) {
+        aws_string_destroy(lines[i].hostname);
+        aws_string_destroy(lines[i].region);
+        aws_dsql_auth_token_clean_up(&tokens[i]);
+    }
+}
+
+/**
+ * Write a token line for every chunk line in input order. A line that failed gets an empty output line, so output
+ * lines keep matching input lines, and the reason is printed to stderr.
+ *
+ * @return true if every line of the chunk has a token
+ */
+static bool s_write_stream_chunk(
+    const struct dsql_token_stream_line *lines,
+    const struct aws_dsql_auth_token_batch_entry *entries,
+    const struct aws_dsql_auth_token *tokens,
+    size_t count) {
+
+    bool all_succeeded = true;
+
+    for (size_t i = 0; i < count; ++i) {
+        if (entries[i].error_code == AWS_ERROR_SUCCESS) {
+            printf("%s\n", aws_dsql_auth_token_get_str(&tokens[i]));
+            continue;
+        }
+
+        /* Lines that failed to parse were already reported */
+        if (lines[i].hostname) {
+            fprintf(
+                stderr,
+                "Error: line %zu: failed to generate auth token for %s: %s\n",
+                lines[i].line_number,
+                aws_string_c_str(lines[i].hostname),
+                aws_error_str(entries[i].error_code));
+        }
+        printf("\n");
+        all_succeeded = false;
+    }
+
+    fflush(stdout);
+    return all_succeeded;
+}
+
+/**
+ * Stream tokens for every line of the input. Blank lines and lines starting with '#' are skipped.
+ *
+ * @return AWS_OP_SUCCESS if every line got a token, AWS_OP_ERR otherwise
+ */
+static int s_run_stream(struct dsql_token_ctx *ctx, const struct aws_dsql_auth_config *config) {
+    bool from_stdin = strcmp(ctx->input_path, "-") == 0;
+    FILE *input = from_stdin ? stdin : fopen(ctx->input_path, "r");
+    if (!input) {
+        fprintf(stderr, "Error: Failed to open %s\n", ctx->input_path);
+        return AWS_OP_ERR;
+    }
+
+    struct dsql_token_stream_line lines[STREAM_CHUNK_SIZE];
+    struct aws_dsql_auth_token_batch_entry entries[STREAM_CHUNK_SIZE];
+    struct aws_dsql_auth_token tokens[STREAM_CHUNK_SIZE];
+    /* Room for the longest line, its newline and the terminator */
+    char buffer[STREAM_MAX_LINE_LENGTH + 2];
+    size_t line_number = 0;
+    bool all_succeeded = true;
+    bool at_end = false;
+
+    while (!at_end) {
+        size_t count = 0;
+        AWS_ZERO_ARRAY(lines);
+        AWS_ZERO_ARRAY(entries);
+        AWS_ZERO_ARRAY(tokens);
+
+        while (count < STREAM_CHUNK_SIZE) {
+            if (!fgets(buffer, sizeof(buffer), input)) {
+                at_end = true;
+                break;
+            }
+            ++line_number;
+
+            /* Only a line too long fills the buffer without its newline; the last line may end without one */
+            struct aws_byte_cursor line = aws_byte_cursor_from_c_str(buffer);
+            bool is_too_long = line.len == sizeof(buffer) - 1 && buffer[line.len - 1] != '\n';
+            if (is_too_long) {
+                int next;
+                do {
+                    next = fgetc(input);
+                } while (next != EOF && next != '\n');
+            }
+
+            struct aws_byte_cursor first = line;
+            struct aws_byte_cursor first_field = s_next_field(&first);
+            if (first_field.len == 0 || first_field.ptr[0] == '#') {
+                continue;
+            }
+
+            /* Left without a hostname, so that it fails and gets its empty output line like any bad line */
+            if (is_too_long) {
+                fprintf(stderr, "Error: line %zu is longer than %d characters\n", line_number, STREAM_MAX_LINE_LENGTH);
+                lines[count].line_number = line_number;
+                ++count;
+                continue;
+            }
+
+            lines[count].line_number = line_number;
+            if (s_parse_stream_line(ctx, line, &lines[count], &entries[count])) {
+                /* Generation skips entries without a hostname; mark the line failed */
+                entries[count].hostname = NULL;
+                entries[count].region = NULL;
+                if (lines[count].hostname) {
+                    aws_string_destroy(lines[count].hostname);
+                    lines[count].hostname = NULL;
+                }
+                if (lines[count].region) {
+                    aws_string_destroy(lines[count].region);
+                    lines[count].region = NULL;
+                }
+            }
+            ++count;
+        }
+
+        if (count > 0) {
+            s_generate_stream_chunk(ctx, config, entries, tokens, count);
+            all_succeeded = s_write_stream_chunk(lines, entries, tokens, count) && all_succeeded;
+            s_clean_up_stream_chunk(lines, tokens, count);
+        }
+    }
+
+    if (!from_stdin) {
+        fclose(input);
+    }
+
+    return all_succeeded ? AWS_OP_SUCCESS : AWS_OP_ERR;
+}
+
 int main(int argc, char **argv) {
     struct aws_allocator *allocator = aws_default_allocator();
     struct dsql_token_ctx ctx = {.allocator = allocator};
     int result = AWS_OP_ERR; /* Initialize to error by default */
+    struct dsql_token_file_cache *file_cache = NULL;
+    char file_cache_key_buffer[1024];
+    struct aws_byte_cursor file_cache_key = {0};
     struct aws_credentials_provider *credentials_provider = NULL;
 
-    /* Initialize required AWS libraries */
+    /* Everything else is initialized once we know the token cannot come from an agent */
     aws_common_library_init(allocator);
-    aws_io_library_init(allocator);
-    aws_auth_library_init(allocator);
-    aws_sdkutils_library_init(allocator);
 
     /* Parse command line arguments */
     if (!s_parse_args(argc, argv, &ctx)) {
@@ -128,29 +771,38 @@ int main(int argc, char **argv) {
     struct aws_dsql_auth_config auth_config;
     aws_dsql_auth_config_init(&auth_config);
 
-    /* Set hostname */
-    aws_dsql_auth_config_set_hostname(&auth_config, aws_string_c_str(ctx.hostname));
+    if (s_build_credentials_selector(&ctx, ctx.credentials_selector, sizeof(ctx.credentials_selector))) {
+        fprintf(stderr, "Error: AWS_PROFILE and AWS_ACCESS_KEY_ID are too long\n");
+        goto cleanup;
+    }
 
-    /* Set region if provided, otherwise try to infer from hostname */
-    if (ctx.region) {
-        aws_dsql_auth_config_set_region(&auth_config, ctx.region);
-    } else {
-        /* Try to infer region from hostname */
-        struct aws_string *inferred_region = NULL;
-        if (aws_dsql_auth_config_infer_region(allocator, &auth_config, &inferred_region) != AWS_OP_SUCCESS ||
-            inferred_region == NULL) {
-            fprintf(
-                stderr,
-                "Error: Failed to infer AWS region from hostname. Please provide region explicitly with --region.\n");
-            result = AWS_OP_ERR;
-            goto cleanup;
-        }
+    /* Streaming input lines and agent requests name their own hostname and region */
+    if (ctx.hostname) {
+        /* Set hostname */
+        aws_dsql_auth_config_set_hostname(&auth_config, aws_string_c_str(ctx.hostname));
+
+        /* Set region if provided, otherwise try to infer from hostname */
+        if (ctx.region) {
+            aws_dsql_auth_config_set_region(&auth_config, ctx.region);
+        } else {
+            /* Try to infer region from hostname */
+            struct aws_string *inferred_region = NULL;
+            if (aws_dsql_auth_config_infer_region(allocator, &auth_config, &inferred_region) != AWS_OP_SUCCESS ||
+                inferred_region == NULL) {
+                fprintf(
+                    stderr,
+                    "Error: Failed to infer AWS region from hostname. "
+                    "Please provide region explicitly with --region.\n");
+                result = AWS_OP_ERR;
+                goto cleanup;
+            }
 
-        /* Store the inferred region in the config */
-        auth_config.region = inferred_region;
+            /* Store the inferred region in the config */
+            auth_config.region = inferred_region;
 
-        /* Remember to free the region later */
-        ctx.region = inferred_region;
+            /* Remember to free the region later */
+            ctx.region = inferred_region;
+        }
     }
 
     /* Set expires_in if provided, otherwise default will be used */
@@ -158,23 +810,94 @@ int main(int argc, char **argv) {
         aws_dsql_auth_config_set_expires_in(&auth_config, ctx.expires_in);
     }
 
-    /* Create default credentials provider */
-    struct aws_credentials_provider_chain_default_options credentials_provider_options = {0};
+    /* A token another run left in the cache file needs no credentials and no signing */
+    if (ctx.use_file_cache && ctx.hostname) {
+        file_cache = s_open_file_cache(&ctx);
+        size_t key_buffer_size = sizeof(file_cache_key_buffer);
+        if (file_cache &&
+            s_build_file_cache_key(&ctx, &auth_config, file_cache_key_buffer, key_buffer_size, &file_cache_key)) {
+            dsql_token_file_cache_close(file_cache);
+            file_cache = NULL;
+        }
+
+        uint64_t valid_until_secs = s_now_secs() + FILE_CACHE_MIN_REMAINING_SECONDS;
+        struct aws_byte_buf cached_token;
+        if (file_cache &&
+            dsql_token_file_cache_get(file_cache, file_cache_key, valid_until_secs, &cached_token, allocator) ==
+                AWS_OP_SUCCESS) {
+            printf(PRInSTR "\n", AWS_BYTE_BUF_PRI(cached_token));
+            aws_byte_buf_clean_up_secure(&cached_token);
+            result = AWS_OP_SUCCESS;
+            goto cleanup;
+        }
+    }
+
+    /* An agent that is already running has warm credentials and tokens; if there is none, generate here */
+    if (ctx.agent_path && ctx.hostname) {
+        struct aws_byte_buf agent_token;
+        if (dsql_token_agent_request(
+                ctx.agent_path,
+                aws_string_c_str(ctx.hostname),
+                ctx.region,
+                ctx.admin,
+                ctx.expires_in,
+                ctx.credentials_selector,
+                &agent_token,
+                allocator) == AWS_OP_SUCCESS) {
+            printf(PRInSTR "\n", AWS_BYTE_BUF_PRI(agent_token));
+            aws_byte_buf_clean_up_secure(&agent_token);
+            result = AWS_OP_SUCCESS;
+            goto cleanup;
+        }
+    }
+
+    /* Create the credentials provider, initializing only what its source needs */
+    if (s_init_libraries(&ctx) != AWS_OP_SUCCESS) {
+        fprintf(stderr, "Error: Failed to initialize: %s\n", aws_error_str(aws_last_error()));
+        goto cleanup;
+    }
 
-    credentials_provider = aws_credentials_provider_new_chain_default(allocator, &credentials_provider_options);
+    credentials_provider = s_new_credentials_provider(&ctx);
 
     if (!credentials_provider) {
         fprintf(stderr, "Error: Failed to create credentials provider\n");
         goto cleanup;
     }
 
+    /* Streaming runs and agents resolve credentials once and keep serving them, refreshed ahead of expiry */
+    if (ctx.input_path || ctx.serve_path) {
+        struct aws_dsql_auth_credentials_snapshot_options snapshot_options = {.source = credentials_provider};
+        struct aws_credentials_provider *snapshot =
+            aws_dsql_auth_credentials_provider_new_snapshot(allocator, &snapshot_options);
+        aws_credentials_provider_release(credentials_provider);
+        credentials_provider = snapshot;
+
+        if (!credentials_provider) {
+            fprintf(stderr, "Error: Failed to create credentials provider\n");
+            goto cleanup;
+        }
+    }
+
     /* Set credentials provider */
     aws_dsql_auth_config_set_credentials_provider(&auth_config, credentials_provider);
 
+    if (ctx.input_path) {
+        result = s_run_stream(&ctx, &auth_config);
+        goto cleanup;
+    }
+
+    if (ctx.serve_path) {
+        result = dsql_token_agent_serve(
+            allocator, ctx.serve_path, credentials_provider, ctx.credentials_selector, ctx.workers);
+        if (result != AWS_OP_SUCCESS) {
+            fprintf(stderr, "Error: Failed to run agent: %s\n", aws_error_str(aws_last_error()));
+        }
+        goto cleanup;
+    }
+
     /* Generate the auth token */
     struct aws_dsql_auth_token auth_token = {0}; /* Initialize with zeros */
 
-    /* Generate the token */
     result = aws_dsql_auth_token_generate(&auth_config, ctx.admin, allocator, &auth_token);
 
     if (result != AWS_OP_SUCCESS) {
@@ -185,11 +908,21 @@ int main(int argc, char **argv) {
     /* Print the token */
     printf("%s\n", aws_dsql_auth_token_get_str(&auth_token));
 
+    /* Failing to share the token does not fail the run */
+    if (file_cache) {
+        dsql_token_file_cache_put(
+            file_cache,
+            file_cache_key,
+            aws_byte_cursor_from_c_str(aws_dsql_auth_token_get_str(&auth_token)),
+            aws_dsql_auth_token_get_expiration_timepoint_seconds(&auth_token));
+    }
+
     /* Clean up */
 cleanup_token:
     aws_dsql_auth_token_clean_up(&auth_token);
 
 cleanup:
+    dsql_token_file_cache_close(file_cache);
     if (credentials_provider) {
         aws_credentials_provider_release(credentials_provider);
     }
@@ -202,9 +935,7 @@ cleanup:
         aws_string_destroy((void *)ctx.region);
     }
 
-    aws_sdkutils_library_clean_up();
-    aws_auth_library_clean_up();
-    aws_io_library_clean_up();
+    s_clean_up_libraries(&ctx);
     aws_common_library_clean_up();
 
     return (result == AWS_OP_SUCCESS) ? 0 : 1;
@@ -0,0 +1,513 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "dsql_token_agent.h"
+
+#include <aws/common/error.h>
+#include <aws/common/thread.h>
+#include <aws/dsql-auth/auth_token.h>
+#include <aws/dsql-auth/token_cache.h>
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+
+#    include <errno.h>
+#    include <fcntl.h>
+#    include <poll.h>
+#    include <signal.h>
+#    include <sys/socket.h>
+#    include <sys/stat.h>
+#    include <sys/time.h>
+#    include <sys/un.h>
+#    include <unistd.h>
+
+/* Longest request or response line; a token is well under this */
+enum { AGENT_MAX_LINE_LENGTH = 4096 };
+
+/* A connection that stalls for this long is dropped, so a stuck client cannot hold a worker */
+enum { AGENT_IO_TIMEOUT_SECONDS = 10 };
+
+/* How often idle workers check whether the agent is stopping */
+enum { AGENT_POLL_INTERVAL_MS = 250 };
+
+enum { AGENT_MAX_WORKERS = 64 };
+
+struct dsql_token_agent {
+    struct aws_allocator *allocator;
+    struct aws_credentials_provider *credentials_provider;
+    const char *credentials_selector;
+    struct aws_dsql_auth_token_cache *cache;
+    int listen_fd;
+};
+
+static volatile sig_atomic_t s_stop_requested = 0;
+
+static void s_on_stop_signal(int signal_number) {
+    (void)signal_number;
+    s_stop_requested = 1;
+}
+
+static int s_init_address(const char *socket_path, struct sockaddr_un *address) {
+    AWS_ZERO_STRUCT(*address);
+    address->sun_family = AF_UNIX;
+
+    size_t path_length = strlen(socket_path);
+    if (path_length == 0 || path_length >= sizeof(address->sun_path)) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    memcpy(address->sun_path, socket_path, path_length);
+    return AWS_OP_SUCCESS;
+}
+
+static void s_set_io_timeouts(int fd) {
+    struct timeval timeout = {.tv_sec = AGENT_IO_TIMEOUT_SECONDS};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+static int s_write_all(int fd, struct aws_byte_cursor data) {
+    while (data.len > 0) {
+        ssize_t written = write(fd, data.ptr, data.len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return aws_raise_error(AWS_ERROR_SYS_CALL_FAILURE);
+        }
+        aws_byte_cursor_advance(&data, (size_t)written);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Split off the next space separated field of the line, or return an empty cursor at the end */
+static struct aws_byte_cursor s_next_field(struct aws_byte_cursor *line) {
+    while (line->len > 0 && isspace(*line->ptr)) {
+        aws_byte_cursor_advance(line, 1);
+    }
+
+    size_t length = 0;
+    while (length < line->len && !isspace(line->ptr[length])) {
+        ++length;
+    }
+
+    return aws_byte_cursor_advance(line, length);
+}
+
+static void s_append_error(struct aws_byte_buf *response, const char *message) {
+    struct aws_byte_cursor prefix = aws_byte_cursor_from_c_str("ERR ");
+    struct aws_byte_cursor text = aws_byte_cursor_from_c_str(message);
+    struct aws_byte_cursor newline = aws_byte_cursor_from_c_str("\n");
+
+    aws_byte_buf_reset(response, false);
+    aws_byte_buf_append_dynamic(response, &prefix);
+    aws_byte_buf_append_dynamic(response, &text);
+    aws_byte_buf_append_dynamic(response, &newline);
+}
+
+/* Answer one request line, leaving the response line in response */
+static void s_handle_request(
+    struct dsql_token_agent *agent,
+    struct aws_byte_cursor line,
+    struct aws_byte_buf *response) {
+
+    struct aws_byte_cursor hostname = s_next_field(&line);
+    struct aws_byte_cursor region = s_next_field(&line);
+    struct aws_byte_cursor role = s_next_field(&line);
+    struct aws_byte_cursor expires = s_next_field(&line);
+    struct aws_byte_cursor credentials_selector = s_next_field(&line);
+    uint64_t expires_in = 0;
+
+    if (hostname.len == 0 || region.len == 0 || credentials_selector.len == 0 || s_next_field(&line).len != 0 ||
+        !(aws_byte_cursor_eq_c_str(&role, "admin") || aws_byte_cursor_eq_c_str(&role, "user")) ||
+        aws_byte_cursor_utf8_parse_u64(expires, &expires_in)) {
+        s_append_error(response, "malformed request");
+        return;
+    }
+
+    /* The agent only signs with its own credentials, so a client that selects others must sign for itself */
+    if (!aws_byte_cursor_eq_c_str(&credentials_selector, agent->credentials_selector)) {
+        s_append_error(response, "credentials do not match the agent's");
+        return;
+    }
+
+    if (aws_byte_cursor_eq_c_str(&region, "-") && aws_dsql_auth_hostname_parse_region(hostname, &region)) {
+        s_append_error(response, "failed to infer AWS region from hostname");
+        return;
+    }
+
+    struct aws_string *hostname_str = aws_string_new_from_cursor(agent->allocator, &hostname);
+    struct aws_string *region_str = aws_string_new_from_cursor(agent->allocator, &region);
+    struct aws_dsql_auth_token token = {0};
+
+    if (!hostname_str || !region_str) {
+        s_append_error(response, aws_error_str(aws_last_error()));
+        goto done;
+    }
+
+    /* The agent holds the provider for its whole lifetime, so the config borrows it instead of acquiring it */
+    struct aws_dsql_auth_config config;
+    aws_dsql_auth_config_init(&config);
+    aws_dsql_auth_config_set_hostname(&config, aws_string_c_str(hostname_str));
+    aws_dsql_auth_config_set_region(&config, region_str);
+    config.credentials_provider = agent->credentials_provider;
+    if (expires_in > 0) {
+        aws_dsql_auth_config_set_expires_in(&config, expires_in);
+    }
+
+    bool is_admin = aws_byte_cursor_eq_c_str(&role, "admin");
+    if (aws_dsql_auth_token_cache_get(agent->cache, &config, is_admin, agent->allocator, &token)) {
+        s_append_error(response, aws_error_str(aws_last_error()));
+        goto done;
+    }
+
+    struct aws_byte_cursor prefix = aws_byte_cursor_from_c_str("OK ");
+    struct aws_byte_cursor value = aws_byte_cursor_from_c_str(aws_dsql_auth_token_get_str(&token));
+    struct aws_byte_cursor newline = aws_byte_cursor_from_c_str("\n");
+
+    aws_byte_buf_reset(response, false);
+    if (aws_byte_buf_append_dynamic(response, &prefix) || aws_byte_buf_append_dynamic(response, &value) ||
+        aws_byte_buf_append_dynamic(response, &newline)) {
+        s_append_error(response, aws_error_str(aws_last_error()));
+    }
+
+done:
+    aws_dsql_auth_token_clean_up(&token);
+    aws_string_destroy(hostname_str);
+    aws_string_destroy(region_str);
+}
+
+/* Answer requests on a connection until the client closes it, stalls, or sends a line that is too long */
+static void s_serve_connection(struct dsql_token_agent *agent, int fd) {
+    uint8_t buffer[AGENT_MAX_LINE_LENGTH];
+    size_t used = 0;
+    struct aws_byte_buf response;
+
+    if (aws_byte_buf_init(&response, agent->allocator, 1024)) {
+        return;
+    }
+
+    while (!s_stop_requested) {
+        ssize_t received = read(fd, buffer + used, sizeof(buffer) - used);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            break;
+        }
+        used += (size_t)received;
+
+        /* Answer every complete line received so far, then keep the partial line that follows them */
+        size_t line_start = 0;
+        for (size_t i = 0; i < used; ++i) {
+            if (buffer[i] != '\n') {
+                continue;
+            }
+
+            s_handle_request(agent, aws_byte_cursor_from_array(buffer + line_start, i - line_start), &response);
+            if (s_write_all(fd, aws_byte_cursor_from_buf(&response))) {
+                goto done;
+            }
+            line_start = i + 1;
+        }
+
+        memmove(buffer, buffer + line_start, used - line_start);
+        used -= line_start;
+
+        if (used == sizeof(buffer)) {
+            s_append_error(&response, "request too long");
+            s_write_all(fd, aws_byte_cursor_from_buf(&response));
+            break;
+        }
+    }
+
+done:
+    aws_byte_buf_clean_up(&response);
+}
+
+static void s_worker_fn(void *arg) {
+    struct dsql_token_agent *agent = arg;
+
+    while (!s_stop_requested) {
+        struct pollfd ready = {.fd = agent->listen_fd, .events = POLLIN};
+        if (poll(&ready, 1, AGENT_POLL_INTERVAL_MS) <= 0) {
+            continue;
+        }
+
+        /* The listening socket is non-blocking, so a worker that loses the race for a connection just polls again */
+        int fd = accept(agent->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+
+        /* Some platforms pass O_NONBLOCK on to accepted sockets; connections use blocking I/O with timeouts */
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+        s_set_io_timeouts(fd);
+
+        s_serve_connection(agent, fd);
+        close(fd);
+    }
+}
+
+/* A socket left by an agent that exited uncleanly can be replaced; anything else at the path is left alone */
+static int s_remove_stale_socket(const char *socket_path, const struct sockaddr_un *address) {
+    struct stat info;
+    if (lstat(socket_path, &info)) {
+        return AWS_OP_SUCCESS;
+    }
+
+    if (!S_ISSOCK(info.st_mode)) {
+        fprintf(stderr, "Error: %s exists and is not a socket\n", socket_path);
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe < 0) {
+        return aws_raise_error(AWS_ERROR_SYS_CALL_FAILURE);
+    }
+
+    bool in_use = connect(probe, (const struct sockaddr *)address, sizeof(*address)) == 0;
+    close(probe);
+    if (in_use) {
+        fprintf(stderr, "Error: an agent is already listening on %s\n", socket_path);
+        return aws_raise_error(AWS_ERROR_INVALID_STATE);
+    }
+
+    unlink(socket_path);
+    return AWS_OP_SUCCESS;
+}
+
+static int s_listen(const char *socket_path, int *out_fd) {
+    struct sockaddr_un address;
+    if (s_init_address(socket_path, &address)) {
+        fprintf(stderr, "Error: socket path %s is empty or too long\n", socket_path);
+        return AWS_OP_ERR;
+    }
+
+    if (s_remove_stale_socket(socket_path, &address)) {
+        return AWS_OP_ERR;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return aws_raise_error(AWS_ERROR_SYS_CALL_FAILURE);
+    }
+
+    /* Anyone who can connect can get tokens, so the socket is created accessible to its owner only */
+    mode_t previous_mask = umask(0177);
+    int bound = bind(fd, (const struct sockaddr *)&address, sizeof(address));
+    umask(previous_mask);
+
+    if (bound || listen(fd, SOMAXCONN) || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK)) {
+        fprintf(stderr, "Error: failed to listen on %s: %s\n", socket_path, strerror(errno));
+        close(fd);
+        if (!bound) {
+            unlink(socket_path);
+        }
+        return aws_raise_error(AWS_ERROR_SYS_CALL_FAILURE);
+    }
+
+    *out_fd = fd;
+    return AWS_OP_SUCCESS;
+}
+
+int dsql_token_agent_serve(
+    struct aws_allocator *allocator,
+    const char *socket_path,
+    struct aws_credentials_provider *credentials_provider,
+    const char *credentials_selector,
+    size_t workers) {
+
+    struct dsql_token_agent agent = {
+        .allocator = allocator,
+        .credentials_provider = credentials_provider,
+        .credentials_selector = credentials_selector,
+        .listen_fd = -1,
+    };
+
+    if (workers == 0 || workers > AGENT_MAX_WORKERS) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    agent.cache = aws_dsql_auth_token_cache_new(allocator, NULL);
+    if (!agent.cache) {
+        return AWS_OP_ERR;
+    }
+
+    if (s_listen(socket_path, &agent.listen_fd)) {
+        aws_dsql_auth_token_cache_release(agent.cache);
+        return AWS_OP_ERR;
+    }
+
+    struct sigaction stop_action;
+    AWS_ZERO_STRUCT(stop_action);
+    stop_action.sa_handler = s_on_stop_signal;
+    sigaction(SIGINT, &stop_action, NULL);
+    sigaction(SIGTERM, &stop_action, NULL);
+
+    /* A client that hangs up early must not kill the agent */
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(stderr, "dsql-token agent listening on %s\n", socket_path);
+
+    /* Workers accept connections themselves; the first one runs on this thread */
+    struct aws_thread threads[AGENT_MAX_WORKERS];
+    bool launched[AGENT_MAX_WORKERS] = {false};
+    for (size_t i = 1; i < workers; ++i) {
+        aws_thread_init(&threads[i], allocator);
+        launched[i] =
+            aws_thread_launch(&threads[i], s_worker_fn, &agent, aws_default_thread_options()) == AWS_OP_SUCCESS;
+        if (!launched[i]) {
+            aws_thread_clean_up(&threads[i]);
+        }
+    }
+
+    s_worker_fn(&agent);
+
+    for (size_t i = 1; i < workers; ++i) {
+        if (launched[i]) {
+            aws_thread_join(&threads[i]);
+            aws_thread_clean_up(&threads[i]);
+        }
+    }
+
+    close(agent.listen_fd);
+    unlink(socket_path);
+    aws_dsql_auth_token_cache_release(agent.cache);
+
+    return AWS_OP_SUCCESS;
+}
+
+int dsql_token_agent_request(
+    const char *socket_path,
+    const char *hostname,
+    const struct aws_string *region,
+    bool is_admin,
+    uint64_t expires_in,
+    const char *credentials_selector,
+    struct aws_byte_buf *out_token,
+    struct aws_allocator *allocator) {
+
+    struct sockaddr_un address;
+    if (s_init_address(socket_path, &address)) {
+        return AWS_OP_ERR;
+    }
+
+    char request[AGENT_MAX_LINE_LENGTH];
+    int request_length = snprintf(
+        request,
+        sizeof(request),
+        "%s %s %s %llu %s\n",
+        hostname,
+        region ? aws_string_c_str(region) : "-",
+        is_admin ? "admin" : "user",
+        (unsigned long long)expires_in,
+        credentials_selector);
+    if (request_length < 0 || (size_t)request_length >= sizeof(request)) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return aws_raise_error(AWS_ERROR_SYS_CALL_FAILURE);
+    }
+
+    /* The agent closing the connection early must fail the request, not kill the client */
+    void (*previous_handler)(int) = signal(SIGPIPE, SIG_IGN);
+    int result = AWS_OP_ERR;
+    char response[AGENT_MAX_LINE_LENGTH];
+    size_t used = 0;
+
+    s_set_io_timeouts(fd);
+    if (connect(fd, (const struct sockaddr *)&address, sizeof(address))) {
+        aws_raise_error(AWS_ERROR_SYS_CALL_FAILURE);
+        goto done;
+    }
+
+    if (s_write_all(fd, aws_byte_cursor_from_array(request, (size_t)request_length))) {
+        goto done;
+    }
+
+    while (used == 0 || response[used - 1] != '\n') {
+        if (used == sizeof(response)) {
+            aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+            goto done;
+        }
+
+        ssize_t received = read(fd, response + used, sizeof(response) - used);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            aws_raise_error(AWS_ERROR_SYS_CALL_FAILURE);
+            goto done;
+        }
+        used += (size_t)received;
+    }
+
+    struct aws_byte_cursor line = aws_byte_cursor_from_array(response, used - 1);
+    struct aws_byte_cursor ok = aws_byte_cursor_from_c_str("OK ");
+    if (!aws_byte_cursor_starts_with(&line, &ok)) {
+        aws_raise_error(AWS_ERROR_INVALID_STATE);
+        goto done;
+    }
+
+    aws_byte_cursor_advance(&line, ok.len);
+    if (line.len == 0 || aws_byte_buf_init_copy_from_cursor(out_token, allocator, line)) {
+        aws_raise_error(AWS_ERROR_INVALID_STATE);
+        goto done;
+    }
+
+    result = AWS_OP_SUCCESS;
+
+done:
+    close(fd);
+    signal(SIGPIPE, previous_handler);
+    return result;
+}
+
+#else /* _WIN32 */
+
+int dsql_token_agent_serve(
+    struct aws_allocator *allocator,
+    const char *socket_path,
+    struct aws_credentials_provider *credentials_provider,
+    const char *credentials_selector,
+    size_t workers) {
+
+    (void)allocator;
+    (void)socket_path;
+    (void)credentials_provider;
+    (void)credentials_selector;
+    (void)workers;
+    return aws_raise_error(AWS_ERROR_PLATFORM_NOT_SUPPORTED);
+}
+
+int dsql_token_agent_request(
+    const char *socket_path,
+    const char *hostname,
+    const struct aws_string *region,
+    bool is_admin,
+    uint64_t expires_in,
+    const char *credentials_selector,
+    struct aws_byte_buf *out_token,
+    struct aws_allocator *allocator) {
+
+    (void)socket_path;
+    (void)hostname;
+    (void)region;
+    (void)is_admin;
+    (void)expires_in;
+    (void)credentials_selector;
+    (void)out_token;
+    (void)allocator;
+    return aws_raise_error(AWS_ERROR_PLATFORM_NOT_SUPPORTED);
+}
+
+#endif /* _WIN32 */
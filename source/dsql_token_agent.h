@@ -0,0 +1,73 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef DSQL_TOKEN_AGENT_H
+#define DSQL_TOKEN_AGENT_H
+
+#include <aws/auth/credentials.h>
+#include <aws/common/byte_buf.h>
+#include <aws/common/string.h>
+
+/*
+ * The dsql-token agent: a long-running process that keeps credentials and a token cache warm and answers token
+ * requests on a Unix domain socket.
+ *
+ * The protocol is line based. Each request is one line:
+ *
+ *     <hostname> <region, or - to infer it> <admin|user> <expires-in seconds, 0 for the default> <selector>\n
+ *
+ * and is answered with one line, either "OK <token>\n" or "ERR <message>\n". A connection may send any number of
+ * requests.
+ *
+ * Every token is signed with the identity of the agent's own credentials provider, whatever the client would have
+ * resolved. The selector names what picks the client's credentials, "<source>,<AWS_PROFILE>,<AWS_ACCESS_KEY_ID>",
+ * and a request whose selector is not the agent's is answered with ERR, so that the client signs for itself.
+ */
+
+/**
+ * Serve token requests on socket_path until SIGINT or SIGTERM. The socket is created with owner-only permissions,
+ * replacing a stale socket left at the path.
+ *
+ * @param[in] allocator The allocator to use for memory allocation
+ * @param[in] socket_path Where to create the socket
+ * @param[in] credentials_provider The provider every token is signed with
+ * @param[in] credentials_selector The selector of credentials_provider; requests naming another are refused
+ * @param[in] workers The number of connections served at once
+ *
+ * @return AWS_OP_SUCCESS after a clean shutdown, AWS_OP_ERR if the agent could not start
+ */
+int dsql_token_agent_serve(
+    struct aws_allocator *allocator,
+    const char *socket_path,
+    struct aws_credentials_provider *credentials_provider,
+    const char *credentials_selector,
+    size_t workers);
+
+/**
+ * Ask the agent at socket_path for a token.
+ *
+ * @param[in] socket_path The agent's socket
+ * @param[in] hostname The hostname of the database
+ * @param[in] region The region, or NULL to have the agent infer it
+ * @param[in] is_admin Whether to request an admin token
+ * @param[in] expires_in The token lifetime in seconds, 0 for the default
+ * @param[in] credentials_selector The selector of the credentials the token must be signed with
+ * @param[out] out_token Receives the token, initialized with the allocator
+ * @param[in] allocator The allocator for out_token
+ *
+ * @return AWS_OP_SUCCESS if the agent returned a token, AWS_OP_ERR if it is unreachable, failed, or signs with other
+ *         credentials
+ */
+int dsql_token_agent_request(
+    const char *socket_path,
+    const char *hostname,
+    const struct aws_string *region,
+    bool is_admin,
+    uint64_t expires_in,
+    const char *credentials_selector,
+    struct aws_byte_buf *out_token,
+    struct aws_allocator *allocator);
+
+#endif /* DSQL_TOKEN_AGENT_H */
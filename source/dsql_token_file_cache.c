@@ -0,0 +1,338 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "dsql_token_file_cache.h"
+
+#include <aws/common/atomics.h>
+#include <aws/common/error.h>
+#include <aws/common/hash_table.h>
+#include <aws/common/zero.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The layout version is part of the file name, so processes built with different layouts never share a file */
+static const char *s_default_file_name = "/dsql-token-v1.cache";
+
+#ifndef _WIN32
+
+#    include <fcntl.h>
+#    include <sys/file.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+
+enum { FILE_CACHE_MAGIC = 0x44535154 };
+enum { FILE_CACHE_VERSION = 1 };
+enum { FILE_CACHE_SLOT_COUNT = 64 };
+
+/* Enough for a maximum length hostname, a region and the credential selectors the CLI keys on */
+enum { FILE_CACHE_KEY_SIZE = 512 };
+
+/* Tokens signed with temporary credentials carry the session token, which can exceed 1KB */
+enum { FILE_CACHE_TOKEN_SIZE = 4096 };
+
+/* A read that keeps overlapping writes gives up and misses rather than spinning */
+enum { FILE_CACHE_READ_ATTEMPTS = 4 };
+
+struct dsql_token_file_cache_slot {
+    /* Odd while a writer is updating the slot */
+    struct aws_atomic_var sequence;
+    uint64_t key_hash;
+    uint64_t expires_at_secs;
+    /* 0 for a slot that was never written */
+    uint32_t key_length;
+    uint32_t token_length;
+    uint8_t key[FILE_CACHE_KEY_SIZE];
+    uint8_t token[FILE_CACHE_TOKEN_SIZE];
+};
+
+struct dsql_token_file_cache_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t slot_size;
+};
+
+struct dsql_token_file_cache_layout {
+    struct dsql_token_file_cache_header header;
+    uint8_t header_padding[64 - sizeof(struct dsql_token_file_cache_header)];
+    struct dsql_token_file_cache_slot slots[FILE_CACHE_SLOT_COUNT];
+};
+
+struct dsql_token_file_cache {
+    struct aws_allocator *allocator;
+    int fd;
+    struct dsql_token_file_cache_layout *layout;
+};
+
+static const struct dsql_token_file_cache_header s_expected_header = {
+    .magic = FILE_CACHE_MAGIC,
+    .version = FILE_CACHE_VERSION,
+    .slot_count = FILE_CACHE_SLOT_COUNT,
+    .slot_size = sizeof(struct dsql_token_file_cache_slot),
+};
+
+int dsql_token_file_cache_default_path(struct aws_allocator *allocator, struct aws_byte_buf *out_path) {
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (!runtime_dir || runtime_dir[0] == '\0') {
+        return aws_raise_error(AWS_ERROR_INVALID_STATE);
+    }
+
+    struct aws_byte_cursor dir = aws_byte_cursor_from_c_str(runtime_dir);
+    struct aws_byte_cursor file_name = aws_byte_cursor_from_c_str(s_default_file_name);
+
+    if (aws_byte_buf_init(out_path, allocator, dir.len + file_name.len + 1)) {
+        return AWS_OP_ERR;
+    }
+
+    aws_byte_buf_append(out_path, &dir);
+    aws_byte_buf_append(out_path, &file_name);
+    aws_byte_buf_write_u8(out_path, '\0');
+    return AWS_OP_SUCCESS;
+}
+
+/* Size a new, empty file and write its header. Another process may be doing the same, so this happens under the lock */
+static int s_init_file(int fd) {
+    if (flock(fd, LOCK_EX)) {
+        return aws_raise_error(AWS_ERROR_SYS_CALL_FAILURE);
+    }
+
+    int result = AWS_OP_SUCCESS;
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size == 0) {
+        if (ftruncate(fd, sizeof(struct dsql_token_file_cache_layout)) ||
+            pwrite(fd, &s_expected_header, sizeof(s_expected_header), 0) != sizeof(s_expected_header)) {
+            result = aws_raise_error(AWS_ERROR_SYS_CALL_FAILURE);
+        }
+    }
+
+    flock(fd, LOCK_UN);
+    return result;
+}
+
+struct dsql_token_file_cache *dsql_token_file_cache_open(struct aws_allocator *allocator, const char *path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        aws_raise_error(AWS_ERROR_SYS_CALL_FAILURE);
+        return NULL;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info)) {
+        aws_raise_error(AWS_ERROR_SYS_CALL_FAILURE);
+        goto on_error;
+    }
+
+    /* Anyone who can read the file can use the tokens in it */
+    if (!S_ISREG(info.st_mode) || info.st_uid != geteuid() || (info.st_mode & 077) != 0) {
+        fprintf(stderr, "Warning: ignoring token cache %s, it must be a file only its owner can access\n", path);
+        aws_raise_error(AWS_ERROR_NO_PERMISSION);
+        goto on_error;
+    }
+
+    if (info.st_size == 0 && (s_init_file(fd) || fstat(fd, &info))) {
+        goto on_error;
+    }
+
+    if ((size_t)info.st_size != sizeof(struct dsql_token_file_cache_layout)) {
+        aws_raise_error(AWS_ERROR_INVALID_STATE);
+        goto on_error;
+    }
+
+    void *mapping = mmap(NULL, sizeof(struct dsql_token_file_cache_layout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        aws_raise_error(AWS_ERROR_SYS_CALL_FAILURE);
+        goto on_error;
+    }
+
+    /* A file another process is still initializing has no header yet; it will be usable next time */
+    struct dsql_token_file_cache_layout *layout = mapping;
+    if (memcmp(&layout->header, &s_expected_header, sizeof(s_expected_header)) != 0) {
+        munmap(mapping, sizeof(struct dsql_token_file_cache_layout));
+        aws_raise_error(AWS_ERROR_INVALID_STATE);
+        goto on_error;
+    }
+
+    struct dsql_token_file_cache *cache = aws_mem_calloc(allocator, 1, sizeof(struct dsql_token_file_cache));
+    cache->allocator = allocator;
+    cache->fd = fd;
+    cache->layout = layout;
+    return cache;
+
+on_error:
+    close(fd);
+    return NULL;
+}
+
+void dsql_token_file_cache_close(struct dsql_token_file_cache *cache) {
+    if (!cache) {
+        return;
+    }
+
+    munmap(cache->layout, sizeof(struct dsql_token_file_cache_layout));
+    close(cache->fd);
+    aws_mem_release(cache->allocator, cache);
+}
+
+/* Whether a slot read without the lock holds key; the caller validates the read against the slot's sequence */
+static bool s_slot_has_key(const struct dsql_token_file_cache_slot *slot, struct aws_byte_cursor key, uint64_t hash) {
+    return slot->key_hash == hash && slot->key_length == key.len && key.len <= FILE_CACHE_KEY_SIZE &&
+           memcmp(slot->key, key.ptr, key.len) == 0;
+}
+
+int dsql_token_file_cache_get(
+    struct dsql_token_file_cache *cache,
+    struct aws_byte_cursor key,
+    uint64_t valid_until_secs,
+    struct aws_byte_buf *out_token,
+    struct aws_allocator *allocator) {
+
+    uint64_t hash = aws_hash_byte_cursor_ptr(&key);
+    uint8_t token[FILE_CACHE_TOKEN_SIZE];
+    int result = AWS_OP_ERR;
+
+    for (size_t i = 0; i < FILE_CACHE_SLOT_COUNT; ++i) {
+        struct dsql_token_file_cache_slot *slot = &cache->layout->slots[i];
+
+        for (size_t attempt = 0; attempt < FILE_CACHE_READ_ATTEMPTS; ++attempt) {
+            size_t begin = aws_atomic_load_int_explicit(&slot->sequence, aws_memory_order_acquire);
+            if (begin & 1) {
+                continue;
+            }
+
+            if (!s_slot_has_key(slot, key, hash)) {
+                break;
+            }
+
+            uint64_t expires_at_secs = slot->expires_at_secs;
+            size_t token_length = slot->token_length;
+            if (token_length > FILE_CACHE_TOKEN_SIZE) {
+                break;
+            }
+            memcpy(token, slot->token, token_length);
+
+            /* Everything copied must be read before the sequence is checked again */
+            aws_atomic_thread_fence(aws_memory_order_acquire);
+            if (aws_atomic_load_int_explicit(&slot->sequence, aws_memory_order_relaxed) != begin) {
+                continue;
+            }
+
+            if (expires_at_secs < valid_until_secs || token_length == 0) {
+                goto done;
+            }
+
+            struct aws_byte_cursor value = aws_byte_cursor_from_array(token, token_length);
+            result = aws_byte_buf_init_copy_from_cursor(out_token, allocator, value);
+            goto done;
+        }
+    }
+
+done:
+    /* The stack copy may hold a whole token, or a torn one, and must not outlive the call */
+    aws_secure_zero(token, sizeof(token));
+    return result;
+}
+
+int dsql_token_file_cache_put(
+    struct dsql_token_file_cache *cache,
+    struct aws_byte_cursor key,
+    struct aws_byte_cursor token,
+    uint64_t expires_at_secs) {
+
+    if (key.len == 0 || key.len > FILE_CACHE_KEY_SIZE || token.len > FILE_CACHE_TOKEN_SIZE) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    if (flock(cache->fd, LOCK_EX)) {
+        return aws_raise_error(AWS_ERROR_SYS_CALL_FAILURE);
+    }
+
+    /* With the lock held no slot changes under us. Prefer the key's own slot, then the one that expires first */
+    uint64_t hash = aws_hash_byte_cursor_ptr(&key);
+    struct dsql_token_file_cache_slot *target = NULL;
+    for (size_t i = 0; i < FILE_CACHE_SLOT_COUNT; ++i) {
+        struct dsql_token_file_cache_slot *slot = &cache->layout->slots[i];
+        if (s_slot_has_key(slot, key, hash)) {
+            target = slot;
+            break;
+        }
+        if (!target || slot->key_length == 0 ||
+            (target->key_length != 0 && slot->expires_at_secs < target->expires_at_secs)) {
+            target = slot;
+        }
+    }
+
+    /*
+     * A writer that died mid-write leaves the sequence odd, so set the low bit rather than add one: the sequence is
+     * odd while this write is in progress and even once it completes, whatever state it was left in.
+     */
+    size_t sequence = aws_atomic_load_int_explicit(&target->sequence, aws_memory_order_relaxed) | 1;
+    aws_atomic_store_int_explicit(&target->sequence, sequence, aws_memory_order_relaxed);
+    aws_atomic_thread_fence(aws_memory_order_release);
+
+    target->key_hash = hash;
+    target->expires_at_secs = expires_at_secs;
+    target->key_length = (uint32_t)key.len;
+    target->token_length = (uint32_t)token.len;
+    memcpy(target->key, key.ptr, key.len);
+    memcpy(target->token, token.ptr, token.len);
+
+    aws_atomic_store_int_explicit(&target->sequence, sequence + 1, aws_memory_order_release);
+
+    flock(cache->fd, LOCK_UN);
+    return AWS_OP_SUCCESS;
+}
+
+#else /* _WIN32 */
+
+int dsql_token_file_cache_default_path(struct aws_allocator *allocator, struct aws_byte_buf *out_path) {
+    (void)allocator;
+    (void)out_path;
+    (void)s_default_file_name;
+    return aws_raise_error(AWS_ERROR_PLATFORM_NOT_SUPPORTED);
+}
+
+struct dsql_token_file_cache *dsql_token_file_cache_open(struct aws_allocator *allocator, const char *path) {
+    (void)allocator;
+    (void)path;
+    aws_raise_error(AWS_ERROR_PLATFORM_NOT_SUPPORTED);
+    return NULL;
+}
+
+void dsql_token_file_cache_close(struct dsql_token_file_cache *cache) {
+    (void)cache;
+}
+
+int dsql_token_file_cache_get(
+    struct dsql_token_file_cache *cache,
+    struct aws_byte_cursor key,
+    uint64_t valid_until_secs,
+    struct aws_byte_buf *out_token,
+    struct aws_allocator *allocator) {
+
+    (void)cache;
+    (void)key;
+    (void)valid_until_secs;
+    (void)out_token;
+    (void)allocator;
+    return aws_raise_error(AWS_ERROR_PLATFORM_NOT_SUPPORTED);
+}
+
+int dsql_token_file_cache_put(
+    struct dsql_token_file_cache *cache,
+    struct aws_byte_cursor key,
+    struct aws_byte_cursor token,
+    uint64_t expires_at_secs) {
+
+    (void)cache;
+    (void)key;
+    (void)token;
+    (void)expires_at_secs;
+    return aws_raise_error(AWS_ERROR_PLATFORM_NOT_SUPPORTED);
+}
+
+#endif /* _WIN32 */
@@ -0,0 +1,81 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef DSQL_TOKEN_FILE_CACHE_H
+#define DSQL_TOKEN_FILE_CACHE_H
+
+#include <aws/common/byte_buf.h>
+
+/*
+ * A token cache shared by every dsql-token process of a user: a fixed-layout file of token slots, memory mapped by
+ * each process. Readers take no lock; each slot carries a sequence number that is odd while the slot is being written,
+ * and a read that overlaps a write is discarded. Writers serialize with an exclusive lock on the file.
+ *
+ * The file holds live tokens, so it is created with owner-only permissions and refused if anyone else can read it.
+ */
+struct dsql_token_file_cache;
+
+/**
+ * Fill out_path with the default cache file path under $XDG_RUNTIME_DIR.
+ *
+ * @param[in] allocator The allocator for out_path
+ * @param[out] out_path Receives the NUL terminated path, initialized with the allocator
+ *
+ * @return AWS_OP_SUCCESS if successful, AWS_OP_ERR if $XDG_RUNTIME_DIR is not set
+ */
+int dsql_token_file_cache_default_path(struct aws_allocator *allocator, struct aws_byte_buf *out_path);
+
+/**
+ * Open the cache file at path, creating it if it does not exist.
+ *
+ * @param[in] allocator The allocator to use for memory allocation
+ * @param[in] path The cache file
+ *
+ * @return The cache, or NULL if the file cannot be used
+ */
+struct dsql_token_file_cache *dsql_token_file_cache_open(struct aws_allocator *allocator, const char *path);
+
+/**
+ * Unmap and close the cache.
+ *
+ * @param[in] cache The cache to close, may be NULL
+ */
+void dsql_token_file_cache_close(struct dsql_token_file_cache *cache);
+
+/**
+ * Look up the token stored under key.
+ *
+ * @param[in] cache The cache
+ * @param[in] key The key the token was stored under
+ * @param[in] valid_until_secs The time, in seconds since the epoch, the token must still be valid at
+ * @param[out] out_token Receives the token, initialized with the allocator
+ * @param[in] allocator The allocator for out_token
+ *
+ * @return AWS_OP_SUCCESS on a hit, AWS_OP_ERR on a miss
+ */
+int dsql_token_file_cache_get(
+    struct dsql_token_file_cache *cache,
+    struct aws_byte_cursor key,
+    uint64_t valid_until_secs,
+    struct aws_byte_buf *out_token,
+    struct aws_allocator *allocator);
+
+/**
+ * Store a token under key, replacing the token stored under it, an expired token, or the token closest to expiry.
+ *
+ * @param[in] cache The cache
+ * @param[in] key The key to store the token under
+ * @param[in] token The token
+ * @param[in] expires_at_secs When the token expires, in seconds since the epoch
+ *
+ * @return AWS_OP_SUCCESS if the token was stored, AWS_OP_ERR if it is too large or the file could not be locked
+ */
+int dsql_token_file_cache_put(
+    struct dsql_token_file_cache *cache,
+    struct aws_byte_cursor key,
+    struct aws_byte_cursor token,
+    uint64_t expires_at_secs);
+
+#endif /* DSQL_TOKEN_FILE_CACHE_H */
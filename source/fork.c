@@ -0,0 +1,99 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <aws/common/mutex.h>
+#include <aws/common/thread.h>
+#include <aws/dsql-auth/private/fork.h>
+
+#ifndef _WIN32
+#    include <pthread.h>
+#endif
+
+/* How long a fork backs off before trying again to take the locks of every registered object */
+enum { FORK_PREPARE_RETRY_NS = 1000 };
+
+/* Guards the handler list, and is held by a fork from its prepare until the fork has completed */
+static struct aws_mutex s_fork_lock = AWS_MUTEX_INIT;
+static struct aws_linked_list s_fork_handlers;
+static aws_thread_once s_fork_once = AWS_THREAD_ONCE_STATIC_INIT;
+
+#ifndef _WIN32
+
+static struct aws_dsql_auth_fork_handler *s_handler_of(struct aws_linked_list_node *node) {
+    return AWS_CONTAINER_OF(node, struct aws_dsql_auth_fork_handler, node);
+}
+
+/*
+ * Take the registry and every object's locks, in registration order. An object whose lock is held makes the prepare
+ * give back everything and the registry, so that the holder can finish even if it needs the registry, and retry.
+ */
+static void s_fork_prepare(void) {
+    while (true) {
+        aws_mutex_lock(&s_fork_lock);
+
+        struct aws_linked_list_node *node = aws_linked_list_begin(&s_fork_handlers);
+        for (; node != aws_linked_list_end(&s_fork_handlers); node = aws_linked_list_next(node)) {
+            struct aws_dsql_auth_fork_handler *handler = s_handler_of(node);
+            if (!handler->try_prepare(handler->user_data)) {
+                break;
+            }
+        }
+        if (node == aws_linked_list_end(&s_fork_handlers)) {
+            return;
+        }
+
+        for (struct aws_linked_list_node *taken = aws_linked_list_begin(&s_fork_handlers); taken != node;
+             taken = aws_linked_list_next(taken)) {
+            s_handler_of(taken)->parent(s_handler_of(taken)->user_data);
+        }
+        aws_mutex_unlock(&s_fork_lock);
+        aws_thread_current_sleep(FORK_PREPARE_RETRY_NS);
+    }
+}
+
+static void s_fork_parent(void) {
+    for (struct aws_linked_list_node *node = aws_linked_list_begin(&s_fork_handlers);
+         node != aws_linked_list_end(&s_fork_handlers);
+         node = aws_linked_list_next(node)) {
+        s_handler_of(node)->parent(s_handler_of(node)->user_data);
+    }
+    aws_mutex_unlock(&s_fork_lock);
+}
+
+static void s_fork_child(void) {
+    for (struct aws_linked_list_node *node = aws_linked_list_begin(&s_fork_handlers);
+         node != aws_linked_list_end(&s_fork_handlers);
+         node = aws_linked_list_next(node)) {
+        s_handler_of(node)->child(s_handler_of(node)->user_data);
+    }
+    aws_mutex_unlock(&s_fork_lock);
+}
+
+#endif /* _WIN32 */
+
+static void s_fork_init(void *user_data) {
+    (void)user_data;
+
+    aws_linked_list_init(&s_fork_handlers);
+
+#ifndef _WIN32
+    /* Should installing the handlers fail, forked children are simply left as they would be without them */
+    pthread_atfork(s_fork_prepare, s_fork_parent, s_fork_child);
+#endif
+}
+
+void aws_dsql_auth_fork_handler_register(struct aws_dsql_auth_fork_handler *handler) {
+    aws_thread_call_once(&s_fork_once, s_fork_init, NULL);
+
+    aws_mutex_lock(&s_fork_lock);
+    aws_linked_list_push_back(&s_fork_handlers, &handler->node);
+    aws_mutex_unlock(&s_fork_lock);
+}
+
+void aws_dsql_auth_fork_handler_unregister(struct aws_dsql_auth_fork_handler *handler) {
+    aws_mutex_lock(&s_fork_lock);
+    aws_linked_list_remove(&handler->node);
+    aws_mutex_unlock(&s_fork_lock);
+}
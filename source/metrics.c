@@ -0,0 +1,103 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <aws/common/atomics.h>
+#include <aws/common/clock.h>
+#include <aws/common/zero.h>
+#include <aws/dsql-auth/private/metrics.h>
+#include <aws/dsql-auth/private/reader_shards.h>
+
+enum { SHARD_COUNTER_COUNT = AWS_DSQL_AUTH_METRIC_COUNT + AWS_DSQL_AUTH_METRICS_LATENCY_BUCKET_COUNT };
+enum { SHARD_COUNTER_BYTES = SHARD_COUNTER_COUNT * sizeof(struct aws_atomic_var) };
+
+/* Padded to whole cache lines and aligned on one, so threads in different shards never write the same line */
+struct dsql_metrics_shard {
+    /* The metrics, indexed by enum aws_dsql_auth_metric, followed by the latency buckets */
+    struct aws_atomic_var counters[SHARD_COUNTER_COUNT];
+    uint8_t padding[AWS_DSQL_AUTH_CACHE_LINE_SIZE - SHARD_COUNTER_BYTES % AWS_DSQL_AUTH_CACHE_LINE_SIZE];
+};
+AWS_ALIGNED_TYPEDEF(struct dsql_metrics_shard, dsql_metrics_aligned_shard, AWS_DSQL_AUTH_CACHE_LINE_SIZE);
+
+/* Zero-initialized, which every counter starts from. Threads record into the shard of aws_dsql_auth_thread_shard. */
+static dsql_metrics_aligned_shard s_metrics_shards[AWS_DSQL_AUTH_THREAD_SHARD_COUNT];
+
+static struct dsql_metrics_shard *s_metrics_shard(void) {
+    return &s_metrics_shards[aws_dsql_auth_thread_shard()];
+}
+
+/*
+ * Counters only need to be atomic, not ordered: nothing is published through them and a snapshot is allowed to miss
+ * whatever is recorded while it runs.
+ */
+static void s_counter_add(size_t counter, uint64_t amount) {
+    aws_atomic_fetch_add_explicit(&s_metrics_shard()->counters[counter], (size_t)amount, aws_memory_order_relaxed);
+}
+
+void aws_dsql_auth_metrics_add(enum aws_dsql_auth_metric metric, uint64_t amount) {
+    s_counter_add(metric, amount);
+}
+
+void aws_dsql_auth_metrics_sub(enum aws_dsql_auth_metric metric, uint64_t amount) {
+    aws_atomic_fetch_sub_explicit(&s_metrics_shard()->counters[metric], (size_t)amount, aws_memory_order_relaxed);
+}
+
+static size_t s_latency_bucket(uint64_t duration_ns) {
+    uint64_t duration_us = aws_timestamp_convert(duration_ns, AWS_TIMESTAMP_NANOS, AWS_TIMESTAMP_MICROS, NULL);
+
+    size_t bucket = 0;
+    while (duration_us != 0 && bucket < AWS_DSQL_AUTH_METRICS_LATENCY_BUCKET_COUNT - 1) {
+        duration_us >>= 1;
+        ++bucket;
+    }
+    return bucket;
+}
+
+void aws_dsql_auth_metrics_record_credentials_fetch(uint64_t duration_ns, bool succeeded) {
+    s_counter_add(AWS_DSQL_AUTH_METRIC_CREDENTIALS_FETCHES, 1);
+    if (!succeeded) {
+        s_counter_add(AWS_DSQL_AUTH_METRIC_CREDENTIALS_FETCH_FAILURES, 1);
+    }
+    /* Microseconds rather than nanoseconds, so that a 32-bit counter takes over an hour of fetches to wrap */
+    s_counter_add(AWS_DSQL_AUTH_METRIC_CREDENTIALS_FETCH_US, (duration_ns + 500) / 1000);
+    s_counter_add(AWS_DSQL_AUTH_METRIC_COUNT + s_latency_bucket(duration_ns), 1);
+}
+
+/* Sum a counter over every shard. Gauges may be negative in a single shard, so the sum is taken modulo size_t. */
+static uint64_t s_counter_sum(size_t counter) {
+    size_t sum = 0;
+    for (size_t i = 0; i < AWS_DSQL_AUTH_THREAD_SHARD_COUNT; ++i) {
+        sum += aws_atomic_load_int_explicit(&s_metrics_shards[i].counters[counter], aws_memory_order_relaxed);
+    }
+    return sum;
+}
+
+void aws_dsql_auth_metrics_snapshot(struct aws_dsql_auth_metrics *out_metrics) {
+    if (!out_metrics) {
+        return;
+    }
+
+    AWS_ZERO_STRUCT(*out_metrics);
+    out_metrics->tokens_generated = s_counter_sum(AWS_DSQL_AUTH_METRIC_TOKENS_GENERATED);
+    out_metrics->generation_failures = s_counter_sum(AWS_DSQL_AUTH_METRIC_GENERATION_FAILURES);
+    out_metrics->token_cache_hits = s_counter_sum(AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_HITS);
+    out_metrics->token_cache_misses = s_counter_sum(AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_MISSES);
+    out_metrics->token_cache_coalesced = s_counter_sum(AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_COALESCED);
+    out_metrics->token_cache_refreshes = s_counter_sum(AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_REFRESHES);
+    out_metrics->token_cache_refresh_failures = s_counter_sum(AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_REFRESH_FAILURES);
+    out_metrics->token_cache_evictions = s_counter_sum(AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_EVICTIONS);
+    out_metrics->token_cache_entries = s_counter_sum(AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_ENTRIES);
+    out_metrics->token_cache_bytes = s_counter_sum(AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_BYTES);
+    out_metrics->credentials_fetches = s_counter_sum(AWS_DSQL_AUTH_METRIC_CREDENTIALS_FETCHES);
+    out_metrics->credentials_fetch_failures = s_counter_sum(AWS_DSQL_AUTH_METRIC_CREDENTIALS_FETCH_FAILURES);
+    out_metrics->credentials_fetch_us = s_counter_sum(AWS_DSQL_AUTH_METRIC_CREDENTIALS_FETCH_US);
+    out_metrics->credentials_snapshot_refreshes = s_counter_sum(AWS_DSQL_AUTH_METRIC_CREDENTIALS_SNAPSHOT_REFRESHES);
+    out_metrics->credentials_snapshot_refresh_failures =
+        s_counter_sum(AWS_DSQL_AUTH_METRIC_CREDENTIALS_SNAPSHOT_REFRESH_FAILURES);
+    out_metrics->fork_abandoned_references = s_counter_sum(AWS_DSQL_AUTH_METRIC_FORK_ABANDONED_REFERENCES);
+
+    for (size_t i = 0; i < AWS_DSQL_AUTH_METRICS_LATENCY_BUCKET_COUNT; ++i) {
+        out_metrics->credentials_fetch_latency_buckets[i] = s_counter_sum(AWS_DSQL_AUTH_METRIC_COUNT + i);
+    }
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <aws/common/thread.h>
+#include <aws/dsql-auth/private/reader_shards.h>
+
+/* Shard of the calling thread; 0 until its first call, the shard index plus one after */
+static AWS_THREAD_LOCAL size_t tl_thread_shard = 0;
+static struct aws_atomic_var s_next_thread_shard = AWS_ATOMIC_INIT_INT(0);
+
+size_t aws_dsql_auth_thread_shard(void) {
+    if (tl_thread_shard == 0) {
+        tl_thread_shard = aws_atomic_fetch_add(&s_next_thread_shard, 1) % AWS_DSQL_AUTH_THREAD_SHARD_COUNT + 1;
+    }
+    return tl_thread_shard - 1;
+}
+
+struct aws_dsql_auth_reader_shards *aws_dsql_auth_reader_shards_new(struct aws_allocator *allocator) {
+    /* The allocator only guarantees the alignment of a scalar, so round up within room for a whole cache line */
+    void *allocation =
+        aws_mem_calloc(allocator, 1, sizeof(struct aws_dsql_auth_reader_shards) + AWS_DSQL_AUTH_CACHE_LINE_SIZE - 1);
+    if (!allocation) {
+        return NULL;
+    }
+
+    struct aws_dsql_auth_reader_shards *reader_shards =
+        (void *)(((uintptr_t)allocation + AWS_DSQL_AUTH_CACHE_LINE_SIZE - 1) &
+                 ~(uintptr_t)(AWS_DSQL_AUTH_CACHE_LINE_SIZE - 1));
+    reader_shards->allocator = allocator;
+    reader_shards->allocation = allocation;
+
+    aws_atomic_init_int(&reader_shards->read_phase, 0);
+    aws_linked_list_init(&reader_shards->retired);
+    for (size_t i = 0; i < AWS_DSQL_AUTH_THREAD_SHARD_COUNT; ++i) {
+        aws_atomic_init_int(&reader_shards->shards[i].active[0], 0);
+        aws_atomic_init_int(&reader_shards->shards[i].active[1], 0);
+    }
+
+    return reader_shards;
+}
+
+void aws_dsql_auth_reader_shards_destroy(
+    struct aws_dsql_auth_reader_shards *reader_shards,
+    aws_dsql_auth_free_retired_fn *free_retired,
+    void *user_data) {
+
+    while (!aws_linked_list_empty(&reader_shards->retired)) {
+        struct aws_linked_list_node *node = aws_linked_list_pop_front(&reader_shards->retired);
+        free_retired(AWS_CONTAINER_OF(node, struct aws_dsql_auth_retired, node), user_data);
+    }
+
+    aws_mem_release(reader_shards->allocator, reader_shards->allocation);
+}
+
+struct aws_atomic_var *aws_dsql_auth_read_lock(struct aws_dsql_auth_reader_shards *reader_shards) {
+    struct aws_dsql_auth_reader_shard *shard = &reader_shards->shards[aws_dsql_auth_thread_shard()];
+    struct aws_atomic_var *active = &shard->active[aws_atomic_load_int(&reader_shards->read_phase) & 1];
+
+    aws_atomic_fetch_add(active, 1);
+    return active;
+}
+
+void aws_dsql_auth_read_unlock(struct aws_atomic_var *active) {
+    aws_atomic_fetch_sub(active, 1);
+}
+
+void aws_dsql_auth_reader_shards_retire(
+    struct aws_dsql_auth_reader_shards *reader_shards,
+    struct aws_dsql_auth_retired *retired) {
+
+    retired->phase = aws_atomic_load_int(&reader_shards->read_phase);
+    aws_linked_list_push_back(&reader_shards->retired, &retired->node);
+}
+
+/* Whether no reader counts itself in the slot of the given read phase, without waiting for any */
+static bool s_is_phase_drained(struct aws_dsql_auth_reader_shards *reader_shards, size_t phase) {
+    for (size_t i = 0; i < AWS_DSQL_AUTH_THREAD_SHARD_COUNT; ++i) {
+        if (aws_atomic_load_int(&reader_shards->shards[i].active[phase & 1]) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void aws_dsql_auth_reader_shards_reclaim(
+    struct aws_dsql_auth_reader_shards *reader_shards,
+    aws_dsql_auth_free_retired_fn *free_retired,
+    void *user_data) {
+
+    while (!aws_linked_list_empty(&reader_shards->retired)) {
+        struct aws_dsql_auth_retired *oldest =
+            AWS_CONTAINER_OF(aws_linked_list_front(&reader_shards->retired), struct aws_dsql_auth_retired, node);
+
+        size_t phase = aws_atomic_load_int(&reader_shards->read_phase);
+        if (phase - oldest->phase >= 2) {
+            aws_linked_list_pop_front(&reader_shards->retired);
+            free_retired(oldest, user_data);
+            continue;
+        }
+
+        if (!s_is_phase_drained(reader_shards, phase - 1)) {
+            return;
+        }
+        aws_atomic_store_int(&reader_shards->read_phase, phase + 1);
+    }
+}
+
+void aws_dsql_auth_reader_shards_reset(struct aws_dsql_auth_reader_shards *reader_shards) {
+    for (size_t i = 0; i < AWS_DSQL_AUTH_THREAD_SHARD_COUNT; ++i) {
+        aws_atomic_store_int(&reader_shards->shards[i].active[0], 0);
+        aws_atomic_store_int(&reader_shards->shards[i].active[1], 0);
+    }
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <aws/dsql-auth/private/scratch_allocator.h>
+
+#include <stdint.h>
+
+/* Alignment of every block, enough for any scalar type */
+enum { SCRATCH_ALIGNMENT = 16 };
+
+static bool s_is_in_storage(const struct aws_dsql_auth_scratch_allocator *scratch, const void *ptr) {
+    uintptr_t address = (uintptr_t)ptr;
+    uintptr_t start = (uintptr_t)scratch->storage;
+    return address >= start && address < start + scratch->capacity;
+}
+
+static void *s_scratch_acquire(struct aws_allocator *allocator, size_t size) {
+    struct aws_dsql_auth_scratch_allocator *scratch = allocator->impl;
+
+    /* The storage itself may be unaligned, so align the address rather than the offset */
+    uintptr_t start = (uintptr_t)scratch->storage;
+    uintptr_t aligned = (start + scratch->used + (SCRATCH_ALIGNMENT - 1)) & ~(uintptr_t)(SCRATCH_ALIGNMENT - 1);
+    size_t offset = (size_t)(aligned - start);
+
+    if (offset <= scratch->capacity && size <= scratch->capacity - offset) {
+        scratch->used = offset + size;
+        return scratch->storage + offset;
+    }
+
+    return aws_mem_acquire(scratch->parent, size);
+}
+
+static void s_scratch_release(struct aws_allocator *allocator, void *ptr) {
+    struct aws_dsql_auth_scratch_allocator *scratch = allocator->impl;
+
+    if (!s_is_in_storage(scratch, ptr)) {
+        aws_mem_release(scratch->parent, ptr);
+    }
+}
+
+struct aws_allocator *aws_dsql_auth_scratch_allocator_init(
+    struct aws_dsql_auth_scratch_allocator *scratch,
+    struct aws_allocator *parent,
+    void *storage,
+    size_t capacity) {
+
+    scratch->base.mem_acquire = s_scratch_acquire;
+    scratch->base.mem_release = s_scratch_release;
+    scratch->base.mem_realloc = NULL;
+    scratch->base.mem_calloc = NULL;
+    scratch->base.impl = scratch;
+    scratch->parent = parent;
+    scratch->storage = storage;
+    scratch->capacity = capacity;
+    scratch->used = 0;
+
+    return &scratch->base;
+}
@@ -0,0 +1,388 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <aws/common/cpuid.h>
+#include <aws/common/zero.h>
+#include <aws/dsql-auth/private/sha256_mb.h>
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#    define SHA256_MB_X86_64
+#    include <immintrin.h>
+/* The kernels are built for their instruction set on their own, and only run once the CPU is known to have it */
+#    if defined(__GNUC__) || defined(__clang__)
+#        define SHA256_MB_TARGET(isa) __attribute__((target(isa)))
+#    else
+#        define SHA256_MB_TARGET(isa)
+#    endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#    define SHA256_MB_AARCH64
+#    include <arm_neon.h>
+#endif
+
+enum { SHA256_BLOCK_LEN = 64, SHA256_STATE_WORDS = 8, SHA256_BLOCK_WORDS = 16 };
+
+/*
+ * Kernels work on lane-interleaved words: words[i][lane] is word i of the lane's block, state[i][lane] word i of its
+ * hash state. A kernel compresses every lane's block into its state and leaves the words alone; one with fewer lanes
+ * than AWS_DSQL_AUTH_SHA256_MB_MAX_LANES uses the first columns.
+ */
+typedef void(sha256_mb_compress_fn)(
+    uint32_t state[SHA256_STATE_WORDS][AWS_DSQL_AUTH_SHA256_MB_MAX_LANES],
+    uint32_t words[SHA256_BLOCK_WORDS][AWS_DSQL_AUTH_SHA256_MB_MAX_LANES]);
+
+static const uint32_t s_sha256_initial_state[SHA256_STATE_WORDS] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+#if defined(SHA256_MB_X86_64) || defined(SHA256_MB_AARCH64)
+
+static const uint32_t s_sha256_round_constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+#endif
+
+#if defined(SHA256_MB_X86_64)
+
+#    define AVX2_ROTR(x, n) _mm256_or_si256(_mm256_srli_epi32((x), (n)), _mm256_slli_epi32((x), 32 - (n)))
+
+SHA256_MB_TARGET("avx2")
+static void s_sha256_compress_avx2(
+    uint32_t state[SHA256_STATE_WORDS][AWS_DSQL_AUTH_SHA256_MB_MAX_LANES],
+    uint32_t words[SHA256_BLOCK_WORDS][AWS_DSQL_AUTH_SHA256_MB_MAX_LANES]) {
+
+    __m256i w[SHA256_BLOCK_WORDS];
+    for (size_t i = 0; i < SHA256_BLOCK_WORDS; ++i) {
+        w[i] = _mm256_loadu_si256((const __m256i *)words[i]);
+    }
+
+    __m256i v[SHA256_STATE_WORDS];
+    for (size_t i = 0; i < SHA256_STATE_WORDS; ++i) {
+        v[i] = _mm256_loadu_si256((const __m256i *)state[i]);
+    }
+    __m256i a = v[0], b = v[1], c = v[2], d = v[3], e = v[4], f = v[5], g = v[6], h = v[7];
+
+    for (size_t t = 0; t < 64; ++t) {
+        if (t >= SHA256_BLOCK_WORDS) {
+            __m256i w15 = w[(t - 15) & 15];
+            __m256i w2 = w[(t - 2) & 15];
+            __m256i s0 = _mm256_xor_si256(
+                _mm256_xor_si256(AVX2_ROTR(w15, 7), AVX2_ROTR(w15, 18)), _mm256_srli_epi32(w15, 3));
+            __m256i s1 = _mm256_xor_si256(
+                _mm256_xor_si256(AVX2_ROTR(w2, 17), AVX2_ROTR(w2, 19)), _mm256_srli_epi32(w2, 10));
+            w[t & 15] = _mm256_add_epi32(_mm256_add_epi32(w[t & 15], s0), _mm256_add_epi32(w[(t - 7) & 15], s1));
+        }
+
+        __m256i sigma1 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROTR(e, 6), AVX2_ROTR(e, 11)), AVX2_ROTR(e, 25));
+        __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+        __m256i t1 = _mm256_add_epi32(
+            _mm256_add_epi32(_mm256_add_epi32(h, sigma1), _mm256_add_epi32(ch, w[t & 15])),
+            _mm256_set1_epi32((int)s_sha256_round_constants[t]));
+        __m256i sigma0 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROTR(a, 2), AVX2_ROTR(a, 13)), AVX2_ROTR(a, 22));
+        __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+        __m256i t2 = _mm256_add_epi32(sigma0, maj);
+
+        h = g;
+        g = f;
+        f = e;
+        e = _mm256_add_epi32(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = _mm256_add_epi32(t1, t2);
+    }
+
+    __m256i out[SHA256_STATE_WORDS] = {a, b, c, d, e, f, g, h};
+    for (size_t i = 0; i < SHA256_STATE_WORDS; ++i) {
+        _mm256_storeu_si256((__m256i *)state[i], _mm256_add_epi32(v[i], out[i]));
+    }
+}
+
+SHA256_MB_TARGET("avx512f")
+static void s_sha256_compress_avx512(
+    uint32_t state[SHA256_STATE_WORDS][AWS_DSQL_AUTH_SHA256_MB_MAX_LANES],
+    uint32_t words[SHA256_BLOCK_WORDS][AWS_DSQL_AUTH_SHA256_MB_MAX_LANES]) {
+
+    __m512i w[SHA256_BLOCK_WORDS];
+    for (size_t i = 0; i < SHA256_BLOCK_WORDS; ++i) {
+        w[i] = _mm512_loadu_si512(words[i]);
+    }
+
+    __m512i v[SHA256_STATE_WORDS];
+    for (size_t i = 0; i < SHA256_STATE_WORDS; ++i) {
+        v[i] = _mm512_loadu_si512(state[i]);
+    }
+    __m512i a = v[0], b = v[1], c = v[2], d = v[3], e = v[4], f = v[5], g = v[6], h = v[7];
+
+    for (size_t t = 0; t < 64; ++t) {
+        if (t >= SHA256_BLOCK_WORDS) {
+            __m512i w15 = w[(t - 15) & 15];
+            __m512i w2 = w[(t - 2) & 15];
+            __m512i s0 = _mm512_ternarylogic_epi32(
+                _mm512_ror_epi32(w15, 7), _mm512_ror_epi32(w15, 18), _mm512_srli_epi32(w15, 3), 0x96);
+            __m512i s1 = _mm512_ternarylogic_epi32(
+                _mm512_ror_epi32(w2, 17), _mm512_ror_epi32(w2, 19), _mm512_srli_epi32(w2, 10), 0x96);
+            w[t & 15] = _mm512_add_epi32(_mm512_add_epi32(w[t & 15], s0), _mm512_add_epi32(w[(t - 7) & 15], s1));
+        }
+
+        /* 0x96 is a three-way XOR, 0xCA selects f or g by e, 0xE8 is the majority of a, b and c */
+        __m512i sigma1 =
+            _mm512_ternarylogic_epi32(_mm512_ror_epi32(e, 6), _mm512_ror_epi32(e, 11), _mm512_ror_epi32(e, 25), 0x96);
+        __m512i ch = _mm512_ternarylogic_epi32(e, f, g, 0xCA);
+        __m512i t1 = _mm512_add_epi32(
+            _mm512_add_epi32(_mm512_add_epi32(h, sigma1), _mm512_add_epi32(ch, w[t & 15])),
+            _mm512_set1_epi32((int)s_sha256_round_constants[t]));
+        __m512i sigma0 =
+            _mm512_ternarylogic_epi32(_mm512_ror_epi32(a, 2), _mm512_ror_epi32(a, 13), _mm512_ror_epi32(a, 22), 0x96);
+        __m512i t2 = _mm512_add_epi32(sigma0, _mm512_ternarylogic_epi32(a, b, c, 0xE8));
+
+        h = g;
+        g = f;
+        f = e;
+        e = _mm512_add_epi32(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = _mm512_add_epi32(t1, t2);
+    }
+
+    __m512i out[SHA256_STATE_WORDS] = {a, b, c, d, e, f, g, h};
+    for (size_t i = 0; i < SHA256_STATE_WORDS; ++i) {
+        _mm512_storeu_si512(state[i], _mm512_add_epi32(v[i], out[i]));
+    }
+}
+
+#elif defined(SHA256_MB_AARCH64)
+
+#    define NEON_ROTR(x, n) vsriq_n_u32(vshlq_n_u32((x), 32 - (n)), (x), (n))
+
+/* NEON is part of every AArch64 CPU, so this kernel needs no target and no feature check */
+static void s_sha256_compress_neon(
+    uint32_t state[SHA256_STATE_WORDS][AWS_DSQL_AUTH_SHA256_MB_MAX_LANES],
+    uint32_t words[SHA256_BLOCK_WORDS][AWS_DSQL_AUTH_SHA256_MB_MAX_LANES]) {
+
+    uint32x4_t w[SHA256_BLOCK_WORDS];
+    for (size_t i = 0; i < SHA256_BLOCK_WORDS; ++i) {
+        w[i] = vld1q_u32(words[i]);
+    }
+
+    uint32x4_t v[SHA256_STATE_WORDS];
+    for (size_t i = 0; i < SHA256_STATE_WORDS; ++i) {
+        v[i] = vld1q_u32(state[i]);
+    }
+    uint32x4_t a = v[0], b = v[1], c = v[2], d = v[3], e = v[4], f = v[5], g = v[6], h = v[7];
+
+    for (size_t t = 0; t < 64; ++t) {
+        if (t >= SHA256_BLOCK_WORDS) {
+            uint32x4_t w15 = w[(t - 15) & 15];
+            uint32x4_t w2 = w[(t - 2) & 15];
+            uint32x4_t s0 = veorq_u32(veorq_u32(NEON_ROTR(w15, 7), NEON_ROTR(w15, 18)), vshrq_n_u32(w15, 3));
+            uint32x4_t s1 = veorq_u32(veorq_u32(NEON_ROTR(w2, 17), NEON_ROTR(w2, 19)), vshrq_n_u32(w2, 10));
+            w[t & 15] = vaddq_u32(vaddq_u32(w[t & 15], s0), vaddq_u32(w[(t - 7) & 15], s1));
+        }
+
+        uint32x4_t sigma1 = veorq_u32(veorq_u32(NEON_ROTR(e, 6), NEON_ROTR(e, 11)), NEON_ROTR(e, 25));
+        uint32x4_t ch = vbslq_u32(e, f, g);
+        uint32x4_t t1 = vaddq_u32(
+            vaddq_u32(vaddq_u32(h, sigma1), vaddq_u32(ch, w[t & 15])), vdupq_n_u32(s_sha256_round_constants[t]));
+        uint32x4_t sigma0 = veorq_u32(veorq_u32(NEON_ROTR(a, 2), NEON_ROTR(a, 13)), NEON_ROTR(a, 22));
+        /* Where a and b differ the majority is c, elsewhere it is b */
+        uint32x4_t maj = vbslq_u32(veorq_u32(a, b), c, b);
+        uint32x4_t t2 = vaddq_u32(sigma0, maj);
+
+        h = g;
+        g = f;
+        f = e;
+        e = vaddq_u32(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = vaddq_u32(t1, t2);
+    }
+
+    uint32x4_t out[SHA256_STATE_WORDS] = {a, b, c, d, e, f, g, h};
+    for (size_t i = 0; i < SHA256_STATE_WORDS; ++i) {
+        vst1q_u32(state[i], vaddq_u32(v[i], out[i]));
+    }
+}
+
+#endif
+
+static sha256_mb_compress_fn *s_sha256_mb_kernel(size_t lanes) {
+#if defined(SHA256_MB_X86_64)
+    if (lanes == 16 && aws_cpu_has_feature(AWS_CPU_FEATURE_AVX512)) {
+        return s_sha256_compress_avx512;
+    }
+    if (lanes == 8 && aws_cpu_has_feature(AWS_CPU_FEATURE_AVX2)) {
+        return s_sha256_compress_avx2;
+    }
+#elif defined(SHA256_MB_AARCH64)
+    if (lanes == 4) {
+        return s_sha256_compress_neon;
+    }
+#else
+    (void)lanes;
+#endif
+    return NULL;
+}
+
+bool aws_dsql_auth_sha256_mb_supports(size_t lanes) {
+    return s_sha256_mb_kernel(lanes) != NULL;
+}
+
+size_t aws_dsql_auth_sha256_mb_lanes(size_t job_count) {
+    for (size_t lanes = AWS_DSQL_AUTH_SHA256_MB_MAX_LANES; lanes >= 4; lanes /= 2) {
+        if (lanes <= job_count && aws_dsql_auth_sha256_mb_supports(lanes)) {
+            return lanes;
+        }
+    }
+    return 0;
+}
+
+/* Where a lane is in its job's message */
+struct sha256_mb_lane {
+    const struct aws_dsql_auth_sha256_mb_job *job;
+    size_t piece;
+    size_t piece_offset;
+    uint64_t message_len;
+
+    /* Whether the 0x80 that ends the message has been written, and whether the last block has */
+    bool is_terminated;
+    bool is_finished;
+};
+
+static void s_sha256_mb_lane_start(
+    struct sha256_mb_lane *lane,
+    const struct aws_dsql_auth_sha256_mb_job *job,
+    uint32_t state[SHA256_STATE_WORDS][AWS_DSQL_AUTH_SHA256_MB_MAX_LANES],
+    size_t lane_index) {
+
+    AWS_ZERO_STRUCT(*lane);
+    lane->job = job;
+    for (size_t i = 0; i < job->piece_count; ++i) {
+        lane->message_len += job->pieces[i].len;
+    }
+    for (size_t i = 0; i < SHA256_STATE_WORDS; ++i) {
+        state[i][lane_index] = s_sha256_initial_state[i];
+    }
+}
+
+/* Produce the lane's next block: message bytes, then the padding and the message length in bits */
+static void s_sha256_mb_lane_next_block(struct sha256_mb_lane *lane, uint8_t block[SHA256_BLOCK_LEN]) {
+    size_t filled = 0;
+    while (filled < SHA256_BLOCK_LEN && lane->piece < lane->job->piece_count) {
+        const struct aws_byte_cursor *piece = &lane->job->pieces[lane->piece];
+        size_t copy_len = piece->len - lane->piece_offset;
+        if (copy_len > SHA256_BLOCK_LEN - filled) {
+            copy_len = SHA256_BLOCK_LEN - filled;
+        }
+        if (copy_len > 0) {
+            memcpy(block + filled, piece->ptr + lane->piece_offset, copy_len);
+        }
+        filled += copy_len;
+        lane->piece_offset += copy_len;
+        if (lane->piece_offset == piece->len) {
+            ++lane->piece;
+            lane->piece_offset = 0;
+        }
+    }
+    if (filled == SHA256_BLOCK_LEN) {
+        return;
+    }
+
+    if (!lane->is_terminated) {
+        block[filled++] = 0x80;
+        lane->is_terminated = true;
+    }
+    if (filled > SHA256_BLOCK_LEN - 8) {
+        /* No room for the length, which goes in one more block */
+        memset(block + filled, 0, SHA256_BLOCK_LEN - filled);
+        return;
+    }
+
+    memset(block + filled, 0, SHA256_BLOCK_LEN - 8 - filled);
+    uint64_t message_bits = lane->message_len * 8;
+    for (size_t i = 0; i < 8; ++i) {
+        block[SHA256_BLOCK_LEN - 1 - i] = (uint8_t)(message_bits >> (8 * i));
+    }
+    lane->is_finished = true;
+}
+
+void aws_dsql_auth_sha256_mb_hash(
+    const struct aws_dsql_auth_sha256_mb_job *jobs,
+    size_t job_count,
+    size_t lanes) {
+
+    sha256_mb_compress_fn *compress = s_sha256_mb_kernel(lanes);
+    AWS_FATAL_ASSERT(compress && "multi-buffer SHA-256 kernel not supported by this CPU");
+
+    /* Idle lanes hash whatever their columns hold and their results are ignored */
+    uint32_t state[SHA256_STATE_WORDS][AWS_DSQL_AUTH_SHA256_MB_MAX_LANES];
+    uint32_t words[SHA256_BLOCK_WORDS][AWS_DSQL_AUTH_SHA256_MB_MAX_LANES];
+    AWS_ZERO_ARRAY(state);
+    AWS_ZERO_ARRAY(words);
+
+    uint8_t block[SHA256_BLOCK_LEN];
+    struct sha256_mb_lane lane_states[AWS_DSQL_AUTH_SHA256_MB_MAX_LANES];
+    size_t next_job = 0;
+    size_t active_lanes = 0;
+    for (size_t lane = 0; lane < lanes; ++lane) {
+        lane_states[lane].job = NULL;
+        if (next_job < job_count) {
+            s_sha256_mb_lane_start(&lane_states[lane], &jobs[next_job++], state, lane);
+            ++active_lanes;
+        }
+    }
+
+    while (active_lanes > 0) {
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            if (!lane_states[lane].job) {
+                continue;
+            }
+            s_sha256_mb_lane_next_block(&lane_states[lane], block);
+            for (size_t i = 0; i < SHA256_BLOCK_WORDS; ++i) {
+                const uint8_t *word = block + 4 * i;
+                words[i][lane] = ((uint32_t)word[0] << 24) | ((uint32_t)word[1] << 16) | ((uint32_t)word[2] << 8) |
+                                 (uint32_t)word[3];
+            }
+        }
+
+        compress(state, words);
+
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            struct sha256_mb_lane *lane_state = &lane_states[lane];
+            if (!lane_state->job || !lane_state->is_finished) {
+                continue;
+            }
+
+            uint8_t *digest = lane_state->job->out_digest;
+            for (size_t i = 0; i < SHA256_STATE_WORDS; ++i) {
+                digest[4 * i] = (uint8_t)(state[i][lane] >> 24);
+                digest[4 * i + 1] = (uint8_t)(state[i][lane] >> 16);
+                digest[4 * i + 2] = (uint8_t)(state[i][lane] >> 8);
+                digest[4 * i + 3] = (uint8_t)state[i][lane];
+            }
+
+            if (next_job < job_count) {
+                s_sha256_mb_lane_start(lane_state, &jobs[next_job++], state, lane);
+            } else {
+                lane_state->job = NULL;
+                --active_lanes;
+            }
+        }
+    }
+
+    /* Messages may be keyed, as the inner and outer blocks of an HMAC are */
+    aws_secure_zero(state, sizeof(state));
+    aws_secure_zero(words, sizeof(words));
+    aws_secure_zero(block, sizeof(block));
+}
@@ -0,0 +1,1173 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <aws/auth/credentials.h>
+#include <aws/cal/hash.h>
+#include <aws/cal/hmac.h>
+#include <aws/common/byte_buf.h>
+#include <aws/common/mutex.h>
+#include <aws/common/thread.h>
+#include <aws/common/zero.h> /* for aws_secure_zero */
+#include <aws/dsql-auth/private/fork.h>
+#include <aws/dsql-auth/private/sha256_mb.h>
+#include <aws/dsql-auth/private/sigv4.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SERVICE_NAME "dsql"
+#define SIGNING_ALGORITHM "AWS4-HMAC-SHA256"
+#define SIGNING_KEY_PREFIX "AWS4"
+#define SCOPE_TERMINATOR "aws4_request"
+
+/* Hex-encoded SHA-256 of the empty request body */
+#define EMPTY_PAYLOAD_HASH "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"
+
+enum { DEFAULT_EXPIRES_IN = 900 };
+
+/* YYYYMMDD and YYYYMMDDTHHMMSSZ */
+enum { SHORT_DATE_LEN = 8, AMZ_DATE_LEN = 16 };
+
+enum {
+    SIGNING_KEY_CACHE_SLOTS = 16,
+    SIGNING_KEY_MAX_REGION_LEN = 32,
+};
+
+/*
+ * One cached signing key. The SHA-256 of the secret is kept rather than the secret, so that rotated credentials never
+ * match a stale key without the cache holding a copy of any secret.
+ */
+struct signing_key_slot {
+    uint8_t secret_digest[AWS_SHA256_LEN];
+    uint8_t region[SIGNING_KEY_MAX_REGION_LEN];
+    size_t region_len;
+    uint8_t short_date[SHORT_DATE_LEN];
+    uint8_t key[AWS_DSQL_AUTH_SIGNING_KEY_LEN];
+    uint64_t last_used;
+    bool in_use;
+};
+
+/* Fixed-size so that the cache never allocates and needs no explicit clean up */
+static struct aws_mutex s_signing_key_cache_lock = AWS_MUTEX_INIT;
+static struct signing_key_slot s_signing_key_cache[SIGNING_KEY_CACHE_SLOTS];
+static uint64_t s_signing_key_cache_tick = 0;
+
+/* Takes the cache lock across a fork, so that a child never inherits it held by a thread that did not come across */
+static aws_thread_once s_sigv4_fork_once = AWS_THREAD_ONCE_STATIC_INIT;
+static struct aws_dsql_auth_fork_handler s_sigv4_fork_handler;
+
+/*
+ * The percent-encoded access key ID and session token of one set of credentials, which every token they sign carries.
+ * Immutable once created.
+ */
+struct aws_dsql_auth_credentials_fragment {
+    struct aws_allocator *allocator;
+
+    /* Held so that no other credentials can be allocated at this address while the fragment lives */
+    const struct aws_credentials *credentials;
+
+    size_t encoded_access_key_id_len;
+    size_t encoded_session_token_len;
+
+    /* The encoded access key ID followed by the encoded session token, allocated with the fragment */
+    uint8_t *encoded;
+};
+
+static bool s_sigv4_try_prepare_fork(void *user_data) {
+    (void)user_data;
+    return aws_mutex_try_lock(&s_signing_key_cache_lock) == AWS_OP_SUCCESS;
+}
+
+/*
+ * After a fork, in the parent and the child alike: the cache was taken between updates, so the child keeps it and the
+ * lock is simply given back.
+ */
+static void s_sigv4_release_fork(void *user_data) {
+    (void)user_data;
+    aws_mutex_unlock(&s_signing_key_cache_lock);
+}
+
+static void s_sigv4_fork_init(void *user_data) {
+    (void)user_data;
+
+    s_sigv4_fork_handler.try_prepare = s_sigv4_try_prepare_fork;
+    s_sigv4_fork_handler.parent = s_sigv4_release_fork;
+    s_sigv4_fork_handler.child = s_sigv4_release_fork;
+    aws_dsql_auth_fork_handler_register(&s_sigv4_fork_handler);
+}
+
+/* Called before the cache lock is first taken; the cache lives for the whole process, so it is never unregistered */
+static void s_sigv4_register_fork_handler(void) {
+    aws_thread_call_once(&s_sigv4_fork_once, s_sigv4_fork_init, NULL);
+}
+
+static const char s_hex_lower[] = "0123456789abcdef";
+static const char s_hex_upper[] = "0123456789ABCDEF";
+
+static void s_hex_encode(const uint8_t *bytes, size_t len, char *out) {
+    for (size_t i = 0; i < len; ++i) {
+        out[2 * i] = s_hex_lower[bytes[i] >> 4];
+        out[2 * i + 1] = s_hex_lower[bytes[i] & 0x0f];
+    }
+}
+
+static int s_hmac(
+    struct aws_allocator *allocator,
+    struct aws_byte_cursor key,
+    struct aws_byte_cursor data,
+    uint8_t out[AWS_SHA256_HMAC_LEN]) {
+
+    struct aws_byte_buf output = aws_byte_buf_from_empty_array(out, AWS_SHA256_HMAC_LEN);
+    return aws_sha256_hmac_compute(allocator, &key, &data, &output, 0);
+}
+
+/**
+ * Run the four chained HMACs that turn a secret access key into the signing key for a region and day.
+ */
+static int s_derive_signing_key(
+    struct aws_allocator *allocator,
+    struct aws_byte_cursor secret_access_key,
+    struct aws_byte_cursor region,
+    struct aws_byte_cursor short_date,
+    uint8_t out_key[AWS_DSQL_AUTH_SIGNING_KEY_LEN]) {
+
+    struct aws_byte_cursor prefix = aws_byte_cursor_from_c_str(SIGNING_KEY_PREFIX);
+
+    struct aws_byte_buf secret;
+    if (aws_byte_buf_init(&secret, allocator, prefix.len + secret_access_key.len)) {
+        return AWS_OP_ERR;
+    }
+    aws_byte_buf_append(&secret, &prefix);
+    aws_byte_buf_append(&secret, &secret_access_key);
+
+    uint8_t k_date[AWS_SHA256_HMAC_LEN];
+    uint8_t k_region[AWS_SHA256_HMAC_LEN];
+    uint8_t k_service[AWS_SHA256_HMAC_LEN];
+
+    int result = AWS_OP_ERR;
+    if (s_hmac(allocator, aws_byte_cursor_from_buf(&secret), short_date, k_date) ||
+        s_hmac(allocator, aws_byte_cursor_from_array(k_date, sizeof(k_date)), region, k_region) ||
+        s_hmac(
+            allocator,
+            aws_byte_cursor_from_array(k_region, sizeof(k_region)),
+            aws_byte_cursor_from_c_str(SERVICE_NAME),
+            k_service) ||
+        s_hmac(
+            allocator,
+            aws_byte_cursor_from_array(k_service, sizeof(k_service)),
+            aws_byte_cursor_from_c_str(SCOPE_TERMINATOR),
+            out_key)) {
+        goto done;
+    }
+
+    result = AWS_OP_SUCCESS;
+
+done:
+    aws_secure_zero(k_date, sizeof(k_date));
+    aws_secure_zero(k_region, sizeof(k_region));
+    aws_secure_zero(k_service, sizeof(k_service));
+    aws_byte_buf_clean_up_secure(&secret);
+
+    return result;
+}
+
+/* Compare two digests in time that does not depend on where they differ */
+static bool s_digests_equal(const uint8_t a[AWS_SHA256_LEN], const uint8_t b[AWS_SHA256_LEN]) {
+    uint8_t difference = 0;
+    for (size_t i = 0; i < AWS_SHA256_LEN; ++i) {
+        difference |= a[i] ^ b[i];
+    }
+    return difference == 0;
+}
+
+static bool s_signing_key_slot_matches_credentials(
+    const struct signing_key_slot *slot,
+    const uint8_t secret_digest[AWS_SHA256_LEN],
+    struct aws_byte_cursor region) {
+
+    return slot->in_use && s_digests_equal(slot->secret_digest, secret_digest) && slot->region_len == region.len &&
+           memcmp(slot->region, region.ptr, region.len) == 0;
+}
+
+int aws_dsql_auth_signing_key_get(
+    struct aws_allocator *allocator,
+    struct aws_byte_cursor secret_access_key,
+    struct aws_byte_cursor region,
+    struct aws_byte_cursor short_date,
+    uint8_t out_key[AWS_DSQL_AUTH_SIGNING_KEY_LEN]) {
+
+    if (short_date.len != SHORT_DATE_LEN) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    /* Unusually long regions are still signed, just not cached */
+    if (region.len > SIGNING_KEY_MAX_REGION_LEN) {
+        return s_derive_signing_key(allocator, secret_access_key, region, short_date, out_key);
+    }
+
+    uint8_t secret_digest[AWS_SHA256_LEN];
+    struct aws_byte_buf digest_buf = aws_byte_buf_from_empty_array(secret_digest, sizeof(secret_digest));
+    if (aws_sha256_compute(allocator, &secret_access_key, &digest_buf, 0)) {
+        return AWS_OP_ERR;
+    }
+
+    s_sigv4_register_fork_handler();
+
+    aws_mutex_lock(&s_signing_key_cache_lock);
+    for (size_t i = 0; i < SIGNING_KEY_CACHE_SLOTS; ++i) {
+        struct signing_key_slot *slot = &s_signing_key_cache[i];
+        if (s_signing_key_slot_matches_credentials(slot, secret_digest, region) &&
+            memcmp(slot->short_date, short_date.ptr, SHORT_DATE_LEN) == 0) {
+
+            memcpy(out_key, slot->key, AWS_DSQL_AUTH_SIGNING_KEY_LEN);
+            slot->last_used = ++s_signing_key_cache_tick;
+            aws_mutex_unlock(&s_signing_key_cache_lock);
+            return AWS_OP_SUCCESS;
+        }
+    }
+    aws_mutex_unlock(&s_signing_key_cache_lock);
+
+    /* Derive outside the lock; concurrent misses for the same key just derive it twice */
+    if (s_derive_signing_key(allocator, secret_access_key, region, short_date, out_key)) {
+        return AWS_OP_ERR;
+    }
+
+    aws_mutex_lock(&s_signing_key_cache_lock);
+
+    /* Replace the previous day's key for these credentials if there is one, else a free slot, else the LRU slot */
+    struct signing_key_slot *victim = NULL;
+    for (size_t i = 0; i < SIGNING_KEY_CACHE_SLOTS; ++i) {
+        struct signing_key_slot *slot = &s_signing_key_cache[i];
+        if (s_signing_key_slot_matches_credentials(slot, secret_digest, region)) {
+            victim = slot;
+            break;
+        }
+        if (!victim || (victim->in_use && (!slot->in_use || slot->last_used < victim->last_used))) {
+            victim = slot;
+        }
+    }
+
+    aws_secure_zero(victim, sizeof(struct signing_key_slot));
+    memcpy(victim->secret_digest, secret_digest, sizeof(secret_digest));
+    memcpy(victim->region, region.ptr, region.len);
+    victim->region_len = region.len;
+    memcpy(victim->short_date, short_date.ptr, SHORT_DATE_LEN);
+    memcpy(victim->key, out_key, AWS_DSQL_AUTH_SIGNING_KEY_LEN);
+    victim->last_used = ++s_signing_key_cache_tick;
+    victim->in_use = true;
+
+    aws_mutex_unlock(&s_signing_key_cache_lock);
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Format a Unix timestamp as YYYYMMDDTHHMMSSZ. The first 8 characters are the short date.
+ * Uses the days-to-civil conversion from http://howardhinnant.github.io/date_algorithms.html so that no locale or
+ * non-reentrant libc time functions are involved.
+ */
+static void s_format_amz_date(uint64_t epoch_secs, char out[AMZ_DATE_LEN + 1]) {
+    uint64_t seconds_of_day = epoch_secs % 86400;
+    uint64_t z = epoch_secs / 86400 + 719468;
+    uint64_t era = z / 146097;
+    uint64_t day_of_era = z - era * 146097;
+    uint64_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    uint64_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    uint64_t shifted_month = (5 * day_of_year + 2) / 153;
+    uint64_t day = day_of_year - (153 * shifted_month + 2) / 5 + 1;
+    uint64_t month = shifted_month < 10 ? shifted_month + 3 : shifted_month - 9;
+    uint64_t year = year_of_era + era * 400 + (month <= 2 ? 1 : 0);
+
+    snprintf(
+        out,
+        AMZ_DATE_LEN + 1,
+        "%04u%02u%02uT%02u%02u%02uZ",
+        (unsigned)year,
+        (unsigned)month,
+        (unsigned)day,
+        (unsigned)(seconds_of_day / 3600),
+        (unsigned)(seconds_of_day / 60 % 60),
+        (unsigned)(seconds_of_day % 60));
+}
+
+/* Appends are never dynamic: every caller makes room for all it writes before writing any of it */
+static int s_append_cursor(struct aws_byte_buf *buf, struct aws_byte_cursor cursor) {
+    return aws_byte_buf_append(buf, &cursor);
+}
+
+static int s_append_c_str(struct aws_byte_buf *buf, const char *c_str) {
+    return s_append_cursor(buf, aws_byte_cursor_from_c_str(c_str));
+}
+
+static bool s_is_unreserved(uint8_t c) {
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '-' || c == '_' ||
+           c == '.' || c == '~';
+}
+
+static size_t s_uri_encoded_length(struct aws_byte_cursor value) {
+    size_t encoded_len = value.len;
+    for (size_t i = 0; i < value.len; ++i) {
+        if (!s_is_unreserved(value.ptr[i])) {
+            encoded_len += 2;
+        }
+    }
+
+    return encoded_len;
+}
+
+/* Append a query parameter value, percent-encoding everything outside the RFC 3986 unreserved set */
+static int s_append_uri_encoded(struct aws_byte_buf *buf, struct aws_byte_cursor value) {
+    if (buf->capacity - buf->len < s_uri_encoded_length(value)) {
+        return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+    }
+
+    for (size_t i = 0; i < value.len; ++i) {
+        uint8_t c = value.ptr[i];
+        if (s_is_unreserved(c)) {
+            buf->buffer[buf->len++] = c;
+        } else {
+            buf->buffer[buf->len++] = '%';
+            buf->buffer[buf->len++] = (uint8_t)s_hex_upper[c >> 4];
+            buf->buffer[buf->len++] = (uint8_t)s_hex_upper[c & 0x0f];
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/* The bytes appended to storage since piece_start */
+static struct aws_byte_cursor s_piece_since(const struct aws_byte_buf *storage, size_t piece_start) {
+    return aws_byte_cursor_from_array(storage->buffer + piece_start, storage->len - piece_start);
+}
+
+/* Point the encoded cursors at encoded_access_key_id_len + encoded_session_token_len bytes of encoded */
+static void s_presign_credentials_set_encoded(
+    struct aws_dsql_auth_presign_credentials *presign_credentials,
+    const uint8_t *encoded,
+    size_t encoded_access_key_id_len,
+    size_t encoded_session_token_len) {
+
+    presign_credentials->access_key_id = aws_byte_cursor_from_array(encoded, encoded_access_key_id_len);
+    presign_credentials->session_token =
+        aws_byte_cursor_from_array(encoded + encoded_access_key_id_len, encoded_session_token_len);
+    presign_credentials->is_encoded = true;
+}
+
+static void s_credentials_fragment_destroy(struct aws_dsql_auth_credentials_fragment *fragment) {
+    aws_credentials_release(fragment->credentials);
+    aws_secure_zero(fragment->encoded, fragment->encoded_access_key_id_len + fragment->encoded_session_token_len);
+    aws_mem_release(fragment->allocator, fragment);
+}
+
+/* Encode credentials into a new fragment, or return NULL if it cannot be allocated */
+static struct aws_dsql_auth_credentials_fragment *s_credentials_fragment_new(
+    struct aws_allocator *allocator,
+    const struct aws_credentials *credentials) {
+
+    struct aws_byte_cursor access_key_id = aws_credentials_get_access_key_id(credentials);
+    struct aws_byte_cursor session_token = aws_credentials_get_session_token(credentials);
+    size_t encoded_access_key_id_len = s_uri_encoded_length(access_key_id);
+    size_t encoded_session_token_len = s_uri_encoded_length(session_token);
+
+    struct aws_dsql_auth_credentials_fragment *fragment = NULL;
+    uint8_t *encoded = NULL;
+    if (!aws_mem_acquire_many(
+            allocator,
+            2,
+            &fragment,
+            sizeof(struct aws_dsql_auth_credentials_fragment),
+            &encoded,
+            encoded_access_key_id_len + encoded_session_token_len)) {
+        return NULL;
+    }
+
+    struct aws_byte_buf encoded_buf =
+        aws_byte_buf_from_empty_array(encoded, encoded_access_key_id_len + encoded_session_token_len);
+    s_append_uri_encoded(&encoded_buf, access_key_id);
+    s_append_uri_encoded(&encoded_buf, session_token);
+
+    fragment->allocator = allocator;
+    fragment->credentials = credentials;
+    fragment->encoded_access_key_id_len = encoded_access_key_id_len;
+    fragment->encoded_session_token_len = encoded_session_token_len;
+    fragment->encoded = encoded;
+    aws_credentials_acquire(credentials);
+
+    return fragment;
+}
+
+void aws_dsql_auth_credentials_fragment_cache_init(
+    struct aws_dsql_auth_credentials_fragment_cache *fragment_cache,
+    struct aws_allocator *allocator) {
+
+    fragment_cache->allocator = allocator;
+    for (size_t i = 0; i < AWS_DSQL_AUTH_CREDENTIALS_FRAGMENT_CACHE_SLOTS; ++i) {
+        aws_atomic_init_ptr(&fragment_cache->slots[i], NULL);
+    }
+}
+
+void aws_dsql_auth_credentials_fragment_cache_clean_up(
+    struct aws_dsql_auth_credentials_fragment_cache *fragment_cache) {
+
+    for (size_t i = 0; i < AWS_DSQL_AUTH_CREDENTIALS_FRAGMENT_CACHE_SLOTS; ++i) {
+        struct aws_dsql_auth_credentials_fragment *fragment = aws_atomic_exchange_ptr(&fragment_cache->slots[i], NULL);
+        if (fragment) {
+            s_credentials_fragment_destroy(fragment);
+        }
+    }
+}
+
+/*
+ * Take the fragment of credentials out of the cache, or return NULL if no slot holds one. A slot is emptied before its
+ * fragment is looked at, so the fragment cannot be freed under the lookup. A fragment of other credentials is stale:
+ * a cache serves one credentials provider, whose credentials only change when they are rotated, so it is freed.
+ */
+static struct aws_dsql_auth_credentials_fragment *s_credentials_fragment_cache_take(
+    struct aws_dsql_auth_credentials_fragment_cache *fragment_cache,
+    const struct aws_credentials *credentials) {
+
+    for (size_t i = 0; i < AWS_DSQL_AUTH_CREDENTIALS_FRAGMENT_CACHE_SLOTS; ++i) {
+        /* Loaded first, so that free slots are skipped without writing their cache line */
+        if (!aws_atomic_load_ptr(&fragment_cache->slots[i])) {
+            continue;
+        }
+
+        struct aws_dsql_auth_credentials_fragment *fragment = aws_atomic_exchange_ptr(&fragment_cache->slots[i], NULL);
+        if (!fragment) {
+            continue;
+        }
+        if (fragment->credentials == credentials) {
+            return fragment;
+        }
+        s_credentials_fragment_destroy(fragment);
+    }
+
+    return NULL;
+}
+
+/* Put a fragment back in the first free slot, or free it if every slot holds one */
+static void s_credentials_fragment_cache_put(
+    struct aws_dsql_auth_credentials_fragment_cache *fragment_cache,
+    struct aws_dsql_auth_credentials_fragment *fragment) {
+
+    for (size_t i = 0; i < AWS_DSQL_AUTH_CREDENTIALS_FRAGMENT_CACHE_SLOTS; ++i) {
+        void *expected = NULL;
+        if (aws_atomic_compare_exchange_ptr(&fragment_cache->slots[i], &expected, fragment)) {
+            return;
+        }
+    }
+
+    s_credentials_fragment_destroy(fragment);
+}
+
+void aws_dsql_auth_presign_credentials_init(
+    struct aws_dsql_auth_presign_credentials *presign_credentials,
+    const struct aws_credentials *credentials,
+    struct aws_dsql_auth_credentials_fragment_cache *fragment_cache) {
+
+    struct aws_byte_cursor access_key_id = aws_credentials_get_access_key_id(credentials);
+    struct aws_byte_cursor session_token = aws_credentials_get_session_token(credentials);
+
+    presign_credentials->credentials = credentials;
+    presign_credentials->access_key_id = access_key_id;
+    presign_credentials->session_token = session_token;
+    presign_credentials->is_encoded = false;
+    presign_credentials->fragment_cache = NULL;
+    presign_credentials->fragment = NULL;
+
+    if (fragment_cache) {
+        struct aws_dsql_auth_credentials_fragment *fragment =
+            s_credentials_fragment_cache_take(fragment_cache, credentials);
+        if (!fragment) {
+            fragment = s_credentials_fragment_new(fragment_cache->allocator, credentials);
+        }
+        if (fragment) {
+            presign_credentials->fragment_cache = fragment_cache;
+            presign_credentials->fragment = fragment;
+            s_presign_credentials_set_encoded(
+                presign_credentials,
+                fragment->encoded,
+                fragment->encoded_access_key_id_len,
+                fragment->encoded_session_token_len);
+            return;
+        }
+    }
+
+    /* Credentials too long for the storage are left raw and encoded as they are written */
+    size_t encoded_access_key_id_len = s_uri_encoded_length(access_key_id);
+    size_t encoded_session_token_len = s_uri_encoded_length(session_token);
+    if (encoded_access_key_id_len + encoded_session_token_len > sizeof(presign_credentials->storage)) {
+        return;
+    }
+
+    struct aws_byte_buf encoded =
+        aws_byte_buf_from_empty_array(presign_credentials->storage, sizeof(presign_credentials->storage));
+    s_append_uri_encoded(&encoded, access_key_id);
+    s_append_uri_encoded(&encoded, session_token);
+    s_presign_credentials_set_encoded(
+        presign_credentials, presign_credentials->storage, encoded_access_key_id_len, encoded_session_token_len);
+}
+
+void aws_dsql_auth_presign_credentials_clean_up(struct aws_dsql_auth_presign_credentials *presign_credentials) {
+    if (presign_credentials->fragment) {
+        s_credentials_fragment_cache_put(presign_credentials->fragment_cache, presign_credentials->fragment);
+        presign_credentials->fragment = NULL;
+    } else if (presign_credentials->is_encoded) {
+        size_t encoded_len = presign_credentials->access_key_id.len + presign_credentials->session_token.len;
+        aws_secure_zero(presign_credentials->storage, encoded_len);
+    }
+    presign_credentials->is_encoded = false;
+}
+
+/* Length in a token of the access key ID or session token of presign_credentials */
+static size_t s_presign_credential_length(
+    const struct aws_dsql_auth_presign_credentials *presign_credentials,
+    struct aws_byte_cursor value) {
+
+    return presign_credentials->is_encoded ? value.len : s_uri_encoded_length(value);
+}
+
+/* Append the access key ID or session token of presign_credentials, encoding it unless it already is */
+static int s_append_presign_credential(
+    struct aws_byte_buf *buf,
+    const struct aws_dsql_auth_presign_credentials *presign_credentials,
+    struct aws_byte_cursor value) {
+
+    return presign_credentials->is_encoded ? s_append_cursor(buf, value) : s_append_uri_encoded(buf, value);
+}
+
+int aws_dsql_auth_presign_template_init(
+    struct aws_dsql_auth_presign_template *presign_template,
+    struct aws_byte_cursor hostname,
+    struct aws_byte_cursor region,
+    struct aws_byte_cursor action,
+    uint64_t expires_in) {
+
+    AWS_ZERO_STRUCT(*presign_template);
+
+    if (hostname.len == 0 || hostname.len > AWS_DSQL_AUTH_MAX_HOSTNAME_LEN || region.len == 0 ||
+        region.len > AWS_DSQL_AUTH_MAX_REGION_LEN || action.len == 0 || action.len > AWS_DSQL_AUTH_MAX_ACTION_LEN) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    char expires_str[32];
+    snprintf(expires_str, sizeof(expires_str), "%" PRIu64, expires_in ? expires_in : DEFAULT_EXPIRES_IN);
+
+    /* The length limits above guarantee that every piece fits in the inline storage */
+    struct aws_byte_buf storage =
+        aws_byte_buf_from_empty_array(presign_template->storage, sizeof(presign_template->storage));
+    size_t piece_start = 0;
+
+    s_append_cursor(&storage, hostname);
+    presign_template->hostname = s_piece_since(&storage, piece_start);
+    s_append_c_str(&storage, "/?");
+    presign_template->token_head = s_piece_since(&storage, piece_start);
+
+    piece_start = storage.len;
+    s_append_cursor(&storage, region);
+    presign_template->region = s_piece_since(&storage, piece_start);
+
+    piece_start = storage.len;
+    s_append_c_str(&storage, "Action=");
+    s_append_uri_encoded(&storage, action);
+    s_append_c_str(&storage, "&X-Amz-Algorithm=" SIGNING_ALGORITHM "&X-Amz-Credential=");
+    presign_template->query_head = s_piece_since(&storage, piece_start);
+
+    piece_start = storage.len;
+    s_append_c_str(&storage, "%2F");
+    s_append_uri_encoded(&storage, region);
+    s_append_c_str(&storage, "%2F" SERVICE_NAME "%2F" SCOPE_TERMINATOR "&X-Amz-Date=");
+    presign_template->scope_param = s_piece_since(&storage, piece_start);
+
+    piece_start = storage.len;
+    s_append_c_str(&storage, "&X-Amz-Expires=");
+    s_append_c_str(&storage, expires_str);
+    presign_template->expires_param = s_piece_since(&storage, piece_start);
+
+    piece_start = storage.len;
+    s_append_c_str(&storage, "&X-Amz-SignedHeaders=host\nhost:");
+    s_append_cursor(&storage, hostname);
+    s_append_c_str(&storage, "\n\nhost\n" EMPTY_PAYLOAD_HASH);
+    presign_template->canonical_tail = s_piece_since(&storage, piece_start);
+
+    piece_start = storage.len;
+    s_append_c_str(&storage, "/");
+    s_append_cursor(&storage, region);
+    s_append_c_str(&storage, "/" SERVICE_NAME "/" SCOPE_TERMINATOR "\n");
+    presign_template->scope_tail = s_piece_since(&storage, piece_start);
+
+    return AWS_OP_SUCCESS;
+}
+
+/* The exact length of the token s_append_unsigned_token and s_append_signature write */
+static int s_presign_token_length(
+    const struct aws_dsql_auth_presign_template *presign_template,
+    const struct aws_dsql_auth_presign_credentials *presign_credentials,
+    size_t *out_len) {
+
+    struct aws_byte_cursor session_token = presign_credentials->session_token;
+
+    /* The pieces of the token, in the order aws_dsql_auth_presign_template_sign writes them */
+    size_t pieces[] = {
+        presign_template->token_head.len,
+        presign_template->query_head.len,
+        s_presign_credential_length(presign_credentials, presign_credentials->access_key_id),
+        sizeof("%2F") - 1 + SHORT_DATE_LEN,
+        presign_template->scope_param.len,
+        AMZ_DATE_LEN,
+        sizeof("&X-Amz-SignedHeaders=host") - 1,
+        presign_template->expires_param.len,
+        session_token.len > 0 ? sizeof("&X-Amz-Security-Token=") - 1 : 0,
+        s_presign_credential_length(presign_credentials, session_token),
+        sizeof("&X-Amz-Signature=") - 1 + AWS_SHA256_HMAC_LEN * 2,
+    };
+
+    size_t len = 0;
+    for (size_t i = 0; i < AWS_ARRAY_SIZE(pieces); ++i) {
+        if (aws_add_size_checked(len, pieces[i], &len)) {
+            return AWS_OP_ERR;
+        }
+    }
+
+    *out_len = len;
+    return AWS_OP_SUCCESS;
+}
+
+int aws_dsql_auth_presign_template_length(
+    const struct aws_dsql_auth_presign_template *presign_template,
+    const struct aws_dsql_auth_presign_credentials *presign_credentials,
+    size_t *out_len) {
+
+    if (!presign_template || !presign_credentials || !out_len) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    return s_presign_token_length(presign_template, presign_credentials, out_len);
+}
+
+/**
+ * Hash the canonical request. It is fed to SHA-256 piece by piece instead of being assembled first:
+ *
+ *     GET\n/\n<query prefix><query suffix>&X-Amz-SignedHeaders=host\nhost:<hostname>\n\nhost\n<empty payload hash>
+ *
+ * X-Amz-SignedHeaders sorts after the suffix parameters, so the canonical query string is the token's query with that
+ * parameter moved to the end, where it starts the template's precomputed canonical tail.
+ */
+enum { CANONICAL_REQUEST_PIECES = 4 };
+
+static void s_canonical_request_pieces(
+    const struct aws_dsql_auth_presign_template *presign_template,
+    struct aws_byte_cursor query_prefix,
+    struct aws_byte_cursor query_suffix,
+    struct aws_byte_cursor out_pieces[CANONICAL_REQUEST_PIECES]) {
+
+    out_pieces[0] = aws_byte_cursor_from_c_str("GET\n/\n");
+    out_pieces[1] = query_prefix;
+    out_pieces[2] = query_suffix;
+    out_pieces[3] = presign_template->canonical_tail;
+}
+
+static int s_hash_canonical_request(
+    struct aws_allocator *allocator,
+    const struct aws_dsql_auth_presign_template *presign_template,
+    struct aws_byte_cursor query_prefix,
+    struct aws_byte_cursor query_suffix,
+    uint8_t out_hash[AWS_SHA256_LEN]) {
+
+    struct aws_hash *hash = aws_sha256_new(allocator);
+    if (!hash) {
+        return AWS_OP_ERR;
+    }
+
+    struct aws_byte_cursor pieces[CANONICAL_REQUEST_PIECES];
+    s_canonical_request_pieces(presign_template, query_prefix, query_suffix, pieces);
+
+    int result = AWS_OP_SUCCESS;
+    for (size_t i = 0; i < AWS_ARRAY_SIZE(pieces) && result == AWS_OP_SUCCESS; ++i) {
+        result = aws_hash_update(hash, &pieces[i]);
+    }
+
+    if (result == AWS_OP_SUCCESS) {
+        struct aws_byte_buf output = aws_byte_buf_from_empty_array(out_hash, AWS_SHA256_LEN);
+        result = aws_hash_finalize(hash, &output, 0);
+    }
+
+    aws_hash_destroy(hash);
+    return result;
+}
+
+enum { STRING_TO_SIGN_PIECES = 6 };
+
+/*
+ * The string to sign, in pieces:
+ *
+ *     AWS4-HMAC-SHA256\n<amz date>\n<short date>/<region>/dsql/aws4_request\n<hex canonical request hash>
+ */
+static void s_string_to_sign_pieces(
+    const struct aws_dsql_auth_presign_template *presign_template,
+    struct aws_byte_cursor amz_date,
+    const char hash_hex[AWS_SHA256_LEN * 2],
+    struct aws_byte_cursor out_pieces[STRING_TO_SIGN_PIECES]) {
+
+    out_pieces[0] = aws_byte_cursor_from_c_str(SIGNING_ALGORITHM "\n");
+    out_pieces[1] = amz_date;
+    out_pieces[2] = aws_byte_cursor_from_c_str("\n");
+    out_pieces[3] = aws_byte_cursor_from_array(amz_date.ptr, SHORT_DATE_LEN);
+    out_pieces[4] = presign_template->scope_tail;
+    out_pieces[5] = aws_byte_cursor_from_array(hash_hex, AWS_SHA256_LEN * 2);
+}
+
+/* HMAC the string to sign with the signing key, again piece by piece */
+static int s_sign_string_to_sign(
+    struct aws_allocator *allocator,
+    const struct aws_dsql_auth_presign_template *presign_template,
+    const uint8_t signing_key[AWS_DSQL_AUTH_SIGNING_KEY_LEN],
+    struct aws_byte_cursor amz_date,
+    const uint8_t canonical_request_hash[AWS_SHA256_LEN],
+    uint8_t out_signature[AWS_SHA256_HMAC_LEN]) {
+
+    struct aws_byte_cursor key = aws_byte_cursor_from_array(signing_key, AWS_DSQL_AUTH_SIGNING_KEY_LEN);
+    struct aws_hmac *hmac = aws_sha256_hmac_new(allocator, &key);
+    if (!hmac) {
+        return AWS_OP_ERR;
+    }
+
+    char hash_hex[AWS_SHA256_LEN * 2];
+    s_hex_encode(canonical_request_hash, AWS_SHA256_LEN, hash_hex);
+
+    struct aws_byte_cursor pieces[STRING_TO_SIGN_PIECES];
+    s_string_to_sign_pieces(presign_template, amz_date, hash_hex, pieces);
+
+    int result = AWS_OP_SUCCESS;
+    for (size_t i = 0; i < AWS_ARRAY_SIZE(pieces) && result == AWS_OP_SUCCESS; ++i) {
+        result = aws_hmac_update(hmac, &pieces[i]);
+    }
+
+    if (result == AWS_OP_SUCCESS) {
+        struct aws_byte_buf output = aws_byte_buf_from_empty_array(out_signature, AWS_SHA256_HMAC_LEN);
+        result = aws_hmac_finalize(hmac, &output, 0);
+    }
+
+    aws_hmac_destroy(hmac);
+    return result;
+}
+
+/* Make room for a whole token up front, growing a dynamic buffer at most once */
+static int s_reserve_token(struct aws_byte_buf *out_token, size_t token_len) {
+    if (out_token->capacity - out_token->len >= token_len) {
+        return AWS_OP_SUCCESS;
+    }
+    if (!out_token->allocator) {
+        return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+    }
+    return aws_byte_buf_reserve_relative(out_token, token_len);
+}
+
+/* Where the query parameters before and after X-Amz-SignedHeaders were written into a token */
+struct presign_query_spans {
+    size_t prefix_start;
+    size_t prefix_end;
+    size_t suffix_start;
+    size_t suffix_end;
+};
+
+/**
+ * Append everything but the signature to a token, recording where its query parameters went. Room must already have
+ * been made, so none of the appends can fail.
+ */
+static void s_append_unsigned_token(
+    struct aws_byte_buf *out_token,
+    const struct aws_dsql_auth_presign_template *presign_template,
+    const struct aws_dsql_auth_presign_credentials *presign_credentials,
+    struct aws_byte_cursor amz_date,
+    struct presign_query_spans *out_spans) {
+
+    s_append_cursor(out_token, presign_template->token_head);
+
+    /* The parameters that precede X-Amz-SignedHeaders in both the token and the canonical query */
+    out_spans->prefix_start = out_token->len;
+    s_append_cursor(out_token, presign_template->query_head);
+    s_append_presign_credential(out_token, presign_credentials, presign_credentials->access_key_id);
+    s_append_c_str(out_token, "%2F");
+    s_append_cursor(out_token, aws_byte_cursor_from_array(amz_date.ptr, SHORT_DATE_LEN));
+    s_append_cursor(out_token, presign_template->scope_param);
+    s_append_cursor(out_token, amz_date);
+    out_spans->prefix_end = out_token->len;
+
+    s_append_c_str(out_token, "&X-Amz-SignedHeaders=host");
+
+    /* The parameters that follow X-Amz-SignedHeaders in the token but sort before it in the canonical query */
+    out_spans->suffix_start = out_token->len;
+    s_append_cursor(out_token, presign_template->expires_param);
+    if (presign_credentials->session_token.len > 0) {
+        s_append_c_str(out_token, "&X-Amz-Security-Token=");
+        s_append_presign_credential(out_token, presign_credentials, presign_credentials->session_token);
+    }
+    out_spans->suffix_end = out_token->len;
+}
+
+static struct aws_byte_cursor s_query_prefix(
+    const struct aws_byte_buf *token,
+    const struct presign_query_spans *spans) {
+
+    return aws_byte_cursor_from_array(token->buffer + spans->prefix_start, spans->prefix_end - spans->prefix_start);
+}
+
+static struct aws_byte_cursor s_query_suffix(
+    const struct aws_byte_buf *token,
+    const struct presign_query_spans *spans) {
+
+    return aws_byte_cursor_from_array(token->buffer + spans->suffix_start, spans->suffix_end - spans->suffix_start);
+}
+
+static void s_append_signature_param(struct aws_byte_buf *out_token, const uint8_t signature[AWS_SHA256_HMAC_LEN]) {
+    char signature_hex[AWS_SHA256_HMAC_LEN * 2];
+    s_hex_encode(signature, AWS_SHA256_HMAC_LEN, signature_hex);
+    s_append_c_str(out_token, "&X-Amz-Signature=");
+    s_append_cursor(out_token, aws_byte_cursor_from_array(signature_hex, sizeof(signature_hex)));
+}
+
+/* Sign a token written by s_append_unsigned_token and append its X-Amz-Signature parameter */
+static int s_append_signature(
+    struct aws_allocator *allocator,
+    const struct aws_dsql_auth_presign_template *presign_template,
+    const uint8_t signing_key[AWS_DSQL_AUTH_SIGNING_KEY_LEN],
+    struct aws_byte_cursor amz_date,
+    const struct presign_query_spans *spans,
+    struct aws_byte_buf *out_token) {
+
+    uint8_t canonical_request_hash[AWS_SHA256_LEN];
+    if (s_hash_canonical_request(
+            allocator,
+            presign_template,
+            s_query_prefix(out_token, spans),
+            s_query_suffix(out_token, spans),
+            canonical_request_hash)) {
+        return AWS_OP_ERR;
+    }
+
+    uint8_t signature[AWS_SHA256_HMAC_LEN];
+    if (s_sign_string_to_sign(allocator, presign_template, signing_key, amz_date, canonical_request_hash, signature)) {
+        return AWS_OP_ERR;
+    }
+
+    s_append_signature_param(out_token, signature);
+    return AWS_OP_SUCCESS;
+}
+
+int aws_dsql_auth_presign_template_sign(
+    struct aws_allocator *allocator,
+    const struct aws_dsql_auth_presign_template *presign_template,
+    const struct aws_dsql_auth_presign_credentials *presign_credentials,
+    uint64_t signing_time_secs,
+    struct aws_byte_buf *out_token) {
+
+    if (!presign_template || !presign_credentials || !out_token) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    size_t token_len = 0;
+    if (s_presign_token_length(presign_template, presign_credentials, &token_len) ||
+        s_reserve_token(out_token, token_len)) {
+        return AWS_OP_ERR;
+    }
+
+    char amz_date_str[AMZ_DATE_LEN + 1];
+    s_format_amz_date(signing_time_secs, amz_date_str);
+    struct aws_byte_cursor amz_date = aws_byte_cursor_from_array(amz_date_str, AMZ_DATE_LEN);
+    struct aws_byte_cursor short_date = aws_byte_cursor_from_array(amz_date_str, SHORT_DATE_LEN);
+
+    uint8_t signing_key[AWS_DSQL_AUTH_SIGNING_KEY_LEN];
+    size_t original_len = out_token->len;
+
+    struct presign_query_spans spans;
+    s_append_unsigned_token(out_token, presign_template, presign_credentials, amz_date, &spans);
+
+    if (aws_dsql_auth_signing_key_get(
+            allocator,
+            aws_credentials_get_secret_access_key(presign_credentials->credentials),
+            presign_template->region,
+            short_date,
+            signing_key)) {
+        goto on_error;
+    }
+
+    if (s_append_signature(allocator, presign_template, signing_key, amz_date, &spans, out_token)) {
+        goto on_error;
+    }
+
+    aws_secure_zero(signing_key, sizeof(signing_key));
+    return AWS_OP_SUCCESS;
+
+on_error:
+    aws_secure_zero(signing_key, sizeof(signing_key));
+    out_token->len = original_len;
+    return AWS_OP_ERR;
+}
+
+int aws_dsql_auth_presign_template_sign_pair(
+    struct aws_allocator *allocator,
+    const struct aws_dsql_auth_presign_template *first_template,
+    const struct aws_dsql_auth_presign_template *second_template,
+    const struct aws_dsql_auth_presign_credentials *presign_credentials,
+    uint64_t signing_time_secs,
+    struct aws_byte_buf *out_first_token,
+    struct aws_byte_buf *out_second_token) {
+
+    if (!first_template || !second_template || !presign_credentials || !out_first_token || !out_second_token ||
+        out_first_token == out_second_token) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    /* Only the Action may differ, so everything after it can be shared */
+    if (!aws_byte_cursor_eq(&first_template->token_head, &second_template->token_head) ||
+        !aws_byte_cursor_eq(&first_template->scope_param, &second_template->scope_param) ||
+        !aws_byte_cursor_eq(&first_template->expires_param, &second_template->expires_param)) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    size_t first_len = 0;
+    if (s_presign_token_length(first_template, presign_credentials, &first_len)) {
+        return AWS_OP_ERR;
+    }
+    size_t second_len = first_len - first_template->query_head.len + second_template->query_head.len;
+    if (s_reserve_token(out_first_token, first_len) || s_reserve_token(out_second_token, second_len)) {
+        return AWS_OP_ERR;
+    }
+
+    char amz_date_str[AMZ_DATE_LEN + 1];
+    s_format_amz_date(signing_time_secs, amz_date_str);
+    struct aws_byte_cursor amz_date = aws_byte_cursor_from_array(amz_date_str, AMZ_DATE_LEN);
+    struct aws_byte_cursor short_date = aws_byte_cursor_from_array(amz_date_str, SHORT_DATE_LEN);
+
+    uint8_t signing_key[AWS_DSQL_AUTH_SIGNING_KEY_LEN];
+    size_t first_original_len = out_first_token->len;
+    size_t second_original_len = out_second_token->len;
+
+    struct presign_query_spans first_spans;
+    s_append_unsigned_token(out_first_token, first_template, presign_credentials, amz_date, &first_spans);
+
+    /*
+     * The second token is the first with its own Action: copy the encoded credential, date, expiry and security token
+     * that follow the query head instead of encoding them again.
+     */
+    size_t shared_start = first_spans.prefix_start + first_template->query_head.len;
+    struct aws_byte_cursor shared =
+        aws_byte_cursor_from_array(out_first_token->buffer + shared_start, first_spans.suffix_end - shared_start);
+
+    struct presign_query_spans second_spans;
+    s_append_cursor(out_second_token, second_template->token_head);
+    second_spans.prefix_start = out_second_token->len;
+    s_append_cursor(out_second_token, second_template->query_head);
+    size_t second_shared_start = out_second_token->len;
+    s_append_cursor(out_second_token, shared);
+    second_spans.prefix_end = second_shared_start + (first_spans.prefix_end - shared_start);
+    second_spans.suffix_start = second_shared_start + (first_spans.suffix_start - shared_start);
+    second_spans.suffix_end = out_second_token->len;
+
+    /* One signing key lookup serves both tokens */
+    if (aws_dsql_auth_signing_key_get(
+            allocator,
+            aws_credentials_get_secret_access_key(presign_credentials->credentials),
+            first_template->region,
+            short_date,
+            signing_key)) {
+        goto on_error;
+    }
+
+    if (s_append_signature(allocator, first_template, signing_key, amz_date, &first_spans, out_first_token) ||
+        s_append_signature(allocator, second_template, signing_key, amz_date, &second_spans, out_second_token)) {
+        goto on_error;
+    }
+
+    aws_secure_zero(signing_key, sizeof(signing_key));
+    return AWS_OP_SUCCESS;
+
+on_error:
+    aws_secure_zero(signing_key, sizeof(signing_key));
+    out_first_token->len = first_original_len;
+    out_second_token->len = second_original_len;
+    return AWS_OP_ERR;
+}
+
+/* HMAC-SHA256 pads its key to a block and XORs it with these for the inner and the outer hash */
+enum { HMAC_BLOCK_LEN = 64, HMAC_INNER_PAD = 0x36, HMAC_OUTER_PAD = 0x5c };
+
+/* What one token of a multi-buffer signing pass hashes, and the digests it gets back */
+struct presign_batch_lane {
+    struct aws_byte_cursor canonical_request_pieces[CANONICAL_REQUEST_PIECES];
+    struct aws_byte_cursor inner_pieces[1 + STRING_TO_SIGN_PIECES];
+    struct aws_byte_cursor outer_pieces[2];
+    uint8_t inner_block[HMAC_BLOCK_LEN];
+    uint8_t outer_block[HMAC_BLOCK_LEN];
+    uint8_t canonical_request_hash[AWS_SHA256_LEN];
+    char hash_hex[AWS_SHA256_LEN * 2];
+    uint8_t inner_hash[AWS_SHA256_LEN];
+    uint8_t signature[AWS_SHA256_HMAC_LEN];
+};
+
+/**
+ * Sign tokens written by s_append_unsigned_token on a multi-buffer SHA-256 kernel and append their X-Amz-Signature
+ * parameters. The canonical requests are hashed side by side, then the inner HMACs, then the outer ones, which hash
+ * the signing key XORed with their pad followed by the string to sign or the inner hash. Nothing here can fail.
+ */
+static void s_append_signatures_mb(
+    const struct aws_dsql_auth_presign_template *const *templates,
+    uint8_t signing_keys[][AWS_DSQL_AUTH_SIGNING_KEY_LEN],
+    struct aws_byte_cursor amz_date,
+    const struct presign_query_spans *spans,
+    struct aws_byte_buf *out_tokens,
+    size_t count,
+    size_t lanes) {
+
+    struct presign_batch_lane batch[AWS_DSQL_AUTH_PRESIGN_BATCH_MAX];
+    struct aws_dsql_auth_sha256_mb_job jobs[AWS_DSQL_AUTH_PRESIGN_BATCH_MAX];
+
+    for (size_t i = 0; i < count; ++i) {
+        s_canonical_request_pieces(
+            templates[i],
+            s_query_prefix(&out_tokens[i], &spans[i]),
+            s_query_suffix(&out_tokens[i], &spans[i]),
+            batch[i].canonical_request_pieces);
+        jobs[i].pieces = batch[i].canonical_request_pieces;
+        jobs[i].piece_count = CANONICAL_REQUEST_PIECES;
+        jobs[i].out_digest = batch[i].canonical_request_hash;
+    }
+    aws_dsql_auth_sha256_mb_hash(jobs, count, lanes);
+
+    for (size_t i = 0; i < count; ++i) {
+        memset(batch[i].inner_block, HMAC_INNER_PAD, HMAC_BLOCK_LEN);
+        memset(batch[i].outer_block, HMAC_OUTER_PAD, HMAC_BLOCK_LEN);
+        for (size_t k = 0; k < AWS_DSQL_AUTH_SIGNING_KEY_LEN; ++k) {
+            batch[i].inner_block[k] ^= signing_keys[i][k];
+            batch[i].outer_block[k] ^= signing_keys[i][k];
+        }
+
+        s_hex_encode(batch[i].canonical_request_hash, AWS_SHA256_LEN, batch[i].hash_hex);
+        batch[i].inner_pieces[0] = aws_byte_cursor_from_array(batch[i].inner_block, HMAC_BLOCK_LEN);
+        s_string_to_sign_pieces(templates[i], amz_date, batch[i].hash_hex, &batch[i].inner_pieces[1]);
+        jobs[i].pieces = batch[i].inner_pieces;
+        jobs[i].piece_count = AWS_ARRAY_SIZE(batch[i].inner_pieces);
+        jobs[i].out_digest = batch[i].inner_hash;
+    }
+    aws_dsql_auth_sha256_mb_hash(jobs, count, lanes);
+
+    for (size_t i = 0; i < count; ++i) {
+        batch[i].outer_pieces[0] = aws_byte_cursor_from_array(batch[i].outer_block, HMAC_BLOCK_LEN);
+        batch[i].outer_pieces[1] = aws_byte_cursor_from_array(batch[i].inner_hash, AWS_SHA256_LEN);
+        jobs[i].pieces = batch[i].outer_pieces;
+        jobs[i].piece_count = AWS_ARRAY_SIZE(batch[i].outer_pieces);
+        jobs[i].out_digest = batch[i].signature;
+    }
+    aws_dsql_auth_sha256_mb_hash(jobs, count, lanes);
+
+    for (size_t i = 0; i < count; ++i) {
+        s_append_signature_param(&out_tokens[i], batch[i].signature);
+    }
+
+    /* The pads are as good as the signing keys */
+    aws_secure_zero(batch, sizeof(batch));
+}
+
+int aws_dsql_auth_presign_template_sign_batch(
+    struct aws_allocator *allocator,
+    const struct aws_dsql_auth_presign_template *const *templates,
+    size_t count,
+    const struct aws_dsql_auth_presign_credentials *presign_credentials,
+    uint64_t signing_time_secs,
+    struct aws_byte_buf *out_tokens) {
+
+    if (!presign_credentials || count > AWS_DSQL_AUTH_PRESIGN_BATCH_MAX || (count > 0 && (!templates || !out_tokens))) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        if (!templates[i]) {
+            return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        }
+    }
+
+    size_t original_lens[AWS_DSQL_AUTH_PRESIGN_BATCH_MAX];
+    for (size_t i = 0; i < count; ++i) {
+        size_t token_len = 0;
+        if (s_presign_token_length(templates[i], presign_credentials, &token_len) ||
+            s_reserve_token(&out_tokens[i], token_len)) {
+            return AWS_OP_ERR;
+        }
+        original_lens[i] = out_tokens[i].len;
+    }
+
+    char amz_date_str[AMZ_DATE_LEN + 1];
+    s_format_amz_date(signing_time_secs, amz_date_str);
+    struct aws_byte_cursor amz_date = aws_byte_cursor_from_array(amz_date_str, AMZ_DATE_LEN);
+    struct aws_byte_cursor short_date = aws_byte_cursor_from_array(amz_date_str, SHORT_DATE_LEN);
+
+    uint8_t signing_keys[AWS_DSQL_AUTH_PRESIGN_BATCH_MAX][AWS_DSQL_AUTH_SIGNING_KEY_LEN];
+    struct presign_query_spans spans[AWS_DSQL_AUTH_PRESIGN_BATCH_MAX];
+    for (size_t i = 0; i < count; ++i) {
+        s_append_unsigned_token(&out_tokens[i], templates[i], presign_credentials, amz_date, &spans[i]);
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        /* Tokens for the same region share a key, and batches usually list a region's clusters together */
+        if (i > 0 && aws_byte_cursor_eq(&templates[i]->region, &templates[i - 1]->region)) {
+            memcpy(signing_keys[i], signing_keys[i - 1], AWS_DSQL_AUTH_SIGNING_KEY_LEN);
+        } else if (aws_dsql_auth_signing_key_get(
+                       allocator,
+                       aws_credentials_get_secret_access_key(presign_credentials->credentials),
+                       templates[i]->region,
+                       short_date,
+                       signing_keys[i])) {
+            goto on_error;
+        }
+    }
+
+    size_t lanes = aws_dsql_auth_sha256_mb_lanes(count);
+    if (lanes > 0) {
+        s_append_signatures_mb(templates, signing_keys, amz_date, spans, out_tokens, count, lanes);
+    } else {
+        for (size_t i = 0; i < count; ++i) {
+            if (s_append_signature(allocator, templates[i], signing_keys[i], amz_date, &spans[i], &out_tokens[i])) {
+                goto on_error;
+            }
+        }
+    }
+
+    aws_secure_zero(signing_keys, sizeof(signing_keys));
+    return AWS_OP_SUCCESS;
+
+on_error:
+    aws_secure_zero(signing_keys, sizeof(signing_keys));
+    for (size_t i = 0; i < count; ++i) {
+        out_tokens[i].len = original_lens[i];
+    }
+    return AWS_OP_ERR;
+}
+
+int aws_dsql_auth_presign(
+    struct aws_allocator *allocator,
+    const struct aws_dsql_auth_presign_params *params,
+    struct aws_byte_buf *out_token) {
+
+    if (!params || !params->credentials) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    /* The template lives on the stack, so a one-off presign costs no more than a prepared one plus a few copies */
+    struct aws_dsql_auth_presign_template presign_template;
+    if (aws_dsql_auth_presign_template_init(
+            &presign_template, params->hostname, params->region, params->action, params->expires_in)) {
+        return AWS_OP_ERR;
+    }
+
+    struct aws_dsql_auth_presign_credentials presign_credentials;
+    aws_dsql_auth_presign_credentials_init(&presign_credentials, params->credentials, NULL);
+
+    int result = aws_dsql_auth_presign_template_sign(
+        allocator, &presign_template, &presign_credentials, params->signing_time_secs, out_token);
+
+    aws_dsql_auth_presign_credentials_clean_up(&presign_credentials);
+    return result;
+}
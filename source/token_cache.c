@@ -0,0 +1,1693 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <aws/common/atomics.h>
+#include <aws/common/clock.h>
+#include <aws/common/condition_variable.h>
+#include <aws/common/device_random.h>
+#include <aws/common/hash_table.h>
+#include <aws/common/linked_list.h>
+#include <aws/common/math.h>
+#include <aws/common/mutex.h>
+#include <aws/common/ref_count.h>
+#include <aws/common/string.h>
+#include <aws/common/thread.h>
+#include <aws/dsql-auth/private/fork.h>
+#include <aws/dsql-auth/private/metrics.h>
+#include <aws/dsql-auth/private/reader_shards.h>
+#include <aws/dsql-auth/token_cache.h>
+
+#include <aws/auth/credentials.h>
+#include <aws/io/event_loop.h>
+
+#include <string.h>
+
+enum { DEFAULT_EXPIRES_IN = 900 };
+enum { DEFAULT_MIN_REMAINING_SECONDS = 10 };
+enum { DEFAULT_MAX_CONCURRENT_REFRESHES = 1 };
+
+enum { INITIAL_INDEX_CAPACITY = 16 };
+
+enum { INITIAL_FRAGMENT_TABLE_SIZE = 16 };
+
+/* Tokens are materialized in this much stack space when they fit, and copied once into their string */
+enum { TOKEN_SCRATCH_SIZE = 4096 };
+
+/* After a failed refresh the next one waits this long, doubling with each further failure up to the maximum */
+enum { REFRESH_RETRY_BASE_MS = 1000 };
+enum { REFRESH_RETRY_MAX_MS = 60000 };
+
+enum dsql_token_cache_retired_kind {
+    DSQL_TOKEN_CACHE_RETIRED_INDEX,
+    DSQL_TOKEN_CACHE_RETIRED_VALUE,
+    DSQL_TOKEN_CACHE_RETIRED_ENTRY,
+};
+
+/*
+ * Part of an index, value or entry that writers have unpublished from readers; it is freed by s_free_retired once
+ * no reader can still see it. Guarded by the cache lock.
+ */
+struct dsql_token_cache_retired {
+    struct aws_dsql_auth_retired base;
+    enum dsql_token_cache_retired_kind kind;
+
+    /* Token bytes freeing it gives back, counted in the cache's retired_bytes until then */
+    size_t bytes;
+};
+
+/* Identifies a cached token. Cursors point into storage owned by the entry (or the caller, for lookups). */
+struct dsql_token_cache_key {
+    struct aws_byte_cursor hostname;
+    struct aws_byte_cursor region;
+    const struct aws_credentials_provider *credentials_provider;
+    uint64_t expires_in;
+    bool is_admin;
+};
+
+/*
+ * A percent-encoded security token, by far the largest part of a token and the same in every token signed with the
+ * same credentials, so the cache keeps it once however many of its tokens share it. Guarded by the cache lock, except
+ * for the bytes, which never change.
+ */
+struct dsql_token_cache_fragment {
+    /* Key in the cache's fragment table, over storage */
+    struct aws_byte_cursor bytes;
+    size_t ref_count;
+
+    /* Of ref_count, the references held by retired values, which give them back once reclaimed */
+    size_t retiring_count;
+    uint8_t storage[];
+};
+
+/*
+ * An immutable cached token, kept compact: the token with its security token cut out, which is put back in whenever
+ * the token is handed out. Replaced as a whole, and only freed once no reader can still see it.
+ */
+struct dsql_token_cache_value {
+    struct dsql_token_cache_retired retired;
+
+    /* NULL for credentials without a session token */
+    struct dsql_token_cache_fragment *session_token;
+
+    /* Where the security token goes back in rest */
+    size_t session_token_at;
+
+    uint64_t issued_at_secs;
+    uint64_t expires_at_ms;
+
+    /* When a get first queues a background refresh, jittered per token */
+    uint64_t refresh_at_ms;
+
+    /*
+     * struct aws_dsql_auth_shared_token *, the full token materialized by the first shared get, with the cache lock
+     * held. Read without it once set; lives on while shared gets still hold references to it.
+     */
+    struct aws_atomic_var shared_token;
+
+    size_t rest_len;
+    uint8_t rest[];
+};
+
+struct dsql_token_cache_entry {
+    struct dsql_token_cache_key key;
+    uint64_t hash;
+
+    /* The cache the entry belongs to, for refreshes that complete on an event loop */
+    struct aws_dsql_auth_token_cache *cache;
+
+    /* Everything needed to regenerate the token without the caller's config */
+    struct aws_string *hostname;
+    struct aws_string *region;
+    struct aws_credentials_provider *credentials_provider;
+    aws_io_clock_fn *system_clock_fn;
+    aws_dsql_auth_on_generation_stats_fn *on_generation_stats;
+    void *on_generation_stats_user_data;
+
+    /* struct dsql_token_cache_value *, read without the lock and only replaced with the cache lock held */
+    struct aws_atomic_var value;
+
+    /* Set by the reader that queues a refresh, cleared once the refresh is done */
+    struct aws_atomic_var refresh_pending;
+
+    /*
+     * Second, on the generation clock, before which no reader queues another refresh; set before refresh_pending is
+     * cleared after a failed one, and cleared by a successful generation
+     */
+    struct aws_atomic_var refresh_retry_at_secs;
+
+    /* Guarded by the cache lock: refreshes failed in a row, which the retry backs off with */
+    size_t refresh_failure_count;
+
+    /* CLOCK bit of a bounded cache: set by gets, cleared by the eviction sweep as it passes */
+    struct aws_atomic_var referenced;
+
+    /* Guarded by the cache lock; also links the entries an eviction sweep collects */
+    struct aws_linked_list_node refresh_node;
+
+    /* Guarded by the cache lock: callers waiting on the entry's generation, which keep it from being evicted */
+    size_t waiter_count;
+
+    /*
+     * Guarded by the cache lock: set once the entry is out of the index, after which it waits to be reclaimed.
+     * A reader that claimed its refresh meanwhile drops the claim instead of queueing the refresh, unless the entry
+     * was reclaimed with the claim still held, which is_owned_by_claimer marks and which leaves it to that reader to
+     * free.
+     */
+    struct dsql_token_cache_retired retired;
+    bool is_evicted;
+    bool is_owned_by_claimer;
+
+    /*
+     * Single flight, guarded by the cache lock: while a caller or a refresh thread generates this entry's token,
+     * other callers wait for it instead of generating their own. Each finished generation bumps the count and leaves
+     * its error code for the callers that waited on it.
+     */
+    bool is_generating;
+    uint64_t generation_count;
+    int generation_error;
+};
+
+/**
+ * Open-addressed table of entries, read without the lock. Slots only go from NULL to an entry, and from an entry to
+ * the tombstone when it is evicted; when live entries and tombstones fill the table up, a copy without tombstones is
+ * published, larger if the live entries alone need it, and this one is freed once no reader can still see it.
+ */
+struct dsql_token_cache_index {
+    struct dsql_token_cache_retired retired;
+    size_t capacity; /* A power of two */
+    struct aws_atomic_var slots[];
+};
+
+struct aws_dsql_auth_token_cache {
+    struct aws_allocator *allocator;
+    struct aws_ref_count ref_count;
+
+    uint64_t refresh_ahead_seconds;
+    uint64_t min_remaining_seconds;
+    uint64_t refresh_jitter_seconds;
+
+    /* struct dsql_token_cache_index *, read without the lock and only replaced with the lock held */
+    struct aws_atomic_var index;
+
+    /* Readers of index and of entries' values; writers retire what they replace here, with the lock held */
+    struct aws_dsql_auth_reader_shards *reader_shards;
+
+    /* Serializes writers: inserts, token replacement and the refresh queue. Readers never take it. */
+    struct aws_mutex lock;
+    struct aws_condition_variable signal;
+
+    /* Signalled with the lock held whenever an entry's generation finishes */
+    struct aws_condition_variable generated;
+
+    /* Guarded by lock */
+    size_t entry_count;
+    size_t tombstone_count;
+    size_t token_bytes;
+    size_t clock_hand;
+    struct aws_linked_list refresh_queue;
+    bool shutting_down;
+
+    /* Guarded by lock: the token bytes held by what is retired in reader_shards, given back as it is freed */
+    size_t retired_bytes;
+
+    /* Guarded by lock: the security tokens cached tokens share, struct aws_byte_cursor * to fragment */
+    struct aws_hash_table fragments;
+
+    struct aws_thread *refresh_threads;
+    size_t refresh_thread_count;
+    size_t max_concurrent_refreshes;
+
+    /*
+     * Guarded by lock: set in a forked child, where neither the refresh threads nor the event loops came across, so
+     * that the first refresh it queues launches refresh threads again.
+     */
+    bool relaunch_refresh_threads;
+
+    /* When set, refreshes run as asynchronous generations on this group instead of on the refresh threads */
+    struct aws_event_loop_group *event_loop_group;
+
+    /*
+     * Guarded by lock: refreshes in flight on the event loop group, which keep the cache alive in place of a
+     * reference. Once the last reference is released with any in flight, destroy_pending is set and the last of them
+     * to complete destroys the cache.
+     */
+    size_t async_refresh_count;
+    bool destroy_pending;
+
+    /* Eviction budget, 0 for no limit */
+    size_t max_entries;
+    size_t max_bytes;
+    aws_dsql_auth_token_cache_on_eviction_fn *on_eviction;
+    void *on_eviction_user_data;
+
+    struct aws_dsql_auth_fork_handler fork_handler;
+};
+
+/* Marks the slot of an evicted entry, so probes for other keys go on past it */
+static struct dsql_token_cache_entry s_tombstone;
+
+/*
+ * Queue what a writer just unpublished to be freed once no reader can still see it. Must be called with the cache
+ * lock held, after the replacement is published or the entry taken out of the index.
+ */
+static void s_retire(
+    struct aws_dsql_auth_token_cache *cache,
+    struct dsql_token_cache_retired *retired,
+    enum dsql_token_cache_retired_kind kind,
+    size_t bytes) {
+
+    retired->kind = kind;
+    retired->bytes = bytes;
+    cache->retired_bytes += bytes;
+    aws_dsql_auth_reader_shards_retire(cache->reader_shards, &retired->base);
+}
+
+static void s_free_retired(struct aws_dsql_auth_retired *base, void *user_data);
+
+/**
+ * Free whatever was retired long enough ago that no reader can still see it, without ever waiting for one. Must be
+ * called with the cache lock held; writers and refresh threads call it whenever they hold the lock, so what readers
+ * hold up now is freed by a later call.
+ */
+static void s_reclaim_retired(struct aws_dsql_auth_token_cache *cache) {
+    aws_dsql_auth_reader_shards_reclaim(cache->reader_shards, s_free_retired, cache);
+}
+
+static uint64_t s_cache_key_hash(const void *item) {
+    const struct dsql_token_cache_key *key = item;
+
+    uint64_t hash = aws_hash_byte_cursor_ptr(&key->hostname);
+    hash = aws_hash_combine(hash, aws_hash_byte_cursor_ptr(&key->region));
+    hash = aws_hash_combine(hash, aws_hash_ptr(key->credentials_provider));
+    hash = aws_hash_combine(hash, key->expires_in);
+    hash = aws_hash_combine(hash, key->is_admin ? 1 : 0);
+
+    return hash;
+}
+
+static bool s_cache_key_eq(const void *a, const void *b) {
+    const struct dsql_token_cache_key *key_a = a;
+    const struct dsql_token_cache_key *key_b = b;
+
+    return key_a->is_admin == key_b->is_admin && key_a->expires_in == key_b->expires_in &&
+           key_a->credentials_provider == key_b->credentials_provider &&
+           aws_byte_cursor_eq(&key_a->hostname, &key_b->hostname) &&
+           aws_byte_cursor_eq(&key_a->region, &key_b->region);
+}
+
+/* Account for bytes the cache starts or stops holding. Must be called with the lock held. */
+static void s_cache_add_bytes(struct aws_dsql_auth_token_cache *cache, size_t bytes) {
+    cache->token_bytes += bytes;
+    aws_dsql_auth_metrics_add(AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_BYTES, bytes);
+}
+
+static void s_cache_sub_bytes(struct aws_dsql_auth_token_cache *cache, size_t bytes) {
+    cache->token_bytes -= bytes;
+    aws_dsql_auth_metrics_sub(AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_BYTES, bytes);
+}
+
+static bool s_fragment_key_eq(const void *a, const void *b) {
+    return aws_byte_cursor_eq(a, b);
+}
+
+/* Get the fragment for bytes, adding one if no cached token shares it yet. Must be called with the lock held. */
+static struct dsql_token_cache_fragment *s_cache_fragment_acquire(
+    struct aws_dsql_auth_token_cache *cache,
+    struct aws_byte_cursor bytes) {
+
+    struct aws_hash_element *element = NULL;
+    aws_hash_table_find(&cache->fragments, &bytes, &element);
+    if (element) {
+        struct dsql_token_cache_fragment *fragment = element->value;
+        if (fragment->retiring_count == fragment->ref_count) {
+            /* Only retired values held it, and freeing them no longer gives its bytes back */
+            cache->retired_bytes -= fragment->bytes.len;
+        }
+        ++fragment->ref_count;
+        return fragment;
+    }
+
+    struct dsql_token_cache_fragment *fragment =
+        aws_mem_acquire(cache->allocator, sizeof(struct dsql_token_cache_fragment) + bytes.len);
+    if (!fragment) {
+        return NULL;
+    }
+    memcpy(fragment->storage, bytes.ptr, bytes.len);
+    fragment->bytes = aws_byte_cursor_from_array(fragment->storage, bytes.len);
+    fragment->ref_count = 1;
+    fragment->retiring_count = 0;
+
+    if (aws_hash_table_put(&cache->fragments, &fragment->bytes, fragment, NULL)) {
+        aws_mem_release(cache->allocator, fragment);
+        return NULL;
+    }
+    s_cache_add_bytes(cache, bytes.len);
+
+    return fragment;
+}
+
+static void s_cache_fragment_release(
+    struct aws_dsql_auth_token_cache *cache,
+    struct dsql_token_cache_fragment *fragment) {
+
+    if (--fragment->ref_count > 0) {
+        return;
+    }
+
+    aws_hash_table_remove(&cache->fragments, &fragment->bytes, NULL, NULL);
+    s_cache_sub_bytes(cache, fragment->bytes.len);
+    aws_mem_release(cache->allocator, fragment);
+}
+
+static size_t s_cache_value_token_len(const struct dsql_token_cache_value *value) {
+    return value->rest_len + (value->session_token ? value->session_token->bytes.len : 0);
+}
+
+/**
+ * Compact a generated token into a new value, cutting its security token out into the fragment it shares with every
+ * other cached token signed with the same credentials. Must be called with the lock held.
+ */
+static struct dsql_token_cache_value *s_cache_value_new(
+    struct aws_dsql_auth_token_cache *cache,
+    const struct aws_dsql_auth_token *generated) {
+
+    struct aws_byte_cursor token = aws_byte_cursor_from_string(generated->token);
+
+    /* Encoded parameter values never hold a raw '&', so the security token runs to the next parameter */
+    struct aws_byte_cursor marker = aws_byte_cursor_from_c_str("&X-Amz-Security-Token=");
+    struct aws_byte_cursor session_token = {0};
+    struct aws_byte_cursor found;
+    if (aws_byte_cursor_find_exact(&token, &marker, &found) == AWS_OP_SUCCESS) {
+        session_token.ptr = found.ptr + marker.len;
+        session_token.len = found.len - marker.len;
+        const uint8_t *end = memchr(session_token.ptr, '&', session_token.len);
+        if (end) {
+            session_token.len = (size_t)(end - session_token.ptr);
+        }
+    }
+
+    size_t rest_len = token.len - session_token.len;
+    struct dsql_token_cache_value *value =
+        aws_mem_calloc(cache->allocator, 1, sizeof(struct dsql_token_cache_value) + rest_len);
+    if (!value) {
+        return NULL;
+    }
+
+    if (session_token.len > 0) {
+        value->session_token = s_cache_fragment_acquire(cache, session_token);
+        if (!value->session_token) {
+            aws_mem_release(cache->allocator, value);
+            return NULL;
+        }
+        value->session_token_at = (size_t)(session_token.ptr - token.ptr);
+        memcpy(value->rest, token.ptr, value->session_token_at);
+        memcpy(
+            value->rest + value->session_token_at,
+            session_token.ptr + session_token.len,
+            rest_len - value->session_token_at);
+    } else {
+        value->session_token_at = rest_len;
+        memcpy(value->rest, token.ptr, rest_len);
+    }
+    value->rest_len = rest_len;
+    value->issued_at_secs = generated->issued_at_secs;
+    value->expires_at_ms = generated->expires_at_secs * 1000;
+    aws_atomic_init_ptr(&value->shared_token, NULL);
+
+    s_cache_add_bytes(cache, rest_len);
+
+    return value;
+}
+
+/**
+ * Mark the value as retired, or as held by a retired entry, and return the bytes freeing it will give back on its own.
+ * Its security token's are counted in the cache's retired_bytes once only retired values hold the fragment, so values
+ * retired together, such as the entries one eviction sweep takes out, give them back exactly once. Must be called with
+ * the lock held, and undone by s_cache_value_end_retirement before the value is freed.
+ */
+static size_t s_cache_value_retire(struct aws_dsql_auth_token_cache *cache, struct dsql_token_cache_value *value) {
+    struct dsql_token_cache_fragment *fragment = value->session_token;
+    if (fragment && ++fragment->retiring_count == fragment->ref_count) {
+        cache->retired_bytes += fragment->bytes.len;
+    }
+
+    size_t bytes = value->rest_len;
+    if (aws_atomic_load_ptr(&value->shared_token)) {
+        bytes += s_cache_value_token_len(value);
+    }
+    return bytes;
+}
+
+static void s_cache_value_end_retirement(
+    struct aws_dsql_auth_token_cache *cache,
+    struct dsql_token_cache_value *value) {
+
+    struct dsql_token_cache_fragment *fragment = value->session_token;
+    if (!fragment) {
+        return;
+    }
+    if (fragment->retiring_count == fragment->ref_count) {
+        cache->retired_bytes -= fragment->bytes.len;
+    }
+    --fragment->retiring_count;
+}
+
+/* Must be called with the lock held, or by the last owner of the cache */
+static void s_cache_value_destroy(struct aws_dsql_auth_token_cache *cache, struct dsql_token_cache_value *value) {
+    struct aws_dsql_auth_shared_token *shared_token = aws_atomic_load_ptr(&value->shared_token);
+    if (shared_token) {
+        s_cache_sub_bytes(cache, s_cache_value_token_len(value));
+        aws_dsql_auth_shared_token_release(shared_token);
+    }
+    if (value->session_token) {
+        s_cache_fragment_release(cache, value->session_token);
+    }
+    s_cache_sub_bytes(cache, value->rest_len);
+    aws_mem_release(cache->allocator, value);
+}
+
+/* Append the full token to output, which must have room for s_cache_value_token_len bytes */
+static void s_cache_value_write_token(const struct dsql_token_cache_value *value, struct aws_byte_buf *output) {
+    aws_byte_buf_write(output, value->rest, value->session_token_at);
+    if (value->session_token) {
+        aws_byte_buf_write_from_whole_cursor(output, value->session_token->bytes);
+    }
+    aws_byte_buf_write(output, value->rest + value->session_token_at, value->rest_len - value->session_token_at);
+}
+
+/**
+ * Materialize the full token into token, replacing any token it already holds. The token is written into scratch
+ * space and copied once into its aws_string from allocator. Safe inside a read section.
+ */
+static int s_cache_value_materialize(
+    const struct dsql_token_cache_value *value,
+    struct aws_allocator *allocator,
+    struct aws_dsql_auth_token *token) {
+
+    uint8_t scratch[TOKEN_SCRATCH_SIZE];
+    struct aws_byte_buf token_buf = aws_byte_buf_from_empty_array(scratch, sizeof(scratch));
+
+    size_t token_len = s_cache_value_token_len(value);
+    if (token_len > sizeof(scratch) && aws_byte_buf_init(&token_buf, allocator, token_len)) {
+        return AWS_OP_ERR;
+    }
+
+    s_cache_value_write_token(value, &token_buf);
+    struct aws_string *materialized = aws_string_new_from_buf(allocator, &token_buf);
+    aws_byte_buf_clean_up(&token_buf);
+    if (!materialized) {
+        return AWS_OP_ERR;
+    }
+
+    if (token->token) {
+        aws_string_destroy(token->token);
+    }
+    token->token = materialized;
+    token->issued_at_secs = value->issued_at_secs;
+    token->expires_at_secs = value->expires_at_ms / 1000;
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Materialize the value's shared token, for the first shared get to ask for it. Must be called with the lock held.
+ * Returns the shared token, owned by the value, or NULL with the error raised.
+ */
+static struct aws_dsql_auth_shared_token *s_cache_value_share(
+    struct aws_dsql_auth_token_cache *cache,
+    struct dsql_token_cache_value *value) {
+
+    struct aws_dsql_auth_shared_token *shared_token = aws_atomic_load_ptr(&value->shared_token);
+    if (shared_token) {
+        return shared_token;
+    }
+
+    struct aws_dsql_auth_token token = {0};
+    if (s_cache_value_materialize(value, cache->allocator, &token)) {
+        return NULL;
+    }
+
+    shared_token = aws_dsql_auth_shared_token_new(cache->allocator, &token);
+    aws_dsql_auth_token_clean_up(&token);
+    if (!shared_token) {
+        return NULL;
+    }
+
+    aws_atomic_store_ptr(&value->shared_token, shared_token);
+    s_cache_add_bytes(cache, s_cache_value_token_len(value));
+
+    return shared_token;
+}
+
+static void s_cache_entry_destroy(struct dsql_token_cache_entry *entry) {
+    struct aws_allocator *allocator = entry->cache->allocator;
+
+    struct dsql_token_cache_value *value = aws_atomic_load_ptr(&entry->value);
+    if (value) {
+        s_cache_value_destroy(entry->cache, value);
+    }
+    aws_credentials_provider_release(entry->credentials_provider);
+    aws_string_destroy(entry->region);
+    aws_string_destroy(entry->hostname);
+
+    aws_mem_release(allocator, entry);
+}
+
+static void s_free_retired(struct aws_dsql_auth_retired *base, void *user_data) {
+    struct aws_dsql_auth_token_cache *cache = user_data;
+    struct dsql_token_cache_retired *retired = AWS_CONTAINER_OF(base, struct dsql_token_cache_retired, base);
+    cache->retired_bytes -= retired->bytes;
+
+    switch (retired->kind) {
+        case DSQL_TOKEN_CACHE_RETIRED_INDEX:
+            aws_mem_release(cache->allocator, AWS_CONTAINER_OF(retired, struct dsql_token_cache_index, retired));
+            break;
+        case DSQL_TOKEN_CACHE_RETIRED_VALUE: {
+            struct dsql_token_cache_value *value = AWS_CONTAINER_OF(retired, struct dsql_token_cache_value, retired);
+            s_cache_value_end_retirement(cache, value);
+            s_cache_value_destroy(cache, value);
+            break;
+        }
+        case DSQL_TOKEN_CACHE_RETIRED_ENTRY: {
+            struct dsql_token_cache_entry *entry = AWS_CONTAINER_OF(retired, struct dsql_token_cache_entry, retired);
+            struct dsql_token_cache_value *value = aws_atomic_load_ptr(&entry->value);
+            if (value) {
+                s_cache_value_end_retirement(cache, value);
+            }
+
+            /* A reader that found the entry before it was tombstoned may still hold its refresh claim */
+            if (aws_atomic_load_int(&entry->refresh_pending)) {
+                entry->is_owned_by_claimer = true;
+            } else {
+                s_cache_entry_destroy(entry);
+            }
+            break;
+        }
+    }
+}
+
+static struct dsql_token_cache_entry *s_cache_entry_new(
+    struct aws_dsql_auth_token_cache *cache,
+    const struct aws_dsql_auth_config *config,
+    bool is_admin) {
+
+    struct aws_allocator *allocator = cache->allocator;
+    struct dsql_token_cache_entry *entry = aws_mem_calloc(allocator, 1, sizeof(struct dsql_token_cache_entry));
+    if (!entry) {
+        return NULL;
+    }
+    entry->cache = cache;
+
+    entry->hostname = aws_string_new_from_c_str(allocator, config->hostname);
+    entry->region = aws_string_new_from_string(allocator, config->region);
+    if (!entry->hostname || !entry->region) {
+        if (entry->hostname) {
+            aws_string_destroy(entry->hostname);
+        }
+        if (entry->region) {
+            aws_string_destroy(entry->region);
+        }
+        aws_mem_release(allocator, entry);
+        return NULL;
+    }
+
+    entry->credentials_provider = aws_credentials_provider_acquire(config->credentials_provider);
+    entry->system_clock_fn = config->system_clock_fn;
+    entry->on_generation_stats = config->on_generation_stats;
+    entry->on_generation_stats_user_data = config->on_generation_stats_user_data;
+
+    entry->key.hostname = aws_byte_cursor_from_string(entry->hostname);
+    entry->key.region = aws_byte_cursor_from_string(entry->region);
+    entry->key.credentials_provider = entry->credentials_provider;
+    entry->key.expires_in = config->expires_in;
+    entry->key.is_admin = is_admin;
+    entry->hash = s_cache_key_hash(&entry->key);
+
+    aws_atomic_init_ptr(&entry->value, NULL);
+    aws_atomic_init_int(&entry->refresh_pending, 0);
+    aws_atomic_init_int(&entry->refresh_retry_at_secs, 0);
+    /* New entries start referenced, so the first sweep to reach one passes over it */
+    aws_atomic_init_int(&entry->referenced, 1);
+
+    return entry;
+}
+
+static struct dsql_token_cache_index *s_cache_index_new(struct aws_allocator *allocator, size_t capacity) {
+    struct dsql_token_cache_index *index =
+        aws_mem_calloc(allocator, 1, sizeof(struct dsql_token_cache_index) + capacity * sizeof(struct aws_atomic_var));
+    if (!index) {
+        return NULL;
+    }
+
+    index->capacity = capacity;
+    for (size_t i = 0; i < capacity; ++i) {
+        aws_atomic_init_ptr(&index->slots[i], NULL);
+    }
+
+    return index;
+}
+
+/* Find the entry for key. Safe without the lock inside a read section, or with the lock held. */
+static struct dsql_token_cache_entry *s_cache_index_find(
+    const struct dsql_token_cache_index *index,
+    const struct dsql_token_cache_key *key,
+    uint64_t hash) {
+
+    size_t mask = index->capacity - 1;
+    for (size_t i = 0; i < index->capacity; ++i) {
+        struct dsql_token_cache_entry *entry = aws_atomic_load_ptr(&index->slots[(hash + i) & mask]);
+        if (!entry) {
+            return NULL;
+        }
+        if (entry != &s_tombstone && entry->hash == hash && s_cache_key_eq(&entry->key, key)) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+/* Publish entry in the first free slot of its probe sequence. Must be called with the lock held and room left. */
+static void s_cache_index_put(struct dsql_token_cache_index *index, struct dsql_token_cache_entry *entry) {
+    size_t mask = index->capacity - 1;
+    for (size_t i = 0; i < index->capacity; ++i) {
+        struct aws_atomic_var *slot = &index->slots[(entry->hash + i) & mask];
+        if (!aws_atomic_load_ptr(slot)) {
+            aws_atomic_store_ptr(slot, entry);
+            return;
+        }
+    }
+}
+
+/**
+ * Add an entry to the cache, first rebuilding the index without its tombstones if live entries and tombstones would
+ * fill more than half of it, and growing it if live entries alone would. Must be called with the lock held.
+ */
+static int s_cache_insert_entry(struct aws_dsql_auth_token_cache *cache, struct dsql_token_cache_entry *entry) {
+    struct dsql_token_cache_index *index = aws_atomic_load_ptr(&cache->index);
+
+    if ((cache->entry_count + cache->tombstone_count + 1) * 2 > index->capacity) {
+        size_t capacity = index->capacity;
+        if ((cache->entry_count + 1) * 2 > capacity) {
+            capacity *= 2;
+        }
+
+        struct dsql_token_cache_index *rebuilt = s_cache_index_new(cache->allocator, capacity);
+        if (!rebuilt) {
+            return AWS_OP_ERR;
+        }
+
+        for (size_t i = 0; i < index->capacity; ++i) {
+            struct dsql_token_cache_entry *existing = aws_atomic_load_ptr(&index->slots[i]);
+            if (existing && existing != &s_tombstone) {
+                s_cache_index_put(rebuilt, existing);
+            }
+        }
+
+        aws_atomic_store_ptr(&cache->index, rebuilt);
+        s_retire(cache, &index->retired, DSQL_TOKEN_CACHE_RETIRED_INDEX, 0);
+        s_reclaim_retired(cache);
+        index = rebuilt;
+        cache->tombstone_count = 0;
+        cache->clock_hand = 0;
+    }
+
+    s_cache_index_put(index, entry);
+    ++cache->entry_count;
+    aws_dsql_auth_metrics_add(AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_ENTRIES, 1);
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Whether the cache is over budget once what was retired, evicted entries included, is freed */
+static bool s_is_over_budget(const struct aws_dsql_auth_token_cache *cache) {
+    return (cache->max_entries != 0 && cache->entry_count > cache->max_entries) ||
+           (cache->max_bytes != 0 && cache->token_bytes - cache->retired_bytes > cache->max_bytes);
+}
+
+/* Whether nothing but the index holds on to the entry, so that an eviction sweep may take it out */
+static bool s_cache_entry_is_evictable(const struct dsql_token_cache_entry *entry) {
+    return !entry->is_generating && entry->waiter_count == 0 && aws_atomic_load_int(&entry->refresh_pending) == 0;
+}
+
+/**
+ * Evict entries with CLOCK until the cache is back within its budget. Must be called with the lock held.
+ *
+ * The hand passes over each slot at most twice, so a referenced entry gets a second chance and the sweep gives up
+ * when everything left is in use. Evicted entries are tombstoned in the index and freed once no reader can still see
+ * them.
+ */
+static void s_cache_evict(struct aws_dsql_auth_token_cache *cache) {
+    if (!s_is_over_budget(cache)) {
+        return;
+    }
+
+    struct dsql_token_cache_index *index = aws_atomic_load_ptr(&cache->index);
+    size_t mask = index->capacity - 1;
+
+    bool evicted = false;
+
+    for (size_t swept = 0; swept < index->capacity * 2 && s_is_over_budget(cache); ++swept) {
+        struct aws_atomic_var *slot = &index->slots[cache->clock_hand & mask];
+        cache->clock_hand = (cache->clock_hand + 1) & mask;
+
+        struct dsql_token_cache_entry *entry = aws_atomic_load_ptr(slot);
+        if (!entry || entry == &s_tombstone || !s_cache_entry_is_evictable(entry)) {
+            continue;
+        }
+        if (aws_atomic_load_int(&entry->referenced)) {
+            aws_atomic_store_int(&entry->referenced, 0);
+            continue;
+        }
+
+        aws_atomic_store_ptr(slot, &s_tombstone);
+        ++cache->tombstone_count;
+        --cache->entry_count;
+
+        aws_dsql_auth_metrics_sub(AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_ENTRIES, 1);
+        aws_dsql_auth_metrics_add(AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_EVICTIONS, 1);
+
+        if (cache->on_eviction) {
+            struct aws_dsql_auth_token_cache_eviction eviction = {
+                .hostname = aws_string_c_str(entry->hostname),
+                .region = entry->region,
+                .credentials_provider = entry->credentials_provider,
+                .is_admin = entry->key.is_admin,
+            };
+            cache->on_eviction(&eviction, cache->on_eviction_user_data);
+        }
+
+        struct dsql_token_cache_value *value = aws_atomic_load_ptr(&entry->value);
+        size_t freeing_bytes = value ? s_cache_value_retire(cache, value) : 0;
+        entry->is_evicted = true;
+        s_retire(cache, &entry->retired, DSQL_TOKEN_CACHE_RETIRED_ENTRY, freeing_bytes);
+        evicted = true;
+    }
+
+    if (evicted) {
+        s_reclaim_retired(cache);
+    }
+}
+
+/**
+ * Helper to get the current time in milliseconds, using the same clock as token generation.
+ */
+static int s_get_current_time_ms(aws_io_clock_fn *system_clock_fn, uint64_t *out_time_ms) {
+    uint64_t current_time_ns = 0;
+
+    if (system_clock_fn) {
+        if (system_clock_fn(&current_time_ns)) {
+            return AWS_OP_ERR;
+        }
+    } else {
+        if (aws_sys_clock_get_ticks(&current_time_ns)) {
+            return AWS_OP_ERR;
+        }
+    }
+
+    *out_time_ms = aws_timestamp_convert(current_time_ns, AWS_TIMESTAMP_NANOS, AWS_TIMESTAMP_MILLIS, NULL);
+    return AWS_OP_SUCCESS;
+}
+
+static uint64_t s_effective_expires_in(uint64_t expires_in) {
+    return expires_in ? expires_in : DEFAULT_EXPIRES_IN;
+}
+
+/**
+ * Pick when a token expiring at expires_at_ms starts refreshing: at the start of its refresh-ahead window, moved
+ * earlier by a random jitter so that tokens cached at the same moment, here or in other processes, spread their
+ * refreshes out. Without a random number the refresh starts at the window.
+ */
+static uint64_t s_refresh_at_ms(
+    const struct aws_dsql_auth_token_cache *cache,
+    uint64_t config_expires_in,
+    uint64_t expires_at_ms) {
+
+    uint64_t expires_in = s_effective_expires_in(config_expires_in);
+    uint64_t refresh_ahead_seconds = cache->refresh_ahead_seconds ? cache->refresh_ahead_seconds : expires_in / 4;
+
+    /* Half the time before the window at most, so a fresh token is never due for refresh straight away */
+    uint64_t jitter_window_seconds = 0;
+    if (refresh_ahead_seconds < expires_in) {
+        jitter_window_seconds = aws_min_u64(cache->refresh_jitter_seconds, (expires_in - refresh_ahead_seconds) / 2);
+    }
+
+    uint64_t jitter_ms = 0;
+    uint64_t random = 0;
+    if (jitter_window_seconds > 0 && aws_device_random_u64(&random) == AWS_OP_SUCCESS) {
+        jitter_ms = random % (jitter_window_seconds * 1000 + 1);
+    }
+
+    uint64_t lead_ms = refresh_ahead_seconds * 1000 + jitter_ms;
+    return expires_at_ms > lead_ms ? expires_at_ms - lead_ms : 0;
+}
+
+/**
+ * Count a failed background refresh and hold the entry's next one off, for an exponential backoff with a random half
+ * of it as jitter, so that a failing credentials provider is not asked again by every get in the refresh window. Must
+ * be called with the cache lock held, before refresh_pending is cleared.
+ */
+static void s_cache_entry_refresh_failed(struct dsql_token_cache_entry *entry) {
+    aws_dsql_auth_metrics_add(AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_REFRESH_FAILURES, 1);
+
+    size_t shift = aws_min_size(entry->refresh_failure_count, 16);
+    ++entry->refresh_failure_count;
+    uint64_t backoff_ms = aws_min_u64((uint64_t)REFRESH_RETRY_BASE_MS << shift, REFRESH_RETRY_MAX_MS);
+
+    uint64_t random = 0;
+    if (aws_device_random_u64(&random) == AWS_OP_SUCCESS) {
+        backoff_ms -= random % (backoff_ms / 2 + 1);
+    }
+
+    uint64_t now_ms = 0;
+    if (s_get_current_time_ms(entry->system_clock_fn, &now_ms) == AWS_OP_SUCCESS) {
+        uint64_t retry_at_secs = aws_timestamp_convert(
+            now_ms + backoff_ms + 999, AWS_TIMESTAMP_MILLIS, AWS_TIMESTAMP_SECS, NULL);
+        aws_atomic_store_int(&entry->refresh_retry_at_secs, (size_t)retry_at_secs);
+    }
+}
+
+/**
+ * Replace the entry's token with a compact copy of the generated one, which is cleaned up, then evict whatever the
+ * cache holds beyond its budget. Must be called with the cache lock held and
+ * the entry generating, which keeps it from being evicted. Returns the value the entry now holds, which stays valid
+ * until the lock is released.
+ */
+static struct dsql_token_cache_value *s_cache_entry_set_token(
+    struct aws_dsql_auth_token_cache *cache,
+    struct dsql_token_cache_entry *entry,
+    struct aws_dsql_auth_token *generated) {
+
+    struct dsql_token_cache_value *current = aws_atomic_load_ptr(&entry->value);
+
+    if (current && current->expires_at_ms > generated->expires_at_secs * 1000) {
+        /* Lost a race with a newer token, keep that one */
+        aws_dsql_auth_token_clean_up(generated);
+        return current;
+    }
+
+    struct dsql_token_cache_value *value = s_cache_value_new(cache, generated);
+    aws_dsql_auth_token_clean_up(generated);
+    if (!value) {
+        return current;
+    }
+    value->refresh_at_ms = s_refresh_at_ms(cache, entry->key.expires_in, value->expires_at_ms);
+
+    aws_atomic_store_ptr(&entry->value, value);
+
+    if (current) {
+        s_retire(cache, &current->retired, DSQL_TOKEN_CACHE_RETIRED_VALUE, s_cache_value_retire(cache, current));
+        s_reclaim_retired(cache);
+    }
+
+    s_cache_evict(cache);
+
+    return value;
+}
+
+/* Point a config at the entry's storage. The config borrows everything and must not be cleaned up. */
+static void s_cache_entry_borrow_config(
+    const struct dsql_token_cache_entry *entry,
+    struct aws_dsql_auth_config *config) {
+
+    aws_dsql_auth_config_init(config);
+    config->hostname = aws_string_c_str(entry->hostname);
+    config->region = entry->region;
+    config->credentials_provider = entry->credentials_provider;
+    config->expires_in = entry->key.expires_in;
+    config->system_clock_fn = entry->system_clock_fn;
+    config->on_generation_stats = entry->on_generation_stats;
+    config->on_generation_stats_user_data = entry->on_generation_stats_user_data;
+}
+
+/**
+ * End the entry's single flight with the generated token, or NULL and the error it failed with, waking every caller
+ * waiting on it. Must be called with the cache lock held.
+ *
+ * Returns the value the entry holds afterwards, valid until the lock is released, or NULL with the error raised.
+ */
+static struct dsql_token_cache_value *s_cache_entry_finish_generation(
+    struct aws_dsql_auth_token_cache *cache,
+    struct dsql_token_cache_entry *entry,
+    struct aws_dsql_auth_token *generated,
+    int error_code) {
+
+    struct dsql_token_cache_value *value = NULL;
+    if (error_code == AWS_ERROR_SUCCESS) {
+        value = s_cache_entry_set_token(cache, entry, generated);
+        if (value) {
+            entry->refresh_failure_count = 0;
+            aws_atomic_store_int(&entry->refresh_retry_at_secs, 0);
+        } else {
+            error_code = aws_last_error();
+        }
+    }
+
+    entry->is_generating = false;
+    entry->generation_error = error_code;
+    ++entry->generation_count;
+    aws_condition_variable_notify_all(&cache->generated);
+
+    if (!value) {
+        aws_raise_error(error_code);
+    }
+    return value;
+}
+
+/**
+ * Generate the entry's token as its single flight: callers that find the entry generating wait for this result
+ * instead of generating their own. Must be called with the cache lock held and the entry not generating. The lock is
+ * released while signing, which is safe since an entry is not evictable while it is generating.
+ *
+ * Returns the value the entry holds afterwards, valid until the lock is released, or NULL with the error raised.
+ */
+static struct dsql_token_cache_value *s_cache_entry_generate(
+    struct aws_dsql_auth_token_cache *cache,
+    struct dsql_token_cache_entry *entry,
+    const struct aws_dsql_auth_config *config) {
+
+    entry->is_generating = true;
+    aws_mutex_unlock(&cache->lock);
+
+    struct aws_dsql_auth_token generated = {0};
+    int error_code = AWS_ERROR_SUCCESS;
+    if (aws_dsql_auth_token_generate(config, entry->key.is_admin, cache->allocator, &generated)) {
+        error_code = aws_last_error();
+    }
+
+    aws_mutex_lock(&cache->lock);
+
+    return s_cache_entry_finish_generation(cache, entry, &generated, error_code);
+}
+
+static void s_token_cache_destroy(struct aws_dsql_auth_token_cache *cache);
+
+/* Completion of a refresh run on the event loop group, on whichever thread finished it */
+static void s_on_async_refresh_complete(struct aws_dsql_auth_token *token, int error_code, void *user_data) {
+    struct dsql_token_cache_entry *entry = user_data;
+    struct aws_dsql_auth_token_cache *cache = entry->cache;
+
+    aws_mutex_lock(&cache->lock);
+    if (!s_cache_entry_finish_generation(cache, entry, token, error_code)) {
+        s_cache_entry_refresh_failed(entry);
+    }
+    aws_atomic_store_int(&entry->refresh_pending, 0);
+    bool is_last = --cache->async_refresh_count == 0 && cache->destroy_pending;
+    aws_mutex_unlock(&cache->lock);
+
+    if (is_last) {
+        s_token_cache_destroy(cache);
+    }
+}
+
+/**
+ * Refresh the entry's token as an asynchronous generation on the cache's event loop group, as its single flight.
+ * Must be called with the cache lock held, which is released while the generation is started in case it completes
+ * inline. The generation keeps the cache alive until it completes, counted in async_refresh_count.
+ */
+static void s_start_async_refresh(struct aws_dsql_auth_token_cache *cache, struct dsql_token_cache_entry *entry) {
+    /* A caller already generating the token makes the refresh redundant */
+    if (entry->is_generating) {
+        aws_atomic_store_int(&entry->refresh_pending, 0);
+        return;
+    }
+
+    struct aws_dsql_auth_config config;
+    s_cache_entry_borrow_config(entry, &config);
+    config.event_loop_group = cache->event_loop_group;
+
+    entry->is_generating = true;
+    ++cache->async_refresh_count;
+    aws_dsql_auth_metrics_add(AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_REFRESHES, 1);
+    aws_mutex_unlock(&cache->lock);
+
+    int result = aws_dsql_auth_token_generate_async(
+        &config, entry->key.is_admin, cache->allocator, s_on_async_refresh_complete, entry);
+
+    aws_mutex_lock(&cache->lock);
+    if (result != AWS_OP_SUCCESS) {
+        /* The caller of the get that queued the refresh still holds a reference, so the cache is not released */
+        s_cache_entry_finish_generation(cache, entry, NULL, aws_last_error());
+        s_cache_entry_refresh_failed(entry);
+        aws_atomic_store_int(&entry->refresh_pending, 0);
+        --cache->async_refresh_count;
+    }
+}
+
+static bool s_has_refresh_work(void *context) {
+    struct aws_dsql_auth_token_cache *cache = context;
+    return cache->shutting_down || !aws_linked_list_empty(&cache->refresh_queue);
+}
+
+static void s_refresh_thread_fn(void *arg) {
+    struct aws_dsql_auth_token_cache *cache = arg;
+
+    aws_mutex_lock(&cache->lock);
+    while (true) {
+        aws_condition_variable_wait_pred(&cache->signal, &cache->lock, s_has_refresh_work, cache);
+        if (cache->shutting_down) {
+            break;
+        }
+        s_reclaim_retired(cache);
+
+        struct aws_linked_list_node *node = aws_linked_list_pop_front(&cache->refresh_queue);
+        struct dsql_token_cache_entry *entry = AWS_CONTAINER_OF(node, struct dsql_token_cache_entry, refresh_node);
+
+        /* A caller already generating the token makes the refresh redundant */
+        if (!entry->is_generating) {
+            struct aws_dsql_auth_config config;
+            s_cache_entry_borrow_config(entry, &config);
+
+            /* On failure the current token stays in place and a get in the refresh window retries after a backoff */
+            aws_dsql_auth_metrics_add(AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_REFRESHES, 1);
+            if (!s_cache_entry_generate(cache, entry, &config)) {
+                s_cache_entry_refresh_failed(entry);
+            }
+        }
+        aws_atomic_store_int(&entry->refresh_pending, 0);
+    }
+    aws_mutex_unlock(&cache->lock);
+}
+
+/* Stop and join the refresh threads that were launched, and free the thread array */
+static void s_stop_refresh_threads(struct aws_dsql_auth_token_cache *cache) {
+    aws_mutex_lock(&cache->lock);
+    cache->shutting_down = true;
+    aws_condition_variable_notify_all(&cache->signal);
+    aws_mutex_unlock(&cache->lock);
+
+    for (size_t i = 0; i < cache->refresh_thread_count; ++i) {
+        aws_thread_join(&cache->refresh_threads[i]);
+        aws_thread_clean_up(&cache->refresh_threads[i]);
+    }
+    aws_mem_release(cache->allocator, cache->refresh_threads);
+}
+
+/**
+ * Launch max_concurrent_refreshes refresh threads, counting each one in refresh_thread_count as it starts. Stops at
+ * the first one that fails to start, with the error raised.
+ */
+static int s_launch_refresh_threads(struct aws_dsql_auth_token_cache *cache) {
+    cache->refresh_threads =
+        aws_mem_calloc(cache->allocator, cache->max_concurrent_refreshes, sizeof(struct aws_thread));
+    if (!cache->refresh_threads) {
+        return AWS_OP_ERR;
+    }
+
+    for (size_t i = 0; i < cache->max_concurrent_refreshes; ++i) {
+        struct aws_thread *thread = &cache->refresh_threads[i];
+        if (aws_thread_init(thread, cache->allocator)) {
+            return AWS_OP_ERR;
+        }
+
+        if (aws_thread_launch(thread, s_refresh_thread_fn, cache, aws_default_thread_options())) {
+            aws_thread_clean_up(thread);
+            return AWS_OP_ERR;
+        }
+        ++cache->refresh_thread_count;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Launch refresh threads in a forked child, for its first queued refresh. Must be called with the lock held, which
+ * the new threads wait for. Any thread that starts is enough to go on refreshing; with none the next refresh retries.
+ */
+static int s_relaunch_refresh_threads(struct aws_dsql_auth_token_cache *cache) {
+    /* Handles of the parent's threads, which can be neither joined nor cleaned up here */
+    aws_mem_release(cache->allocator, cache->refresh_threads);
+    cache->refresh_threads = NULL;
+
+    s_launch_refresh_threads(cache);
+    if (cache->refresh_thread_count == 0) {
+        return AWS_OP_ERR;
+    }
+
+    cache->relaunch_refresh_threads = false;
+    return AWS_OP_SUCCESS;
+}
+
+static bool s_token_cache_try_prepare_fork(void *user_data) {
+    struct aws_dsql_auth_token_cache *cache = user_data;
+    return aws_mutex_try_lock(&cache->lock) == AWS_OP_SUCCESS;
+}
+
+static void s_token_cache_parent_fork(void *user_data) {
+    struct aws_dsql_auth_token_cache *cache = user_data;
+    aws_mutex_unlock(&cache->lock);
+}
+
+/**
+ * Reset the cache in a forked child, whose only thread is the one that forked, holding the lock. No reader is left
+ * inside the cache, no caller is waiting and no generation or refresh is running, whatever the parent's threads were
+ * doing, so the cache is put back in that state. Cached tokens are kept, so that the child's first gets are hits.
+ *
+ * Refreshes in flight on the event loop group are no longer counted as keeping the cache alive, since they will
+ * never complete. What the generations themselves held, the group's reference, and entries reclaimed while a reader
+ * still held their refresh claim stay allocated; the refreshes and the reference are counted as abandoned.
+ */
+static void s_token_cache_child_fork(void *user_data) {
+    struct aws_dsql_auth_token_cache *cache = user_data;
+
+    aws_dsql_auth_reader_shards_reset(cache->reader_shards);
+
+    struct dsql_token_cache_index *index = aws_atomic_load_ptr(&cache->index);
+    for (size_t i = 0; i < index->capacity; ++i) {
+        struct dsql_token_cache_entry *entry = aws_atomic_load_ptr(&index->slots[i]);
+        if (!entry || entry == &s_tombstone) {
+            continue;
+        }
+
+        entry->is_generating = false;
+        entry->waiter_count = 0;
+        aws_atomic_store_int(&entry->refresh_pending, 0);
+
+        /*
+         * Draw each token's jitter again, in place since no reader can see the value, so that workers forked from
+         * one parent spread their refreshes out instead of all refreshing the same token at the same moment
+         */
+        struct dsql_token_cache_value *value = aws_atomic_load_ptr(&entry->value);
+        if (value) {
+            value->refresh_at_ms = s_refresh_at_ms(cache, entry->key.expires_in, value->expires_at_ms);
+        }
+    }
+    aws_linked_list_init(&cache->refresh_queue);
+
+    /* Claims on retired entries were held by readers that did not come across, so reclaiming frees the entries */
+    for (struct aws_linked_list_node *node = aws_linked_list_begin(&cache->reader_shards->retired);
+         node != aws_linked_list_end(&cache->reader_shards->retired);
+         node = aws_linked_list_next(node)) {
+        struct dsql_token_cache_retired *retired = AWS_CONTAINER_OF(node, struct dsql_token_cache_retired, base.node);
+        if (retired->kind == DSQL_TOKEN_CACHE_RETIRED_ENTRY) {
+            struct dsql_token_cache_entry *entry = AWS_CONTAINER_OF(retired, struct dsql_token_cache_entry, retired);
+            aws_atomic_store_int(&entry->refresh_pending, 0);
+        }
+    }
+
+    /*
+     * Destroying the cache here would do so inside the fork registry, so a cache whose last reference was released
+     * while refreshes were in flight stays allocated; no one in the child can reach it anyway.
+     */
+    size_t abandoned = cache->async_refresh_count;
+    cache->async_refresh_count = 0;
+
+    /* The group's loops did not come across either, so its reference is given up rather than released */
+    if (cache->event_loop_group) {
+        cache->event_loop_group = NULL;
+        ++abandoned;
+    }
+    aws_dsql_auth_metrics_add(AWS_DSQL_AUTH_METRIC_FORK_ABANDONED_REFERENCES, abandoned);
+    cache->refresh_thread_count = 0;
+    cache->relaunch_refresh_threads = true;
+
+    /* Initialized over the parent's, which threads that did not come across may have been waiting on */
+    AWS_FATAL_ASSERT(aws_condition_variable_init(&cache->signal) == AWS_OP_SUCCESS);
+    AWS_FATAL_ASSERT(aws_condition_variable_init(&cache->generated) == AWS_OP_SUCCESS);
+    aws_mutex_unlock(&cache->lock);
+}
+
+static void s_token_cache_destroy(struct aws_dsql_auth_token_cache *cache) {
+    aws_dsql_auth_fork_handler_unregister(&cache->fork_handler);
+    s_stop_refresh_threads(cache);
+
+    /* The refresh threads are gone and no reader can hold the last reference, so nothing else can see the index */
+    struct dsql_token_cache_index *index = aws_atomic_load_ptr(&cache->index);
+    for (size_t i = 0; i < index->capacity; ++i) {
+        struct dsql_token_cache_entry *entry = aws_atomic_load_ptr(&index->slots[i]);
+        if (entry && entry != &s_tombstone) {
+            s_cache_entry_destroy(entry);
+        }
+    }
+    aws_mem_release(cache->allocator, index);
+    aws_dsql_auth_metrics_sub(AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_ENTRIES, cache->entry_count);
+
+    /* Nor what was retired, which no caller holds a refresh claim on either, since callers hold references */
+    aws_dsql_auth_reader_shards_destroy(cache->reader_shards, s_free_retired, cache);
+    aws_hash_table_clean_up(&cache->fragments);
+
+    aws_condition_variable_clean_up(&cache->generated);
+    aws_condition_variable_clean_up(&cache->signal);
+    aws_mutex_clean_up(&cache->lock);
+
+    if (cache->event_loop_group) {
+        aws_event_loop_group_release(cache->event_loop_group);
+    }
+
+    aws_mem_release(cache->allocator, cache);
+}
+
+/* The last reference is gone: destroy the cache now, or leave it to the last refresh in flight */
+static void s_token_cache_on_zero_refs(void *user_data) {
+    struct aws_dsql_auth_token_cache *cache = user_data;
+
+    aws_mutex_lock(&cache->lock);
+    cache->destroy_pending = cache->async_refresh_count > 0;
+    bool is_destroyed_now = !cache->destroy_pending;
+    aws_mutex_unlock(&cache->lock);
+
+    if (is_destroyed_now) {
+        s_token_cache_destroy(cache);
+    }
+}
+
+struct aws_dsql_auth_token_cache *aws_dsql_auth_token_cache_new(
+    struct aws_allocator *allocator,
+    const struct aws_dsql_auth_token_cache_options *options) {
+
+    struct aws_dsql_auth_token_cache *cache = aws_mem_calloc(allocator, 1, sizeof(struct aws_dsql_auth_token_cache));
+    if (!cache) {
+        return NULL;
+    }
+
+    cache->allocator = allocator;
+    aws_ref_count_init(&cache->ref_count, cache, s_token_cache_on_zero_refs);
+
+    if (options) {
+        cache->refresh_ahead_seconds = options->refresh_ahead_seconds;
+        cache->min_remaining_seconds = options->min_remaining_seconds;
+        cache->refresh_jitter_seconds = options->refresh_jitter_seconds;
+        cache->max_concurrent_refreshes = options->max_concurrent_refreshes;
+        cache->max_entries = options->max_entries;
+        cache->max_bytes = options->max_bytes;
+        cache->on_eviction = options->on_eviction;
+        cache->on_eviction_user_data = options->on_eviction_user_data;
+        if (options->event_loop_group) {
+            cache->event_loop_group = aws_event_loop_group_acquire(options->event_loop_group);
+        }
+    }
+    if (cache->min_remaining_seconds == 0) {
+        cache->min_remaining_seconds = DEFAULT_MIN_REMAINING_SECONDS;
+    }
+    if (cache->max_concurrent_refreshes == 0) {
+        cache->max_concurrent_refreshes = DEFAULT_MAX_CONCURRENT_REFRESHES;
+    }
+
+    aws_linked_list_init(&cache->refresh_queue);
+
+    cache->reader_shards = aws_dsql_auth_reader_shards_new(allocator);
+    if (!cache->reader_shards) {
+        goto on_reader_shards_error;
+    }
+
+    if (aws_mutex_init(&cache->lock)) {
+        goto on_mutex_error;
+    }
+
+    if (aws_condition_variable_init(&cache->signal)) {
+        goto on_condition_variable_error;
+    }
+
+    if (aws_condition_variable_init(&cache->generated)) {
+        goto on_generated_error;
+    }
+
+    if (aws_hash_table_init(
+            &cache->fragments,
+            allocator,
+            INITIAL_FRAGMENT_TABLE_SIZE,
+            aws_hash_byte_cursor_ptr,
+            s_fragment_key_eq,
+            NULL,
+            NULL)) {
+        goto on_fragments_error;
+    }
+
+    struct dsql_token_cache_index *index = s_cache_index_new(allocator, INITIAL_INDEX_CAPACITY);
+    if (!index) {
+        goto on_index_error;
+    }
+    aws_atomic_init_ptr(&cache->index, index);
+
+    /* Refreshes on an event loop group need no threads of their own */
+    if (!cache->event_loop_group && s_launch_refresh_threads(cache)) {
+        goto on_threads_error;
+    }
+
+    cache->fork_handler.try_prepare = s_token_cache_try_prepare_fork;
+    cache->fork_handler.parent = s_token_cache_parent_fork;
+    cache->fork_handler.child = s_token_cache_child_fork;
+    cache->fork_handler.user_data = cache;
+    aws_dsql_auth_fork_handler_register(&cache->fork_handler);
+
+    return cache;
+
+on_threads_error:
+    s_stop_refresh_threads(cache);
+    aws_mem_release(allocator, index);
+on_index_error:
+    aws_hash_table_clean_up(&cache->fragments);
+on_fragments_error:
+    aws_condition_variable_clean_up(&cache->generated);
+on_generated_error:
+    aws_condition_variable_clean_up(&cache->signal);
+on_condition_variable_error:
+    aws_mutex_clean_up(&cache->lock);
+on_mutex_error:
+    aws_dsql_auth_reader_shards_destroy(cache->reader_shards, s_free_retired, cache);
+on_reader_shards_error:
+    if (cache->event_loop_group) {
+        aws_event_loop_group_release(cache->event_loop_group);
+    }
+    aws_mem_release(allocator, cache);
+    return NULL;
+}
+
+struct aws_dsql_auth_token_cache *aws_dsql_auth_token_cache_acquire(struct aws_dsql_auth_token_cache *cache) {
+    if (cache) {
+        aws_ref_count_acquire(&cache->ref_count);
+    }
+    return cache;
+}
+
+struct aws_dsql_auth_token_cache *aws_dsql_auth_token_cache_release(struct aws_dsql_auth_token_cache *cache) {
+    if (cache) {
+        aws_ref_count_release(&cache->ref_count);
+    }
+    return NULL;
+}
+
+/* Queue a background refresh of the entry unless one is already pending. Only the reader that wins the flag locks. */
+/**
+ * Claim the entry's refresh, so that only one reader queues it. Must be called inside a read section: the claim
+ * keeps the entry from being evicted once the reader leaves it.
+ */
+static bool s_claim_refresh(struct dsql_token_cache_entry *entry) {
+    size_t expected = 0;
+    return aws_atomic_load_int(&entry->refresh_pending) == 0 &&
+           aws_atomic_compare_exchange_int(&entry->refresh_pending, &expected, 1);
+}
+
+/* Whether a refresh that failed before has backed off long enough for the next one */
+static bool s_is_refresh_retry_due(struct dsql_token_cache_entry *entry, uint64_t now_ms) {
+    uint64_t retry_at_secs = aws_atomic_load_int(&entry->refresh_retry_at_secs);
+    return retry_at_secs == 0 || now_ms >= retry_at_secs * 1000;
+}
+
+static void s_cache_entry_mark_referenced(struct dsql_token_cache_entry *entry) {
+    /* Loaded first, so that a hot entry's cache line is only written once per sweep */
+    if (aws_atomic_load_int_explicit(&entry->referenced, aws_memory_order_relaxed) == 0) {
+        aws_atomic_store_int_explicit(&entry->referenced, 1, aws_memory_order_relaxed);
+    }
+}
+
+/* Queue or start the refresh the caller claimed with s_claim_refresh */
+static void s_schedule_refresh(struct aws_dsql_auth_token_cache *cache, struct dsql_token_cache_entry *entry) {
+    aws_mutex_lock(&cache->lock);
+    if (entry->is_owned_by_claimer) {
+        /* Evicted and reclaimed while the refresh was being claimed, which left the entry to this caller */
+        s_cache_entry_destroy(entry);
+    } else if (entry->is_evicted) {
+        /* Evicted, but still waiting to be reclaimed, which frees it once the claim is dropped */
+        aws_atomic_store_int(&entry->refresh_pending, 0);
+    } else if (cache->event_loop_group) {
+        s_start_async_refresh(cache, entry);
+    } else if (cache->relaunch_refresh_threads && s_relaunch_refresh_threads(cache)) {
+        /* Nothing to run the refresh on; a get inside the refresh window tries again after a backoff */
+        s_cache_entry_refresh_failed(entry);
+        aws_atomic_store_int(&entry->refresh_pending, 0);
+    } else {
+        aws_linked_list_push_back(&cache->refresh_queue, &entry->refresh_node);
+        aws_condition_variable_notify_one(&cache->signal);
+    }
+    aws_mutex_unlock(&cache->lock);
+}
+
+/* Report a token served from the cache; a miss is reported by the generation that fills it */
+static void s_report_hit(const struct aws_dsql_auth_config *config, uint64_t started_at_ns, int error_code) {
+    uint64_t now_ns = 0;
+    aws_high_res_clock_get_ticks(&now_ns);
+
+    struct aws_dsql_auth_generation_stats stats = {
+        .total_ns = now_ns - started_at_ns,
+        .token_cache_hit = true,
+        .error_code = error_code,
+    };
+    config->on_generation_stats(&stats, config->on_generation_stats_user_data);
+}
+
+/* Where a get hands its token: exactly one of token, shared_token and buf is set */
+struct dsql_token_cache_output {
+    /* Materialized into token, from allocator */
+    struct aws_allocator *allocator;
+    struct aws_dsql_auth_token *token;
+
+    /* A reference to the cached token's shared token */
+    struct aws_dsql_auth_shared_token **shared_token;
+
+    /* Materialized at the end of buf, which is never grown, with the token length in required_len */
+    struct aws_byte_buf *buf;
+    size_t *required_len;
+};
+
+/* Whether s_token_out can hand out value inside a read section: a shared get first needs its shared token */
+static bool s_can_hand_out_unlocked(
+    const struct dsql_token_cache_value *value,
+    const struct dsql_token_cache_output *output) {
+
+    return !output->shared_token || aws_atomic_load_ptr(&value->shared_token) != NULL;
+}
+
+/**
+ * Hand a cached token to the caller. Safe inside a read section when s_can_hand_out_unlocked, otherwise must be
+ * called with the lock held.
+ */
+static int s_token_out(
+    struct aws_dsql_auth_token_cache *cache,
+    struct dsql_token_cache_value *value,
+    const struct dsql_token_cache_output *output) {
+
+    if (output->shared_token) {
+        struct aws_dsql_auth_shared_token *shared_token = s_cache_value_share(cache, value);
+        if (!shared_token) {
+            return AWS_OP_ERR;
+        }
+        *output->shared_token = aws_dsql_auth_shared_token_acquire(shared_token);
+        return AWS_OP_SUCCESS;
+    }
+
+    if (output->buf) {
+        *output->required_len = s_cache_value_token_len(value);
+        if (output->buf->capacity - output->buf->len < *output->required_len) {
+            return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+        }
+        s_cache_value_write_token(value, output->buf);
+        return AWS_OP_SUCCESS;
+    }
+
+    return s_cache_value_materialize(value, output->allocator, output->token);
+}
+
+/* A caller waiting for the generation of an entry that was in progress when it started waiting */
+struct dsql_token_cache_generation_wait {
+    const struct dsql_token_cache_entry *entry;
+    uint64_t generation_count;
+};
+
+static bool s_is_generation_done(void *context) {
+    const struct dsql_token_cache_generation_wait *wait = context;
+    return wait->entry->generation_count != wait->generation_count;
+}
+
+static int s_token_cache_get(
+    struct aws_dsql_auth_token_cache *cache,
+    const struct aws_dsql_auth_config *config,
+    bool is_admin,
+    const struct dsql_token_cache_output *output) {
+
+    if (!cache || !config) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    if (!config->hostname || !config->region || !config->credentials_provider) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    uint64_t started_at_ns = 0;
+    if (config->on_generation_stats) {
+        aws_high_res_clock_get_ticks(&started_at_ns);
+    }
+
+    uint64_t now_ms = 0;
+    if (s_get_current_time_ms(config->system_clock_fn, &now_ms)) {
+        return AWS_OP_ERR;
+    }
+
+    struct dsql_token_cache_key key = {
+        .hostname = aws_byte_cursor_from_c_str(config->hostname),
+        .region = aws_byte_cursor_from_string(config->region),
+        .credentials_provider = config->credentials_provider,
+        .expires_in = config->expires_in,
+        .is_admin = is_admin,
+    };
+    uint64_t hash = s_cache_key_hash(&key);
+
+    /*
+     * Hit path: no lock, and no writes outside this thread's reader shard unless a refresh is due or, in a bounded
+     * cache, this is the token's first get since the eviction sweep last passed it
+     */
+    struct aws_atomic_var *read_section = aws_dsql_auth_read_lock(cache->reader_shards);
+
+    struct dsql_token_cache_entry *entry = s_cache_index_find(aws_atomic_load_ptr(&cache->index), &key, hash);
+    struct dsql_token_cache_value *value = entry ? aws_atomic_load_ptr(&entry->value) : NULL;
+
+    bool is_usable = value && now_ms + cache->min_remaining_seconds * 1000 < value->expires_at_ms;
+    if (is_usable && s_can_hand_out_unlocked(value, output)) {
+        bool needs_refresh = now_ms >= value->refresh_at_ms && s_is_refresh_retry_due(entry, now_ms) &&
+                             s_claim_refresh(entry);
+        if (cache->max_entries != 0 || cache->max_bytes != 0) {
+            s_cache_entry_mark_referenced(entry);
+        }
+        int result = s_token_out(cache, value, output);
+        aws_dsql_auth_read_unlock(read_section);
+        aws_dsql_auth_metrics_add(AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_HITS, 1);
+
+        if (needs_refresh) {
+            s_schedule_refresh(cache, entry);
+        }
+
+        if (config->on_generation_stats) {
+            s_report_hit(config, started_at_ns, result == AWS_OP_SUCCESS ? AWS_ERROR_SUCCESS : aws_last_error());
+        }
+        return result;
+    }
+
+    aws_dsql_auth_read_unlock(read_section);
+
+    /*
+     * Miss, or the cached token is too close to expiry to hand out: generate synchronously. A usable token only comes
+     * here for its first shared get, which takes the lock to materialize the shared token and still counts as a hit.
+     */
+    aws_dsql_auth_metrics_add(
+        is_usable ? AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_HITS : AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_MISSES, 1);
+
+    aws_mutex_lock(&cache->lock);
+
+    /* Free what readers were still holding up when it was retired, if they have left since */
+    s_reclaim_retired(cache);
+
+    entry = s_cache_index_find(aws_atomic_load_ptr(&cache->index), &key, hash);
+    if (!entry) {
+        entry = s_cache_entry_new(cache, config, is_admin);
+        if (!entry) {
+            goto on_error;
+        }
+
+        if (s_cache_insert_entry(cache, entry)) {
+            s_cache_entry_destroy(entry);
+            goto on_error;
+        }
+    }
+
+    /*
+     * Single flight: while the token is being generated, wait for that generation and share its result, failures
+     * included, rather than sending another request to the credentials provider.
+     */
+    bool waited = false;
+    while (entry->is_generating) {
+        if (!waited) {
+            aws_dsql_auth_metrics_add(AWS_DSQL_AUTH_METRIC_TOKEN_CACHE_COALESCED, 1);
+            waited = true;
+        }
+
+        struct dsql_token_cache_generation_wait wait = {
+            .entry = entry,
+            .generation_count = entry->generation_count,
+        };
+        /* Dropping the lock to wait is the only time an eviction sweep could find the entry, so it is pinned */
+        ++entry->waiter_count;
+        aws_condition_variable_wait_pred(&cache->generated, &cache->lock, s_is_generation_done, &wait);
+        --entry->waiter_count;
+
+        if (entry->generation_error != AWS_ERROR_SUCCESS) {
+            aws_raise_error(entry->generation_error);
+            goto on_error;
+        }
+        if (s_get_current_time_ms(config->system_clock_fn, &now_ms)) {
+            goto on_error;
+        }
+    }
+
+    /* Whoever generated before this caller may have left a usable token; otherwise this caller is the flight */
+    bool generated = false;
+    value = aws_atomic_load_ptr(&entry->value);
+    if (!value || now_ms + cache->min_remaining_seconds * 1000 >= value->expires_at_ms) {
+        value = s_cache_entry_generate(cache, entry, config);
+        generated = true;
+        if (!value) {
+            goto on_error;
+        }
+    }
+
+    int result = s_token_out(cache, value, output);
+
+    /* A shared token materialized just now counts against the budget; the caller already holds its reference */
+    if (output->shared_token) {
+        s_cache_evict(cache);
+    }
+    aws_mutex_unlock(&cache->lock);
+
+    /* A generation reports itself; a caller served by someone else's generation is reported like a hit */
+    if (!generated && config->on_generation_stats) {
+        s_report_hit(config, started_at_ns, result == AWS_OP_SUCCESS ? AWS_ERROR_SUCCESS : aws_last_error());
+    }
+    return result;
+
+on_error:
+    aws_mutex_unlock(&cache->lock);
+    return AWS_OP_ERR;
+}
+
+int aws_dsql_auth_token_cache_get(
+    struct aws_dsql_auth_token_cache *cache,
+    const struct aws_dsql_auth_config *config,
+    bool is_admin,
+    struct aws_allocator *allocator,
+    struct aws_dsql_auth_token *token) {
+
+    if (!token) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    struct dsql_token_cache_output output = {
+        .allocator = allocator,
+        .token = token,
+    };
+    return s_token_cache_get(cache, config, is_admin, &output);
+}
+
+int aws_dsql_auth_token_cache_get_shared(
+    struct aws_dsql_auth_token_cache *cache,
+    const struct aws_dsql_auth_config *config,
+    bool is_admin,
+    struct aws_dsql_auth_shared_token **out_token) {
+
+    if (!out_token) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    struct dsql_token_cache_output output = {
+        .shared_token = out_token,
+    };
+    return s_token_cache_get(cache, config, is_admin, &output);
+}
+
+int aws_dsql_auth_token_cache_get_into_buf(
+    struct aws_dsql_auth_token_cache *cache,
+    const struct aws_dsql_auth_config *config,
+    bool is_admin,
+    struct aws_byte_buf *output,
+    size_t *out_required_len) {
+
+    if (!output || !out_required_len) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    struct dsql_token_cache_output cache_output = {
+        .buf = output,
+        .required_len = out_required_len,
+    };
+    return s_token_cache_get(cache, config, is_admin, &cache_output);
+}
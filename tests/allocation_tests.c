@@ -0,0 +1,194 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+
+#include "counting_allocator.h"
+#include "test_fixtures.h"
+
+#include <aws/auth/auth.h>
+#include <aws/dsql-auth/token_cache.h>
+#include <string.h>
+
+/*
+ * Allocation budgets for the hot paths: upper bounds on what each call may allocate, so that a change adding an
+ * allocation or a copy to one of them fails here instead of only showing up in a benchmark.
+ */
+
+/* How many times each measured call runs, after a warm-up that fills the signing key and credentials caches */
+enum { ALLOCATION_TEST_ITERATIONS = 16 };
+
+/* Region inference only accepts hostnames whose cluster ID is a full 26 characters */
+AWS_STATIC_STRING_FROM_LITERAL(s_cluster_hostname, "24abtvxzzxzrrfaxyduobmpfea.dsql.us-east-1.on.aws");
+
+/* What aws_string_new_from_buf and friends allocate for a string of len bytes */
+static size_t s_string_allocation_size(size_t len) {
+    return sizeof(struct aws_string) + len + 1;
+}
+
+static int s_allocation_get_system_time(uint64_t *current_time) {
+    *current_time = s_base_time_ns;
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that generating a token allocates only the token string, and that generating into a buffer allocates nothing
+ */
+static int s_aws_dsql_auth_token_generate_allocation_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+
+    struct aws_credentials_provider *credentials_provider = s_create_test_credentials_provider(allocator);
+    ASSERT_NOT_NULL(credentials_provider);
+
+    struct aws_dsql_auth_config config;
+    ASSERT_SUCCESS(s_setup_auth_config(&config, credentials_provider, 450, s_allocation_get_system_time));
+
+    struct counting_allocator counting;
+    struct aws_allocator *counting_allocator = s_counting_allocator_init(&counting, allocator);
+
+    for (int is_admin = 0; is_admin <= 1; ++is_admin) {
+        /* The first token derives the signing key and encodes the credentials, which later tokens reuse */
+        struct aws_dsql_auth_token warm_up = {0};
+        ASSERT_SUCCESS(aws_dsql_auth_token_generate(&config, is_admin, counting_allocator, &warm_up));
+        size_t token_len = strlen(aws_dsql_auth_token_get_str(&warm_up));
+        aws_dsql_auth_token_clean_up(&warm_up);
+
+        s_counting_allocator_reset(&counting);
+        for (size_t i = 0; i < ALLOCATION_TEST_ITERATIONS; ++i) {
+            struct aws_dsql_auth_token token = {0};
+            ASSERT_SUCCESS(aws_dsql_auth_token_generate(&config, is_admin, counting_allocator, &token));
+            aws_dsql_auth_token_clean_up(&token);
+        }
+        ASSERT_TRUE(s_counting_allocator_count(&counting) <= ALLOCATION_TEST_ITERATIONS);
+        ASSERT_TRUE(
+            s_counting_allocator_bytes(&counting) <= ALLOCATION_TEST_ITERATIONS * s_string_allocation_size(token_len));
+
+        /* Generating into a buffer the caller owns allocates nothing at all */
+        char storage[1024];
+        s_counting_allocator_reset(&counting);
+        for (size_t i = 0; i < ALLOCATION_TEST_ITERATIONS; ++i) {
+            size_t required_len = 0;
+            struct aws_byte_buf output = aws_byte_buf_from_empty_array(storage, sizeof(storage));
+            ASSERT_SUCCESS(
+                aws_dsql_auth_token_generate_into_buf(&config, is_admin, counting_allocator, &output, &required_len));
+            ASSERT_UINT_EQUALS(token_len, required_len);
+        }
+        ASSERT_UINT_EQUALS(0, s_counting_allocator_count(&counting));
+    }
+
+    aws_dsql_auth_config_clean_up(&config);
+    aws_credentials_provider_release(credentials_provider);
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that cache hits allocate nothing, other than the string of a token returned by copy
+ */
+static int s_aws_dsql_auth_token_cache_hit_allocation_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+
+    struct aws_credentials_provider *credentials_provider = s_create_test_credentials_provider(allocator);
+    ASSERT_NOT_NULL(credentials_provider);
+
+    struct aws_dsql_auth_config config;
+    ASSERT_SUCCESS(s_setup_auth_config(&config, credentials_provider, 450, s_allocation_get_system_time));
+
+    /* The cache and the tokens it returns share the counting allocator, so anything a hit allocates is seen */
+    struct counting_allocator counting;
+    struct aws_allocator *counting_allocator = s_counting_allocator_init(&counting, allocator);
+
+    struct aws_dsql_auth_token_cache *cache = aws_dsql_auth_token_cache_new(counting_allocator, NULL);
+    ASSERT_NOT_NULL(cache);
+
+    /* Miss once to cache the token, and share it once so that the shared token is materialized */
+    struct aws_dsql_auth_token warm_up = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, counting_allocator, &warm_up));
+    size_t token_len = strlen(aws_dsql_auth_token_get_str(&warm_up));
+    aws_dsql_auth_token_clean_up(&warm_up);
+
+    struct aws_dsql_auth_shared_token *shared = NULL;
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get_shared(cache, &config, false, &shared));
+    aws_dsql_auth_shared_token_release(shared);
+
+    /* Into a buffer */
+    char storage[1024];
+    s_counting_allocator_reset(&counting);
+    for (size_t i = 0; i < ALLOCATION_TEST_ITERATIONS; ++i) {
+        size_t required_len = 0;
+        struct aws_byte_buf output = aws_byte_buf_from_empty_array(storage, sizeof(storage));
+        ASSERT_SUCCESS(aws_dsql_auth_token_cache_get_into_buf(cache, &config, false, &output, &required_len));
+        ASSERT_UINT_EQUALS(token_len, required_len);
+    }
+    ASSERT_UINT_EQUALS(0, s_counting_allocator_count(&counting));
+
+    /* Shared: every hit takes a reference to the token the cache already holds */
+    for (size_t i = 0; i < ALLOCATION_TEST_ITERATIONS; ++i) {
+        ASSERT_SUCCESS(aws_dsql_auth_token_cache_get_shared(cache, &config, false, &shared));
+        aws_dsql_auth_shared_token_release(shared);
+    }
+    ASSERT_UINT_EQUALS(0, s_counting_allocator_count(&counting));
+
+    /* By copy: the token string, and nothing else */
+    for (size_t i = 0; i < ALLOCATION_TEST_ITERATIONS; ++i) {
+        struct aws_dsql_auth_token token = {0};
+        ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, counting_allocator, &token));
+        aws_dsql_auth_token_clean_up(&token);
+    }
+    ASSERT_TRUE(s_counting_allocator_count(&counting) <= ALLOCATION_TEST_ITERATIONS);
+    ASSERT_TRUE(
+        s_counting_allocator_bytes(&counting) <= ALLOCATION_TEST_ITERATIONS * s_string_allocation_size(token_len));
+
+    aws_dsql_auth_token_cache_release(cache);
+    aws_dsql_auth_config_clean_up(&config);
+    aws_credentials_provider_release(credentials_provider);
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that parsing the region out of a hostname allocates nothing, and that inferring it allocates only its string
+ */
+static int s_aws_dsql_auth_region_inference_allocation_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    struct counting_allocator counting;
+    struct aws_allocator *counting_allocator = s_counting_allocator_init(&counting, allocator);
+
+    for (size_t i = 0; i < ALLOCATION_TEST_ITERATIONS; ++i) {
+        struct aws_byte_cursor region;
+        ASSERT_SUCCESS(aws_dsql_auth_hostname_parse_region(aws_byte_cursor_from_string(s_cluster_hostname), &region));
+        ASSERT_CURSOR_VALUE_CSTRING_EQUALS(region, "us-east-1");
+    }
+    ASSERT_UINT_EQUALS(0, s_counting_allocator_count(&counting));
+
+    struct aws_dsql_auth_config config;
+    ASSERT_SUCCESS(aws_dsql_auth_config_init(&config));
+    aws_dsql_auth_config_set_hostname(&config, aws_string_c_str(s_cluster_hostname));
+
+    for (size_t i = 0; i < ALLOCATION_TEST_ITERATIONS; ++i) {
+        struct aws_string *region = NULL;
+        ASSERT_SUCCESS(aws_dsql_auth_config_infer_region(counting_allocator, &config, &region));
+        ASSERT_TRUE(aws_string_eq_c_str(region, "us-east-1"));
+        aws_string_destroy(region);
+    }
+    ASSERT_TRUE(s_counting_allocator_count(&counting) <= ALLOCATION_TEST_ITERATIONS);
+    ASSERT_TRUE(
+        s_counting_allocator_bytes(&counting) <= ALLOCATION_TEST_ITERATIONS * s_string_allocation_size(s_region->len));
+
+    aws_dsql_auth_config_clean_up(&config);
+
+    return AWS_OP_SUCCESS;
+}
+
+AWS_TEST_CASE(aws_dsql_auth_token_generate_allocation_test, s_aws_dsql_auth_token_generate_allocation_test);
+AWS_TEST_CASE(aws_dsql_auth_token_cache_hit_allocation_test, s_aws_dsql_auth_token_cache_hit_allocation_test);
+AWS_TEST_CASE(aws_dsql_auth_region_inference_allocation_test, s_aws_dsql_auth_region_inference_allocation_test);
@@ -0,0 +1,129 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+
+#include <aws/testing/aws_test_harness.h>
+
+#include <aws/auth/auth.h>
+#include <aws/auth/credentials.h>
+#include <aws/dsql-auth/auth_token.hpp>
+
+#include <chrono>
+#include <future>
+#include <string_view>
+#include <utility>
+
+using namespace Aws::DsqlAuth;
+
+static const std::string_view s_hostname = "24abtvxzzxzrrfaxyduobmpfea.dsql.us-east-1.on.aws";
+
+static struct aws_credentials_provider *s_create_test_credentials_provider(struct aws_allocator *allocator) {
+    struct aws_credentials_provider_static_options options;
+    AWS_ZERO_STRUCT(options);
+    options.access_key_id = aws_byte_cursor_from_c_str("akid");
+    options.secret_access_key = aws_byte_cursor_from_c_str("secret");
+    options.session_token = aws_byte_cursor_from_c_str("token");
+
+    return aws_credentials_provider_new_static(allocator, &options);
+}
+
+/* Whether the token is a DbConnect token for the test hostname and credentials, with the given X-Amz-Expires */
+static bool s_is_test_token(std::string_view token, std::string_view expires_in) {
+    return token.substr(0, s_hostname.size()) == s_hostname && token.find("?Action=DbConnect&") != token.npos &&
+           token.find(expires_in) != token.npos && token.find("&X-Amz-Security-Token=token&") != token.npos;
+}
+
+/**
+ * Test that the header-only C++ wrappers compile, and generate tokens synchronously, into a buffer, asynchronously and
+ * through a generator
+ */
+static int s_aws_dsql_auth_cpp_wrappers_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+
+    struct aws_credentials_provider *credentials_provider = s_create_test_credentials_provider(allocator);
+    ASSERT_NOT_NULL(credentials_provider);
+
+    {
+        Config config(allocator);
+        ASSERT_TRUE(config.SetHostname(s_hostname));
+        ASSERT_TRUE(config.InferRegion());
+        config.SetExpiresIn(450);
+        config.SetCredentialsProvider(credentials_provider);
+
+        Token token = config.Generate(false);
+        ASSERT_TRUE(static_cast<bool>(token));
+        ASSERT_INT_EQUALS(AWS_ERROR_SUCCESS, token.LastError());
+        ASSERT_TRUE(s_is_test_token(token.View(), "&X-Amz-Expires=450&"));
+        ASSERT_TRUE(token.View() == token.CStr());
+        ASSERT_UINT_EQUALS(token.IssuedAtSeconds() + 450, token.ExpiresAtSeconds());
+
+        /* Moving takes the string over and leaves an empty token behind */
+        Token moved(std::move(token));
+        ASSERT_FALSE(static_cast<bool>(token));
+        ASSERT_NULL(token.CStr());
+        ASSERT_TRUE(s_is_test_token(moved.View(), "&X-Amz-Expires=450&"));
+
+        Token admin = config.Generate(true);
+        ASSERT_TRUE(admin.View().find("?Action=DbConnectAdmin&") != admin.View().npos);
+
+        char buffer[1024];
+        ASSERT_TRUE(s_is_test_token(config.GenerateInto(false, buffer, sizeof(buffer)), "&X-Amz-Expires=450&"));
+        ASSERT_TRUE(config.GenerateInto(false, buffer, 16).empty());
+        ASSERT_INT_EQUALS(AWS_ERROR_SHORT_BUFFER, aws_last_error());
+
+        /* Without an event loop group the generation completes on this thread, before the future is returned */
+        std::future<Token> future = config.GenerateAsync(false);
+        ASSERT_TRUE(future.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+        Token async_token = future.get();
+        ASSERT_TRUE(s_is_test_token(async_token.View(), "&X-Amz-Expires=450&"));
+
+        /* The generator keeps its own copy of the config, which does not need to outlive it */
+        Generator generator(config);
+        ASSERT_TRUE(static_cast<bool>(generator));
+        Config moved_config(std::move(config));
+        moved_config.SetExpiresIn(60);
+
+        Token generated = generator.Generate(false);
+        ASSERT_TRUE(s_is_test_token(generated.View(), "&X-Amz-Expires=450&"));
+        ASSERT_TRUE(s_is_test_token(generator.GenerateInto(false, buffer, sizeof(buffer)), "&X-Amz-Expires=450&"));
+        ASSERT_TRUE(s_is_test_token(moved_config.Generate(false).View(), "&X-Amz-Expires=60&"));
+
+        Generator moved_generator(std::move(generator));
+        ASSERT_FALSE(static_cast<bool>(generator));
+        ASSERT_TRUE(static_cast<bool>(moved_generator.Generate(true)));
+    }
+
+    {
+        /* Failures leave an empty object carrying the error rather than throwing */
+        Config config(allocator);
+        ASSERT_FALSE(config.InferRegion());
+        ASSERT_INT_EQUALS(AWS_ERROR_INVALID_ARGUMENT, aws_last_error());
+
+        Token token = config.Generate(false);
+        ASSERT_FALSE(static_cast<bool>(token));
+        ASSERT_INT_EQUALS(AWS_ERROR_INVALID_ARGUMENT, token.LastError());
+        ASSERT_TRUE(token.View().empty());
+        ASSERT_UINT_EQUALS(0, token.ExpiresAtSeconds());
+
+        Token async_token = config.GenerateAsync(false).get();
+        ASSERT_FALSE(static_cast<bool>(async_token));
+        ASSERT_INT_EQUALS(AWS_ERROR_INVALID_ARGUMENT, async_token.LastError());
+
+        Generator generator(config);
+        ASSERT_FALSE(static_cast<bool>(generator));
+    }
+
+    aws_credentials_provider_release(credentials_provider);
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+/* The generated test driver is C, so the test case is looked up by its C name */
+AWS_EXTERN_C_BEGIN
+AWS_TEST_CASE(aws_dsql_auth_cpp_wrappers_test, s_aws_dsql_auth_cpp_wrappers_test);
+AWS_EXTERN_C_END
@@ -3,14 +3,18 @@
  * SPDX-License-Identifier: Apache-2.0.
  */
 
-#include <aws/testing/aws_test_harness.h>
+#include "test_fixtures.h"
 
 #include <aws/auth/auth.h>
 #include <aws/auth/credentials.h>
 #include <aws/common/clock.h>
+#include <aws/common/condition_variable.h>
 #include <aws/common/date_time.h>
 #include <aws/common/error.h> /* for AWS_ERROR_INVALID_ARGUMENT */
+#include <aws/common/thread.h>
 #include <aws/dsql-auth/auth_token.h>
+#include <aws/dsql-auth/metrics.h>
+#include <aws/io/event_loop.h>
 #include <string.h>
 
 /* Mock time functions */
@@ -30,46 +34,6 @@ void mock_aws_set_system_time(uint64_t current_time) {
     aws_mutex_unlock(&system_clock_sync);
 }
 
-/* Test constants */
-AWS_STATIC_STRING_FROM_LITERAL(s_access_key_id, "akid");
-AWS_STATIC_STRING_FROM_LITERAL(s_secret_access_key, "secret");
-AWS_STATIC_STRING_FROM_LITERAL(s_session_token, "token");
-AWS_STATIC_STRING_FROM_LITERAL(s_hostname, "peccy.dsql.us-east-1.on.aws");
-AWS_STATIC_STRING_FROM_LITERAL(s_region, "us-east-1");
-
-/**
- * Helper function to create a static credentials provider
- */
-static struct aws_credentials_provider *s_create_test_credentials_provider(struct aws_allocator *allocator) {
-    struct aws_credentials_provider_static_options options = {
-        .access_key_id = aws_byte_cursor_from_string(s_access_key_id),
-        .secret_access_key = aws_byte_cursor_from_string(s_secret_access_key),
-        .session_token = aws_byte_cursor_from_string(s_session_token)};
-
-    return aws_credentials_provider_new_static(allocator, &options);
-}
-
-/**
- * Helper function to set up auth config
- */
-static int s_setup_auth_config(
-    struct aws_allocator *allocator,
-    struct aws_dsql_auth_config *config,
-    struct aws_credentials_provider *credentials_provider,
-    uint64_t expires_in) {
-
-    ASSERT_SUCCESS(aws_dsql_auth_config_init(config));
-    aws_dsql_auth_config_set_hostname(config, aws_string_c_str(s_hostname));
-    aws_dsql_auth_config_set_region(config, (struct aws_string *)s_region); /* Cast away const */
-    aws_dsql_auth_config_set_expires_in(config, expires_in);
-    aws_dsql_auth_config_set_credentials_provider(config, credentials_provider);
-
-    /* Set the mock time functions */
-    config->system_clock_fn = mock_aws_get_system_time;
-
-    return AWS_OP_SUCCESS;
-}
-
 /**
  * Test that signing works for regular DbConnect action
  */
@@ -88,7 +52,7 @@ static int s_aws_dsql_auth_signing_works_test(struct aws_allocator *allocator, v
 
     /* Set up auth config */
     struct aws_dsql_auth_config config;
-    ASSERT_SUCCESS(s_setup_auth_config(allocator, &config, credentials_provider, 450));
+    ASSERT_SUCCESS(s_setup_auth_config(&config, credentials_provider, 450, mock_aws_get_system_time));
 
     /* Generate auth token */
     struct aws_dsql_auth_token token = {0}; /* Zero-initialize */
@@ -135,7 +99,7 @@ static int s_aws_dsql_auth_signing_works_admin_test(struct aws_allocator *alloca
 
     /* Set up auth config */
     struct aws_dsql_auth_config config;
-    ASSERT_SUCCESS(s_setup_auth_config(allocator, &config, credentials_provider, 450));
+    ASSERT_SUCCESS(s_setup_auth_config(&config, credentials_provider, 450, mock_aws_get_system_time));
 
     /* Generate admin auth token */
     struct aws_dsql_auth_token token = {0}; /* Zero-initialize */
@@ -164,6 +128,447 @@ static int s_aws_dsql_auth_signing_works_admin_test(struct aws_allocator *alloca
     return AWS_OP_SUCCESS;
 }
 
+/* Captures the result of an asynchronous generation */
+struct async_generate_result {
+    struct aws_dsql_auth_token token;
+    int error_code;
+    int callback_count;
+};
+
+static void s_on_async_token_generated(struct aws_dsql_auth_token *token, int error_code, void *user_data) {
+    struct async_generate_result *result = user_data;
+
+    if (token) {
+        result->token = *token;
+        AWS_ZERO_STRUCT(*token);
+    }
+    result->error_code = error_code;
+    result->callback_count++;
+}
+
+/**
+ * Test that the async API produces the same token as the sync API and invokes its callback exactly once
+ */
+static int s_aws_dsql_auth_signing_works_async_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    /* Initialize the AWS auth library */
+    aws_auth_library_init(allocator);
+
+    /* Set the mock time to August 27, 2024 at 00:00:00 UTC (1724716800 seconds since Unix epoch) */
+    mock_aws_set_system_time(1724716800ULL * 1000000000ULL); /* Convert to nanoseconds */
+
+    /* Create credentials provider */
+    struct aws_credentials_provider *credentials_provider = s_create_test_credentials_provider(allocator);
+    ASSERT_NOT_NULL(credentials_provider);
+
+    /* Set up auth config */
+    struct aws_dsql_auth_config config;
+    ASSERT_SUCCESS(s_setup_auth_config(&config, credentials_provider, 450, mock_aws_get_system_time));
+
+    /* A missing callback is rejected up front */
+    ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT, aws_dsql_auth_token_generate_async(&config, false, allocator, NULL, NULL));
+
+    /* The static provider completes immediately, so the callback runs before the call returns */
+    struct async_generate_result result;
+    AWS_ZERO_STRUCT(result);
+    ASSERT_SUCCESS(
+        aws_dsql_auth_token_generate_async(&config, false, allocator, s_on_async_token_generated, &result));
+    ASSERT_INT_EQUALS(1, result.callback_count);
+    ASSERT_INT_EQUALS(AWS_ERROR_SUCCESS, result.error_code);
+
+    struct aws_dsql_auth_token expected = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_generate(&config, false, allocator, &expected));
+    ASSERT_STR_EQUALS(aws_dsql_auth_token_get_str(&expected), aws_dsql_auth_token_get_str(&result.token));
+
+    /* Clean up */
+    aws_dsql_auth_token_clean_up(&expected);
+    aws_dsql_auth_token_clean_up(&result.token);
+    aws_dsql_auth_config_clean_up(&config);
+    aws_credentials_provider_release(credentials_provider);
+
+    /* Clean up the AWS auth library */
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Captures the result of a generation completed on an event loop */
+struct event_loop_generate_result {
+    struct aws_mutex lock;
+    struct aws_condition_variable signal;
+    struct aws_dsql_auth_token token;
+    int error_code;
+    bool completed;
+    aws_thread_id_t thread_id;
+};
+
+static void s_on_event_loop_token_generated(struct aws_dsql_auth_token *token, int error_code, void *user_data) {
+    struct event_loop_generate_result *result = user_data;
+
+    aws_mutex_lock(&result->lock);
+    if (token) {
+        result->token = *token;
+        AWS_ZERO_STRUCT(*token);
+    }
+    result->error_code = error_code;
+    result->thread_id = aws_thread_current_thread_id();
+    result->completed = true;
+    aws_condition_variable_notify_one(&result->signal);
+    aws_mutex_unlock(&result->lock);
+}
+
+static bool s_event_loop_generate_completed(void *user_data) {
+    struct event_loop_generate_result *result = user_data;
+    return result->completed;
+}
+
+/**
+ * Test that with an event loop group the async API completes on one of its loops rather than on the calling thread,
+ * with the same token as the sync API
+ */
+static int s_aws_dsql_auth_signing_works_event_loop_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+    mock_aws_set_system_time(1724716800ULL * 1000000000ULL);
+
+    struct aws_credentials_provider *credentials_provider = s_create_test_credentials_provider(allocator);
+    ASSERT_NOT_NULL(credentials_provider);
+
+    struct aws_dsql_auth_config config;
+    ASSERT_SUCCESS(s_setup_auth_config(&config, credentials_provider, 450, mock_aws_get_system_time));
+
+    struct aws_event_loop_group *event_loop_group = aws_event_loop_group_new_default(allocator, 1, NULL);
+    ASSERT_NOT_NULL(event_loop_group);
+    aws_dsql_auth_config_set_event_loop_group(&config, event_loop_group);
+
+    struct event_loop_generate_result result = {
+        .lock = AWS_MUTEX_INIT,
+        .signal = AWS_CONDITION_VARIABLE_INIT,
+    };
+    ASSERT_SUCCESS(
+        aws_dsql_auth_token_generate_async(&config, false, allocator, s_on_event_loop_token_generated, &result));
+
+    aws_mutex_lock(&result.lock);
+    aws_condition_variable_wait_pred(&result.signal, &result.lock, s_event_loop_generate_completed, &result);
+    aws_mutex_unlock(&result.lock);
+
+    ASSERT_INT_EQUALS(AWS_ERROR_SUCCESS, result.error_code);
+    ASSERT_FALSE(aws_thread_thread_id_equal(aws_thread_current_thread_id(), result.thread_id));
+
+    /* The sync API ignores the group and signs on the calling thread */
+    struct aws_dsql_auth_token expected = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_generate(&config, false, allocator, &expected));
+    ASSERT_STR_EQUALS(aws_dsql_auth_token_get_str(&expected), aws_dsql_auth_token_get_str(&result.token));
+
+    aws_dsql_auth_token_clean_up(&expected);
+    aws_dsql_auth_token_clean_up(&result.token);
+    aws_dsql_auth_config_clean_up(&config);
+    aws_event_loop_group_release(event_loop_group);
+    aws_credentials_provider_release(credentials_provider);
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that batch generation matches single generation for every entry and reports per-entry failures
+ */
+static int s_aws_dsql_auth_signing_works_batch_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    /* Initialize the AWS auth library */
+    aws_auth_library_init(allocator);
+
+    /* Set the mock time to August 27, 2024 at 00:00:00 UTC (1724716800 seconds since Unix epoch) */
+    mock_aws_set_system_time(1724716800ULL * 1000000000ULL); /* Convert to nanoseconds */
+
+    /* Create credentials provider */
+    struct aws_credentials_provider *credentials_provider = s_create_test_credentials_provider(allocator);
+    ASSERT_NOT_NULL(credentials_provider);
+
+    /* Set up auth config shared by the batch */
+    struct aws_dsql_auth_config config;
+    ASSERT_SUCCESS(s_setup_auth_config(&config, credentials_provider, 450, mock_aws_get_system_time));
+
+    struct aws_string *other_region = aws_string_new_from_c_str(allocator, "eu-west-1");
+    ASSERT_NOT_NULL(other_region);
+
+    struct aws_dsql_auth_token_batch_entry entries[] = {
+        {.hostname = aws_string_c_str(s_hostname), .region = (struct aws_string *)s_region, .is_admin = false},
+        {.hostname = aws_string_c_str(s_hostname), .region = (struct aws_string *)s_region, .is_admin = true},
+        {.hostname = "peccy.dsql.eu-west-1.on.aws", .region = other_region, .is_admin = false},
+        /* Missing hostname fails only this entry */
+        {.hostname = NULL, .region = (struct aws_string *)s_region, .is_admin = false},
+    };
+    struct aws_dsql_auth_token tokens[AWS_ARRAY_SIZE(entries)];
+    AWS_ZERO_ARRAY(tokens);
+
+    ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT,
+        aws_dsql_auth_token_generate_batch(&config, entries, tokens, AWS_ARRAY_SIZE(entries), allocator));
+
+    ASSERT_INT_EQUALS(AWS_ERROR_INVALID_ARGUMENT, entries[3].error_code);
+    ASSERT_NULL(aws_dsql_auth_token_get_str(&tokens[3]));
+
+    for (size_t i = 0; i < 3; i++) {
+        ASSERT_INT_EQUALS(AWS_ERROR_SUCCESS, entries[i].error_code);
+
+        struct aws_dsql_auth_config single_config = config;
+        single_config.hostname = entries[i].hostname;
+        single_config.region = entries[i].region;
+
+        struct aws_dsql_auth_token expected = {0};
+        ASSERT_SUCCESS(aws_dsql_auth_token_generate(&single_config, entries[i].is_admin, allocator, &expected));
+        ASSERT_STR_EQUALS(aws_dsql_auth_token_get_str(&expected), aws_dsql_auth_token_get_str(&tokens[i]));
+        aws_dsql_auth_token_clean_up(&expected);
+    }
+
+    /* An empty batch succeeds without going to the credentials provider */
+    struct aws_dsql_auth_metrics before;
+    aws_dsql_auth_metrics_snapshot(&before);
+    ASSERT_SUCCESS(aws_dsql_auth_token_generate_batch(&config, NULL, NULL, 0, allocator));
+    struct aws_dsql_auth_metrics after;
+    aws_dsql_auth_metrics_snapshot(&after);
+    ASSERT_UINT_EQUALS(before.credentials_fetches, after.credentials_fetches);
+
+    /* Enough entries for several signing passes, the last one partial, with a failing entry in the middle of one */
+    struct aws_dsql_auth_token_batch_entry large_entries[37];
+    struct aws_dsql_auth_token large_tokens[AWS_ARRAY_SIZE(large_entries)];
+    AWS_ZERO_ARRAY(large_tokens);
+    for (size_t i = 0; i < AWS_ARRAY_SIZE(large_entries); i++) {
+        large_entries[i] = entries[i % 3];
+    }
+    large_entries[20].hostname = NULL;
+
+    ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT,
+        aws_dsql_auth_token_generate_batch(
+            &config, large_entries, large_tokens, AWS_ARRAY_SIZE(large_entries), allocator));
+
+    for (size_t i = 0; i < AWS_ARRAY_SIZE(large_entries); i++) {
+        if (i == 20) {
+            ASSERT_INT_EQUALS(AWS_ERROR_INVALID_ARGUMENT, large_entries[i].error_code);
+            ASSERT_NULL(aws_dsql_auth_token_get_str(&large_tokens[i]));
+            continue;
+        }
+        ASSERT_INT_EQUALS(AWS_ERROR_SUCCESS, large_entries[i].error_code);
+        ASSERT_STR_EQUALS(aws_dsql_auth_token_get_str(&tokens[i % 3]), aws_dsql_auth_token_get_str(&large_tokens[i]));
+        aws_dsql_auth_token_clean_up(&large_tokens[i]);
+    }
+
+    /* Clean up */
+    for (size_t i = 0; i < AWS_ARRAY_SIZE(tokens); i++) {
+        aws_dsql_auth_token_clean_up(&tokens[i]);
+    }
+    aws_string_destroy(other_region);
+    aws_dsql_auth_config_clean_up(&config);
+    aws_credentials_provider_release(credentials_provider);
+
+    /* Clean up the AWS auth library */
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that tokens written into caller-provided buffers match aws_dsql_auth_token_generate, and that a buffer that is
+ * too small reports the required length without being modified
+ */
+static int s_aws_dsql_auth_signing_works_into_buf_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    /* Initialize the AWS auth library */
+    aws_auth_library_init(allocator);
+
+    /* Set the mock time to August 27, 2024 at 00:00:00 UTC (1724716800 seconds since Unix epoch) */
+    mock_aws_set_system_time(1724716800ULL * 1000000000ULL); /* Convert to nanoseconds */
+
+    /* Create credentials provider */
+    struct aws_credentials_provider *credentials_provider = s_create_test_credentials_provider(allocator);
+    ASSERT_NOT_NULL(credentials_provider);
+
+    /* Set up auth config */
+    struct aws_dsql_auth_config config;
+    ASSERT_SUCCESS(s_setup_auth_config(&config, credentials_provider, 450, mock_aws_get_system_time));
+
+    struct aws_dsql_auth_token expected = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_generate(&config, false, allocator, &expected));
+    const char *expected_str = aws_dsql_auth_token_get_str(&expected);
+    size_t expected_len = strlen(expected_str);
+
+    /* Too small: nothing is written, the required length is still reported */
+    char storage[1024];
+    memset(storage, 'x', sizeof(storage));
+    size_t required_len = 0;
+    struct aws_byte_buf short_buf = aws_byte_buf_from_empty_array(storage, expected_len - 1);
+    ASSERT_ERROR(
+        AWS_ERROR_SHORT_BUFFER,
+        aws_dsql_auth_token_generate_into_buf(&config, false, allocator, &short_buf, &required_len));
+    ASSERT_UINT_EQUALS(expected_len, required_len);
+    ASSERT_UINT_EQUALS(0, short_buf.len);
+    ASSERT_INT_EQUALS('x', storage[0]);
+
+    /* Exactly large enough, appended after existing contents */
+    struct aws_byte_buf exact_buf = aws_byte_buf_from_empty_array(storage, expected_len + 1);
+    ASSERT_TRUE(aws_byte_buf_write_u8(&exact_buf, '>'));
+    ASSERT_SUCCESS(aws_dsql_auth_token_generate_into_buf(&config, false, allocator, &exact_buf, &required_len));
+    ASSERT_UINT_EQUALS(expected_len, required_len);
+    ASSERT_BIN_ARRAYS_EQUALS(expected_str, expected_len, exact_buf.buffer + 1, exact_buf.len - 1);
+
+    /* The char variant needs room for the terminator as well */
+    size_t token_len = 0;
+    ASSERT_ERROR(
+        AWS_ERROR_SHORT_BUFFER,
+        aws_dsql_auth_token_generate_into_c_str(&config, false, allocator, storage, expected_len, &token_len));
+    ASSERT_UINT_EQUALS(expected_len, token_len);
+    ASSERT_ERROR(
+        AWS_ERROR_SHORT_BUFFER,
+        aws_dsql_auth_token_generate_into_c_str(&config, false, allocator, NULL, 0, &token_len));
+    ASSERT_UINT_EQUALS(expected_len, token_len);
+
+    ASSERT_SUCCESS(
+        aws_dsql_auth_token_generate_into_c_str(&config, false, allocator, storage, sizeof(storage), &token_len));
+    ASSERT_UINT_EQUALS(expected_len, token_len);
+    ASSERT_STR_EQUALS(expected_str, storage);
+
+    /* Clean up */
+    aws_dsql_auth_token_clean_up(&expected);
+    aws_dsql_auth_config_clean_up(&config);
+    aws_credentials_provider_release(credentials_provider);
+
+    /* Clean up the AWS auth library */
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that a prepared generator produces the same tokens as aws_dsql_auth_token_generate, and rejects incomplete
+ * configs up front
+ */
+static int s_aws_dsql_auth_generator_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    /* Initialize the AWS auth library */
+    aws_auth_library_init(allocator);
+
+    /* Set the mock time to August 27, 2024 at 00:00:00 UTC (1724716800 seconds since Unix epoch) */
+    mock_aws_set_system_time(1724716800ULL * 1000000000ULL); /* Convert to nanoseconds */
+
+    /* Create credentials provider */
+    struct aws_credentials_provider *credentials_provider = s_create_test_credentials_provider(allocator);
+    ASSERT_NOT_NULL(credentials_provider);
+
+    /* Set up auth config */
+    struct aws_dsql_auth_config config;
+    ASSERT_SUCCESS(s_setup_auth_config(&config, credentials_provider, 450, mock_aws_get_system_time));
+
+    struct aws_dsql_auth_generator *generator = aws_dsql_auth_generator_new(allocator, &config);
+    ASSERT_NOT_NULL(generator);
+
+    for (int is_admin = 0; is_admin <= 1; ++is_admin) {
+        struct aws_dsql_auth_token expected = {0};
+        ASSERT_SUCCESS(aws_dsql_auth_token_generate(&config, is_admin, allocator, &expected));
+
+        struct aws_dsql_auth_token token = {0};
+        ASSERT_SUCCESS(aws_dsql_auth_generator_generate(generator, is_admin, &token));
+        ASSERT_STR_EQUALS(aws_dsql_auth_token_get_str(&expected), aws_dsql_auth_token_get_str(&token));
+
+        char storage[1024];
+        size_t required_len = 0;
+        struct aws_byte_buf output = aws_byte_buf_from_empty_array(storage, sizeof(storage));
+        ASSERT_SUCCESS(aws_dsql_auth_generator_generate_into_buf(generator, is_admin, &output, &required_len));
+        ASSERT_BIN_ARRAYS_EQUALS(aws_string_bytes(expected.token), expected.token->len, output.buffer, output.len);
+
+        aws_dsql_auth_token_clean_up(&token);
+        aws_dsql_auth_token_clean_up(&expected);
+    }
+
+    /* The generator keeps its own copy of the config */
+    aws_dsql_auth_config_set_expires_in(&config, 60);
+    struct aws_dsql_auth_token token = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_generator_generate(generator, false, &token));
+    ASSERT_NOT_NULL(strstr(aws_dsql_auth_token_get_str(&token), "&X-Amz-Expires=450&"));
+    aws_dsql_auth_token_clean_up(&token);
+
+    aws_dsql_auth_generator_release(generator);
+
+    /* Invalid configs fail at creation rather than on every generation */
+    struct aws_dsql_auth_config invalid_config = config;
+    invalid_config.region = NULL;
+    ASSERT_NULL(aws_dsql_auth_generator_new(allocator, &invalid_config));
+    ASSERT_INT_EQUALS(AWS_ERROR_INVALID_ARGUMENT, aws_last_error());
+
+    /* Clean up */
+    aws_dsql_auth_config_clean_up(&config);
+    aws_credentials_provider_release(credentials_provider);
+
+    /* Clean up the AWS auth library */
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that a shared generator token matches a plain one, and that sharing a token takes over its string
+ */
+static int s_aws_dsql_auth_shared_token_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+    mock_aws_set_system_time(1724716800ULL * 1000000000ULL);
+
+    struct aws_credentials_provider *credentials_provider = s_create_test_credentials_provider(allocator);
+    ASSERT_NOT_NULL(credentials_provider);
+
+    struct aws_dsql_auth_config config;
+    ASSERT_SUCCESS(s_setup_auth_config(&config, credentials_provider, 450, mock_aws_get_system_time));
+
+    struct aws_dsql_auth_generator *generator = aws_dsql_auth_generator_new(allocator, &config);
+    ASSERT_NOT_NULL(generator);
+
+    struct aws_dsql_auth_token expected = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_generator_generate(generator, false, &expected));
+
+    struct aws_dsql_auth_shared_token *shared = NULL;
+    ASSERT_SUCCESS(aws_dsql_auth_generator_generate_shared(generator, false, &shared));
+    const struct aws_dsql_auth_token *token = aws_dsql_auth_shared_token_get_token(shared);
+    ASSERT_STR_EQUALS(aws_dsql_auth_token_get_str(&expected), aws_dsql_auth_token_get_str(token));
+    ASSERT_UINT_EQUALS(
+        aws_dsql_auth_token_get_expiration_timepoint_seconds(&expected),
+        aws_dsql_auth_token_get_expiration_timepoint_seconds(token));
+
+    /* Every reference reads the same allocation, which outlives all but the last release */
+    ASSERT_PTR_EQUALS(shared, aws_dsql_auth_shared_token_acquire(shared));
+    ASSERT_NULL(aws_dsql_auth_shared_token_release(shared));
+    ASSERT_STR_EQUALS(aws_dsql_auth_token_get_str(&expected), aws_dsql_auth_token_get_str(token));
+    aws_dsql_auth_shared_token_release(shared);
+
+    /* Sharing a plain token moves its string rather than copying it */
+    const char *expected_str = aws_dsql_auth_token_get_str(&expected);
+    struct aws_dsql_auth_shared_token *moved = aws_dsql_auth_shared_token_new(allocator, &expected);
+    ASSERT_NOT_NULL(moved);
+    ASSERT_NULL(expected.token);
+    ASSERT_PTR_EQUALS(expected_str, aws_dsql_auth_token_get_str(aws_dsql_auth_shared_token_get_token(moved)));
+    aws_dsql_auth_shared_token_release(moved);
+
+    /* An empty token has nothing to share */
+    ASSERT_NULL(aws_dsql_auth_shared_token_new(allocator, &expected));
+    ASSERT_INT_EQUALS(AWS_ERROR_INVALID_ARGUMENT, aws_last_error());
+
+    aws_dsql_auth_generator_release(generator);
+    aws_dsql_auth_config_clean_up(&config);
+    aws_credentials_provider_release(credentials_provider);
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
 /**
  * Test that region auto-detection works from hostname using aws_dsql_auth_config_infer_region
  */
@@ -327,12 +732,225 @@ static int s_aws_dsql_auth_region_inference_private_endpoint_test(struct aws_all
     return AWS_OP_SUCCESS;
 }
 
+/**
+ * Test that aws_dsql_auth_hostname_parse_region returns a cursor into the hostname itself, including for hostnames
+ * that are not NUL-terminated
+ */
+static int s_aws_dsql_auth_hostname_parse_region_test(struct aws_allocator *allocator, void *ctx) {
+    (void)allocator;
+    (void)ctx;
+
+    const char *hostname = "24abtvxzzxzrrfaxyduobmpfea.dsql-foobar.us-east-1.on.aws";
+    struct aws_byte_cursor region;
+    ASSERT_SUCCESS(aws_dsql_auth_hostname_parse_region(aws_byte_cursor_from_c_str(hostname), &region));
+    ASSERT_CURSOR_VALUE_CSTRING_EQUALS(region, "us-east-1");
+    ASSERT_PTR_EQUALS(hostname + strlen("24abtvxzzxzrrfaxyduobmpfea.dsql-foobar."), region.ptr);
+
+    /* A hostname inside a larger buffer, e.g. a connection string */
+    const char *connection_string = "host=24abtvxzzxzrrfaxyduobmpfea.dsql.eu-west-1.on.aws port=5432";
+    struct aws_byte_cursor embedded = aws_byte_cursor_from_array(connection_string + 5, 48);
+    ASSERT_SUCCESS(aws_dsql_auth_hostname_parse_region(embedded, &region));
+    ASSERT_CURSOR_VALUE_CSTRING_EQUALS(region, "eu-west-1");
+
+    const char *invalid_hostnames[] = {
+        "",
+        ".on.aws",
+        "24abtvxzzxzrrfaxyduobmpfea.dsql.on.aws",
+        /* Empty region label */
+        "24abtvxzzxzrrfaxyduobmpfea.dsql..on.aws",
+        /* The suffix must be a whole label */
+        "24abtvxzzxzrrfaxyduobmpfea.dsql.us-east-1.won.aws",
+    };
+    for (size_t i = 0; i < AWS_ARRAY_SIZE(invalid_hostnames); i++) {
+        ASSERT_ERROR(
+            AWS_ERROR_INVALID_ARGUMENT,
+            aws_dsql_auth_hostname_parse_region(aws_byte_cursor_from_c_str(invalid_hostnames[i]), &region));
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that the generation stats observer is called once per token with consistent stage timings
+ */
+struct generation_stats_observer {
+    size_t calls;
+    struct aws_dsql_auth_generation_stats last;
+};
+
+static void s_on_generation_stats(const struct aws_dsql_auth_generation_stats *stats, void *user_data) {
+    struct generation_stats_observer *observer = user_data;
+    observer->calls++;
+    observer->last = *stats;
+}
+
+static int s_aws_dsql_auth_generation_stats_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+    mock_aws_set_system_time(1724716800ULL * 1000000000ULL);
+
+    struct aws_credentials_provider *credentials_provider = s_create_test_credentials_provider(allocator);
+    ASSERT_NOT_NULL(credentials_provider);
+
+    struct aws_dsql_auth_config config;
+    ASSERT_SUCCESS(s_setup_auth_config(&config, credentials_provider, 450, mock_aws_get_system_time));
+
+    struct generation_stats_observer observer = {0};
+    aws_dsql_auth_config_set_on_generation_stats(&config, s_on_generation_stats, &observer);
+
+    struct aws_dsql_auth_token token = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_generate(&config, false, allocator, &token));
+
+    ASSERT_UINT_EQUALS(1, observer.calls);
+    ASSERT_INT_EQUALS(AWS_ERROR_SUCCESS, observer.last.error_code);
+    ASSERT_FALSE(observer.last.token_cache_hit);
+    ASSERT_TRUE(
+        observer.last.total_ns >= observer.last.credentials_ns + observer.last.request_ns +
+                                      observer.last.signing_ns + observer.last.token_string_ns);
+
+    /* Signing straight into a caller buffer has no separate string stage */
+    uint8_t storage[1024];
+    struct aws_byte_buf buf = aws_byte_buf_from_empty_array(storage, sizeof(storage));
+    size_t required_len = 0;
+    ASSERT_SUCCESS(aws_dsql_auth_token_generate_into_buf(&config, false, allocator, &buf, &required_len));
+
+    ASSERT_UINT_EQUALS(2, observer.calls);
+    ASSERT_INT_EQUALS(AWS_ERROR_SUCCESS, observer.last.error_code);
+    ASSERT_UINT_EQUALS(0, observer.last.token_string_ns);
+
+    aws_dsql_auth_token_clean_up(&token);
+    aws_dsql_auth_config_clean_up(&config);
+    aws_credentials_provider_release(credentials_provider);
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that tokens carry when they were signed and when they expire, whichever way they are generated
+ */
+static int s_aws_dsql_auth_token_times_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+    mock_aws_set_system_time(1724716800ULL * 1000000000ULL);
+
+    struct aws_credentials_provider *credentials_provider = s_create_test_credentials_provider(allocator);
+    ASSERT_NOT_NULL(credentials_provider);
+
+    struct aws_dsql_auth_config config;
+    ASSERT_SUCCESS(s_setup_auth_config(&config, credentials_provider, 450, mock_aws_get_system_time));
+
+    /* No token yet */
+    struct aws_dsql_auth_token token = {0};
+    ASSERT_UINT_EQUALS(0, aws_dsql_auth_token_get_issued_timepoint_seconds(&token));
+    ASSERT_UINT_EQUALS(0, aws_dsql_auth_token_get_expiration_timepoint_seconds(&token));
+
+    ASSERT_SUCCESS(aws_dsql_auth_token_generate(&config, false, allocator, &token));
+    ASSERT_UINT_EQUALS(1724716800, aws_dsql_auth_token_get_issued_timepoint_seconds(&token));
+    ASSERT_UINT_EQUALS(1724716800 + 450, aws_dsql_auth_token_get_expiration_timepoint_seconds(&token));
+    aws_dsql_auth_token_clean_up(&token);
+
+    /* A generator signs with its own copy of the config, at the time of each call */
+    struct aws_dsql_auth_generator *generator = aws_dsql_auth_generator_new(allocator, &config);
+    ASSERT_NOT_NULL(generator);
+    mock_aws_set_system_time(1724716860ULL * 1000000000ULL);
+
+    ASSERT_SUCCESS(aws_dsql_auth_generator_generate(generator, true, &token));
+    ASSERT_UINT_EQUALS(1724716860, aws_dsql_auth_token_get_issued_timepoint_seconds(&token));
+    ASSERT_UINT_EQUALS(1724716860 + 450, aws_dsql_auth_token_get_expiration_timepoint_seconds(&token));
+    aws_dsql_auth_token_clean_up(&token);
+    aws_dsql_auth_generator_release(generator);
+
+    /* Cleaning up forgets the times along with the string */
+    ASSERT_UINT_EQUALS(0, aws_dsql_auth_token_get_expiration_timepoint_seconds(&token));
+
+    aws_dsql_auth_config_clean_up(&config);
+    aws_credentials_provider_release(credentials_provider);
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that a pair generated in one pass matches the regular and admin tokens generated separately
+ */
+static int s_aws_dsql_auth_token_pair_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+    mock_aws_set_system_time(1724716800ULL * 1000000000ULL);
+
+    struct aws_credentials_provider *credentials_provider = s_create_test_credentials_provider(allocator);
+    ASSERT_NOT_NULL(credentials_provider);
+
+    struct aws_dsql_auth_config config;
+    ASSERT_SUCCESS(s_setup_auth_config(&config, credentials_provider, 450, mock_aws_get_system_time));
+
+    struct generation_stats_observer observer = {0};
+    aws_dsql_auth_config_set_on_generation_stats(&config, s_on_generation_stats, &observer);
+
+    struct aws_dsql_auth_token expected = {0};
+    struct aws_dsql_auth_token expected_admin = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_generate(&config, false, allocator, &expected));
+    ASSERT_SUCCESS(aws_dsql_auth_token_generate(&config, true, allocator, &expected_admin));
+    observer.calls = 0;
+
+    struct aws_dsql_auth_token token = {0};
+    struct aws_dsql_auth_token admin_token = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_generate_pair(&config, allocator, &token, &admin_token));
+    ASSERT_STR_EQUALS(aws_dsql_auth_token_get_str(&expected), aws_dsql_auth_token_get_str(&token));
+    ASSERT_STR_EQUALS(aws_dsql_auth_token_get_str(&expected_admin), aws_dsql_auth_token_get_str(&admin_token));
+    ASSERT_UINT_EQUALS(1724716800 + 450, aws_dsql_auth_token_get_expiration_timepoint_seconds(&token));
+    ASSERT_UINT_EQUALS(1724716800 + 450, aws_dsql_auth_token_get_expiration_timepoint_seconds(&admin_token));
+
+    /* The observer hears about both tokens */
+    ASSERT_UINT_EQUALS(2, observer.calls);
+    ASSERT_INT_EQUALS(AWS_ERROR_SUCCESS, observer.last.error_code);
+
+    /* A generator's pair replaces the tokens already held */
+    struct aws_dsql_auth_generator *generator = aws_dsql_auth_generator_new(allocator, &config);
+    ASSERT_NOT_NULL(generator);
+    ASSERT_SUCCESS(aws_dsql_auth_generator_generate_pair(generator, &token, &admin_token));
+    ASSERT_STR_EQUALS(aws_dsql_auth_token_get_str(&expected), aws_dsql_auth_token_get_str(&token));
+    ASSERT_STR_EQUALS(aws_dsql_auth_token_get_str(&expected_admin), aws_dsql_auth_token_get_str(&admin_token));
+    aws_dsql_auth_generator_release(generator);
+
+    /* Both tokens must be distinct */
+    ASSERT_ERROR(AWS_ERROR_INVALID_ARGUMENT, aws_dsql_auth_token_generate_pair(&config, allocator, &token, &token));
+    ASSERT_STR_EQUALS(aws_dsql_auth_token_get_str(&expected), aws_dsql_auth_token_get_str(&token));
+
+    aws_dsql_auth_token_clean_up(&admin_token);
+    aws_dsql_auth_token_clean_up(&token);
+    aws_dsql_auth_token_clean_up(&expected_admin);
+    aws_dsql_auth_token_clean_up(&expected);
+    aws_dsql_auth_config_clean_up(&config);
+    aws_credentials_provider_release(credentials_provider);
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
 AWS_TEST_CASE(aws_dsql_auth_signing_works_test, s_aws_dsql_auth_signing_works_test);
 AWS_TEST_CASE(aws_dsql_auth_signing_works_admin_test, s_aws_dsql_auth_signing_works_admin_test);
+AWS_TEST_CASE(aws_dsql_auth_signing_works_async_test, s_aws_dsql_auth_signing_works_async_test);
+AWS_TEST_CASE(aws_dsql_auth_signing_works_event_loop_test, s_aws_dsql_auth_signing_works_event_loop_test);
+AWS_TEST_CASE(aws_dsql_auth_signing_works_batch_test, s_aws_dsql_auth_signing_works_batch_test);
+AWS_TEST_CASE(aws_dsql_auth_signing_works_into_buf_test, s_aws_dsql_auth_signing_works_into_buf_test);
+AWS_TEST_CASE(aws_dsql_auth_generator_test, s_aws_dsql_auth_generator_test);
+AWS_TEST_CASE(aws_dsql_auth_shared_token_test, s_aws_dsql_auth_shared_token_test);
 AWS_TEST_CASE(aws_dsql_auth_region_detection_test, s_aws_dsql_auth_region_detection_test);
+AWS_TEST_CASE(aws_dsql_auth_hostname_parse_region_test, s_aws_dsql_auth_hostname_parse_region_test);
 AWS_TEST_CASE(
     aws_dsql_auth_region_inference_private_endpoint_test,
     s_aws_dsql_auth_region_inference_private_endpoint_test);
 AWS_TEST_CASE(
     aws_dsql_auth_region_inference_invalid_hostname_test,
     s_aws_dsql_auth_region_inference_invalid_hostname_test);
+AWS_TEST_CASE(aws_dsql_auth_generation_stats_test, s_aws_dsql_auth_generation_stats_test);
+AWS_TEST_CASE(aws_dsql_auth_token_times_test, s_aws_dsql_auth_token_times_test);
+AWS_TEST_CASE(aws_dsql_auth_token_pair_test, s_aws_dsql_auth_token_pair_test);
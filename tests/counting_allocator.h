@@ -0,0 +1,63 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+
+#ifndef AWS_DSQL_AUTH_TESTS_COUNTING_ALLOCATOR_H
+#define AWS_DSQL_AUTH_TESTS_COUNTING_ALLOCATOR_H
+
+#include <aws/common/allocator.h>
+#include <aws/common/atomics.h>
+#include <aws/common/zero.h>
+
+/* Counts every allocation made through it, from any thread. Shared by the allocation tests and the benchmark. */
+struct counting_allocator {
+    struct aws_allocator base;
+    struct aws_allocator *parent;
+    struct aws_atomic_var count;
+    struct aws_atomic_var bytes;
+};
+
+static inline void *s_counting_acquire(struct aws_allocator *allocator, size_t size) {
+    struct counting_allocator *counting = allocator->impl;
+
+    aws_atomic_fetch_add_explicit(&counting->count, 1, aws_memory_order_relaxed);
+    aws_atomic_fetch_add_explicit(&counting->bytes, size, aws_memory_order_relaxed);
+
+    return aws_mem_acquire(counting->parent, size);
+}
+
+static inline void s_counting_release(struct aws_allocator *allocator, void *ptr) {
+    struct counting_allocator *counting = allocator->impl;
+    aws_mem_release(counting->parent, ptr);
+}
+
+static inline struct aws_allocator *s_counting_allocator_init(
+    struct counting_allocator *counting,
+    struct aws_allocator *parent) {
+
+    AWS_ZERO_STRUCT(*counting);
+    counting->base.mem_acquire = s_counting_acquire;
+    counting->base.mem_release = s_counting_release;
+    counting->base.impl = counting;
+    counting->parent = parent;
+    aws_atomic_init_int(&counting->count, 0);
+    aws_atomic_init_int(&counting->bytes, 0);
+
+    return &counting->base;
+}
+
+static inline void s_counting_allocator_reset(struct counting_allocator *counting) {
+    aws_atomic_store_int(&counting->count, 0);
+    aws_atomic_store_int(&counting->bytes, 0);
+}
+
+static inline size_t s_counting_allocator_count(struct counting_allocator *counting) {
+    return aws_atomic_load_int(&counting->count);
+}
+
+static inline size_t s_counting_allocator_bytes(struct counting_allocator *counting) {
+    return aws_atomic_load_int(&counting->bytes);
+}
+
+#endif /* AWS_DSQL_AUTH_TESTS_COUNTING_ALLOCATOR_H */
@@ -0,0 +1,397 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+
+#include <aws/testing/aws_test_harness.h>
+
+#include <aws/auth/auth.h>
+#include <aws/auth/credentials.h>
+#include <aws/common/atomics.h>
+#include <aws/common/mutex.h>
+#include <aws/common/thread.h>
+#include <aws/dsql-auth/credentials_snapshot.h>
+
+#include <stdio.h>
+
+/* Mock time functions */
+static struct aws_mutex s_snapshot_clock_sync = AWS_MUTEX_INIT;
+static uint64_t s_snapshot_clock_time = 0;
+
+static int s_mock_snapshot_get_system_time(uint64_t *current_time) {
+    aws_mutex_lock(&s_snapshot_clock_sync);
+    *current_time = s_snapshot_clock_time;
+    aws_mutex_unlock(&s_snapshot_clock_sync);
+    return AWS_OP_SUCCESS;
+}
+
+/* August 27, 2024 at 00:00:00 UTC, in seconds */
+static const uint64_t s_base_time_secs = 1724716800ULL;
+static const uint64_t s_credentials_lifetime_secs = 900;
+
+static void s_mock_snapshot_set_time_secs(uint64_t time_secs) {
+    aws_mutex_lock(&s_snapshot_clock_sync);
+    s_snapshot_clock_time = time_secs * 1000000000ULL;
+    aws_mutex_unlock(&s_snapshot_clock_sync);
+}
+
+/**
+ * A source that completes synchronously with credentials valid for s_credentials_lifetime_secs from the mock time.
+ * Each fetch gets a distinct access key id, "akid<n>", so tests can tell which fetch a snapshot came from. While
+ * is_failing is set, fetches fail instead.
+ */
+struct counting_source_impl {
+    int fetch_count;
+    bool is_failing;
+};
+
+static int s_counting_source_get_credentials(
+    struct aws_credentials_provider *provider,
+    aws_on_get_credentials_callback_fn callback,
+    void *user_data) {
+
+    struct counting_source_impl *impl = provider->impl;
+    ++impl->fetch_count;
+
+    if (impl->is_failing) {
+        callback(NULL, AWS_ERROR_UNKNOWN, user_data);
+        return AWS_OP_SUCCESS;
+    }
+
+    char access_key_id[32];
+    snprintf(access_key_id, sizeof(access_key_id), "akid%d", impl->fetch_count);
+
+    uint64_t now_ns = 0;
+    s_mock_snapshot_get_system_time(&now_ns);
+    struct aws_credentials *credentials = aws_credentials_new(
+        provider->allocator,
+        aws_byte_cursor_from_c_str(access_key_id),
+        aws_byte_cursor_from_c_str("secret"),
+        aws_byte_cursor_from_c_str("token"),
+        now_ns / 1000000000ULL + s_credentials_lifetime_secs);
+    if (!credentials) {
+        return AWS_OP_ERR;
+    }
+
+    callback(credentials, AWS_ERROR_SUCCESS, user_data);
+    aws_credentials_release(credentials);
+
+    return AWS_OP_SUCCESS;
+}
+
+static void s_counting_source_destroy(struct aws_credentials_provider *provider) {
+    aws_mem_release(provider->allocator, provider);
+}
+
+static struct aws_credentials_provider_vtable s_counting_source_vtable = {
+    .get_credentials = s_counting_source_get_credentials,
+    .destroy = s_counting_source_destroy,
+};
+
+static struct aws_credentials_provider *s_counting_source_new(
+    struct aws_allocator *allocator,
+    struct counting_source_impl **out_impl) {
+
+    struct aws_credentials_provider *provider = NULL;
+    struct counting_source_impl *impl = NULL;
+    if (!aws_mem_acquire_many(
+            allocator, 2, &provider, sizeof(struct aws_credentials_provider), &impl, sizeof(*impl))) {
+        return NULL;
+    }
+
+    AWS_ZERO_STRUCT(*provider);
+    AWS_ZERO_STRUCT(*impl);
+    provider->vtable = &s_counting_source_vtable;
+    provider->allocator = allocator;
+    provider->impl = impl;
+    aws_atomic_init_int(&provider->ref_count, 1);
+
+    *out_impl = impl;
+    return provider;
+}
+
+struct snapshot_get_result {
+    struct aws_credentials *credentials;
+    int error_code;
+    bool is_complete;
+};
+
+static void s_on_snapshot_credentials(struct aws_credentials *credentials, int error_code, void *user_data) {
+    struct snapshot_get_result *result = user_data;
+
+    result->credentials = credentials;
+    if (credentials) {
+        aws_credentials_acquire(credentials);
+    }
+    result->error_code = error_code;
+    result->is_complete = true;
+}
+
+/* Get credentials from the snapshot and check that the access key id is the expected one */
+static int s_check_snapshot_serves(struct aws_credentials_provider *provider, const char *expected_access_key_id) {
+    struct snapshot_get_result result;
+    AWS_ZERO_STRUCT(result);
+
+    ASSERT_SUCCESS(aws_credentials_provider_get_credentials(provider, s_on_snapshot_credentials, &result));
+    ASSERT_TRUE(result.is_complete);
+    ASSERT_INT_EQUALS(AWS_ERROR_SUCCESS, result.error_code);
+    ASSERT_NOT_NULL(result.credentials);
+    ASSERT_CURSOR_VALUE_CSTRING_EQUALS(
+        aws_credentials_get_access_key_id(result.credentials), expected_access_key_id);
+
+    aws_credentials_release(result.credentials);
+    return AWS_OP_SUCCESS;
+}
+
+static struct aws_credentials_provider *s_snapshot_new(
+    struct aws_allocator *allocator,
+    struct aws_credentials_provider *source) {
+
+    struct aws_dsql_auth_credentials_snapshot_options options = {
+        .source = source,
+        .refresh_ahead_seconds = 300,
+        .system_clock_fn = s_mock_snapshot_get_system_time,
+    };
+
+    return aws_dsql_auth_credentials_provider_new_snapshot(allocator, &options);
+}
+
+/**
+ * Test that only the first request reaches the source while the snapshot is fresh
+ */
+static int s_aws_dsql_auth_credentials_snapshot_hit_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+    s_mock_snapshot_set_time_secs(s_base_time_secs);
+
+    struct counting_source_impl *source_impl = NULL;
+    struct aws_credentials_provider *source = s_counting_source_new(allocator, &source_impl);
+    ASSERT_NOT_NULL(source);
+
+    struct aws_credentials_provider *snapshot = s_snapshot_new(allocator, source);
+    ASSERT_NOT_NULL(snapshot);
+
+    ASSERT_SUCCESS(s_check_snapshot_serves(snapshot, "akid1"));
+    ASSERT_INT_EQUALS(1, source_impl->fetch_count);
+
+    /* Still outside the refresh window */
+    s_mock_snapshot_set_time_secs(s_base_time_secs + 500);
+    for (int i = 0; i < 8; ++i) {
+        ASSERT_SUCCESS(s_check_snapshot_serves(snapshot, "akid1"));
+    }
+    ASSERT_INT_EQUALS(1, source_impl->fetch_count);
+
+    aws_credentials_provider_release(snapshot);
+    aws_credentials_provider_release(source);
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that a request inside the refresh window is served the current snapshot and starts exactly one refresh
+ */
+static int s_aws_dsql_auth_credentials_snapshot_refresh_ahead_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+    s_mock_snapshot_set_time_secs(s_base_time_secs);
+
+    struct counting_source_impl *source_impl = NULL;
+    struct aws_credentials_provider *source = s_counting_source_new(allocator, &source_impl);
+    ASSERT_NOT_NULL(source);
+
+    struct aws_credentials_provider *snapshot = s_snapshot_new(allocator, source);
+    ASSERT_NOT_NULL(snapshot);
+
+    ASSERT_SUCCESS(s_check_snapshot_serves(snapshot, "akid1"));
+
+    /* 200 seconds left: the caller still gets the current snapshot while the refresh replaces it */
+    s_mock_snapshot_set_time_secs(s_base_time_secs + 700);
+    ASSERT_SUCCESS(s_check_snapshot_serves(snapshot, "akid1"));
+    ASSERT_INT_EQUALS(2, source_impl->fetch_count);
+
+    /* The refreshed snapshot is fresh, so later requests do not refresh again */
+    ASSERT_SUCCESS(s_check_snapshot_serves(snapshot, "akid2"));
+    ASSERT_SUCCESS(s_check_snapshot_serves(snapshot, "akid2"));
+    ASSERT_INT_EQUALS(2, source_impl->fetch_count);
+
+    aws_credentials_provider_release(snapshot);
+    aws_credentials_provider_release(source);
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that an expired snapshot makes the request wait on the source
+ */
+static int s_aws_dsql_auth_credentials_snapshot_expired_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+    s_mock_snapshot_set_time_secs(s_base_time_secs);
+
+    struct counting_source_impl *source_impl = NULL;
+    struct aws_credentials_provider *source = s_counting_source_new(allocator, &source_impl);
+    ASSERT_NOT_NULL(source);
+
+    struct aws_credentials_provider *snapshot = s_snapshot_new(allocator, source);
+    ASSERT_NOT_NULL(snapshot);
+
+    ASSERT_SUCCESS(s_check_snapshot_serves(snapshot, "akid1"));
+
+    /* Past the expiration the stale snapshot must not be served */
+    s_mock_snapshot_set_time_secs(s_base_time_secs + s_credentials_lifetime_secs);
+    ASSERT_SUCCESS(s_check_snapshot_serves(snapshot, "akid2"));
+    ASSERT_INT_EQUALS(2, source_impl->fetch_count);
+
+    aws_credentials_provider_release(snapshot);
+    aws_credentials_provider_release(source);
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that a failed refresh holds the next one off instead of going back to the source on every request
+ */
+static int s_aws_dsql_auth_credentials_snapshot_refresh_backoff_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+    s_mock_snapshot_set_time_secs(s_base_time_secs);
+
+    struct counting_source_impl *source_impl = NULL;
+    struct aws_credentials_provider *source = s_counting_source_new(allocator, &source_impl);
+    ASSERT_NOT_NULL(source);
+
+    struct aws_credentials_provider *snapshot = s_snapshot_new(allocator, source);
+    ASSERT_NOT_NULL(snapshot);
+
+    ASSERT_SUCCESS(s_check_snapshot_serves(snapshot, "akid1"));
+
+    /* The refresh fails, and requests in the same second are served the snapshot without asking the source again */
+    source_impl->is_failing = true;
+    s_mock_snapshot_set_time_secs(s_base_time_secs + 700);
+    for (int i = 0; i < 8; ++i) {
+        ASSERT_SUCCESS(s_check_snapshot_serves(snapshot, "akid1"));
+    }
+    ASSERT_INT_EQUALS(2, source_impl->fetch_count);
+
+    /* Once the backoff is over the next request retries, and fails again */
+    s_mock_snapshot_set_time_secs(s_base_time_secs + 710);
+    ASSERT_SUCCESS(s_check_snapshot_serves(snapshot, "akid1"));
+    ASSERT_SUCCESS(s_check_snapshot_serves(snapshot, "akid1"));
+    ASSERT_INT_EQUALS(3, source_impl->fetch_count);
+
+    /* A retry that succeeds replaces the snapshot */
+    source_impl->is_failing = false;
+    s_mock_snapshot_set_time_secs(s_base_time_secs + 780);
+    ASSERT_SUCCESS(s_check_snapshot_serves(snapshot, "akid1"));
+    ASSERT_SUCCESS(s_check_snapshot_serves(snapshot, "akid4"));
+    ASSERT_INT_EQUALS(4, source_impl->fetch_count);
+
+    aws_credentials_provider_release(snapshot);
+    aws_credentials_provider_release(source);
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+enum { CONCURRENT_READER_COUNT = 8 };
+
+struct concurrent_reader {
+    struct aws_credentials_provider *snapshot;
+    struct aws_atomic_var *stop;
+    struct aws_thread thread;
+    size_t gets;
+    size_t failures;
+};
+
+static void s_concurrent_reader_fn(void *arg) {
+    struct concurrent_reader *reader = arg;
+
+    while (!aws_atomic_load_int(reader->stop) || reader->gets == 0) {
+        struct snapshot_get_result result;
+        AWS_ZERO_STRUCT(result);
+
+        if (aws_credentials_provider_get_credentials(reader->snapshot, s_on_snapshot_credentials, &result) ||
+            !result.credentials) {
+            ++reader->failures;
+        } else {
+            struct aws_byte_cursor access_key_id = aws_credentials_get_access_key_id(result.credentials);
+            struct aws_byte_cursor prefix = aws_byte_cursor_from_c_str("akid");
+            if (!aws_byte_cursor_starts_with(&access_key_id, &prefix)) {
+                ++reader->failures;
+            }
+            aws_credentials_release(result.credentials);
+        }
+        ++reader->gets;
+    }
+}
+
+/**
+ * Test that readers sharing a snapshot always get valid credentials while refreshes replace the snapshot under them
+ */
+static int s_aws_dsql_auth_credentials_snapshot_concurrent_readers_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+    s_mock_snapshot_set_time_secs(s_base_time_secs);
+
+    struct counting_source_impl *source_impl = NULL;
+    struct aws_credentials_provider *source = s_counting_source_new(allocator, &source_impl);
+    ASSERT_NOT_NULL(source);
+
+    struct aws_credentials_provider *snapshot = s_snapshot_new(allocator, source);
+    ASSERT_NOT_NULL(snapshot);
+    ASSERT_SUCCESS(s_check_snapshot_serves(snapshot, "akid1"));
+
+    struct aws_atomic_var stop;
+    aws_atomic_init_int(&stop, 0);
+
+    struct concurrent_reader readers[CONCURRENT_READER_COUNT];
+    for (size_t i = 0; i < CONCURRENT_READER_COUNT; ++i) {
+        readers[i] = (struct concurrent_reader){
+            .snapshot = snapshot,
+            .stop = &stop,
+        };
+        ASSERT_SUCCESS(aws_thread_init(&readers[i].thread, allocator));
+        ASSERT_SUCCESS(
+            aws_thread_launch(&readers[i].thread, s_concurrent_reader_fn, &readers[i], aws_default_thread_options()));
+    }
+
+    /* Every few steps land inside the refresh window, so the snapshot keeps being replaced while the readers run */
+    for (uint64_t step = 1; step <= 200; ++step) {
+        s_mock_snapshot_set_time_secs(s_base_time_secs + step * 100);
+        aws_thread_current_sleep(1000000);
+    }
+
+    aws_atomic_store_int(&stop, 1);
+    for (size_t i = 0; i < CONCURRENT_READER_COUNT; ++i) {
+        ASSERT_SUCCESS(aws_thread_join(&readers[i].thread));
+        aws_thread_clean_up(&readers[i].thread);
+        ASSERT_UINT_EQUALS(0, readers[i].failures);
+    }
+    ASSERT_TRUE(source_impl->fetch_count > 1);
+
+    aws_credentials_provider_release(snapshot);
+    aws_credentials_provider_release(source);
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+AWS_TEST_CASE(aws_dsql_auth_credentials_snapshot_hit_test, s_aws_dsql_auth_credentials_snapshot_hit_test);
+AWS_TEST_CASE(
+    aws_dsql_auth_credentials_snapshot_refresh_ahead_test,
+    s_aws_dsql_auth_credentials_snapshot_refresh_ahead_test);
+AWS_TEST_CASE(aws_dsql_auth_credentials_snapshot_expired_test, s_aws_dsql_auth_credentials_snapshot_expired_test);
+AWS_TEST_CASE(
+    aws_dsql_auth_credentials_snapshot_refresh_backoff_test,
+    s_aws_dsql_auth_credentials_snapshot_refresh_backoff_test);
+AWS_TEST_CASE(
+    aws_dsql_auth_credentials_snapshot_concurrent_readers_test,
+    s_aws_dsql_auth_credentials_snapshot_concurrent_readers_test);
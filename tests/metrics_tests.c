@@ -0,0 +1,130 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+
+#include "test_fixtures.h"
+
+#include <aws/auth/auth.h>
+#include <aws/auth/credentials.h>
+#include <aws/common/thread.h>
+#include <aws/dsql-auth/metrics.h>
+#include <aws/dsql-auth/private/metrics.h>
+#include <aws/dsql-auth/token_cache.h>
+#include <string.h>
+
+static int s_mock_metrics_get_system_time(uint64_t *current_time) {
+    *current_time = s_base_time_ns;
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that a cache miss, a hit and the cache's release show up in the metrics
+ */
+static int s_aws_dsql_auth_metrics_token_cache_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+
+    struct aws_credentials_provider *credentials_provider = s_create_test_credentials_provider(allocator);
+    ASSERT_NOT_NULL(credentials_provider);
+
+    struct aws_dsql_auth_config config;
+    ASSERT_SUCCESS(aws_dsql_auth_config_init(&config));
+    aws_dsql_auth_config_set_hostname(&config, aws_string_c_str(s_hostname));
+    aws_dsql_auth_config_set_region(&config, (struct aws_string *)s_region); /* Cast away const */
+    aws_dsql_auth_config_set_credentials_provider(&config, credentials_provider);
+    config.system_clock_fn = s_mock_metrics_get_system_time;
+
+    struct aws_dsql_auth_metrics before;
+    aws_dsql_auth_metrics_snapshot(&before);
+
+    struct aws_dsql_auth_token_cache *cache = aws_dsql_auth_token_cache_new(allocator, NULL);
+    ASSERT_NOT_NULL(cache);
+
+    struct aws_dsql_auth_token first = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &first));
+    struct aws_dsql_auth_token second = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &second));
+
+    struct aws_dsql_auth_metrics during;
+    aws_dsql_auth_metrics_snapshot(&during);
+
+    ASSERT_UINT_EQUALS(before.tokens_generated + 1, during.tokens_generated);
+    ASSERT_UINT_EQUALS(before.generation_failures, during.generation_failures);
+    ASSERT_UINT_EQUALS(before.token_cache_misses + 1, during.token_cache_misses);
+    ASSERT_UINT_EQUALS(before.token_cache_hits + 1, during.token_cache_hits);
+    ASSERT_UINT_EQUALS(before.credentials_fetches + 1, during.credentials_fetches);
+    ASSERT_UINT_EQUALS(before.token_cache_entries + 1, during.token_cache_entries);
+    ASSERT_UINT_EQUALS(
+        before.token_cache_bytes + strlen(aws_dsql_auth_token_get_str(&first)), during.token_cache_bytes);
+
+    uint64_t bucketed = 0;
+    for (size_t i = 0; i < AWS_DSQL_AUTH_METRICS_LATENCY_BUCKET_COUNT; ++i) {
+        bucketed += during.credentials_fetch_latency_buckets[i] - before.credentials_fetch_latency_buckets[i];
+    }
+    ASSERT_UINT_EQUALS(1, bucketed);
+
+    aws_dsql_auth_token_clean_up(&second);
+    aws_dsql_auth_token_clean_up(&first);
+    aws_dsql_auth_token_cache_release(cache);
+
+    /* Releasing the cache takes its tokens out of the gauges */
+    struct aws_dsql_auth_metrics after;
+    aws_dsql_auth_metrics_snapshot(&after);
+    ASSERT_UINT_EQUALS(before.token_cache_entries, after.token_cache_entries);
+    ASSERT_UINT_EQUALS(before.token_cache_bytes, after.token_cache_bytes);
+
+    aws_dsql_auth_config_clean_up(&config);
+    aws_credentials_provider_release(credentials_provider);
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+enum { METRICS_THREAD_COUNT = 8 };
+enum { METRICS_RECORDS_PER_THREAD = 10000 };
+
+static void s_metrics_recorder_fn(void *arg) {
+    (void)arg;
+    for (size_t i = 0; i < METRICS_RECORDS_PER_THREAD; ++i) {
+        /* 3 microseconds, in the [2, 4) microsecond bucket */
+        aws_dsql_auth_metrics_record_credentials_fetch(3000, i % 2 == 0);
+    }
+}
+
+/**
+ * Test that concurrent recorders, in different shards or the same one, add up exactly
+ */
+static int s_aws_dsql_auth_metrics_concurrent_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    struct aws_dsql_auth_metrics before;
+    aws_dsql_auth_metrics_snapshot(&before);
+
+    struct aws_thread threads[METRICS_THREAD_COUNT];
+    for (size_t i = 0; i < METRICS_THREAD_COUNT; ++i) {
+        ASSERT_SUCCESS(aws_thread_init(&threads[i], allocator));
+        ASSERT_SUCCESS(aws_thread_launch(&threads[i], s_metrics_recorder_fn, NULL, aws_default_thread_options()));
+    }
+    for (size_t i = 0; i < METRICS_THREAD_COUNT; ++i) {
+        ASSERT_SUCCESS(aws_thread_join(&threads[i]));
+        aws_thread_clean_up(&threads[i]);
+    }
+
+    struct aws_dsql_auth_metrics after;
+    aws_dsql_auth_metrics_snapshot(&after);
+
+    uint64_t total = (uint64_t)METRICS_THREAD_COUNT * METRICS_RECORDS_PER_THREAD;
+    ASSERT_UINT_EQUALS(before.credentials_fetches + total, after.credentials_fetches);
+    ASSERT_UINT_EQUALS(before.credentials_fetch_failures + total / 2, after.credentials_fetch_failures);
+    ASSERT_UINT_EQUALS(before.credentials_fetch_us + total * 3, after.credentials_fetch_us);
+    ASSERT_UINT_EQUALS(
+        before.credentials_fetch_latency_buckets[2] + total, after.credentials_fetch_latency_buckets[2]);
+
+    return AWS_OP_SUCCESS;
+}
+
+AWS_TEST_CASE(aws_dsql_auth_metrics_token_cache_test, s_aws_dsql_auth_metrics_token_cache_test);
+AWS_TEST_CASE(aws_dsql_auth_metrics_concurrent_test, s_aws_dsql_auth_metrics_concurrent_test);
@@ -0,0 +1,55 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+
+#include <aws/testing/aws_test_harness.h>
+
+#include <aws/common/byte_buf.h>
+#include <aws/dsql-auth/private/scratch_allocator.h>
+
+#include <stdint.h>
+
+static bool s_is_within(const void *ptr, const uint8_t *storage, size_t capacity) {
+    return (const uint8_t *)ptr >= storage && (const uint8_t *)ptr < storage + capacity;
+}
+
+/**
+ * Test that small requests are served from the storage, aligned, and that anything larger goes to the parent
+ */
+static int s_aws_dsql_auth_scratch_allocator_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    uint8_t storage[256];
+    struct aws_dsql_auth_scratch_allocator scratch;
+    struct aws_allocator *scratch_allocator =
+        aws_dsql_auth_scratch_allocator_init(&scratch, allocator, storage, sizeof(storage));
+
+    void *first = aws_mem_acquire(scratch_allocator, 3);
+    void *second = aws_mem_calloc(scratch_allocator, 1, 40);
+    ASSERT_TRUE(s_is_within(first, storage, sizeof(storage)));
+    ASSERT_TRUE(s_is_within(second, storage, sizeof(storage)));
+    ASSERT_INT_EQUALS(0, (uintptr_t)second % 16);
+    ASSERT_TRUE((uint8_t *)second >= (uint8_t *)first + 3);
+
+    /* Does not fit in what is left, so it comes from the parent and goes back to it */
+    void *large = aws_mem_acquire(scratch_allocator, sizeof(storage));
+    ASSERT_NOT_NULL(large);
+    ASSERT_FALSE(s_is_within(large, storage, sizeof(storage)));
+    aws_mem_release(scratch_allocator, large);
+
+    /* Growing a buffer moves it out of the storage once it outgrows the space left */
+    struct aws_byte_buf buf;
+    ASSERT_SUCCESS(aws_byte_buf_init(&buf, scratch_allocator, 16));
+    ASSERT_TRUE(s_is_within(buf.buffer, storage, sizeof(storage)));
+    ASSERT_SUCCESS(aws_byte_buf_reserve(&buf, 1024));
+    ASSERT_FALSE(s_is_within(buf.buffer, storage, sizeof(storage)));
+    aws_byte_buf_clean_up(&buf);
+
+    aws_mem_release(scratch_allocator, second);
+    aws_mem_release(scratch_allocator, first);
+
+    return AWS_OP_SUCCESS;
+}
+
+AWS_TEST_CASE(aws_dsql_auth_scratch_allocator_test, s_aws_dsql_auth_scratch_allocator_test);
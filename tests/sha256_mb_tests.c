@@ -0,0 +1,74 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+
+#include <aws/testing/aws_test_harness.h>
+
+#include <aws/cal/cal.h>
+#include <aws/cal/hash.h>
+#include <aws/dsql-auth/private/sha256_mb.h>
+
+enum { SHA256_MB_TEST_MESSAGES = 40, SHA256_MB_TEST_MAX_LEN = 300, SHA256_MB_TEST_PIECES = 3 };
+
+/**
+ * Test that every kernel this CPU runs matches aws-c-cal's SHA-256, for messages of every length around the block and
+ * padding boundaries, split into pieces, with more messages than lanes so that lanes pick up new ones as they finish
+ */
+static int s_aws_dsql_auth_sha256_mb_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_cal_library_init(allocator);
+
+    uint8_t data[SHA256_MB_TEST_MAX_LEN];
+    for (size_t i = 0; i < sizeof(data); ++i) {
+        data[i] = (uint8_t)(i * 131 + 7);
+    }
+
+    for (size_t lanes = 4; lanes <= AWS_DSQL_AUTH_SHA256_MB_MAX_LANES; lanes *= 2) {
+        if (!aws_dsql_auth_sha256_mb_supports(lanes)) {
+            continue;
+        }
+
+        for (size_t first_len = 0; first_len + SHA256_MB_TEST_MESSAGES <= SHA256_MB_TEST_MAX_LEN; first_len += 20) {
+            struct aws_byte_cursor pieces[SHA256_MB_TEST_MESSAGES][SHA256_MB_TEST_PIECES];
+            struct aws_dsql_auth_sha256_mb_job jobs[SHA256_MB_TEST_MESSAGES];
+            uint8_t digests[SHA256_MB_TEST_MESSAGES][AWS_SHA256_LEN];
+
+            for (size_t i = 0; i < SHA256_MB_TEST_MESSAGES; ++i) {
+                /* Consecutive lengths, each split at a third and two thirds, with empty pieces for short ones */
+                size_t len = first_len + i;
+                pieces[i][0] = aws_byte_cursor_from_array(data, len / 3);
+                pieces[i][1] = aws_byte_cursor_from_array(data + len / 3, len / 3);
+                pieces[i][2] = aws_byte_cursor_from_array(data + 2 * (len / 3), len - 2 * (len / 3));
+                jobs[i].pieces = pieces[i];
+                jobs[i].piece_count = SHA256_MB_TEST_PIECES;
+                jobs[i].out_digest = digests[i];
+            }
+
+            aws_dsql_auth_sha256_mb_hash(jobs, SHA256_MB_TEST_MESSAGES, lanes);
+
+            for (size_t i = 0; i < SHA256_MB_TEST_MESSAGES; ++i) {
+                struct aws_byte_cursor message = aws_byte_cursor_from_array(data, first_len + i);
+                uint8_t expected[AWS_SHA256_LEN];
+                struct aws_byte_buf expected_buf = aws_byte_buf_from_empty_array(expected, sizeof(expected));
+                ASSERT_SUCCESS(aws_sha256_compute(allocator, &message, &expected_buf, 0));
+                ASSERT_BIN_ARRAYS_EQUALS(expected, sizeof(expected), digests[i], AWS_SHA256_LEN);
+            }
+        }
+    }
+
+    /* The kernel picked for a batch is one the messages fill, and no kernel is worth it for a single message */
+    size_t lanes = aws_dsql_auth_sha256_mb_lanes(12);
+    if (lanes > 0) {
+        ASSERT_TRUE(aws_dsql_auth_sha256_mb_supports(lanes));
+        ASSERT_TRUE(lanes <= 12);
+    }
+    ASSERT_UINT_EQUALS(0, aws_dsql_auth_sha256_mb_lanes(1));
+
+    aws_cal_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+AWS_TEST_CASE(aws_dsql_auth_sha256_mb_test, s_aws_dsql_auth_sha256_mb_test);
@@ -0,0 +1,717 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+
+#include <aws/testing/aws_test_harness.h>
+
+#include <aws/auth/auth.h>
+#include <aws/auth/credentials.h>
+#include <aws/auth/signable.h>
+#include <aws/auth/signing.h>
+#include <aws/auth/signing_config.h>
+#include <aws/auth/signing_result.h>
+#include <aws/common/atomics.h>
+#include <aws/common/date_time.h>
+#include <aws/common/thread.h>
+#include <aws/dsql-auth/private/sigv4.h>
+#include <aws/http/request_response.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#    include <sys/wait.h>
+#    include <unistd.h>
+#endif
+
+/* August 27, 2024 at 00:00:00 UTC, in seconds */
+static const uint64_t s_base_time_secs = 1724716800ULL;
+
+struct reference_signing_result {
+    struct aws_http_message *request;
+    struct aws_allocator *allocator;
+    int error_code;
+    bool is_complete;
+};
+
+/* aws_sign_request_aws completes inline when credentials are supplied directly in the config */
+static void s_on_reference_signing_complete(struct aws_signing_result *result, int error_code, void *userdata) {
+    struct reference_signing_result *reference = userdata;
+
+    reference->error_code = error_code;
+    if (error_code == AWS_ERROR_SUCCESS &&
+        aws_apply_signing_result_to_http_request(reference->request, reference->allocator, result)) {
+        reference->error_code = aws_last_error();
+    }
+    reference->is_complete = true;
+}
+
+/**
+ * Sign the token request with aws-c-auth, the way tokens were produced before the dedicated presigner, and append
+ * '<hostname><signed path>' to out_token.
+ */
+static int s_reference_presign(
+    struct aws_allocator *allocator,
+    const struct aws_dsql_auth_presign_params *params,
+    struct aws_byte_buf *out_token) {
+
+    struct aws_http_message *request = aws_http_message_new_request(allocator);
+    ASSERT_NOT_NULL(request);
+    ASSERT_SUCCESS(aws_http_message_set_request_method(request, aws_byte_cursor_from_c_str("GET")));
+
+    char path_buffer[128];
+    snprintf(path_buffer, sizeof(path_buffer), "/?Action=" PRInSTR, AWS_BYTE_CURSOR_PRI(params->action));
+    ASSERT_SUCCESS(aws_http_message_set_request_path(request, aws_byte_cursor_from_c_str(path_buffer)));
+
+    struct aws_http_header host_header = {.name = aws_byte_cursor_from_c_str("Host"), .value = params->hostname};
+    ASSERT_SUCCESS(aws_http_message_add_header(request, host_header));
+
+    struct aws_signable *signable = aws_signable_new_http_request(allocator, request);
+    ASSERT_NOT_NULL(signable);
+
+    struct aws_date_time date_time;
+    aws_date_time_init_epoch_secs(&date_time, (double)params->signing_time_secs);
+
+    struct aws_signing_config_aws signing_config;
+    AWS_ZERO_STRUCT(signing_config);
+    signing_config.config_type = AWS_SIGNING_CONFIG_AWS;
+    signing_config.algorithm = AWS_SIGNING_ALGORITHM_V4;
+    signing_config.signature_type = AWS_ST_HTTP_REQUEST_QUERY_PARAMS;
+    signing_config.region = params->region;
+    signing_config.service = aws_byte_cursor_from_c_str("dsql");
+    signing_config.flags.use_double_uri_encode = false;
+    signing_config.flags.should_normalize_uri_path = true;
+    signing_config.credentials = params->credentials;
+    signing_config.expiration_in_seconds = params->expires_in;
+    signing_config.date = date_time;
+
+    struct reference_signing_result reference = {.request = request, .allocator = allocator};
+    ASSERT_SUCCESS(aws_sign_request_aws(
+        allocator,
+        signable,
+        (struct aws_signing_config_base *)&signing_config,
+        s_on_reference_signing_complete,
+        &reference));
+    ASSERT_TRUE(reference.is_complete);
+    ASSERT_INT_EQUALS(AWS_ERROR_SUCCESS, reference.error_code);
+
+    struct aws_byte_cursor path;
+    ASSERT_SUCCESS(aws_http_message_get_request_path(request, &path));
+    ASSERT_SUCCESS(aws_byte_buf_append_dynamic(out_token, &params->hostname));
+    ASSERT_SUCCESS(aws_byte_buf_append_dynamic(out_token, &path));
+
+    aws_signable_destroy(signable);
+    aws_http_message_release(request);
+
+    return AWS_OP_SUCCESS;
+}
+
+/* With a fragment cache, the token is also presigned with credentials encoded by the cache */
+static int s_check_presign_matches_reference(
+    struct aws_allocator *allocator,
+    struct aws_dsql_auth_credentials_fragment_cache *fragment_cache,
+    const char *hostname,
+    const char *region,
+    const char *action,
+    const char *session_token,
+    uint64_t expires_in) {
+
+    struct aws_credentials *credentials = aws_credentials_new(
+        allocator,
+        aws_byte_cursor_from_c_str("AKIDEXAMPLE"),
+        aws_byte_cursor_from_c_str("wJalrXUtnFEMI/K7MDENG+bPxRfiCYEXAMPLEKEY"),
+        aws_byte_cursor_from_c_str(session_token),
+        UINT64_MAX);
+    ASSERT_NOT_NULL(credentials);
+
+    struct aws_dsql_auth_presign_params params = {
+        .hostname = aws_byte_cursor_from_c_str(hostname),
+        .region = aws_byte_cursor_from_c_str(region),
+        .action = aws_byte_cursor_from_c_str(action),
+        .credentials = credentials,
+        .expires_in = expires_in,
+        .signing_time_secs = s_base_time_secs,
+    };
+
+    struct aws_byte_buf expected;
+    ASSERT_SUCCESS(aws_byte_buf_init(&expected, allocator, 256));
+    ASSERT_SUCCESS(s_reference_presign(allocator, &params, &expected));
+
+    /* Presign twice so the second token is signed with a cached signing key */
+    for (int i = 0; i < 2; ++i) {
+        struct aws_byte_buf actual;
+        ASSERT_SUCCESS(aws_byte_buf_init(&actual, allocator, 16));
+        ASSERT_SUCCESS(aws_dsql_auth_presign(allocator, &params, &actual));
+        ASSERT_BIN_ARRAYS_EQUALS(expected.buffer, expected.len, actual.buffer, actual.len);
+        aws_byte_buf_clean_up(&actual);
+    }
+
+    if (fragment_cache) {
+        struct aws_dsql_auth_presign_template presign_template;
+        ASSERT_SUCCESS(aws_dsql_auth_presign_template_init(
+            &presign_template, params.hostname, params.region, params.action, params.expires_in));
+
+        /* Once with the fragment the first presign creates, then with the same fragment back from the cache */
+        struct aws_dsql_auth_credentials_fragment *fragment = NULL;
+        for (int i = 0; i < 2; ++i) {
+            struct aws_dsql_auth_presign_credentials presign_credentials;
+            aws_dsql_auth_presign_credentials_init(&presign_credentials, credentials, fragment_cache);
+            ASSERT_NOT_NULL(presign_credentials.fragment);
+            if (fragment) {
+                ASSERT_PTR_EQUALS(fragment, presign_credentials.fragment);
+            }
+            fragment = presign_credentials.fragment;
+
+            struct aws_byte_buf actual;
+            ASSERT_SUCCESS(aws_byte_buf_init(&actual, allocator, 16));
+            ASSERT_SUCCESS(aws_dsql_auth_presign_template_sign(
+                allocator, &presign_template, &presign_credentials, s_base_time_secs, &actual));
+            ASSERT_BIN_ARRAYS_EQUALS(expected.buffer, expected.len, actual.buffer, actual.len);
+            aws_byte_buf_clean_up(&actual);
+            aws_dsql_auth_presign_credentials_clean_up(&presign_credentials);
+        }
+    }
+
+    aws_byte_buf_clean_up(&expected);
+    aws_credentials_release(credentials);
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that the presigner produces byte-for-byte the same tokens as aws-c-auth's SigV4 signer
+ */
+static int s_aws_dsql_auth_presign_matches_signer_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+
+    const char *hostname = "peccy.dsql.us-east-1.on.aws";
+
+    ASSERT_SUCCESS(
+        s_check_presign_matches_reference(allocator, NULL, hostname, "us-east-1", "DbConnect", "token", 450));
+    ASSERT_SUCCESS(
+        s_check_presign_matches_reference(allocator, NULL, hostname, "us-east-1", "DbConnectAdmin", "", 900));
+    ASSERT_SUCCESS(s_check_presign_matches_reference(
+        allocator, NULL, hostname, "us-east-1", "DbConnect", "IQoJb3JpZ2luX2VjE+/a=b&c==", 3600));
+    ASSERT_SUCCESS(s_check_presign_matches_reference(
+        allocator, NULL, "abcdefghijklmnopqrstuvwxyz.dsql.eu-west-1.on.aws", "eu-west-1", "DbConnect", "token", 1));
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that tokens signed with encoded credentials, from a fragment cache that more credentials pass through than it
+ * holds and unencoded when too long for the inline storage, still match aws-c-auth
+ */
+static int s_aws_dsql_auth_presign_credentials_cache_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+
+    const char *hostname = "peccy.dsql.us-east-1.on.aws";
+
+    struct aws_dsql_auth_credentials_fragment_cache fragment_cache;
+    aws_dsql_auth_credentials_fragment_cache_init(&fragment_cache, allocator);
+
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int i = 0; i < AWS_DSQL_AUTH_CREDENTIALS_FRAGMENT_CACHE_SLOTS + 4; ++i) {
+            char session_token[32];
+            snprintf(session_token, sizeof(session_token), "token+/%02d", i);
+            ASSERT_SUCCESS(s_check_presign_matches_reference(
+                allocator, &fragment_cache, hostname, "us-east-1", "DbConnect", session_token, 900));
+        }
+    }
+
+    /* A session token that encodes to more than the inline storage holds */
+    char long_session_token[3001];
+    for (size_t i = 0; i < sizeof(long_session_token) - 1; ++i) {
+        long_session_token[i] = "IQoJb3+/="[i % 9];
+    }
+    long_session_token[sizeof(long_session_token) - 1] = '\0';
+    ASSERT_SUCCESS(s_check_presign_matches_reference(
+        allocator, &fragment_cache, hostname, "us-east-1", "DbConnect", long_session_token, 900));
+
+    aws_dsql_auth_credentials_fragment_cache_clean_up(&fragment_cache);
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+static int s_sign_with_presign_credentials(
+    struct aws_allocator *allocator,
+    const struct aws_dsql_auth_presign_template *presign_template,
+    const struct aws_dsql_auth_presign_credentials *presign_credentials,
+    const struct aws_byte_buf *expected) {
+
+    struct aws_byte_buf actual;
+    ASSERT_SUCCESS(aws_byte_buf_init(&actual, allocator, 16));
+    ASSERT_SUCCESS(aws_dsql_auth_presign_template_sign(
+        allocator, presign_template, presign_credentials, s_base_time_secs, &actual));
+    ASSERT_BIN_ARRAYS_EQUALS(expected->buffer, expected->len, actual.buffer, actual.len);
+    aws_byte_buf_clean_up(&actual);
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that a fragment cache hands a fragment to one presign at a time, reuses it for the same credentials and replaces
+ * it for rotated ones
+ */
+static int s_aws_dsql_auth_presign_fragment_cache_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+
+    struct aws_credentials *credentials = aws_credentials_new(
+        allocator,
+        aws_byte_cursor_from_c_str("AKIDEXAMPLE"),
+        aws_byte_cursor_from_c_str("wJalrXUtnFEMI/K7MDENG+bPxRfiCYEXAMPLEKEY"),
+        aws_byte_cursor_from_c_str("IQoJb3JpZ2luX2VjE+/a=b&c=="),
+        UINT64_MAX);
+    ASSERT_NOT_NULL(credentials);
+    struct aws_credentials *rotated_credentials = aws_credentials_new(
+        allocator,
+        aws_byte_cursor_from_c_str("AKIDEXAMPLE"),
+        aws_byte_cursor_from_c_str("wJalrXUtnFEMI/K7MDENG+bPxRfiCYEXAMPLEKEY"),
+        aws_byte_cursor_from_c_str("IQoJb3JpZ2luX2VjE+/rotated"),
+        UINT64_MAX);
+    ASSERT_NOT_NULL(rotated_credentials);
+
+    struct aws_dsql_auth_presign_params params = {
+        .hostname = aws_byte_cursor_from_c_str("peccy.dsql.us-east-1.on.aws"),
+        .region = aws_byte_cursor_from_c_str("us-east-1"),
+        .action = aws_byte_cursor_from_c_str("DbConnect"),
+        .credentials = credentials,
+        .expires_in = 900,
+        .signing_time_secs = s_base_time_secs,
+    };
+
+    struct aws_byte_buf expected;
+    ASSERT_SUCCESS(aws_byte_buf_init(&expected, allocator, 16));
+    ASSERT_SUCCESS(aws_dsql_auth_presign(allocator, &params, &expected));
+    struct aws_byte_buf rotated_expected;
+    ASSERT_SUCCESS(aws_byte_buf_init(&rotated_expected, allocator, 16));
+    params.credentials = rotated_credentials;
+    ASSERT_SUCCESS(aws_dsql_auth_presign(allocator, &params, &rotated_expected));
+
+    struct aws_dsql_auth_presign_template presign_template;
+    ASSERT_SUCCESS(aws_dsql_auth_presign_template_init(
+        &presign_template, params.hostname, params.region, params.action, params.expires_in));
+
+    struct aws_dsql_auth_credentials_fragment_cache fragment_cache;
+    aws_dsql_auth_credentials_fragment_cache_init(&fragment_cache, allocator);
+
+    /* Two presigns at once each get their own fragment */
+    struct aws_dsql_auth_presign_credentials first;
+    struct aws_dsql_auth_presign_credentials second;
+    aws_dsql_auth_presign_credentials_init(&first, credentials, &fragment_cache);
+    aws_dsql_auth_presign_credentials_init(&second, credentials, &fragment_cache);
+    ASSERT_TRUE(first.is_encoded);
+    ASSERT_TRUE(second.is_encoded);
+    ASSERT_NOT_NULL(first.fragment);
+    ASSERT_NOT_NULL(second.fragment);
+    ASSERT_TRUE(first.fragment != second.fragment);
+    ASSERT_SUCCESS(s_sign_with_presign_credentials(allocator, &presign_template, &first, &expected));
+    ASSERT_SUCCESS(s_sign_with_presign_credentials(allocator, &presign_template, &second, &expected));
+    struct aws_dsql_auth_credentials_fragment *fragment = first.fragment;
+    aws_dsql_auth_presign_credentials_clean_up(&first);
+    aws_dsql_auth_presign_credentials_clean_up(&second);
+
+    /* The next presign with the same credentials gets a fragment back from the cache */
+    aws_dsql_auth_presign_credentials_init(&first, credentials, &fragment_cache);
+    ASSERT_TRUE(first.fragment == fragment || first.fragment == second.fragment);
+    ASSERT_SUCCESS(s_sign_with_presign_credentials(allocator, &presign_template, &first, &expected));
+    aws_dsql_auth_presign_credentials_clean_up(&first);
+
+    /* Rotated credentials are encoded afresh and their fragments replace the stale ones */
+    for (int i = 0; i < 2; ++i) {
+        aws_dsql_auth_presign_credentials_init(&first, rotated_credentials, &fragment_cache);
+        ASSERT_SUCCESS(s_sign_with_presign_credentials(allocator, &presign_template, &first, &rotated_expected));
+        aws_dsql_auth_presign_credentials_clean_up(&first);
+    }
+
+    /* Without a cache, the credentials are encoded into the inline storage */
+    aws_dsql_auth_presign_credentials_init(&first, credentials, NULL);
+    ASSERT_TRUE(first.is_encoded);
+    ASSERT_NULL(first.fragment);
+    ASSERT_SUCCESS(s_sign_with_presign_credentials(allocator, &presign_template, &first, &expected));
+    aws_dsql_auth_presign_credentials_clean_up(&first);
+
+    aws_dsql_auth_credentials_fragment_cache_clean_up(&fragment_cache);
+    aws_byte_buf_clean_up(&expected);
+    aws_byte_buf_clean_up(&rotated_expected);
+    aws_credentials_release(credentials);
+    aws_credentials_release(rotated_credentials);
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that cached signing keys match freshly derived ones and are scoped to the date and region
+ */
+static int s_aws_dsql_auth_signing_key_cache_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+
+    struct aws_byte_cursor secret = aws_byte_cursor_from_c_str("secret");
+    struct aws_byte_cursor rotated_secret = aws_byte_cursor_from_c_str("rotated");
+    struct aws_byte_cursor region = aws_byte_cursor_from_c_str("us-east-1");
+    struct aws_byte_cursor day = aws_byte_cursor_from_c_str("20240827");
+    struct aws_byte_cursor next_day = aws_byte_cursor_from_c_str("20240828");
+
+    uint8_t first[AWS_DSQL_AUTH_SIGNING_KEY_LEN];
+    uint8_t second[AWS_DSQL_AUTH_SIGNING_KEY_LEN];
+    ASSERT_SUCCESS(aws_dsql_auth_signing_key_get(allocator, secret, region, day, first));
+    ASSERT_SUCCESS(aws_dsql_auth_signing_key_get(allocator, secret, region, day, second));
+    ASSERT_BIN_ARRAYS_EQUALS(first, sizeof(first), second, sizeof(second));
+
+    /* A new day, a new region or a rotated secret each get their own key */
+    uint8_t other[AWS_DSQL_AUTH_SIGNING_KEY_LEN];
+    ASSERT_SUCCESS(aws_dsql_auth_signing_key_get(allocator, secret, region, next_day, other));
+    ASSERT_FALSE(memcmp(first, other, sizeof(first)) == 0);
+
+    struct aws_byte_cursor other_region = aws_byte_cursor_from_c_str("eu-west-1");
+    ASSERT_SUCCESS(aws_dsql_auth_signing_key_get(allocator, secret, other_region, day, other));
+    ASSERT_FALSE(memcmp(first, other, sizeof(first)) == 0);
+
+    ASSERT_SUCCESS(aws_dsql_auth_signing_key_get(allocator, rotated_secret, region, day, other));
+    ASSERT_FALSE(memcmp(first, other, sizeof(first)) == 0);
+
+    /* The original key is still served after the others were cached */
+    ASSERT_SUCCESS(aws_dsql_auth_signing_key_get(allocator, secret, region, day, second));
+    ASSERT_BIN_ARRAYS_EQUALS(first, sizeof(first), second, sizeof(second));
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that a pair presigned in one pass matches the two tokens presigned separately
+ */
+static int s_aws_dsql_auth_presign_pair_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+
+    struct aws_byte_cursor hostname = aws_byte_cursor_from_c_str("peccy.dsql.us-east-1.on.aws");
+    struct aws_byte_cursor region = aws_byte_cursor_from_c_str("us-east-1");
+    const char *session_tokens[] = {"", "token", "IQoJb3JpZ2luX2VjE+/a=b&c=="};
+
+    struct aws_dsql_auth_presign_template connect_template;
+    struct aws_dsql_auth_presign_template admin_template;
+    ASSERT_SUCCESS(aws_dsql_auth_presign_template_init(
+        &connect_template, hostname, region, aws_byte_cursor_from_c_str("DbConnect"), 450));
+    ASSERT_SUCCESS(aws_dsql_auth_presign_template_init(
+        &admin_template, hostname, region, aws_byte_cursor_from_c_str("DbConnectAdmin"), 450));
+
+    for (size_t i = 0; i < AWS_ARRAY_SIZE(session_tokens); ++i) {
+        struct aws_credentials *credentials = aws_credentials_new(
+            allocator,
+            aws_byte_cursor_from_c_str("AKIDEXAMPLE"),
+            aws_byte_cursor_from_c_str("wJalrXUtnFEMI/K7MDENG+bPxRfiCYEXAMPLEKEY"),
+            aws_byte_cursor_from_c_str(session_tokens[i]),
+            UINT64_MAX);
+        ASSERT_NOT_NULL(credentials);
+
+        struct aws_dsql_auth_presign_credentials presign_credentials;
+        aws_dsql_auth_presign_credentials_init(&presign_credentials, credentials, NULL);
+
+        struct aws_byte_buf expected_connect;
+        struct aws_byte_buf expected_admin;
+        ASSERT_SUCCESS(aws_byte_buf_init(&expected_connect, allocator, 16));
+        ASSERT_SUCCESS(aws_byte_buf_init(&expected_admin, allocator, 16));
+        ASSERT_SUCCESS(aws_dsql_auth_presign_template_sign(
+            allocator, &connect_template, &presign_credentials, s_base_time_secs, &expected_connect));
+        ASSERT_SUCCESS(aws_dsql_auth_presign_template_sign(
+            allocator, &admin_template, &presign_credentials, s_base_time_secs, &expected_admin));
+
+        /* Either action can come first */
+        struct aws_byte_buf connect;
+        struct aws_byte_buf admin;
+        ASSERT_SUCCESS(aws_byte_buf_init(&connect, allocator, 16));
+        ASSERT_SUCCESS(aws_byte_buf_init(&admin, allocator, 16));
+        ASSERT_SUCCESS(aws_dsql_auth_presign_template_sign_pair(
+            allocator, &connect_template, &admin_template, &presign_credentials, s_base_time_secs, &connect, &admin));
+        ASSERT_BIN_ARRAYS_EQUALS(expected_connect.buffer, expected_connect.len, connect.buffer, connect.len);
+        ASSERT_BIN_ARRAYS_EQUALS(expected_admin.buffer, expected_admin.len, admin.buffer, admin.len);
+
+        aws_byte_buf_reset(&connect, false);
+        aws_byte_buf_reset(&admin, false);
+        ASSERT_SUCCESS(aws_dsql_auth_presign_template_sign_pair(
+            allocator, &admin_template, &connect_template, &presign_credentials, s_base_time_secs, &admin, &connect));
+        ASSERT_BIN_ARRAYS_EQUALS(expected_connect.buffer, expected_connect.len, connect.buffer, connect.len);
+        ASSERT_BIN_ARRAYS_EQUALS(expected_admin.buffer, expected_admin.len, admin.buffer, admin.len);
+
+        aws_byte_buf_clean_up(&admin);
+        aws_byte_buf_clean_up(&connect);
+        aws_byte_buf_clean_up(&expected_admin);
+        aws_byte_buf_clean_up(&expected_connect);
+        aws_dsql_auth_presign_credentials_clean_up(&presign_credentials);
+        aws_credentials_release(credentials);
+    }
+
+    /* Templates that differ in more than their action cannot share a pass, and leave both buffers alone */
+    struct aws_dsql_auth_presign_template other_template;
+    ASSERT_SUCCESS(aws_dsql_auth_presign_template_init(
+        &other_template, hostname, region, aws_byte_cursor_from_c_str("DbConnectAdmin"), 900));
+
+    struct aws_credentials *credentials = aws_credentials_new(
+        allocator,
+        aws_byte_cursor_from_c_str("AKIDEXAMPLE"),
+        aws_byte_cursor_from_c_str("wJalrXUtnFEMI/K7MDENG+bPxRfiCYEXAMPLEKEY"),
+        aws_byte_cursor_from_c_str("token"),
+        UINT64_MAX);
+    ASSERT_NOT_NULL(credentials);
+
+    struct aws_dsql_auth_presign_credentials presign_credentials;
+    aws_dsql_auth_presign_credentials_init(&presign_credentials, credentials, NULL);
+
+    struct aws_byte_buf connect;
+    struct aws_byte_buf admin;
+    ASSERT_SUCCESS(aws_byte_buf_init(&connect, allocator, 16));
+    ASSERT_SUCCESS(aws_byte_buf_init(&admin, allocator, 16));
+    ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT,
+        aws_dsql_auth_presign_template_sign_pair(
+            allocator, &connect_template, &other_template, &presign_credentials, s_base_time_secs, &connect, &admin));
+    ASSERT_UINT_EQUALS(0, connect.len);
+    ASSERT_UINT_EQUALS(0, admin.len);
+
+    aws_byte_buf_clean_up(&admin);
+    aws_byte_buf_clean_up(&connect);
+    aws_dsql_auth_presign_credentials_clean_up(&presign_credentials);
+    aws_credentials_release(credentials);
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that batches of every size, mixing clusters, regions, actions and expirations, match aws-c-auth's SigV4 signer
+ * byte for byte, whichever multi-buffer kernel the batch size picks, and that a failed batch writes nothing
+ */
+static int s_aws_dsql_auth_presign_batch_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+
+    const char *hostnames[] = {
+        "peccy.dsql.us-east-1.on.aws",
+        "abcdefghijklmnopqrstuvwxyz.dsql.us-east-1.on.aws",
+        "abcdefghijklmnopqrstuvwxyz.dsql.eu-west-1.on.aws",
+    };
+    const char *regions[] = {"us-east-1", "us-east-1", "eu-west-1"};
+    const char *actions[] = {"DbConnect", "DbConnectAdmin"};
+    const char *session_tokens[] = {"", "IQoJb3JpZ2luX2VjE+/a=b&c=="};
+
+    /* Runs of two templates per cluster, so that neighbors share a region some of the time */
+    struct aws_dsql_auth_presign_params params[AWS_DSQL_AUTH_PRESIGN_BATCH_MAX];
+    struct aws_dsql_auth_presign_template templates[AWS_DSQL_AUTH_PRESIGN_BATCH_MAX];
+    const struct aws_dsql_auth_presign_template *template_ptrs[AWS_DSQL_AUTH_PRESIGN_BATCH_MAX];
+    for (size_t i = 0; i < AWS_DSQL_AUTH_PRESIGN_BATCH_MAX; ++i) {
+        size_t cluster = (i / 2) % AWS_ARRAY_SIZE(hostnames);
+        params[i] = (struct aws_dsql_auth_presign_params){
+            .hostname = aws_byte_cursor_from_c_str(hostnames[cluster]),
+            .region = aws_byte_cursor_from_c_str(regions[cluster]),
+            .action = aws_byte_cursor_from_c_str(actions[i % 2]),
+            .expires_in = i % 3 == 0 ? 900 : 450,
+            .signing_time_secs = s_base_time_secs,
+        };
+        ASSERT_SUCCESS(aws_dsql_auth_presign_template_init(
+            &templates[i], params[i].hostname, params[i].region, params[i].action, params[i].expires_in));
+        template_ptrs[i] = &templates[i];
+    }
+
+    for (size_t t = 0; t < AWS_ARRAY_SIZE(session_tokens); ++t) {
+        struct aws_credentials *credentials = aws_credentials_new(
+            allocator,
+            aws_byte_cursor_from_c_str("AKIDEXAMPLE"),
+            aws_byte_cursor_from_c_str("wJalrXUtnFEMI/K7MDENG+bPxRfiCYEXAMPLEKEY"),
+            aws_byte_cursor_from_c_str(session_tokens[t]),
+            UINT64_MAX);
+        ASSERT_NOT_NULL(credentials);
+
+        struct aws_dsql_auth_presign_credentials presign_credentials;
+        aws_dsql_auth_presign_credentials_init(&presign_credentials, credentials, NULL);
+
+        struct aws_byte_buf expected[AWS_DSQL_AUTH_PRESIGN_BATCH_MAX];
+        for (size_t i = 0; i < AWS_DSQL_AUTH_PRESIGN_BATCH_MAX; ++i) {
+            params[i].credentials = credentials;
+            ASSERT_SUCCESS(aws_byte_buf_init(&expected[i], allocator, 256));
+            ASSERT_SUCCESS(s_reference_presign(allocator, &params[i], &expected[i]));
+        }
+
+        for (size_t count = 1; count <= AWS_DSQL_AUTH_PRESIGN_BATCH_MAX; ++count) {
+            struct aws_byte_buf tokens[AWS_DSQL_AUTH_PRESIGN_BATCH_MAX];
+            for (size_t i = 0; i < count; ++i) {
+                ASSERT_SUCCESS(aws_byte_buf_init(&tokens[i], allocator, 16));
+            }
+
+            ASSERT_SUCCESS(aws_dsql_auth_presign_template_sign_batch(
+                allocator, template_ptrs, count, &presign_credentials, s_base_time_secs, tokens));
+
+            for (size_t i = 0; i < count; ++i) {
+                ASSERT_BIN_ARRAYS_EQUALS(expected[i].buffer, expected[i].len, tokens[i].buffer, tokens[i].len);
+                aws_byte_buf_clean_up(&tokens[i]);
+            }
+        }
+
+        /* A fixed buffer too small for its token fails the whole batch and leaves every buffer alone */
+        struct aws_byte_buf tokens[AWS_DSQL_AUTH_PRESIGN_BATCH_MAX];
+        for (size_t i = 0; i < AWS_DSQL_AUTH_PRESIGN_BATCH_MAX - 1; ++i) {
+            ASSERT_SUCCESS(aws_byte_buf_init(&tokens[i], allocator, 16));
+        }
+        uint8_t short_storage[64];
+        tokens[AWS_DSQL_AUTH_PRESIGN_BATCH_MAX - 1] =
+            aws_byte_buf_from_empty_array(short_storage, sizeof(short_storage));
+        ASSERT_ERROR(
+            AWS_ERROR_SHORT_BUFFER,
+            aws_dsql_auth_presign_template_sign_batch(
+                allocator,
+                template_ptrs,
+                AWS_DSQL_AUTH_PRESIGN_BATCH_MAX,
+                &presign_credentials,
+                s_base_time_secs,
+                tokens));
+        for (size_t i = 0; i < AWS_DSQL_AUTH_PRESIGN_BATCH_MAX; ++i) {
+            ASSERT_UINT_EQUALS(0, tokens[i].len);
+        }
+        for (size_t i = 0; i < AWS_DSQL_AUTH_PRESIGN_BATCH_MAX - 1; ++i) {
+            aws_byte_buf_clean_up(&tokens[i]);
+        }
+
+        /* More templates than one pass signs are rejected */
+        ASSERT_ERROR(
+            AWS_ERROR_INVALID_ARGUMENT,
+            aws_dsql_auth_presign_template_sign_batch(
+                allocator,
+                template_ptrs,
+                AWS_DSQL_AUTH_PRESIGN_BATCH_MAX + 1,
+                &presign_credentials,
+                s_base_time_secs,
+                tokens));
+
+        for (size_t i = 0; i < AWS_DSQL_AUTH_PRESIGN_BATCH_MAX; ++i) {
+            aws_byte_buf_clean_up(&expected[i]);
+        }
+        aws_dsql_auth_presign_credentials_clean_up(&presign_credentials);
+        aws_credentials_release(credentials);
+    }
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+#ifndef _WIN32
+
+enum { SIGV4_FORK_COUNT = 50 };
+
+struct presign_worker {
+    struct aws_allocator *allocator;
+    struct aws_credentials *credentials;
+    struct aws_atomic_var stop;
+    struct aws_atomic_var presigns;
+    struct aws_thread thread;
+};
+
+/* Presign a token signed on a new day each time, so that every presign also updates the signing key cache */
+static int s_presign_for_day(struct aws_allocator *allocator, struct aws_credentials *credentials, uint64_t day) {
+    struct aws_dsql_auth_presign_params params = {
+        .hostname = aws_byte_cursor_from_c_str("peccy.dsql.us-east-1.on.aws"),
+        .region = aws_byte_cursor_from_c_str("us-east-1"),
+        .action = aws_byte_cursor_from_c_str("DbConnect"),
+        .credentials = credentials,
+        .signing_time_secs = s_base_time_secs + day * 86400,
+    };
+
+    struct aws_byte_buf token;
+    if (aws_byte_buf_init(&token, allocator, 512)) {
+        return AWS_OP_ERR;
+    }
+    int result = aws_dsql_auth_presign(allocator, &params, &token);
+    aws_byte_buf_clean_up(&token);
+
+    return result;
+}
+
+static void s_presign_worker_fn(void *arg) {
+    struct presign_worker *worker = arg;
+
+    for (uint64_t day = 0; !aws_atomic_load_int(&worker->stop); ++day) {
+        if (s_presign_for_day(worker->allocator, worker->credentials, day) == AWS_OP_SUCCESS) {
+            aws_atomic_fetch_add(&worker->presigns, 1);
+        }
+    }
+}
+
+/**
+ * Test that a child forked while another thread is presigning can presign too, rather than inheriting a cache lock
+ * that thread held
+ */
+static int s_aws_dsql_auth_presign_fork_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+
+    struct presign_worker worker = {.allocator = allocator};
+    worker.credentials = aws_credentials_new(
+        allocator,
+        aws_byte_cursor_from_c_str("AKIDEXAMPLE"),
+        aws_byte_cursor_from_c_str("wJalrXUtnFEMI/K7MDENG+bPxRfiCYEXAMPLEKEY"),
+        aws_byte_cursor_from_c_str("token"),
+        UINT64_MAX);
+    ASSERT_NOT_NULL(worker.credentials);
+    aws_atomic_init_int(&worker.stop, 0);
+    aws_atomic_init_int(&worker.presigns, 0);
+
+    ASSERT_SUCCESS(aws_thread_init(&worker.thread, allocator));
+    ASSERT_SUCCESS(aws_thread_launch(&worker.thread, s_presign_worker_fn, &worker, aws_default_thread_options()));
+    while (aws_atomic_load_int(&worker.presigns) == 0) {
+        aws_thread_current_sleep(100000);
+    }
+
+    for (int i = 0; i < SIGV4_FORK_COUNT; ++i) {
+        pid_t pid = fork();
+        ASSERT_TRUE(pid >= 0);
+        if (pid == 0) {
+            _exit(s_presign_for_day(allocator, worker.credentials, 1000 + (uint64_t)i) == AWS_OP_SUCCESS ? 0 : 1);
+        }
+
+        int status = 0;
+        ASSERT_INT_EQUALS(pid, waitpid(pid, &status, 0));
+        ASSERT_TRUE(WIFEXITED(status));
+        ASSERT_INT_EQUALS(0, WEXITSTATUS(status));
+    }
+
+    aws_atomic_store_int(&worker.stop, 1);
+    ASSERT_SUCCESS(aws_thread_join(&worker.thread));
+    aws_thread_clean_up(&worker.thread);
+    aws_credentials_release(worker.credentials);
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+#endif /* _WIN32 */
+
+AWS_TEST_CASE(aws_dsql_auth_presign_matches_signer_test, s_aws_dsql_auth_presign_matches_signer_test);
+AWS_TEST_CASE(aws_dsql_auth_presign_credentials_cache_test, s_aws_dsql_auth_presign_credentials_cache_test);
+AWS_TEST_CASE(aws_dsql_auth_presign_fragment_cache_test, s_aws_dsql_auth_presign_fragment_cache_test);
+AWS_TEST_CASE(aws_dsql_auth_signing_key_cache_test, s_aws_dsql_auth_signing_key_cache_test);
+AWS_TEST_CASE(aws_dsql_auth_presign_pair_test, s_aws_dsql_auth_presign_pair_test);
+AWS_TEST_CASE(aws_dsql_auth_presign_batch_test, s_aws_dsql_auth_presign_batch_test);
+#ifndef _WIN32
+AWS_TEST_CASE(aws_dsql_auth_presign_fork_test, s_aws_dsql_auth_presign_fork_test);
+#endif
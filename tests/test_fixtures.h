@@ -0,0 +1,57 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+
+#ifndef AWS_DSQL_AUTH_TESTS_TEST_FIXTURES_H
+#define AWS_DSQL_AUTH_TESTS_TEST_FIXTURES_H
+
+#include <aws/testing/aws_test_harness.h>
+
+#include <aws/auth/credentials.h>
+#include <aws/common/string.h>
+#include <aws/dsql-auth/auth_token.h>
+#include <aws/io/io.h>
+
+/* The credentials and cluster the tests generate tokens for */
+AWS_STATIC_STRING_FROM_LITERAL(s_access_key_id, "akid");
+AWS_STATIC_STRING_FROM_LITERAL(s_secret_access_key, "secret");
+AWS_STATIC_STRING_FROM_LITERAL(s_session_token, "token");
+AWS_STATIC_STRING_FROM_LITERAL(s_hostname, "peccy.dsql.us-east-1.on.aws");
+AWS_STATIC_STRING_FROM_LITERAL(s_region, "us-east-1");
+
+/* August 27, 2024 at 00:00:00 UTC, in nanoseconds */
+static const uint64_t s_base_time_ns = 1724716800ULL * 1000000000ULL;
+
+/**
+ * Create a static credentials provider for the test credentials
+ */
+static inline struct aws_credentials_provider *s_create_test_credentials_provider(struct aws_allocator *allocator) {
+    struct aws_credentials_provider_static_options options = {
+        .access_key_id = aws_byte_cursor_from_string(s_access_key_id),
+        .secret_access_key = aws_byte_cursor_from_string(s_secret_access_key),
+        .session_token = aws_byte_cursor_from_string(s_session_token)};
+
+    return aws_credentials_provider_new_static(allocator, &options);
+}
+
+/**
+ * Set up a config for the test cluster, signing with the given provider at the time system_clock_fn reports
+ */
+static inline int s_setup_auth_config(
+    struct aws_dsql_auth_config *config,
+    struct aws_credentials_provider *credentials_provider,
+    uint64_t expires_in,
+    aws_io_clock_fn *system_clock_fn) {
+
+    ASSERT_SUCCESS(aws_dsql_auth_config_init(config));
+    aws_dsql_auth_config_set_hostname(config, aws_string_c_str(s_hostname));
+    aws_dsql_auth_config_set_region(config, (struct aws_string *)s_region); /* Cast away const */
+    aws_dsql_auth_config_set_expires_in(config, expires_in);
+    aws_dsql_auth_config_set_credentials_provider(config, credentials_provider);
+    config->system_clock_fn = system_clock_fn;
+
+    return AWS_OP_SUCCESS;
+}
+
+#endif /* AWS_DSQL_AUTH_TESTS_TEST_FIXTURES_H */
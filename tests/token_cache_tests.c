@@ -0,0 +1,1202 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+
+#include "test_fixtures.h"
+
+#include <aws/auth/auth.h>
+#include <aws/auth/credentials.h>
+#include <aws/common/atomics.h>
+#include <aws/common/thread.h>
+#include <aws/dsql-auth/credentials_snapshot.h>
+#include <aws/dsql-auth/metrics.h>
+#include <aws/dsql-auth/token_cache.h>
+#include <aws/io/event_loop.h>
+#include <string.h>
+
+#ifndef _WIN32
+#    include <sys/wait.h>
+#    include <unistd.h>
+#endif
+
+/* Mock time functions */
+static struct aws_mutex s_cache_clock_sync = AWS_MUTEX_INIT;
+static uint64_t s_cache_clock_time = 0;
+
+static int s_mock_cache_get_system_time(uint64_t *current_time) {
+    aws_mutex_lock(&s_cache_clock_sync);
+    *current_time = s_cache_clock_time;
+    aws_mutex_unlock(&s_cache_clock_sync);
+    return AWS_OP_SUCCESS;
+}
+
+static void s_mock_cache_set_system_time(uint64_t current_time) {
+    aws_mutex_lock(&s_cache_clock_sync);
+    s_cache_clock_time = current_time;
+    aws_mutex_unlock(&s_cache_clock_sync);
+}
+
+/**
+ * Test that a cache hit returns the same token as direct generation, and that admin tokens are cached separately
+ */
+static int s_aws_dsql_auth_token_cache_hit_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+    s_mock_cache_set_system_time(s_base_time_ns);
+
+    struct aws_credentials_provider *credentials_provider = s_create_test_credentials_provider(allocator);
+    ASSERT_NOT_NULL(credentials_provider);
+
+    struct aws_dsql_auth_config config;
+    ASSERT_SUCCESS(s_setup_auth_config(&config, credentials_provider, 450, s_mock_cache_get_system_time));
+
+    struct aws_dsql_auth_token_cache *cache = aws_dsql_auth_token_cache_new(allocator, NULL);
+    ASSERT_NOT_NULL(cache);
+
+    struct aws_dsql_auth_token expected = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_generate(&config, false, allocator, &expected));
+
+    struct aws_dsql_auth_token first = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &first));
+    ASSERT_STR_EQUALS(aws_dsql_auth_token_get_str(&expected), aws_dsql_auth_token_get_str(&first));
+
+    /* A minute later the cached token is still served as-is */
+    s_mock_cache_set_system_time(s_base_time_ns + 60ULL * 1000000000ULL);
+
+    struct aws_dsql_auth_token second = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &second));
+    ASSERT_STR_EQUALS(aws_dsql_auth_token_get_str(&first), aws_dsql_auth_token_get_str(&second));
+
+    /* Hits carry the times the token was generated with, not the time of the lookup */
+    ASSERT_UINT_EQUALS(
+        aws_dsql_auth_token_get_issued_timepoint_seconds(&expected),
+        aws_dsql_auth_token_get_issued_timepoint_seconds(&second));
+    ASSERT_UINT_EQUALS(
+        aws_dsql_auth_token_get_expiration_timepoint_seconds(&expected),
+        aws_dsql_auth_token_get_expiration_timepoint_seconds(&second));
+
+    /* Admin tokens are a different key */
+    struct aws_dsql_auth_token admin = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, true, allocator, &admin));
+    ASSERT_NOT_NULL(strstr(aws_dsql_auth_token_get_str(&admin), "Action=DbConnectAdmin&"));
+
+    aws_dsql_auth_token_clean_up(&admin);
+    aws_dsql_auth_token_clean_up(&second);
+    aws_dsql_auth_token_clean_up(&first);
+    aws_dsql_auth_token_clean_up(&expected);
+    aws_dsql_auth_token_cache_release(cache);
+    aws_dsql_auth_config_clean_up(&config);
+    aws_credentials_provider_release(credentials_provider);
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that shared gets hand out one allocation per cached token, which outlives its replacement and the cache
+ */
+static int s_aws_dsql_auth_token_cache_shared_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+    s_mock_cache_set_system_time(s_base_time_ns);
+
+    struct aws_credentials_provider *credentials_provider = s_create_test_credentials_provider(allocator);
+    ASSERT_NOT_NULL(credentials_provider);
+
+    struct aws_dsql_auth_config config;
+    ASSERT_SUCCESS(s_setup_auth_config(&config, credentials_provider, 450, s_mock_cache_get_system_time));
+
+    struct aws_dsql_auth_token_cache *cache = aws_dsql_auth_token_cache_new(allocator, NULL);
+    ASSERT_NOT_NULL(cache);
+
+    struct aws_dsql_auth_shared_token *first = NULL;
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get_shared(cache, &config, false, &first));
+    struct aws_dsql_auth_shared_token *second = NULL;
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get_shared(cache, &config, false, &second));
+    ASSERT_PTR_EQUALS(first, second);
+
+    /* A plain get copies the same token */
+    struct aws_dsql_auth_token copy = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &copy));
+    const struct aws_dsql_auth_token *shared_token = aws_dsql_auth_shared_token_get_token(first);
+    ASSERT_STR_EQUALS(aws_dsql_auth_token_get_str(&copy), aws_dsql_auth_token_get_str(shared_token));
+
+    /* Past expiry the cache replaces the token, and the old one stays readable for the callers still holding it */
+    s_mock_cache_set_system_time(s_base_time_ns + 450ULL * 1000000000ULL);
+
+    struct aws_dsql_auth_shared_token *replaced = NULL;
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get_shared(cache, &config, false, &replaced));
+    ASSERT_TRUE(first != replaced);
+    ASSERT_NOT_NULL(
+        strstr(aws_dsql_auth_token_get_str(aws_dsql_auth_shared_token_get_token(replaced)), "20240827T000730Z"));
+    ASSERT_STR_EQUALS(aws_dsql_auth_token_get_str(&copy), aws_dsql_auth_token_get_str(shared_token));
+
+    aws_dsql_auth_shared_token_release(second);
+    aws_dsql_auth_token_cache_release(cache);
+    ASSERT_STR_EQUALS(aws_dsql_auth_token_get_str(&copy), aws_dsql_auth_token_get_str(shared_token));
+
+    aws_dsql_auth_shared_token_release(replaced);
+    aws_dsql_auth_shared_token_release(first);
+    aws_dsql_auth_token_clean_up(&copy);
+    aws_dsql_auth_config_clean_up(&config);
+    aws_credentials_provider_release(credentials_provider);
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that tokens put back together from the cache's compact form match direct generation, whichever get hands them
+ * out, and that tokens signed with the same credentials hold their security token once
+ */
+static int s_aws_dsql_auth_token_cache_compact_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+    s_mock_cache_set_system_time(s_base_time_ns);
+
+    struct aws_credentials_provider *credentials_provider = s_create_test_credentials_provider(allocator);
+    ASSERT_NOT_NULL(credentials_provider);
+
+    struct aws_dsql_auth_config config;
+    ASSERT_SUCCESS(s_setup_auth_config(&config, credentials_provider, 450, s_mock_cache_get_system_time));
+
+    struct aws_dsql_auth_token_cache *cache = aws_dsql_auth_token_cache_new(allocator, NULL);
+    ASSERT_NOT_NULL(cache);
+
+    struct aws_dsql_auth_metrics before;
+    aws_dsql_auth_metrics_snapshot(&before);
+
+    struct aws_dsql_auth_token direct = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_generate(&config, false, allocator, &direct));
+    struct aws_dsql_auth_token cached = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &cached));
+    ASSERT_STR_EQUALS(aws_dsql_auth_token_get_str(&direct), aws_dsql_auth_token_get_str(&cached));
+    ASSERT_UINT_EQUALS(direct.issued_at_secs, cached.issued_at_secs);
+    ASSERT_UINT_EQUALS(direct.expires_at_secs, cached.expires_at_secs);
+
+    /* A hit into a buffer writes the same token, and a buffer too small is left untouched */
+    size_t token_len = strlen(aws_dsql_auth_token_get_str(&direct));
+    uint8_t storage[1024];
+    struct aws_byte_buf output = aws_byte_buf_from_empty_array(storage, token_len - 1);
+    size_t required_len = 0;
+    ASSERT_FAILS(aws_dsql_auth_token_cache_get_into_buf(cache, &config, false, &output, &required_len));
+    ASSERT_INT_EQUALS(AWS_ERROR_SHORT_BUFFER, aws_last_error());
+    ASSERT_UINT_EQUALS(token_len, required_len);
+    ASSERT_UINT_EQUALS(0, output.len);
+
+    output = aws_byte_buf_from_empty_array(storage, sizeof(storage));
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get_into_buf(cache, &config, false, &output, &required_len));
+    ASSERT_BIN_ARRAYS_EQUALS(aws_dsql_auth_token_get_str(&direct), token_len, output.buffer, output.len);
+
+    struct aws_dsql_auth_shared_token *shared_token = NULL;
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get_shared(cache, &config, false, &shared_token));
+    ASSERT_STR_EQUALS(
+        aws_dsql_auth_token_get_str(&direct),
+        aws_dsql_auth_token_get_str(aws_dsql_auth_shared_token_get_token(shared_token)));
+    aws_dsql_auth_shared_token_release(shared_token);
+
+    /* The admin token shares the regular token's security token, so the cache holds it once */
+    struct aws_dsql_auth_token admin = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, true, allocator, &admin));
+    size_t admin_len = strlen(aws_dsql_auth_token_get_str(&admin));
+
+    struct aws_dsql_auth_metrics during;
+    aws_dsql_auth_metrics_snapshot(&during);
+    ASSERT_UINT_EQUALS(before.token_cache_misses + 2, during.token_cache_misses);
+    ASSERT_UINT_EQUALS(before.token_cache_hits + 3, during.token_cache_hits);
+    /* Both compact tokens, the security token once, and the shared get's materialized token */
+    ASSERT_UINT_EQUALS(
+        before.token_cache_bytes + token_len + admin_len - s_session_token->len + token_len,
+        during.token_cache_bytes);
+
+    aws_dsql_auth_token_clean_up(&admin);
+    aws_dsql_auth_token_clean_up(&cached);
+    aws_dsql_auth_token_clean_up(&direct);
+    aws_dsql_auth_token_cache_release(cache);
+    aws_dsql_auth_config_clean_up(&config);
+    aws_credentials_provider_release(credentials_provider);
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Records the tokens a cache evicts */
+struct eviction_record {
+    size_t count;
+    char last_hostname[64];
+    struct aws_credentials_provider *last_credentials_provider;
+};
+
+static void s_on_eviction(const struct aws_dsql_auth_token_cache_eviction *eviction, void *user_data) {
+    struct eviction_record *record = user_data;
+
+    ++record->count;
+    strncpy(record->last_hostname, eviction->hostname, sizeof(record->last_hostname) - 1);
+    record->last_credentials_provider = eviction->credentials_provider;
+}
+
+static const char *s_eviction_hostnames[] = {
+    "cluster1.dsql.us-east-1.on.aws",
+    "cluster2.dsql.us-east-1.on.aws",
+    "cluster3.dsql.us-east-1.on.aws",
+};
+
+/**
+ * Test that a cache over its entry or byte budget evicts tokens, reports them, and generates them again on the next
+ * get
+ */
+static int s_aws_dsql_auth_token_cache_eviction_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+    s_mock_cache_set_system_time(s_base_time_ns);
+
+    struct aws_credentials_provider *credentials_provider = s_create_test_credentials_provider(allocator);
+    ASSERT_NOT_NULL(credentials_provider);
+
+    struct aws_dsql_auth_config config;
+    ASSERT_SUCCESS(s_setup_auth_config(&config, credentials_provider, 450, s_mock_cache_get_system_time));
+
+    struct eviction_record record;
+    AWS_ZERO_STRUCT(record);
+    struct aws_dsql_auth_token_cache_options options = {
+        .max_entries = 2,
+        .on_eviction = s_on_eviction,
+        .on_eviction_user_data = &record,
+    };
+    struct aws_dsql_auth_token_cache *cache = aws_dsql_auth_token_cache_new(allocator, &options);
+    ASSERT_NOT_NULL(cache);
+
+    struct aws_dsql_auth_metrics before;
+    aws_dsql_auth_metrics_snapshot(&before);
+
+    struct aws_dsql_auth_token token = {0};
+    for (size_t i = 0; i < AWS_ARRAY_SIZE(s_eviction_hostnames); ++i) {
+        aws_dsql_auth_config_set_hostname(&config, s_eviction_hostnames[i]);
+        ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &token));
+        ASSERT_NOT_NULL(strstr(aws_dsql_auth_token_get_str(&token), s_eviction_hostnames[i]));
+    }
+
+    /* The third token pushed one of the first two out */
+    ASSERT_UINT_EQUALS(1, record.count);
+    ASSERT_PTR_EQUALS(credentials_provider, record.last_credentials_provider);
+    ASSERT_TRUE(
+        strcmp(record.last_hostname, s_eviction_hostnames[0]) == 0 ||
+        strcmp(record.last_hostname, s_eviction_hostnames[1]) == 0);
+
+    struct aws_dsql_auth_metrics during;
+    aws_dsql_auth_metrics_snapshot(&during);
+    ASSERT_UINT_EQUALS(before.token_cache_evictions + 1, during.token_cache_evictions);
+    ASSERT_UINT_EQUALS(before.token_cache_entries + 2, during.token_cache_entries);
+
+    /* The evicted token is generated again, which evicts another */
+    char evicted_hostname[64];
+    strcpy(evicted_hostname, record.last_hostname);
+    aws_dsql_auth_config_set_hostname(&config, evicted_hostname);
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &token));
+    ASSERT_NOT_NULL(strstr(aws_dsql_auth_token_get_str(&token), evicted_hostname));
+
+    struct aws_dsql_auth_metrics after;
+    aws_dsql_auth_metrics_snapshot(&after);
+    ASSERT_UINT_EQUALS(during.token_cache_misses + 1, after.token_cache_misses);
+    ASSERT_UINT_EQUALS(2, record.count);
+    ASSERT_TRUE(strcmp(evicted_hostname, record.last_hostname) != 0);
+
+    aws_dsql_auth_token_cache_release(cache);
+
+    /* A byte budget of one and a half tokens holds a single token */
+    size_t token_len = strlen(aws_dsql_auth_token_get_str(&token));
+    struct aws_dsql_auth_token_cache_options byte_options = {
+        .max_bytes = token_len + token_len / 2,
+        .on_eviction = s_on_eviction,
+        .on_eviction_user_data = &record,
+    };
+    cache = aws_dsql_auth_token_cache_new(allocator, &byte_options);
+    ASSERT_NOT_NULL(cache);
+
+    AWS_ZERO_STRUCT(record);
+    aws_dsql_auth_config_set_hostname(&config, s_eviction_hostnames[0]);
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &token));
+    ASSERT_UINT_EQUALS(0, record.count);
+    aws_dsql_auth_config_set_hostname(&config, s_eviction_hostnames[1]);
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &token));
+    ASSERT_UINT_EQUALS(1, record.count);
+    ASSERT_STR_EQUALS(s_eviction_hostnames[0], record.last_hostname);
+
+    aws_dsql_auth_token_clean_up(&token);
+    aws_dsql_auth_token_cache_release(cache);
+    aws_dsql_auth_config_clean_up(&config);
+    aws_credentials_provider_release(credentials_provider);
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+static struct aws_credentials_provider *s_create_long_session_token_provider(
+    struct aws_allocator *allocator,
+    char fill,
+    size_t len) {
+
+    char session_token[4096];
+    AWS_FATAL_ASSERT(len <= sizeof(session_token));
+    memset(session_token, fill, len);
+
+    struct aws_credentials_provider_static_options options = {
+        .access_key_id = aws_byte_cursor_from_string(s_access_key_id),
+        .secret_access_key = aws_byte_cursor_from_string(s_secret_access_key),
+        .session_token = aws_byte_cursor_from_array(session_token, len)};
+
+    return aws_credentials_provider_new_static(allocator, &options);
+}
+
+static const char *s_shared_fragment_hostnames[] = {
+    "cluster1.dsql.us-east-1.on.aws",
+    "cluster2.dsql.us-east-1.on.aws",
+    "cluster3.dsql.us-east-1.on.aws",
+    "cluster4.dsql.us-east-1.on.aws",
+    "cluster5.dsql.us-east-1.on.aws",
+    "cluster6.dsql.us-east-1.on.aws",
+};
+
+/* Fill a cache with two tokens sharing a long security token and three with the short test one */
+static int s_fill_shared_fragment_cache(
+    struct aws_allocator *allocator,
+    struct aws_dsql_auth_token_cache *cache,
+    struct aws_dsql_auth_config *config,
+    struct aws_credentials_provider *shared_provider,
+    struct aws_credentials_provider *short_provider) {
+
+    struct aws_dsql_auth_token token = {0};
+    for (size_t i = 0; i < 5; ++i) {
+        aws_dsql_auth_config_set_credentials_provider(config, i < 2 ? shared_provider : short_provider);
+        aws_dsql_auth_config_set_hostname(config, s_shared_fragment_hostnames[i]);
+        ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, config, false, allocator, &token));
+        aws_dsql_auth_token_clean_up(&token);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that an eviction sweep gives back a security token once it took out every entry sharing it, and stops evicting
+ * as soon as that brings the cache back within its byte budget
+ */
+static int s_aws_dsql_auth_token_cache_eviction_shared_fragment_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+    s_mock_cache_set_system_time(s_base_time_ns);
+
+    struct aws_credentials_provider *shared_provider = s_create_long_session_token_provider(allocator, 'a', 4000);
+    ASSERT_NOT_NULL(shared_provider);
+    struct aws_credentials_provider *short_provider = s_create_test_credentials_provider(allocator);
+    ASSERT_NOT_NULL(short_provider);
+    struct aws_credentials_provider *new_provider = s_create_long_session_token_provider(allocator, 'b', 3000);
+    ASSERT_NOT_NULL(new_provider);
+
+    struct aws_dsql_auth_config config;
+    ASSERT_SUCCESS(s_setup_auth_config(&config, short_provider, 450, s_mock_cache_get_system_time));
+
+    /* Measure what the first five tokens take, and give the cache exactly that */
+    struct aws_dsql_auth_metrics before;
+    aws_dsql_auth_metrics_snapshot(&before);
+    struct aws_dsql_auth_token_cache *cache = aws_dsql_auth_token_cache_new(allocator, NULL);
+    ASSERT_NOT_NULL(cache);
+    ASSERT_SUCCESS(s_fill_shared_fragment_cache(allocator, cache, &config, shared_provider, short_provider));
+    struct aws_dsql_auth_metrics filled;
+    aws_dsql_auth_metrics_snapshot(&filled);
+    aws_dsql_auth_token_cache_release(cache);
+
+    struct eviction_record record;
+    AWS_ZERO_STRUCT(record);
+    struct aws_dsql_auth_token_cache_options options = {
+        .max_bytes = filled.token_cache_bytes - before.token_cache_bytes,
+        .on_eviction = s_on_eviction,
+        .on_eviction_user_data = &record,
+    };
+    cache = aws_dsql_auth_token_cache_new(allocator, &options);
+    ASSERT_NOT_NULL(cache);
+    ASSERT_SUCCESS(s_fill_shared_fragment_cache(allocator, cache, &config, shared_provider, short_provider));
+    ASSERT_UINT_EQUALS(0, record.count);
+
+    /*
+     * The sixth token brings its own long security token, which only taking out both tokens sharing the first long
+     * one makes room for. The sweep stops right after the second of them, whatever order it reaches the entries in.
+     */
+    aws_dsql_auth_config_set_credentials_provider(&config, new_provider);
+    aws_dsql_auth_config_set_hostname(&config, s_shared_fragment_hostnames[5]);
+    struct aws_dsql_auth_token token = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &token));
+    aws_dsql_auth_token_clean_up(&token);
+
+    ASSERT_TRUE(record.count >= 2);
+    ASSERT_TRUE(
+        strcmp(record.last_hostname, s_shared_fragment_hostnames[0]) == 0 ||
+        strcmp(record.last_hostname, s_shared_fragment_hostnames[1]) == 0);
+
+    struct aws_dsql_auth_metrics after;
+    aws_dsql_auth_metrics_snapshot(&after);
+    ASSERT_UINT_EQUALS(before.token_cache_entries + 6 - record.count, after.token_cache_entries);
+
+    aws_dsql_auth_token_cache_release(cache);
+    aws_dsql_auth_config_clean_up(&config);
+    aws_credentials_provider_release(new_provider);
+    aws_credentials_provider_release(short_provider);
+    aws_credentials_provider_release(shared_provider);
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that a token inside the refresh-ahead window is still served while a replacement is generated in the
+ * background
+ */
+static int s_aws_dsql_auth_token_cache_refresh_ahead_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+    s_mock_cache_set_system_time(s_base_time_ns);
+
+    struct aws_credentials_provider *credentials_provider = s_create_test_credentials_provider(allocator);
+    ASSERT_NOT_NULL(credentials_provider);
+
+    struct aws_dsql_auth_config config;
+    ASSERT_SUCCESS(s_setup_auth_config(&config, credentials_provider, 450, s_mock_cache_get_system_time));
+
+    struct aws_dsql_auth_token_cache_options options = {.refresh_ahead_seconds = 60};
+    struct aws_dsql_auth_token_cache *cache = aws_dsql_auth_token_cache_new(allocator, &options);
+    ASSERT_NOT_NULL(cache);
+
+    struct aws_dsql_auth_token original = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &original));
+
+    /* 30 seconds of validity left: inside the refresh window, but still enough to be handed out */
+    s_mock_cache_set_system_time(s_base_time_ns + 420ULL * 1000000000ULL);
+
+    struct aws_dsql_auth_token token = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &token));
+    ASSERT_STR_EQUALS(aws_dsql_auth_token_get_str(&original), aws_dsql_auth_token_get_str(&token));
+
+    /* Wait for the background refresh to land */
+    bool refreshed = false;
+    for (int i = 0; i < 1000 && !refreshed; ++i) {
+        ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &token));
+        refreshed = strstr(aws_dsql_auth_token_get_str(&token), "X-Amz-Date=20240827T000700Z") != NULL;
+        if (!refreshed) {
+            aws_thread_current_sleep(1000000);
+        }
+    }
+    ASSERT_TRUE(refreshed);
+
+    aws_dsql_auth_token_clean_up(&token);
+    aws_dsql_auth_token_clean_up(&original);
+    aws_dsql_auth_token_cache_release(cache);
+    aws_dsql_auth_config_clean_up(&config);
+    aws_credentials_provider_release(credentials_provider);
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that a cache with an event loop group refreshes ahead of expiry on the group rather than on refresh threads
+ */
+static int s_aws_dsql_auth_token_cache_event_loop_refresh_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+    s_mock_cache_set_system_time(s_base_time_ns);
+
+    struct aws_credentials_provider *credentials_provider = s_create_test_credentials_provider(allocator);
+    ASSERT_NOT_NULL(credentials_provider);
+
+    struct aws_dsql_auth_config config;
+    ASSERT_SUCCESS(s_setup_auth_config(&config, credentials_provider, 450, s_mock_cache_get_system_time));
+
+    struct aws_event_loop_group *event_loop_group = aws_event_loop_group_new_default(allocator, 2, NULL);
+    ASSERT_NOT_NULL(event_loop_group);
+
+    struct aws_dsql_auth_token_cache_options options = {
+        .refresh_ahead_seconds = 60,
+        .event_loop_group = event_loop_group,
+    };
+    struct aws_dsql_auth_token_cache *cache = aws_dsql_auth_token_cache_new(allocator, &options);
+    ASSERT_NOT_NULL(cache);
+
+    /* The cache holds its own reference to the group */
+    aws_event_loop_group_release(event_loop_group);
+
+    struct aws_dsql_auth_token original = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &original));
+
+    struct aws_dsql_auth_metrics before;
+    aws_dsql_auth_metrics_snapshot(&before);
+
+    s_mock_cache_set_system_time(s_base_time_ns + 420ULL * 1000000000ULL);
+
+    struct aws_dsql_auth_token token = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &token));
+    ASSERT_STR_EQUALS(aws_dsql_auth_token_get_str(&original), aws_dsql_auth_token_get_str(&token));
+
+    bool refreshed = false;
+    for (int i = 0; i < 1000 && !refreshed; ++i) {
+        ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &token));
+        refreshed = strstr(aws_dsql_auth_token_get_str(&token), "X-Amz-Date=20240827T000700Z") != NULL;
+        if (!refreshed) {
+            aws_thread_current_sleep(1000000);
+        }
+    }
+    ASSERT_TRUE(refreshed);
+
+    struct aws_dsql_auth_metrics after;
+    aws_dsql_auth_metrics_snapshot(&after);
+    ASSERT_UINT_EQUALS(before.token_cache_refreshes + 1, after.token_cache_refreshes);
+    ASSERT_UINT_EQUALS(before.token_cache_refresh_failures, after.token_cache_refresh_failures);
+
+    aws_dsql_auth_token_clean_up(&token);
+    aws_dsql_auth_token_clean_up(&original);
+    aws_dsql_auth_token_cache_release(cache);
+    aws_dsql_auth_config_clean_up(&config);
+    aws_credentials_provider_release(credentials_provider);
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that a jittered refresh never starts earlier than the capped jitter allows, nor later than the refresh-ahead
+ * window, with several refresh threads running
+ */
+static int s_aws_dsql_auth_token_cache_refresh_jitter_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+    s_mock_cache_set_system_time(s_base_time_ns);
+
+    struct aws_credentials_provider *credentials_provider = s_create_test_credentials_provider(allocator);
+    ASSERT_NOT_NULL(credentials_provider);
+
+    struct aws_dsql_auth_config config;
+    ASSERT_SUCCESS(s_setup_auth_config(&config, credentials_provider, 450, s_mock_cache_get_system_time));
+
+    /* The jitter is capped at half of the 350 seconds before the window, so the refresh starts 175 to 350 seconds in */
+    struct aws_dsql_auth_token_cache_options options = {
+        .refresh_ahead_seconds = 100,
+        .refresh_jitter_seconds = 1000,
+        .max_concurrent_refreshes = 4,
+    };
+    struct aws_dsql_auth_token_cache *cache = aws_dsql_auth_token_cache_new(allocator, &options);
+    ASSERT_NOT_NULL(cache);
+
+    struct aws_dsql_auth_token original = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &original));
+
+    struct aws_dsql_auth_metrics before;
+    aws_dsql_auth_metrics_snapshot(&before);
+
+    s_mock_cache_set_system_time(s_base_time_ns + 174ULL * 1000000000ULL);
+    struct aws_dsql_auth_token token = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &token));
+    aws_thread_current_sleep(10000000);
+
+    struct aws_dsql_auth_metrics after;
+    aws_dsql_auth_metrics_snapshot(&after);
+    ASSERT_UINT_EQUALS(before.token_cache_refreshes, after.token_cache_refreshes);
+
+    /* At the start of the refresh-ahead window the refresh is due whatever the jitter */
+    s_mock_cache_set_system_time(s_base_time_ns + 350ULL * 1000000000ULL);
+
+    bool refreshed = false;
+    for (int i = 0; i < 1000 && !refreshed; ++i) {
+        ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &token));
+        refreshed = strstr(aws_dsql_auth_token_get_str(&token), "X-Amz-Date=20240827T000550Z") != NULL;
+        if (!refreshed) {
+            aws_thread_current_sleep(1000000);
+        }
+    }
+    ASSERT_TRUE(refreshed);
+
+    aws_dsql_auth_token_clean_up(&token);
+    aws_dsql_auth_token_clean_up(&original);
+    aws_dsql_auth_token_cache_release(cache);
+    aws_dsql_auth_config_clean_up(&config);
+    aws_credentials_provider_release(credentials_provider);
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that a token too close to expiry is regenerated synchronously instead of being handed out
+ */
+static int s_aws_dsql_auth_token_cache_expired_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+    s_mock_cache_set_system_time(s_base_time_ns);
+
+    struct aws_credentials_provider *credentials_provider = s_create_test_credentials_provider(allocator);
+    ASSERT_NOT_NULL(credentials_provider);
+
+    struct aws_dsql_auth_config config;
+    ASSERT_SUCCESS(s_setup_auth_config(&config, credentials_provider, 450, s_mock_cache_get_system_time));
+
+    struct aws_dsql_auth_token_cache *cache = aws_dsql_auth_token_cache_new(allocator, NULL);
+    ASSERT_NOT_NULL(cache);
+
+    struct aws_dsql_auth_token token = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &token));
+    ASSERT_NOT_NULL(strstr(aws_dsql_auth_token_get_str(&token), "X-Amz-Date=20240827T000000Z"));
+
+    /* Past expiry the next get must not return the stale token */
+    s_mock_cache_set_system_time(s_base_time_ns + 600ULL * 1000000000ULL);
+
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &token));
+    ASSERT_NOT_NULL(strstr(aws_dsql_auth_token_get_str(&token), "X-Amz-Date=20240827T001000Z"));
+
+    aws_dsql_auth_token_clean_up(&token);
+    aws_dsql_auth_token_cache_release(cache);
+    aws_dsql_auth_config_clean_up(&config);
+    aws_credentials_provider_release(credentials_provider);
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+enum { CONCURRENT_READER_COUNT = 8 };
+
+struct concurrent_reader {
+    struct aws_allocator *allocator;
+    struct aws_dsql_auth_token_cache *cache;
+    struct aws_dsql_auth_config *config;
+    struct aws_atomic_var *stop;
+    struct aws_thread thread;
+    size_t gets;
+    size_t failures;
+};
+
+static void s_concurrent_reader_fn(void *arg) {
+    struct concurrent_reader *reader = arg;
+
+    while (!aws_atomic_load_int(reader->stop) || reader->gets == 0) {
+        bool is_admin = (reader->gets & 1) != 0;
+        struct aws_dsql_auth_token token = {0};
+
+        if (aws_dsql_auth_token_cache_get(reader->cache, reader->config, is_admin, reader->allocator, &token) ||
+            !strstr(aws_dsql_auth_token_get_str(&token), is_admin ? "Action=DbConnectAdmin&" : "Action=DbConnect&")) {
+            ++reader->failures;
+        }
+
+        aws_dsql_auth_token_clean_up(&token);
+        ++reader->gets;
+    }
+}
+
+/**
+ * Test that readers sharing a cache always get a valid token while refreshes replace the cached tokens under them
+ */
+static int s_aws_dsql_auth_token_cache_concurrent_readers_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+    s_mock_cache_set_system_time(s_base_time_ns);
+
+    struct aws_credentials_provider *credentials_provider = s_create_test_credentials_provider(allocator);
+    ASSERT_NOT_NULL(credentials_provider);
+
+    struct aws_dsql_auth_config config;
+    ASSERT_SUCCESS(s_setup_auth_config(&config, credentials_provider, 450, s_mock_cache_get_system_time));
+
+    struct aws_dsql_auth_token_cache_options options = {.refresh_ahead_seconds = 400};
+    struct aws_dsql_auth_token_cache *cache = aws_dsql_auth_token_cache_new(allocator, &options);
+    ASSERT_NOT_NULL(cache);
+
+    struct aws_atomic_var stop;
+    aws_atomic_init_int(&stop, 0);
+
+    struct concurrent_reader readers[CONCURRENT_READER_COUNT];
+    for (size_t i = 0; i < CONCURRENT_READER_COUNT; ++i) {
+        readers[i] = (struct concurrent_reader){
+            .allocator = allocator,
+            .cache = cache,
+            .config = &config,
+            .stop = &stop,
+        };
+        ASSERT_SUCCESS(aws_thread_init(&readers[i].thread, allocator));
+        ASSERT_SUCCESS(
+            aws_thread_launch(&readers[i].thread, s_concurrent_reader_fn, &readers[i], aws_default_thread_options()));
+    }
+
+    /* Every step lands inside the refresh window, so tokens keep being replaced while the readers run */
+    for (int step = 1; step <= 200; ++step) {
+        s_mock_cache_set_system_time(s_base_time_ns + (uint64_t)step * 60ULL * 1000000000ULL);
+        aws_thread_current_sleep(1000000);
+    }
+
+    aws_atomic_store_int(&stop, 1);
+    for (size_t i = 0; i < CONCURRENT_READER_COUNT; ++i) {
+        ASSERT_SUCCESS(aws_thread_join(&readers[i].thread));
+        aws_thread_clean_up(&readers[i].thread);
+        ASSERT_UINT_EQUALS(0, readers[i].failures);
+    }
+
+    aws_dsql_auth_token_cache_release(cache);
+    aws_dsql_auth_config_clean_up(&config);
+    aws_credentials_provider_release(credentials_provider);
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * A provider that takes a while to answer and counts how often it is asked, as IMDS or STS would be hit, and that
+ * fails while is_failing is set
+ */
+struct slow_counting_provider_impl {
+    struct aws_atomic_var fetch_count;
+    struct aws_atomic_var is_failing;
+};
+
+static int s_slow_counting_get_credentials(
+    struct aws_credentials_provider *provider,
+    aws_on_get_credentials_callback_fn callback,
+    void *user_data) {
+
+    struct slow_counting_provider_impl *impl = provider->impl;
+    aws_atomic_fetch_add(&impl->fetch_count, 1);
+    aws_thread_current_sleep(20000000);
+
+    if (aws_atomic_load_int(&impl->is_failing)) {
+        callback(NULL, AWS_ERROR_UNKNOWN, user_data);
+        return AWS_OP_SUCCESS;
+    }
+
+    struct aws_credentials *credentials = aws_credentials_new(
+        provider->allocator,
+        aws_byte_cursor_from_string(s_access_key_id),
+        aws_byte_cursor_from_string(s_secret_access_key),
+        aws_byte_cursor_from_string(s_session_token),
+        UINT64_MAX);
+    if (!credentials) {
+        return AWS_OP_ERR;
+    }
+
+    callback(credentials, AWS_ERROR_SUCCESS, user_data);
+    aws_credentials_release(credentials);
+
+    return AWS_OP_SUCCESS;
+}
+
+static void s_slow_counting_destroy(struct aws_credentials_provider *provider) {
+    aws_mem_release(provider->allocator, provider);
+}
+
+static struct aws_credentials_provider_vtable s_slow_counting_vtable = {
+    .get_credentials = s_slow_counting_get_credentials,
+    .destroy = s_slow_counting_destroy,
+};
+
+static struct aws_credentials_provider *s_slow_counting_provider_new(
+    struct aws_allocator *allocator,
+    struct slow_counting_provider_impl **out_impl) {
+
+    struct aws_credentials_provider *provider = NULL;
+    struct slow_counting_provider_impl *impl = NULL;
+    if (!aws_mem_acquire_many(
+            allocator, 2, &provider, sizeof(struct aws_credentials_provider), &impl, sizeof(*impl))) {
+        return NULL;
+    }
+
+    AWS_ZERO_STRUCT(*provider);
+    provider->vtable = &s_slow_counting_vtable;
+    provider->allocator = allocator;
+    provider->impl = impl;
+    aws_atomic_init_int(&provider->ref_count, 1);
+    aws_atomic_init_int(&impl->fetch_count, 0);
+    aws_atomic_init_int(&impl->is_failing, 0);
+
+    *out_impl = impl;
+    return provider;
+}
+
+enum { COALESCED_CALLER_COUNT = 8 };
+
+struct coalesced_caller {
+    struct aws_allocator *allocator;
+    struct aws_dsql_auth_token_cache *cache;
+    struct aws_dsql_auth_config *config;
+    struct aws_atomic_var *start;
+    struct aws_thread thread;
+    struct aws_dsql_auth_token token;
+    int result;
+};
+
+static void s_coalesced_caller_fn(void *arg) {
+    struct coalesced_caller *caller = arg;
+
+    /* Spin so that every caller misses at the same moment */
+    while (!aws_atomic_load_int(caller->start)) {
+    }
+    caller->result =
+        aws_dsql_auth_token_cache_get(caller->cache, caller->config, false, caller->allocator, &caller->token);
+}
+
+/**
+ * Test that concurrent misses for the same key are served by a single generation
+ */
+static int s_aws_dsql_auth_token_cache_single_flight_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+    s_mock_cache_set_system_time(s_base_time_ns);
+
+    struct slow_counting_provider_impl *provider_impl = NULL;
+    struct aws_credentials_provider *credentials_provider = s_slow_counting_provider_new(allocator, &provider_impl);
+    ASSERT_NOT_NULL(credentials_provider);
+
+    struct aws_dsql_auth_config config;
+    ASSERT_SUCCESS(s_setup_auth_config(&config, credentials_provider, 450, s_mock_cache_get_system_time));
+
+    struct aws_dsql_auth_token_cache *cache = aws_dsql_auth_token_cache_new(allocator, NULL);
+    ASSERT_NOT_NULL(cache);
+
+    struct aws_atomic_var start;
+    aws_atomic_init_int(&start, 0);
+
+    struct coalesced_caller callers[COALESCED_CALLER_COUNT];
+    for (size_t i = 0; i < COALESCED_CALLER_COUNT; ++i) {
+        callers[i] = (struct coalesced_caller){
+            .allocator = allocator,
+            .cache = cache,
+            .config = &config,
+            .start = &start,
+        };
+        ASSERT_SUCCESS(aws_thread_init(&callers[i].thread, allocator));
+        ASSERT_SUCCESS(
+            aws_thread_launch(&callers[i].thread, s_coalesced_caller_fn, &callers[i], aws_default_thread_options()));
+    }
+
+    aws_atomic_store_int(&start, 1);
+    for (size_t i = 0; i < COALESCED_CALLER_COUNT; ++i) {
+        ASSERT_SUCCESS(aws_thread_join(&callers[i].thread));
+        aws_thread_clean_up(&callers[i].thread);
+    }
+
+    ASSERT_UINT_EQUALS(1, aws_atomic_load_int(&provider_impl->fetch_count));
+    for (size_t i = 0; i < COALESCED_CALLER_COUNT; ++i) {
+        ASSERT_SUCCESS(callers[i].result);
+        ASSERT_STR_EQUALS(
+            aws_dsql_auth_token_get_str(&callers[0].token), aws_dsql_auth_token_get_str(&callers[i].token));
+    }
+
+    for (size_t i = 0; i < COALESCED_CALLER_COUNT; ++i) {
+        aws_dsql_auth_token_clean_up(&callers[i].token);
+    }
+    aws_dsql_auth_token_cache_release(cache);
+    aws_dsql_auth_config_clean_up(&config);
+    aws_credentials_provider_release(credentials_provider);
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Poll the metrics until the background refreshes have failed failures times in all */
+static int s_wait_for_refresh_failures(uint64_t failures) {
+    struct aws_dsql_auth_metrics metrics;
+    for (int i = 0; i < 1000; ++i) {
+        aws_dsql_auth_metrics_snapshot(&metrics);
+        if (metrics.token_cache_refresh_failures >= failures) {
+            break;
+        }
+        aws_thread_current_sleep(1000000);
+    }
+    ASSERT_UINT_EQUALS(failures, metrics.token_cache_refresh_failures);
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that a failed background refresh holds the next one off instead of asking the provider on every get
+ */
+static int s_aws_dsql_auth_token_cache_refresh_backoff_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+    s_mock_cache_set_system_time(s_base_time_ns);
+
+    struct slow_counting_provider_impl *provider_impl = NULL;
+    struct aws_credentials_provider *credentials_provider = s_slow_counting_provider_new(allocator, &provider_impl);
+    ASSERT_NOT_NULL(credentials_provider);
+
+    struct aws_dsql_auth_config config;
+    ASSERT_SUCCESS(s_setup_auth_config(&config, credentials_provider, 450, s_mock_cache_get_system_time));
+
+    struct aws_dsql_auth_token_cache_options options = {.refresh_ahead_seconds = 60};
+    struct aws_dsql_auth_token_cache *cache = aws_dsql_auth_token_cache_new(allocator, &options);
+    ASSERT_NOT_NULL(cache);
+
+    struct aws_dsql_auth_token token = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &token));
+    ASSERT_UINT_EQUALS(1, aws_atomic_load_int(&provider_impl->fetch_count));
+
+    struct aws_dsql_auth_metrics before;
+    aws_dsql_auth_metrics_snapshot(&before);
+
+    /* The refresh fails, and gets in the same second are served the cached token without another refresh */
+    aws_atomic_store_int(&provider_impl->is_failing, 1);
+    s_mock_cache_set_system_time(s_base_time_ns + 420ULL * 1000000000ULL);
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &token));
+    ASSERT_SUCCESS(s_wait_for_refresh_failures(before.token_cache_refresh_failures + 1));
+    for (int i = 0; i < 8; ++i) {
+        ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &token));
+    }
+    aws_thread_current_sleep(50000000);
+    ASSERT_UINT_EQUALS(2, aws_atomic_load_int(&provider_impl->fetch_count));
+
+    /* Once the backoff is over the next get retries, and the retry fails again */
+    s_mock_cache_set_system_time(s_base_time_ns + 425ULL * 1000000000ULL);
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &token));
+    ASSERT_SUCCESS(s_wait_for_refresh_failures(before.token_cache_refresh_failures + 2));
+    ASSERT_UINT_EQUALS(3, aws_atomic_load_int(&provider_impl->fetch_count));
+
+    /* A retry that succeeds replaces the token */
+    aws_atomic_store_int(&provider_impl->is_failing, 0);
+    s_mock_cache_set_system_time(s_base_time_ns + 430ULL * 1000000000ULL);
+    bool refreshed = false;
+    for (int i = 0; i < 1000 && !refreshed; ++i) {
+        ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &token));
+        refreshed = strstr(aws_dsql_auth_token_get_str(&token), "X-Amz-Date=20240827T000710Z") != NULL;
+        if (!refreshed) {
+            aws_thread_current_sleep(1000000);
+        }
+    }
+    ASSERT_TRUE(refreshed);
+    ASSERT_UINT_EQUALS(4, aws_atomic_load_int(&provider_impl->fetch_count));
+
+    aws_dsql_auth_token_clean_up(&token);
+    aws_dsql_auth_token_cache_release(cache);
+    aws_dsql_auth_config_clean_up(&config);
+    aws_credentials_provider_release(credentials_provider);
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that the generation stats observer sees a miss as a generation and a later get as a cache hit
+ */
+struct cache_stats_observer {
+    size_t calls;
+    size_t hits;
+};
+
+static void s_on_cache_generation_stats(const struct aws_dsql_auth_generation_stats *stats, void *user_data) {
+    struct cache_stats_observer *observer = user_data;
+    observer->calls++;
+    if (stats->token_cache_hit) {
+        observer->hits++;
+    }
+}
+
+static int s_aws_dsql_auth_token_cache_stats_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+    s_mock_cache_set_system_time(s_base_time_ns);
+
+    struct aws_credentials_provider *credentials_provider = s_create_test_credentials_provider(allocator);
+    ASSERT_NOT_NULL(credentials_provider);
+
+    struct aws_dsql_auth_config config;
+    ASSERT_SUCCESS(s_setup_auth_config(&config, credentials_provider, 450, s_mock_cache_get_system_time));
+
+    struct cache_stats_observer observer = {0};
+    aws_dsql_auth_config_set_on_generation_stats(&config, s_on_cache_generation_stats, &observer);
+
+    struct aws_dsql_auth_token_cache *cache = aws_dsql_auth_token_cache_new(allocator, NULL);
+    ASSERT_NOT_NULL(cache);
+
+    struct aws_dsql_auth_token first = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &first));
+    ASSERT_UINT_EQUALS(1, observer.calls);
+    ASSERT_UINT_EQUALS(0, observer.hits);
+
+    struct aws_dsql_auth_token second = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &second));
+    ASSERT_UINT_EQUALS(2, observer.calls);
+    ASSERT_UINT_EQUALS(1, observer.hits);
+
+    aws_dsql_auth_token_clean_up(&second);
+    aws_dsql_auth_token_clean_up(&first);
+    aws_dsql_auth_token_cache_release(cache);
+    aws_dsql_auth_config_clean_up(&config);
+    aws_credentials_provider_release(credentials_provider);
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+#ifndef _WIN32
+
+/* What a forked child checks, with the token the parent cached before the fork */
+static int s_token_cache_fork_child(
+    struct aws_allocator *allocator,
+    struct aws_dsql_auth_token_cache *cache,
+    struct aws_dsql_auth_config *config,
+    struct slow_counting_provider_impl *source_impl,
+    const char *parent_token,
+    uint64_t parent_abandoned_references) {
+
+    struct aws_dsql_auth_metrics before;
+    aws_dsql_auth_metrics_snapshot(&before);
+
+    /* The cache's reference to the parent's event loop group was given up, with nothing in flight */
+    ASSERT_UINT_EQUALS(parent_abandoned_references + 1, before.fork_abandoned_references);
+
+    /* The child's first get is a hit on the token the parent cached */
+    struct aws_dsql_auth_token token = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, config, false, allocator, &token));
+    ASSERT_STR_EQUALS(parent_token, aws_dsql_auth_token_get_str(&token));
+
+    struct aws_dsql_auth_metrics after;
+    aws_dsql_auth_metrics_snapshot(&after);
+    ASSERT_UINT_EQUALS(before.token_cache_hits + 1, after.token_cache_hits);
+    ASSERT_UINT_EQUALS(before.token_cache_misses, after.token_cache_misses);
+
+    /* The parent's event loops are gone, so the refresh runs on a thread the child launches for it */
+    s_mock_cache_set_system_time(s_base_time_ns + 420ULL * 1000000000ULL);
+
+    bool refreshed = false;
+    for (int i = 0; i < 1000 && !refreshed; ++i) {
+        ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, config, false, allocator, &token));
+        refreshed = strstr(aws_dsql_auth_token_get_str(&token), "X-Amz-Date=20240827T000700Z") != NULL;
+        if (!refreshed) {
+            aws_thread_current_sleep(1000000);
+        }
+    }
+    ASSERT_TRUE(refreshed);
+
+    /* Signed with the inherited credentials snapshot, without going back to its source */
+    ASSERT_UINT_EQUALS(1, aws_atomic_load_int(&source_impl->fetch_count));
+
+    aws_dsql_auth_token_clean_up(&token);
+
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * Test that a forked child is served the tokens and credentials its parent cached, and goes on refreshing them
+ * although the parent's event loops did not come across
+ */
+static int s_aws_dsql_auth_token_cache_fork_test(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    aws_auth_library_init(allocator);
+    s_mock_cache_set_system_time(s_base_time_ns);
+
+    struct slow_counting_provider_impl *source_impl = NULL;
+    struct aws_credentials_provider *source = s_slow_counting_provider_new(allocator, &source_impl);
+    ASSERT_NOT_NULL(source);
+
+    struct aws_dsql_auth_credentials_snapshot_options snapshot_options = {.source = source};
+    struct aws_credentials_provider *credentials_provider =
+        aws_dsql_auth_credentials_provider_new_snapshot(allocator, &snapshot_options);
+    ASSERT_NOT_NULL(credentials_provider);
+
+    struct aws_dsql_auth_config config;
+    ASSERT_SUCCESS(s_setup_auth_config(&config, credentials_provider, 450, s_mock_cache_get_system_time));
+
+    struct aws_event_loop_group *event_loop_group = aws_event_loop_group_new_default(allocator, 1, NULL);
+    ASSERT_NOT_NULL(event_loop_group);
+
+    struct aws_dsql_auth_token_cache_options options = {
+        .refresh_ahead_seconds = 60,
+        .event_loop_group = event_loop_group,
+    };
+    struct aws_dsql_auth_token_cache *cache = aws_dsql_auth_token_cache_new(allocator, &options);
+    ASSERT_NOT_NULL(cache);
+
+    struct aws_dsql_auth_token original = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &original));
+    ASSERT_UINT_EQUALS(1, aws_atomic_load_int(&source_impl->fetch_count));
+
+    struct aws_dsql_auth_metrics parent_metrics;
+    aws_dsql_auth_metrics_snapshot(&parent_metrics);
+
+    pid_t pid = fork();
+    ASSERT_TRUE(pid >= 0);
+    if (pid == 0) {
+        int result = s_token_cache_fork_child(
+            allocator,
+            cache,
+            &config,
+            source_impl,
+            aws_dsql_auth_token_get_str(&original),
+            parent_metrics.fork_abandoned_references);
+        _exit(result == AWS_OP_SUCCESS ? 0 : 1);
+    }
+
+    int status = 0;
+    ASSERT_INT_EQUALS(pid, waitpid(pid, &status, 0));
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_INT_EQUALS(0, WEXITSTATUS(status));
+
+    /* The parent is untouched: still the same token, and its own group keeps working */
+    struct aws_dsql_auth_token token = {0};
+    ASSERT_SUCCESS(aws_dsql_auth_token_cache_get(cache, &config, false, allocator, &token));
+    ASSERT_STR_EQUALS(aws_dsql_auth_token_get_str(&original), aws_dsql_auth_token_get_str(&token));
+
+    aws_dsql_auth_token_clean_up(&token);
+    aws_dsql_auth_token_clean_up(&original);
+    aws_dsql_auth_token_cache_release(cache);
+    aws_event_loop_group_release(event_loop_group);
+    aws_dsql_auth_config_clean_up(&config);
+    aws_credentials_provider_release(credentials_provider);
+    aws_credentials_provider_release(source);
+
+    aws_auth_library_clean_up();
+
+    return AWS_OP_SUCCESS;
+}
+
+#endif /* _WIN32 */
+
+AWS_TEST_CASE(aws_dsql_auth_token_cache_hit_test, s_aws_dsql_auth_token_cache_hit_test);
+AWS_TEST_CASE(aws_dsql_auth_token_cache_shared_test, s_aws_dsql_auth_token_cache_shared_test);
+AWS_TEST_CASE(aws_dsql_auth_token_cache_compact_test, s_aws_dsql_auth_token_cache_compact_test);
+AWS_TEST_CASE(aws_dsql_auth_token_cache_eviction_test, s_aws_dsql_auth_token_cache_eviction_test);
+AWS_TEST_CASE(
+    aws_dsql_auth_token_cache_eviction_shared_fragment_test,
+    s_aws_dsql_auth_token_cache_eviction_shared_fragment_test);
+AWS_TEST_CASE(aws_dsql_auth_token_cache_refresh_ahead_test, s_aws_dsql_auth_token_cache_refresh_ahead_test);
+AWS_TEST_CASE(
+    aws_dsql_auth_token_cache_event_loop_refresh_test,
+    s_aws_dsql_auth_token_cache_event_loop_refresh_test);
+AWS_TEST_CASE(aws_dsql_auth_token_cache_refresh_jitter_test, s_aws_dsql_auth_token_cache_refresh_jitter_test);
+AWS_TEST_CASE(aws_dsql_auth_token_cache_expired_test, s_aws_dsql_auth_token_cache_expired_test);
+AWS_TEST_CASE(
+    aws_dsql_auth_token_cache_concurrent_readers_test,
+    s_aws_dsql_auth_token_cache_concurrent_readers_test);
+AWS_TEST_CASE(aws_dsql_auth_token_cache_single_flight_test, s_aws_dsql_auth_token_cache_single_flight_test);
+AWS_TEST_CASE(aws_dsql_auth_token_cache_refresh_backoff_test, s_aws_dsql_auth_token_cache_refresh_backoff_test);
+AWS_TEST_CASE(aws_dsql_auth_token_cache_stats_test, s_aws_dsql_auth_token_cache_stats_test);
+#ifndef _WIN32
+AWS_TEST_CASE(aws_dsql_auth_token_cache_fork_test, s_aws_dsql_auth_token_cache_fork_test);
+#endif